@@ -0,0 +1,407 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "tdogl/Bitmap.h"
+#include "tdogl/ImageCompare.h"
+#include "tdogl/MappedFile.h"
+#include "tdogl/PackedBitmap.h"
+#include "tdogl/TiledBitmap.h"
+
+/*
+ Microbenchmarks for tdogl::Bitmap
+
+ Runs without a GL context. Each benchmark is repeated until it has run for at
+ least MinSeconds, and the average time per run is reported as throughput
+ (megabytes of pixels per second) and nanoseconds per pixel.
+
+ Usage: bitmap-bench [--json] [--filter <text>] [--max-size <pixels>] [--resources <dir>]
+
+   --json       print the results as JSON, so runs from different builds can be diffed
+   --filter     only run the benchmarks with names containing <text>
+   --max-size   skip the image sizes wider than <pixels>
+   --resources  the directory containing wooden-crate.jpg and hazard.png
+ */
+
+// results of a single benchmark
+struct Result {
+    std::string name;
+    std::string format;
+    unsigned width;
+    unsigned height;
+    size_t bytes; //pixel bytes processed per run
+    unsigned runs;
+    double seconds; //average time per run
+
+    double megabytesPerSecond() const { return bytes / seconds / (1024.0 * 1024.0); }
+    double nanosecondsPerPixel() const { return seconds * 1e9 / ((double)width * height); }
+};
+
+struct Options {
+    bool json;
+    std::string filter;
+    unsigned maxSize;
+    std::string resources;
+
+    Options() : json(false), maxSize(4096), resources("../../resources/") {}
+};
+
+static const double MinSeconds = 0.25;
+static const unsigned MinRuns = 3;
+
+static const unsigned SIZES[] = { 64, 256, 1024, 4096 };
+static const tdogl::Bitmap::Format FORMATS[] = {
+    tdogl::Bitmap::Format_Grayscale,
+    tdogl::Bitmap::Format_GrayscaleAlpha,
+    tdogl::Bitmap::Format_RGB,
+    tdogl::Bitmap::Format_RGBA
+};
+
+// stops the compiler from optimising away pixels that are read but not used
+static volatile unsigned Sink;
+
+static Options ParseOptions(int argc, char* argv[]) {
+    Options options;
+    for(int i = 1; i < argc; ++i){
+        std::string arg = argv[i];
+        bool hasValue = (i + 1 < argc);
+        if(arg == "--json"){
+            options.json = true;
+        } else if(arg == "--filter" && hasValue){
+            options.filter = argv[++i];
+        } else if(arg == "--max-size" && hasValue){
+            options.maxSize = (unsigned)strtoul(argv[++i], NULL, 10);
+        } else if(arg == "--resources" && hasValue){
+            options.resources = argv[++i];
+            if(!options.resources.empty() && options.resources[options.resources.size() - 1] != '/')
+                options.resources += '/';
+        } else {
+            throw std::runtime_error("Unknown or incomplete option: " + arg);
+        }
+    }
+    return options;
+}
+
+static const char* FormatName(tdogl::Bitmap::Format format) {
+    switch(format){
+        case tdogl::Bitmap::Format_Grayscale: return "Grayscale";
+        case tdogl::Bitmap::Format_GrayscaleAlpha: return "GrayscaleAlpha";
+        case tdogl::Bitmap::Format_RGB: return "RGB";
+        case tdogl::Bitmap::Format_RGBA: return "RGBA";
+        default: return "Unknown";
+    }
+}
+
+// a bitmap full of noise, so nothing can take shortcuts on uniform pixels
+static tdogl::Bitmap NoiseBitmap(unsigned width, unsigned height, tdogl::Bitmap::Format format) {
+    tdogl::Bitmap bitmap(width, height, format);
+    unsigned state = 12345;
+    size_t rowSize = (size_t)width * format;
+    for(unsigned row = 0; row < height; ++row){
+        unsigned char* pixels = bitmap.row(row);
+        for(size_t i = 0; i < rowSize; ++i){
+            state = state * 1664525 + 1013904223;
+            pixels[i] = (unsigned char)(state >> 24);
+        }
+    }
+    return bitmap;
+}
+
+// times `run`, which processes `bytes` bytes of a width x height image each time it's called
+template <typename Fn>
+static Result Measure(const std::string& name, const std::string& format, unsigned width, unsigned height, size_t bytes, Fn run) {
+    typedef std::chrono::steady_clock Clock;
+
+    run(); //warm up caches, the thread pool and the allocator
+
+    unsigned runs = 0;
+    double elapsed = 0.0;
+    Clock::time_point start = Clock::now();
+    while(runs < MinRuns || elapsed < MinSeconds){
+        run();
+        ++runs;
+        elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+    }
+
+    Result result;
+    result.name = name;
+    result.format = format;
+    result.width = width;
+    result.height = height;
+    result.bytes = bytes;
+    result.runs = runs;
+    result.seconds = elapsed / runs;
+    return result;
+}
+
+static bool ShouldRun(const Options& options, const std::string& name) {
+    return options.filter.empty() || name.find(options.filter) != std::string::npos;
+}
+
+static void PrintResult(const Options& options, const Result& result) {
+    if(options.json)
+        return;
+    printf("%-36s %-30s %5ux%-5u %10.1f MB/s %10.3f ns/pixel\n",
+           result.name.c_str(), result.format.c_str(), result.width, result.height,
+           result.megabytesPerSecond(), result.nanosecondsPerPixel());
+    fflush(stdout);
+}
+
+static std::string JsonString(const std::string& str) {
+    std::string escaped = "\"";
+    for(size_t i = 0; i < str.size(); ++i){
+        char c = str[i];
+        if(c == '"' || c == '\\'){
+            escaped += '\\';
+            escaped += c;
+        } else if((unsigned char)c < 0x20){
+            char code[8];
+            snprintf(code, sizeof(code), "\\u%04x", (unsigned)c);
+            escaped += code;
+        } else {
+            escaped += c;
+        }
+    }
+    return escaped + "\"";
+}
+
+static void PrintJson(const std::vector<Result>& results) {
+    printf("{\n  \"results\": [");
+    for(size_t i = 0; i < results.size(); ++i){
+        const Result& r = results[i];
+        printf("%s\n    {\"name\": %s, \"format\": %s, \"width\": %u, \"height\": %u, \"bytes\": %lu, "
+               "\"runs\": %u, \"seconds\": %.9g, \"mb_per_s\": %.6g, \"ns_per_pixel\": %.6g}",
+               (i == 0 ? "" : ","), JsonString(r.name).c_str(), JsonString(r.format).c_str(),
+               r.width, r.height, (unsigned long)r.bytes, r.runs, r.seconds,
+               r.megabytesPerSecond(), r.nanosecondsPerPixel());
+    }
+    printf("\n  ]\n}\n");
+}
+
+static void BenchmarkLoading(const Options& options, std::vector<Result>& results) {
+    const char* files[][2] = {
+        { "bitmapFromFile/jpeg", "wooden-crate.jpg" },
+        { "bitmapFromFile/png", "hazard.png" }
+    };
+    for(size_t i = 0; i < sizeof(files) / sizeof(files[0]); ++i){
+        std::string name = files[i][0];
+        if(!ShouldRun(options, name))
+            continue;
+
+        std::string path = options.resources + files[i][1];
+        tdogl::Bitmap probe = tdogl::Bitmap::bitmapFromFile(path);
+        size_t bytes = (size_t)probe.width() * probe.height() * probe.format();
+        results.push_back(Measure(name, FormatName(probe.format()), probe.width(), probe.height(), bytes, [&]{
+            tdogl::Bitmap bitmap = tdogl::Bitmap::bitmapFromFile(path);
+            Sink = bitmap.pixelBuffer()[0];
+        }));
+        PrintResult(options, results.back());
+    }
+
+    //reduced JPEG decodes, measured against the full size image so they compare
+    //directly with bitmapFromFile/jpeg
+    for(unsigned scaleShift = 1; scaleShift <= 3; ++scaleShift){
+        std::string name = "bitmapFromMemoryScaled/jpeg-1/" + std::to_string(1u << scaleShift);
+        if(!ShouldRun(options, name))
+            continue;
+
+        tdogl::MappedFile file(options.resources + "wooden-crate.jpg");
+        tdogl::Bitmap probe = tdogl::Bitmap::bitmapFromMemory(file.data(), file.size());
+        size_t bytes = (size_t)probe.width() * probe.height() * probe.format();
+        results.push_back(Measure(name, FormatName(probe.format()), probe.width(), probe.height(), bytes, [&]{
+            tdogl::Bitmap bitmap = tdogl::Bitmap::bitmapFromMemoryScaled(file.data(), file.size(), scaleShift);
+            Sink = bitmap.pixelBuffer()[0];
+        }));
+        PrintResult(options, results.back());
+    }
+}
+
+static void BenchmarkPacking(const Options& options, std::vector<Result>& results) {
+    if(!ShouldRun(options, "PackedBitmap"))
+        return;
+
+    //real images, because noise doesn't compress
+    const char* files[] = { "wooden-crate.jpg", "hazard.png" };
+    for(size_t i = 0; i < sizeof(files) / sizeof(files[0]); ++i){
+        tdogl::Bitmap bitmap = tdogl::Bitmap::bitmapFromFile(options.resources + files[i]);
+        size_t bytes = (size_t)bitmap.width() * bitmap.height() * bitmap.format();
+        std::string format = std::string(FormatName(bitmap.format())) + " " + files[i];
+
+        if(ShouldRun(options, "PackedBitmap/pack")){
+            results.push_back(Measure("PackedBitmap/pack", format, bitmap.width(), bitmap.height(), bytes, [&]{
+                tdogl::PackedBitmap packed(bitmap);
+                Sink = (unsigned)packed.packedSize();
+            }));
+            PrintResult(options, results.back());
+        }
+
+        if(ShouldRun(options, "PackedBitmap/toBitmap")){
+            tdogl::PackedBitmap packed(bitmap);
+            results.push_back(Measure("PackedBitmap/toBitmap", format, bitmap.width(), bitmap.height(), bytes, [&]{
+                tdogl::Bitmap unpacked = packed.toBitmap();
+                Sink = unpacked.pixelBuffer()[0];
+            }));
+            PrintResult(options, results.back());
+        }
+    }
+}
+
+static void BenchmarkTransforms(const Options& options, std::vector<Result>& results, unsigned size, tdogl::Bitmap::Format format) {
+    size_t bytes = (size_t)size * size * format;
+
+    if(ShouldRun(options, "flipVertically")){
+        tdogl::Bitmap bitmap = NoiseBitmap(size, size, format);
+        results.push_back(Measure("flipVertically", FormatName(format), size, size, bytes, [&]{
+            bitmap.flipVertically();
+        }));
+        PrintResult(options, results.back());
+    }
+
+    if(ShouldRun(options, "rotate90CounterClockwise")){
+        tdogl::Bitmap bitmap = NoiseBitmap(size, size, format);
+        results.push_back(Measure("rotate90CounterClockwise", FormatName(format), size, size, bytes, [&]{
+            bitmap.rotate90CounterClockwise();
+        }));
+        PrintResult(options, results.back());
+    }
+
+    if(ShouldRun(options, "TiledBitmap/rotate90CounterClockwise")){
+        tdogl::TiledBitmap bitmap(NoiseBitmap(size, size, format));
+        results.push_back(Measure("TiledBitmap/rotate90CounterClockwise", FormatName(format), size, size, bytes, [&]{
+            bitmap.rotate90CounterClockwise();
+        }));
+        PrintResult(options, results.back());
+    }
+
+    if(ShouldRun(options, "getPixel/setPixel")){
+        tdogl::Bitmap src = NoiseBitmap(size, size, format);
+        tdogl::Bitmap dest(size, size, format);
+        results.push_back(Measure("getPixel/setPixel", FormatName(format), size, size, bytes, [&]{
+            for(unsigned row = 0; row < size; ++row){
+                for(unsigned col = 0; col < size; ++col)
+                    dest.setPixel(col, row, src.getPixel(col, row));
+            }
+            Sink = dest.getPixel(size - 1, size - 1)[0];
+        }));
+        PrintResult(options, results.back());
+    }
+}
+
+static void BenchmarkCopyRect(const Options& options, std::vector<Result>& results, unsigned size,
+                              tdogl::Bitmap::Format srcFormat, tdogl::Bitmap::Format destFormat)
+{
+    if(!ShouldRun(options, "copyRectFromBitmap"))
+        return;
+
+    tdogl::Bitmap src = NoiseBitmap(size, size, srcFormat);
+    tdogl::Bitmap dest(size, size, destFormat);
+    //throughput counts the bytes read and written
+    size_t bytes = (size_t)size * size * (srcFormat + destFormat);
+    std::string formats = std::string(FormatName(srcFormat)) + "->" + FormatName(destFormat);
+    results.push_back(Measure("copyRectFromBitmap", formats, size, size, bytes, [&]{
+        dest.copyRectFromBitmap(src, 0, 0, 0, 0, size, size);
+    }));
+    PrintResult(options, results.back());
+}
+
+static void BenchmarkDistanceField(const Options& options, std::vector<Result>& results, unsigned size) {
+    if(!ShouldRun(options, "generateDistanceField"))
+        return;
+
+    //a grid of discs, like a sheet of icons
+    tdogl::Bitmap mask(size, size, tdogl::Bitmap::Format_Grayscale);
+    unsigned cell = std::max(8u, size / 8);
+    for(unsigned row = 0; row < size; ++row){
+        unsigned char* pixels = mask.row(row);
+        int dy = (int)(row % cell) - (int)cell / 2;
+        for(unsigned col = 0; col < size; ++col){
+            int dx = (int)(col % cell) - (int)cell / 2;
+            pixels[col] = (dx*dx + dy*dy) * 9 < (int)(cell * cell) ? 255 : 0;
+        }
+    }
+
+    size_t bytes = (size_t)size * size;
+    results.push_back(Measure("generateDistanceField", "Grayscale", size, size, bytes, [&]{
+        tdogl::Bitmap field = mask.generateDistanceField(8.0f);
+        Sink = field.pixelBuffer()[0];
+    }));
+    PrintResult(options, results.back());
+}
+
+static void BenchmarkCompare(const Options& options, std::vector<Result>& results, unsigned size, tdogl::Bitmap::Format format) {
+    if(!ShouldRun(options, "CompareImages") && !ShouldRun(options, "StructuralSimilarity"))
+        return;
+
+    //a copy of the noise with every 7th channel nudged, like a slightly different frame
+    tdogl::Bitmap reference = NoiseBitmap(size, size, format);
+    tdogl::Bitmap candidate = reference.clone();
+    size_t rowSize = (size_t)size * format;
+    for(unsigned row = 0; row < size; ++row){
+        unsigned char* pixels = candidate.row(row);
+        for(size_t i = row % 7; i < rowSize; i += 7)
+            pixels[i] ^= 1;
+    }
+
+    //throughput counts the bytes of both images
+    size_t bytes = (size_t)size * size * format * 2;
+    if(ShouldRun(options, "CompareImages")){
+        results.push_back(Measure("CompareImages", FormatName(format), size, size, bytes, [&]{
+            Sink = tdogl::CompareImages(reference, candidate).maxAbsDiff;
+        }));
+        PrintResult(options, results.back());
+    }
+
+    if(ShouldRun(options, "StructuralSimilarity")){
+        results.push_back(Measure("StructuralSimilarity", FormatName(format), size, size, bytes, [&]{
+            Sink = (unsigned)(tdogl::StructuralSimilarity(reference, candidate) * 1000.0);
+        }));
+        PrintResult(options, results.back());
+    }
+}
+
+static void BenchMain(int argc, char* argv[]) {
+    Options options = ParseOptions(argc, argv);
+    std::vector<Result> results;
+
+    BenchmarkLoading(options, results);
+    BenchmarkPacking(options, results);
+
+    for(size_t s = 0; s < sizeof(SIZES) / sizeof(SIZES[0]); ++s){
+        unsigned size = SIZES[s];
+        if(size > options.maxSize)
+            continue;
+
+        for(size_t f = 0; f < sizeof(FORMATS) / sizeof(FORMATS[0]); ++f)
+            BenchmarkTransforms(options, results, size, FORMATS[f]);
+
+        for(size_t f = 0; f < sizeof(FORMATS) / sizeof(FORMATS[0]); ++f)
+            BenchmarkCompare(options, results, size, FORMATS[f]);
+
+        for(size_t from = 0; from < sizeof(FORMATS) / sizeof(FORMATS[0]); ++from){
+            for(size_t to = 0; to < sizeof(FORMATS) / sizeof(FORMATS[0]); ++to)
+                BenchmarkCopyRect(options, results, size, FORMATS[from], FORMATS[to]);
+        }
+
+        BenchmarkDistanceField(options, results, size);
+    }
+
+    if(options.json)
+        PrintJson(results);
+}
+
+int main(int argc, char *argv[]) {
+    try {
+        BenchMain(argc, argv);
+    } catch (const std::exception& e){
+        std::cerr << "ERROR: " << e.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -206,6 +206,7 @@ enum
 };
 
 typedef unsigned char stbi_uc;
+typedef unsigned short stbi_us;
 
 #ifdef __cplusplus
 extern "C" {
@@ -237,6 +238,15 @@ typedef struct
 
 extern stbi_uc *stbi_load_from_callbacks  (stbi_io_callbacks const *clbk, void *user, int *x, int *y, int *comp, int req_comp);
 
+// 16 bits per channel, in native byte order. 16-bit PNGs keep all their
+// precision; everything else is loaded as 8-bit and scaled up (x * 257).
+extern stbi_us *stbi_load_16_from_memory(stbi_uc const *buffer, int len, int *x, int *y, int *comp, int req_comp);
+
+#ifndef STBI_NO_STDIO
+extern stbi_us *stbi_load_16           (char const *filename,     int *x, int *y, int *comp, int req_comp);
+extern stbi_us *stbi_load_16_from_file (FILE *f,                  int *x, int *y, int *comp, int req_comp);
+#endif
+
 #ifndef STBI_NO_HDR
    extern float *stbi_loadf_from_memory(stbi_uc const *buffer, int len, int *x, int *y, int *comp, int req_comp);
 
@@ -267,7 +277,7 @@ extern int      stbi_is_hdr_from_file(FILE *f);
 // NOT THREADSAFE
 extern const char *stbi_failure_reason  (void); 
 
-// free the loaded image -- this is just free()
+// free the loaded image -- this is just STBI_FREE(), which is free() by default
 extern void     stbi_image_free      (void *retval_from_stbi_load);
 
 // get image dimensions & components without fully decoding
@@ -280,6 +290,26 @@ extern int      stbi_info_from_file  (FILE *f,                  int *x, int *y,
 
 #endif
 
+// streaming PNG decode, for images too big to hold in memory all at once.
+// decoded rows are handed to `band` in bands of up to band_rows rows, top row
+// first, each row x*comp bytes. `band` returns 0 to stop decoding. only 8-bit,
+// non-interlaced PNGs can be streamed. memory use is bounded by the band size
+// plus the 32K zlib window, no matter how big the image is.
+typedef int (*stbi_band_callback)(void *user, stbi_uc const *rows, int first_row, int row_count);
+
+// returns 1 and the dimensions and output channels if the PNG can be streamed
+extern int      stbi_png_stream_info (stbi_uc const *buffer, size_t len, int *x, int *y, int *comp);
+extern int      stbi_png_stream      (stbi_uc const *buffer, size_t len, int band_rows, stbi_band_callback band, void *user);
+
+// reduced JPEG decode, for thumbnails and low quality tiers. the image comes
+// out 1/(1<<scale_shift) of its size (scale_shift 0-3, sizes round up), from
+// an IDCT of only the low frequency coefficients, so the detail that would be
+// thrown away is never computed. if region isn't NULL it is x0,y0,x1,y1 in
+// full size pixels, and the result is just that part of the image: only the
+// MCUs around it go through the IDCT, and decoding stops after the last MCU
+// row it needs. fails with "not JPEG" for other formats.
+extern int      stbi_jpeg_test_memory(stbi_uc const *buffer, int len);
+extern stbi_uc *stbi_jpeg_load_scaled_from_memory(stbi_uc const *buffer, int len, int *x, int *y, int *comp, int req_comp, int scale_shift, int const *region);
 
 
 // for image formats that explicitly notate that they have premultiplied alpha,
@@ -346,6 +376,26 @@ extern void stbi_install_YCbCr_to_RGB(stbi_YCbCr_to_RGB_run func);
 #include <assert.h>
 #include <stdarg.h>
 
+// the jpeg decoder and png unfiltering have SSE2 kernels, used when SSE2 is
+// available at compile time, and the jpeg decoder has AVX2 ones that are
+// compiled alongside and picked at runtime if the CPU supports them. define
+// STBI_NO_SIMD to leave them all out, or STBI_NO_AVX2 to leave out just the
+// AVX2 ones
+#if !defined(STBI_NO_SIMD) && !defined(STBI_SIMD) && (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#define STBI_SSE2
+#include <emmintrin.h>
+#if !defined(STBI_NO_AVX2) && (defined(_MSC_VER) || defined(__GNUC__))
+#define STBI_AVX2
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define STBI_TARGET_AVX2
+#else
+#define STBI_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
+#endif
+
 #ifndef _MSC_VER
    #ifdef __cplusplus
    #define stbi_inline inline
@@ -364,6 +414,11 @@ typedef   signed short  int16;
 typedef unsigned int   uint32;
 typedef   signed int    int32;
 typedef unsigned int   uint;
+#ifdef _MSC_VER
+typedef unsigned __int64 uint64;
+#else
+typedef unsigned long long uint64;
+#endif
 
 // should produce compiler error if size is wrong
 typedef unsigned char validate_uint32[sizeof(uint32)==4 ? 1 : -1];
@@ -373,6 +428,7 @@ typedef unsigned char validate_uint32[sizeof(uint32)==4 ? 1 : -1];
 #endif
 
 #define STBI_NOTUSED(v)  (void)sizeof(v)
+#define stbi_min(a,b)    ((a) < (b) ? (a) : (b))
 
 #ifdef _MSC_VER
 #define STBI_HAS_LROTL
@@ -475,6 +531,7 @@ static stbi_uc *stbi_jpeg_load(stbi *s, int *x, int *y, int *comp, int req_comp)
 static int      stbi_jpeg_info(stbi *s, int *x, int *y, int *comp);
 static int      stbi_png_test(stbi *s);
 static stbi_uc *stbi_png_load(stbi *s, int *x, int *y, int *comp, int req_comp);
+static stbi_us *stbi_png_load_16(stbi *s, int *x, int *y, int *comp, int req_comp);
 static int      stbi_png_info(stbi *s, int *x, int *y, int *comp);
 static int      stbi_bmp_test(stbi *s);
 static stbi_uc *stbi_bmp_load(stbi *s, int *x, int *y, int *comp, int req_comp);
@@ -492,8 +549,39 @@ static stbi_uc *stbi_gif_load(stbi *s, int *x, int *y, int *comp, int req_comp);
 static int      stbi_gif_info(stbi *s, int *x, int *y, int *comp);
 
 
+// all allocations go through these, so they can be redirected by defining all
+// three before including this file. STBI_REALLOC and STBI_FREE must accept
+// anything returned by any of them.
+#if defined(STBI_MALLOC) && defined(STBI_REALLOC) && defined(STBI_FREE)
+   // user provided
+#elif !defined(STBI_MALLOC) && !defined(STBI_REALLOC) && !defined(STBI_FREE)
+   #define STBI_MALLOC(sz)      malloc(sz)
+   #define STBI_REALLOC(p,sz)   realloc(p,sz)
+   #define STBI_FREE(p)         free(p)
+#else
+   #error "Must define all or none of STBI_MALLOC, STBI_REALLOC and STBI_FREE"
+#endif
+
+// the failure reason is kept per thread, so images can be decoded on several
+// threads at once and each thread still sees its own error
+#ifndef STBI_THREAD_LOCAL
+   #if defined(__cplusplus) && __cplusplus >= 201103L
+      #define STBI_THREAD_LOCAL thread_local
+   #elif defined(__STDC_VERSION__) && __STDC_VERSION__ >= 201112L
+      #define STBI_THREAD_LOCAL _Thread_local
+   #elif defined(__GNUC__)
+      #define STBI_THREAD_LOCAL __thread
+   #elif defined(_MSC_VER)
+      #define STBI_THREAD_LOCAL __declspec(thread)
+   #endif
+#endif
+
+#ifdef STBI_THREAD_LOCAL
+static STBI_THREAD_LOCAL const char *failure_reason;
+#else
 // this is not threadsafe
 static const char *failure_reason;
+#endif
 
 const char *stbi_failure_reason(void)
 {
@@ -520,16 +608,18 @@ static int e(const char *str)
 
 #define epf(x,y)   ((float *) (e(x,y)?NULL:NULL))
 #define epuc(x,y)  ((unsigned char *) (e(x,y)?NULL:NULL))
+#define epus(x,y)  ((stbi_us *) (e(x,y)?NULL:NULL))
 
 void stbi_image_free(void *retval_from_stbi_load)
 {
-   free(retval_from_stbi_load);
+   STBI_FREE(retval_from_stbi_load);
 }
 
 #ifndef STBI_NO_HDR
 static float   *ldr_to_hdr(stbi_uc *data, int x, int y, int comp);
 static stbi_uc *hdr_to_ldr(float   *data, int x, int y, int comp);
 #endif
+static stbi_us *convert_8_to_16(stbi_uc *data, int x, int y, int comp);
 
 static unsigned char *stbi_load_main(stbi *s, int *x, int *y, int *comp, int req_comp)
 {
@@ -586,6 +676,42 @@ unsigned char *stbi_load_from_callbacks(stbi_io_callbacks const *clbk, void *use
    return stbi_load_main(&s,x,y,comp,req_comp);
 }
 
+static stbi_us *stbi_load_16_main(stbi *s, int *x, int *y, int *comp, int req_comp)
+{
+   stbi_uc *data;
+   if (stbi_png_test(s)) return stbi_png_load_16(s,x,y,comp,req_comp);
+   // every other format only has 8 bits per channel
+   data = stbi_load_main(s,x,y,comp,req_comp);
+   if (data == NULL) return NULL;
+   return convert_8_to_16(data, *x, *y, req_comp ? req_comp : *comp);
+}
+
+stbi_us *stbi_load_16_from_memory(stbi_uc const *buffer, int len, int *x, int *y, int *comp, int req_comp)
+{
+   stbi s;
+   start_mem(&s,buffer,len);
+   return stbi_load_16_main(&s,x,y,comp,req_comp);
+}
+
+#ifndef STBI_NO_STDIO
+stbi_us *stbi_load_16(char const *filename, int *x, int *y, int *comp, int req_comp)
+{
+   FILE *f = fopen(filename, "rb");
+   stbi_us *result;
+   if (!f) return epus("can't fopen", "Unable to open file");
+   result = stbi_load_16_from_file(f,x,y,comp,req_comp);
+   fclose(f);
+   return result;
+}
+
+stbi_us *stbi_load_16_from_file(FILE *f, int *x, int *y, int *comp, int req_comp)
+{
+   stbi s;
+   start_file(&s,f);
+   return stbi_load_16_main(&s,x,y,comp,req_comp);
+}
+#endif //!STBI_NO_STDIO
+
 #ifndef STBI_NO_HDR
 
 float *stbi_loadf_main(stbi *s, int *x, int *y, int *comp, int req_comp)
@@ -709,7 +835,8 @@ enum
 {
    SCAN_load=0,
    SCAN_type,
-   SCAN_header
+   SCAN_header,
+   SCAN_stream  // png only: stop at the first IDAT, with the layout in png::stream
 };
 
 static void refill_buffer(stbi *s)
@@ -839,9 +966,9 @@ static unsigned char *convert_format(unsigned char *data, int img_n, int req_com
    if (req_comp == img_n) return data;
    assert(req_comp >= 1 && req_comp <= 4);
 
-   good = (unsigned char *) malloc(req_comp * x * y);
+   good = (unsigned char *) STBI_MALLOC(req_comp * x * y);
    if (good == NULL) {
-      free(data);
+      STBI_FREE(data);
       return epuc("outofmem", "Out of memory");
    }
 
@@ -871,16 +998,85 @@ static unsigned char *convert_format(unsigned char *data, int img_n, int req_com
       #undef CASE
    }
 
-   free(data);
+   STBI_FREE(data);
+   return good;
+}
+
+static uint16 compute_y16(int r, int g, int b)
+{
+   return (uint16) (((r*77) + (g*150) +  (29*b)) >> 8);
+}
+
+// convert_format, for 16 bits per channel
+static stbi_us *convert_format16(stbi_us *data, int img_n, int req_comp, uint x, uint y)
+{
+   int i,j;
+   stbi_us *good;
+
+   if (req_comp == img_n) return data;
+   assert(req_comp >= 1 && req_comp <= 4);
+
+   good = (stbi_us *) STBI_MALLOC((size_t) req_comp * x * y * 2);
+   if (good == NULL) {
+      STBI_FREE(data);
+      return epus("outofmem", "Out of memory");
+   }
+
+   for (j=0; j < (int) y; ++j) {
+      stbi_us *src  = data + (size_t) j * x * img_n   ;
+      stbi_us *dest = good + (size_t) j * x * req_comp;
+
+      #define CASE(a,b)   case COMBO(a,b): for(i=x-1; i >= 0; --i, src += a, dest += b)
+      switch (COMBO(img_n, req_comp)) {
+         CASE(1,2) dest[0]=src[0], dest[1]=0xffff; break;
+         CASE(1,3) dest[0]=dest[1]=dest[2]=src[0]; break;
+         CASE(1,4) dest[0]=dest[1]=dest[2]=src[0], dest[3]=0xffff; break;
+         CASE(2,1) dest[0]=src[0]; break;
+         CASE(2,3) dest[0]=dest[1]=dest[2]=src[0]; break;
+         CASE(2,4) dest[0]=dest[1]=dest[2]=src[0], dest[3]=src[1]; break;
+         CASE(3,4) dest[0]=src[0],dest[1]=src[1],dest[2]=src[2],dest[3]=0xffff; break;
+         CASE(3,1) dest[0]=compute_y16(src[0],src[1],src[2]); break;
+         CASE(3,2) dest[0]=compute_y16(src[0],src[1],src[2]), dest[1] = 0xffff; break;
+         CASE(4,1) dest[0]=compute_y16(src[0],src[1],src[2]); break;
+         CASE(4,2) dest[0]=compute_y16(src[0],src[1],src[2]), dest[1] = src[3]; break;
+         CASE(4,3) dest[0]=src[0],dest[1]=src[1],dest[2]=src[2]; break;
+         default: assert(0);
+      }
+      #undef CASE
+   }
+
+   STBI_FREE(data);
    return good;
 }
 
+// scales 8-bit channels up to 16 bits, so 255 becomes 65535
+static stbi_us *convert_8_to_16(stbi_uc *data, int x, int y, int comp)
+{
+   size_t i, count = (size_t) x * y * comp;
+   stbi_us *output = (stbi_us *) STBI_MALLOC(count * 2);
+   if (output == NULL) { STBI_FREE(data); return epus("outofmem", "Out of memory"); }
+   for (i=0; i < count; ++i)
+      output[i] = (stbi_us) (data[i] * 257);
+   STBI_FREE(data);
+   return output;
+}
+
+// keeps the high byte of each 16-bit channel, in place
+static stbi_uc *convert_16_to_8(stbi_us *data, int x, int y, int comp)
+{
+   size_t i, count = (size_t) x * y * comp;
+   stbi_uc *output = (stbi_uc *) data;
+   for (i=0; i < count; ++i)
+      output[i] = (stbi_uc) (data[i] >> 8);
+   return output;
+}
+
 #ifndef STBI_NO_HDR
 static float   *ldr_to_hdr(stbi_uc *data, int x, int y, int comp)
 {
    int i,k,n;
-   float *output = (float *) malloc(x * y * comp * sizeof(float));
-   if (output == NULL) { free(data); return epf("outofmem", "Out of memory"); }
+   float *output = (float *) STBI_MALLOC(x * y * comp * sizeof(float));
+   if (output == NULL) { STBI_FREE(data); return epf("outofmem", "Out of memory"); }
    // compute number of non-alpha components
    if (comp & 1) n = comp; else n = comp-1;
    for (i=0; i < x*y; ++i) {
@@ -889,7 +1085,7 @@ static float   *ldr_to_hdr(stbi_uc *data, int x, int y, int comp)
       }
       if (k < comp) output[i*comp + k] = data[i*comp+k]/255.0f;
    }
-   free(data);
+   STBI_FREE(data);
    return output;
 }
 
@@ -897,8 +1093,8 @@ static float   *ldr_to_hdr(stbi_uc *data, int x, int y, int comp)
 static stbi_uc *hdr_to_ldr(float   *data, int x, int y, int comp)
 {
    int i,k,n;
-   stbi_uc *output = (stbi_uc *) malloc(x * y * comp);
-   if (output == NULL) { free(data); return epuc("outofmem", "Out of memory"); }
+   stbi_uc *output = (stbi_uc *) STBI_MALLOC(x * y * comp);
+   if (output == NULL) { STBI_FREE(data); return epuc("outofmem", "Out of memory"); }
    // compute number of non-alpha components
    if (comp & 1) n = comp; else n = comp-1;
    for (i=0; i < x*y; ++i) {
@@ -915,7 +1111,7 @@ static stbi_uc *hdr_to_ldr(float   *data, int x, int y, int comp)
          output[i*comp + k] = (uint8) float2int(z);
       }
    }
-   free(data);
+   STBI_FREE(data);
    return output;
 }
 #endif
@@ -947,6 +1143,18 @@ static stbi_uc *hdr_to_ldr(float   *data, int x, int y, int comp)
 //          IJG 1998:   0.98 seconds (MSVC6, makefile provided by IJG)
 //          IJG 1998:   0.95 seconds (MSVC6, makefile + proc=PPro)
 
+#ifdef STBI_SIMD
+typedef unsigned short stbi_dequantize_t;
+#else
+typedef uint8 stbi_dequantize_t;
+#endif
+
+// the kernels that can be swapped for SIMD versions (see jpeg_setup_kernels)
+typedef void (*idct_block_func)(uint8 *out, int out_stride, short data[64], stbi_dequantize_t *dequantize);
+typedef void (*YCbCr_to_RGB_func)(uint8 *out, const uint8 *y, const uint8 *pcb, const uint8 *pcr, int count, int step);
+typedef uint8 *(*resample_row_func)(uint8 *out, uint8 *in0, uint8 *in1,
+                                    int w, int hs);
+
 // huffman decoding acceleration
 #define FAST_BITS   9  // larger handles more cases; smaller stomps less cache
 
@@ -969,6 +1177,7 @@ typedef struct
    stbi *s;
    huffman huff_dc[4];
    huffman huff_ac[4];
+   int16 fast_ac[4][1 << FAST_BITS];
    uint8 dequant[4][64];
 
 // sizes for components, interleaved MCUs
@@ -998,15 +1207,33 @@ typedef struct
 
    int scan_n, order[4];
    int restart_interval, todo;
+
+// reduced decoding: blocks come out (8>>scale_shift) pixels square, and only
+// the ones in the window of MCUs are kept. the component buffers hold just
+// the window, and out_* is the part of it that is returned, in scaled pixels
+   int scale_shift;
+   int region[4];       // requested x0,y0,x1,y1 in full size pixels, x1 == 0 for all
+   int win_x0, win_y0, win_x1, win_y1;
+   int out_x0, out_y0, out_x1, out_y1;
+   int stopped;         // the last scan stopped after the window's last MCU row
+
+   idct_block_func idct_block_kernel;
+   YCbCr_to_RGB_func YCbCr_to_RGB_kernel;
+   resample_row_func resample_row_v_2_kernel;
+   resample_row_func resample_row_h_2_kernel;
+   resample_row_func resample_row_hv_2_kernel;
 } jpeg;
 
 static int build_huffman(huffman *h, int *count)
 {
    int i,j,k=0,code;
    // build size list for each symbol (from JPEG spec)
-   for (i=0; i < 16; ++i)
+   for (i=0; i < 16; ++i) {
+      // a table has at most 256 symbols
+      if (count[i] > 256 - k) return e("bad code lengths","Corrupt JPEG");
       for (j=0; j < count[i]; ++j)
          h->size[k++] = (uint8) (i+1);
+   }
    h->size[k] = 0;
 
    // compute actual symbols (from jpeg spec)
@@ -1041,6 +1268,33 @@ static int build_huffman(huffman *h, int *count)
    return 1;
 }
 
+// build a table that decodes the run, size and value of small AC coefficients
+// in one lookup: value*256 + run*16 + bits used, or 0 if the code doesn't fit
+// in FAST_BITS along with its value bits
+static void build_fast_ac(int16 *fast_ac, huffman *h)
+{
+   int i;
+   for (i=0; i < (1 << FAST_BITS); ++i) {
+      uint8 fast = h->fast[i];
+      fast_ac[i] = 0;
+      if (fast < 255) {
+         int rs = h->values[fast];
+         int run = (rs >> 4) & 15;
+         int magbits = rs & 15;
+         int len = h->size[fast];
+
+         if (magbits && len + magbits <= FAST_BITS) {
+            // the same value extend_receive would produce
+            int k = ((i << len) & ((1 << FAST_BITS) - 1)) >> (FAST_BITS - magbits);
+            int m = 1 << (magbits - 1);
+            if (k < m) k -= (1 << magbits) - 1;
+            if (k >= -128 && k <= 127)
+               fast_ac[i] = (int16) ((k * 256) + (run * 16) + (len + magbits));
+         }
+      }
+   }
+}
+
 static void grow_buffer_unsafe(jpeg *j)
 {
    do {
@@ -1061,14 +1315,12 @@ static void grow_buffer_unsafe(jpeg *j)
 // (1 << n) - 1
 static uint32 bmask[17]={0,1,3,7,15,31,63,127,255,511,1023,2047,4095,8191,16383,32767,65535};
 
-// decode a jpeg huffman value from the bitstream
-stbi_inline static int decode(jpeg *j, huffman *h)
+// decode a jpeg huffman value from the bitstream, once it has been topped up
+stbi_inline static int decode_grown(jpeg *j, huffman *h)
 {
    unsigned int temp;
    int c,k;
 
-   if (j->code_bits < 16) grow_buffer_unsafe(j);
-
    // look at the top FAST_BITS and determine what symbol ID it is,
    // if the code is <= FAST_BITS
    c = (j->code_buffer >> (32 - FAST_BITS)) & ((1 << FAST_BITS)-1);
@@ -1111,6 +1363,12 @@ stbi_inline static int decode(jpeg *j, huffman *h)
    return h->values[c];
 }
 
+stbi_inline static int decode(jpeg *j, huffman *h)
+{
+   if (j->code_bits < 16) grow_buffer_unsafe(j);
+   return decode_grown(j, h);
+}
+
 // combined JPEG 'receive' and JPEG 'extend', since baseline
 // always extends everything it receives.
 stbi_inline static int extend_receive(jpeg *j, int n)
@@ -1159,8 +1417,10 @@ static uint8 dezigzag[64+15] =
 static int decode_block(jpeg *j, short data[64], huffman *hdc, huffman *hac, int b)
 {
    int diff,dc,k;
+   int16 *fast_ac = j->fast_ac[j->img_comp[b].ha];
    int t = decode(j, hdc);
-   if (t < 0) return e("bad huffman code","Corrupt JPEG");
+   // a DC difference is at most 15 bits; anything larger would index past bmask
+   if (t < 0 || t > 15) return e("bad huffman code","Corrupt JPEG");
 
    // 0 all the ac values now so we can do it 32-bits at a time
    memset(data,0,64*sizeof(data[0]));
@@ -1173,8 +1433,22 @@ static int decode_block(jpeg *j, short data[64], huffman *hdc, huffman *hac, int
    // decode AC components, see JPEG spec
    k = 1;
    do {
-      int r,s;
-      int rs = decode(j, hac);
+      int r,s,c,rs;
+      if (j->code_bits < 16) grow_buffer_unsafe(j);
+      // small coefficients whose bits are all in the buffer decode in one
+      // lookup, and leave the bit buffer in the same state as decoding them
+      // the long way would
+      c = (j->code_buffer >> (32 - FAST_BITS)) & ((1 << FAST_BITS)-1);
+      r = fast_ac[c];
+      if (r && (r & 15) <= j->code_bits) {
+         s = r & 15;
+         k += (r >> 4) & 15;
+         j->code_buffer <<= s;
+         j->code_bits -= s;
+         data[dezigzag[k++]] = (short) (r >> 8);
+         continue;
+      }
+      rs = decode_grown(j, hac);
       if (rs < 0) return e("bad huffman code","Corrupt JPEG");
       s = rs & 15;
       r = rs >> 4;
@@ -1242,12 +1516,6 @@ stbi_inline static uint8 clamp(int x)
    t1 += p2+p4;                                \
    t0 += p1+p3;
 
-#ifdef STBI_SIMD
-typedef unsigned short stbi_dequantize_t;
-#else
-typedef uint8 stbi_dequantize_t;
-#endif
-
 // .344 seconds on 3*anemones.jpg
 static void idct_block(uint8 *out, int out_stride, short data[64], stbi_dequantize_t *dequantize)
 {
@@ -1310,6 +1578,374 @@ static void idct_block(uint8 *out, int out_stride, short data[64], stbi_dequanti
    }
 }
 
+#ifdef STBI_SSE2
+// the kernels below do exactly the same integer arithmetic as the scalar
+// versions above (wrapping the same way on garbage input), just on several
+// pixels at once, so they give identical output
+
+// IDCT_1D on vectors of 32-bit lanes, one lane per column (or row)
+#define IDCT_1D_SIMD(T,ADD,SUB,MUL,FSH,s0,s1,s2,s3,s4,s5,s6,s7) \
+   T t0,t1,t2,t3,p1,p2,p3,p4,p5,x0,x1,x2,x3;             \
+   p2 = s2;                                                 \
+   p3 = s6;                                                 \
+   p1 = MUL(ADD(p2,p3), f2f(0.5411961f));                   \
+   t2 = ADD(p1, MUL(p3, f2f(-1.847759065f)));               \
+   t3 = ADD(p1, MUL(p2, f2f( 0.765366865f)));               \
+   p2 = s0;                                                 \
+   p3 = s4;                                                 \
+   t0 = FSH(ADD(p2,p3));                                    \
+   t1 = FSH(SUB(p2,p3));                                    \
+   x0 = ADD(t0,t3);                                         \
+   x3 = SUB(t0,t3);                                         \
+   x1 = ADD(t1,t2);                                         \
+   x2 = SUB(t1,t2);                                         \
+   t0 = s7;                                                 \
+   t1 = s5;                                                 \
+   t2 = s3;                                                 \
+   t3 = s1;                                                 \
+   p3 = ADD(t0,t2);                                         \
+   p4 = ADD(t1,t3);                                         \
+   p1 = ADD(t0,t3);                                         \
+   p2 = ADD(t1,t2);                                         \
+   p5 = MUL(ADD(p3,p4), f2f( 1.175875602f));                \
+   t0 = MUL(t0, f2f( 0.298631336f));                        \
+   t1 = MUL(t1, f2f( 2.053119869f));                        \
+   t2 = MUL(t2, f2f( 3.072711026f));                        \
+   t3 = MUL(t3, f2f( 1.501321110f));                        \
+   p1 = ADD(p5, MUL(p1, f2f(-0.899976223f)));               \
+   p2 = ADD(p5, MUL(p2, f2f(-2.562915447f)));               \
+   p3 = MUL(p3, f2f(-1.961570560f));                        \
+   p4 = MUL(p4, f2f(-0.390180644f));                        \
+   t3 = ADD(t3, ADD(p1,p4));                                \
+   t2 = ADD(t2, ADD(p2,p3));                                \
+   t1 = ADD(t1, ADD(p2,p4));                                \
+   t0 = ADD(t0, ADD(p1,p3));
+
+// SSE2 has no 32-bit multiply, so the even and odd lanes are multiplied separately
+static __m128i stbi_mul_sse2(__m128i a, int c)
+{
+   __m128i k = _mm_set1_epi32(c);
+   __m128i even = _mm_mul_epu32(a, k);
+   __m128i odd  = _mm_mul_epu32(_mm_srli_epi64(a, 32), k);
+   return _mm_unpacklo_epi32(_mm_shuffle_epi32(even, _MM_SHUFFLE(0,0,2,0)),
+                             _mm_shuffle_epi32(odd,  _MM_SHUFFLE(0,0,2,0)));
+}
+
+#define STBI_FSH_SSE2(x)  _mm_slli_epi32(x, 12)
+
+#define STBI_TRANSPOSE4_SSE2(a,b,c,d) {                                        \
+   __m128i ab_lo = _mm_unpacklo_epi32(a,b), cd_lo = _mm_unpacklo_epi32(c,d);   \
+   __m128i ab_hi = _mm_unpackhi_epi32(a,b), cd_hi = _mm_unpackhi_epi32(c,d);   \
+   a = _mm_unpacklo_epi64(ab_lo,cd_lo);                                        \
+   b = _mm_unpackhi_epi64(ab_lo,cd_lo);                                        \
+   c = _mm_unpacklo_epi64(ab_hi,cd_hi);                                        \
+   d = _mm_unpackhi_epi64(ab_hi,cd_hi);                                        \
+}
+
+// a madd_epi16 operand that multiplies interleaved 16-bit pairs (x,y) by (a,b)
+static __m128i stbi_pair_epi16(int a, int b)
+{
+   return _mm_set1_epi32((int) (((uint32) b << 16) | ((uint32) a & 0xffff)));
+}
+
+// IDCT_1D on eight columns of 16-bit inputs. Each output of IDCT_1D is a sum
+// of products of the inputs with fixed constants, so gathering the constants
+// per input gives the same integers (mod 2^32) with the multiplies done in
+// pairs by _mm_madd_epi16. out_lo/out_hi get the 32-bit results for columns
+// 0-3/4-7 with `bias` added, before the final shift, in output order
+static void stbi_idct_1d_16(const __m128i s[8], __m128i out_lo[8], __m128i out_hi[8], int bias)
+{
+   // even part
+   const int c0 = f2f(0.5411961f);
+   const __m128i k_t2 = stbi_pair_epi16(c0, c0 + f2f(-1.847759065f));
+   const __m128i k_t3 = stbi_pair_epi16(c0 + f2f(0.765366865f), c0);
+   const __m128i k_t0 = stbi_pair_epi16(4096,  4096);
+   const __m128i k_t1 = stbi_pair_epi16(4096, -4096);
+   // odd part, as (s1,s3) and (s5,s7) pairs
+   const int k0 = f2f(0.298631336f), k1 = f2f(2.053119869f);
+   const int k2 = f2f(3.072711026f), k3 = f2f(1.501321110f);
+   const int k5 = f2f(1.175875602f);
+   const int kp1 = f2f(-0.899976223f), kp2 = f2f(-2.562915447f);
+   const int kp3 = f2f(-1.961570560f), kp4 = f2f(-0.390180644f);
+   const __m128i k_o3a = stbi_pair_epi16(k3 + k5 + kp1 + kp4, k5);
+   const __m128i k_o3b = stbi_pair_epi16(k5 + kp4, k5 + kp1);
+   const __m128i k_o2a = stbi_pair_epi16(k5, k2 + k5 + kp2 + kp3);
+   const __m128i k_o2b = stbi_pair_epi16(k5 + kp2, k5 + kp3);
+   const __m128i k_o1a = stbi_pair_epi16(k5 + kp4, k5 + kp2);
+   const __m128i k_o1b = stbi_pair_epi16(k1 + k5 + kp2 + kp4, k5);
+   const __m128i k_o0a = stbi_pair_epi16(k5 + kp1, k5 + kp3);
+   const __m128i k_o0b = stbi_pair_epi16(k5, k0 + k5 + kp1 + kp3);
+   const __m128i b = _mm_set1_epi32(bias);
+   int h;
+
+   for (h=0; h < 2; ++h) {
+      __m128i s04 = h ? _mm_unpackhi_epi16(s[0], s[4]) : _mm_unpacklo_epi16(s[0], s[4]);
+      __m128i s26 = h ? _mm_unpackhi_epi16(s[2], s[6]) : _mm_unpacklo_epi16(s[2], s[6]);
+      __m128i s13 = h ? _mm_unpackhi_epi16(s[1], s[3]) : _mm_unpacklo_epi16(s[1], s[3]);
+      __m128i s57 = h ? _mm_unpackhi_epi16(s[5], s[7]) : _mm_unpacklo_epi16(s[5], s[7]);
+      __m128i *out = h ? out_hi : out_lo;
+      __m128i t0 = _mm_madd_epi16(s04, k_t0), t1 = _mm_madd_epi16(s04, k_t1);
+      __m128i t2 = _mm_madd_epi16(s26, k_t2), t3 = _mm_madd_epi16(s26, k_t3);
+      __m128i x0 = _mm_add_epi32(_mm_add_epi32(t0, t3), b);
+      __m128i x3 = _mm_add_epi32(_mm_sub_epi32(t0, t3), b);
+      __m128i x1 = _mm_add_epi32(_mm_add_epi32(t1, t2), b);
+      __m128i x2 = _mm_add_epi32(_mm_sub_epi32(t1, t2), b);
+      __m128i o3 = _mm_add_epi32(_mm_madd_epi16(s13, k_o3a), _mm_madd_epi16(s57, k_o3b));
+      __m128i o2 = _mm_add_epi32(_mm_madd_epi16(s13, k_o2a), _mm_madd_epi16(s57, k_o2b));
+      __m128i o1 = _mm_add_epi32(_mm_madd_epi16(s13, k_o1a), _mm_madd_epi16(s57, k_o1b));
+      __m128i o0 = _mm_add_epi32(_mm_madd_epi16(s13, k_o0a), _mm_madd_epi16(s57, k_o0b));
+      out[0] = _mm_add_epi32(x0, o3);
+      out[7] = _mm_sub_epi32(x0, o3);
+      out[1] = _mm_add_epi32(x1, o2);
+      out[6] = _mm_sub_epi32(x1, o2);
+      out[2] = _mm_add_epi32(x2, o1);
+      out[5] = _mm_sub_epi32(x2, o1);
+      out[3] = _mm_add_epi32(x3, o0);
+      out[4] = _mm_sub_epi32(x3, o0);
+   }
+}
+
+#define STBI_TRANSPOSE8_16_SSE2(r) {                                                  \
+   __m128i a0 = _mm_unpacklo_epi16(r[0],r[1]), a1 = _mm_unpackhi_epi16(r[0],r[1]);    \
+   __m128i a2 = _mm_unpacklo_epi16(r[2],r[3]), a3 = _mm_unpackhi_epi16(r[2],r[3]);    \
+   __m128i a4 = _mm_unpacklo_epi16(r[4],r[5]), a5 = _mm_unpackhi_epi16(r[4],r[5]);    \
+   __m128i a6 = _mm_unpacklo_epi16(r[6],r[7]), a7 = _mm_unpackhi_epi16(r[6],r[7]);    \
+   __m128i b0 = _mm_unpacklo_epi32(a0,a2), b1 = _mm_unpackhi_epi32(a0,a2);            \
+   __m128i b2 = _mm_unpacklo_epi32(a1,a3), b3 = _mm_unpackhi_epi32(a1,a3);            \
+   __m128i b4 = _mm_unpacklo_epi32(a4,a6), b5 = _mm_unpackhi_epi32(a4,a6);            \
+   __m128i b6 = _mm_unpacklo_epi32(a5,a7), b7 = _mm_unpackhi_epi32(a5,a7);            \
+   r[0] = _mm_unpacklo_epi64(b0,b4); r[1] = _mm_unpackhi_epi64(b0,b4);                \
+   r[2] = _mm_unpacklo_epi64(b1,b5); r[3] = _mm_unpackhi_epi64(b1,b5);                \
+   r[4] = _mm_unpacklo_epi64(b2,b6); r[5] = _mm_unpackhi_epi64(b2,b6);                \
+   r[6] = _mm_unpacklo_epi64(b3,b7); r[7] = _mm_unpackhi_epi64(b3,b7);                \
+}
+
+// idct_block for the usual case, where the dequantized coefficients and the
+// results of the column pass all fit in 16 bits. returns 0 without writing
+// anything if they don't, and the caller falls back to 32-bit lanes. (the
+// column shortcut for DC-only columns needs no special case here: without
+// overflow it gives the same result as the full transform)
+static int idct_block_16(uint8 *out, int out_stride, short data[64], stbi_dequantize_t *dequantize)
+{
+   __m128i s[8], lo[8], hi[8];
+   __m128i zero = _mm_setzero_si128();
+   __m128i overflow = zero;
+   __m128i half = _mm_set1_epi32(32768);
+   int i;
+
+   for (i=0; i < 8; ++i) {
+      __m128i d = _mm_loadu_si128((const __m128i *) (data + i*8));
+      __m128i q = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *) (dequantize + i*8)), zero);
+      __m128i p_lo = _mm_mullo_epi16(d, q);
+      __m128i p_hi = _mm_mulhi_epi16(d, q);
+      // the product fits if its high half is just the low half's sign
+      overflow = _mm_or_si128(overflow, _mm_xor_si128(p_hi, _mm_srai_epi16(p_lo, 15)));
+      s[i] = p_lo;
+   }
+   if (_mm_movemask_epi8(_mm_cmpeq_epi16(overflow, zero)) != 0xffff) return 0;
+
+   // columns
+   stbi_idct_1d_16(s, lo, hi, 512);
+   for (i=0; i < 8; ++i) {
+      __m128i a = _mm_srai_epi32(lo[i], 10);
+      __m128i b = _mm_srai_epi32(hi[i], 10);
+      overflow = _mm_or_si128(overflow, _mm_srli_epi32(_mm_add_epi32(a, half), 16));
+      overflow = _mm_or_si128(overflow, _mm_srli_epi32(_mm_add_epi32(b, half), 16));
+      s[i] = _mm_packs_epi32(a, b);
+   }
+   if (_mm_movemask_epi8(_mm_cmpeq_epi32(overflow, zero)) != 0xffff) return 0;
+
+   // rows
+   STBI_TRANSPOSE8_16_SSE2(s);
+   stbi_idct_1d_16(s, lo, hi, 65536 + (128<<17));
+   for (i=0; i < 8; ++i)
+      s[i] = _mm_packs_epi32(_mm_srai_epi32(lo[i], 17), _mm_srai_epi32(hi[i], 17));
+   STBI_TRANSPOSE8_16_SSE2(s);
+   for (i=0; i < 8; ++i)
+      _mm_storel_epi64((__m128i *) (out + i*out_stride), _mm_packus_epi16(s[i], s[i]));
+   return 1;
+}
+
+// idct_block on the block as 8 rows of two halves, four 32-bit lanes each,
+// for blocks that don't fit the 16-bit version
+static void idct_block_sse2(uint8 *out, int out_stride, short data[64], stbi_dequantize_t *dequantize)
+{
+   __m128i s[8][2], v[8][2], dc_only[2];
+   __m128i zero = _mm_setzero_si128();
+   __m128i ac = zero;
+   int i,h,g;
+
+   if (idct_block_16(out, out_stride, data, dequantize)) return;
+
+   // dequantize. the products of 16-bit data and 8-bit factors fit in 32 bits
+   for (i=0; i < 8; ++i) {
+      __m128i d = _mm_loadu_si128((const __m128i *) (data + i*8));
+      __m128i q = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *) (dequantize + i*8)), zero);
+      __m128i lo = _mm_mullo_epi16(d, q);
+      __m128i hi = _mm_mulhi_epi16(d, q);
+      s[i][0] = _mm_unpacklo_epi16(lo, hi);
+      s[i][1] = _mm_unpackhi_epi16(lo, hi);
+      if (i) ac = _mm_or_si128(ac, d);
+   }
+
+   // columns. the scalar version shortcuts columns that are all zero below
+   // the DC term, so those lanes take the shortcut's result here too
+   ac = _mm_cmpeq_epi16(ac, zero);
+   dc_only[0] = _mm_unpacklo_epi16(ac, ac);
+   dc_only[1] = _mm_unpackhi_epi16(ac, ac);
+   for (h=0; h < 2; ++h) {
+      __m128i dcterm = _mm_slli_epi32(s[0][h], 2);
+      if (_mm_movemask_epi8(dc_only[h]) == 0xffff) {
+         for (i=0; i < 8; ++i) v[i][h] = dcterm;
+      } else {
+         __m128i bias = _mm_set1_epi32(512);
+         IDCT_1D_SIMD(__m128i, _mm_add_epi32, _mm_sub_epi32, stbi_mul_sse2, STBI_FSH_SSE2,
+                      s[0][h],s[1][h],s[2][h],s[3][h],s[4][h],s[5][h],s[6][h],s[7][h])
+         x0 = _mm_add_epi32(x0, bias); x1 = _mm_add_epi32(x1, bias);
+         x2 = _mm_add_epi32(x2, bias); x3 = _mm_add_epi32(x3, bias);
+         v[0][h] = _mm_srai_epi32(_mm_add_epi32(x0,t3), 10);
+         v[7][h] = _mm_srai_epi32(_mm_sub_epi32(x0,t3), 10);
+         v[1][h] = _mm_srai_epi32(_mm_add_epi32(x1,t2), 10);
+         v[6][h] = _mm_srai_epi32(_mm_sub_epi32(x1,t2), 10);
+         v[2][h] = _mm_srai_epi32(_mm_add_epi32(x2,t1), 10);
+         v[5][h] = _mm_srai_epi32(_mm_sub_epi32(x2,t1), 10);
+         v[3][h] = _mm_srai_epi32(_mm_add_epi32(x3,t0), 10);
+         v[4][h] = _mm_srai_epi32(_mm_sub_epi32(x3,t0), 10);
+         for (i=0; i < 8; ++i)
+            v[i][h] = _mm_or_si128(_mm_and_si128(dc_only[h], dcterm), _mm_andnot_si128(dc_only[h], v[i][h]));
+      }
+   }
+
+   // transpose, so each vector holds one column of four rows: s[column][row / 4]
+   STBI_TRANSPOSE4_SSE2(v[0][0], v[1][0], v[2][0], v[3][0]);
+   STBI_TRANSPOSE4_SSE2(v[0][1], v[1][1], v[2][1], v[3][1]);
+   STBI_TRANSPOSE4_SSE2(v[4][0], v[5][0], v[6][0], v[7][0]);
+   STBI_TRANSPOSE4_SSE2(v[4][1], v[5][1], v[6][1], v[7][1]);
+   for (i=0; i < 4; ++i) {
+      s[i][0]   = v[i][0];
+      s[i+4][0] = v[i][1];
+      s[i][1]   = v[i+4][0];
+      s[i+4][1] = v[i+4][1];
+   }
+
+   // rows, four at a time
+   for (g=0; g < 2; ++g) {
+      __m128i o[8];
+      __m128i bias = _mm_set1_epi32(65536 + (128<<17));
+      IDCT_1D_SIMD(__m128i, _mm_add_epi32, _mm_sub_epi32, stbi_mul_sse2, STBI_FSH_SSE2,
+                   s[0][g],s[1][g],s[2][g],s[3][g],s[4][g],s[5][g],s[6][g],s[7][g])
+      x0 = _mm_add_epi32(x0, bias); x1 = _mm_add_epi32(x1, bias);
+      x2 = _mm_add_epi32(x2, bias); x3 = _mm_add_epi32(x3, bias);
+      o[0] = _mm_srai_epi32(_mm_add_epi32(x0,t3), 17);
+      o[7] = _mm_srai_epi32(_mm_sub_epi32(x0,t3), 17);
+      o[1] = _mm_srai_epi32(_mm_add_epi32(x1,t2), 17);
+      o[6] = _mm_srai_epi32(_mm_sub_epi32(x1,t2), 17);
+      o[2] = _mm_srai_epi32(_mm_add_epi32(x2,t1), 17);
+      o[5] = _mm_srai_epi32(_mm_sub_epi32(x2,t1), 17);
+      o[3] = _mm_srai_epi32(_mm_add_epi32(x3,t0), 17);
+      o[4] = _mm_srai_epi32(_mm_sub_epi32(x3,t0), 17);
+      STBI_TRANSPOSE4_SSE2(o[0], o[1], o[2], o[3]);
+      STBI_TRANSPOSE4_SSE2(o[4], o[5], o[6], o[7]);
+      // saturating packs clamp to 0..255 exactly like clamp()
+      for (i=0; i < 4; ++i) {
+         __m128i row = _mm_packs_epi32(o[i], o[i+4]);
+         _mm_storel_epi64((__m128i *) (out + (g*4 + i)*out_stride), _mm_packus_epi16(row, row));
+      }
+   }
+}
+
+#ifdef STBI_AVX2
+#define STBI_MUL_AVX2(a,c)  _mm256_mullo_epi32(a, _mm256_set1_epi32(c))
+#define STBI_FSH_AVX2(x)    _mm256_slli_epi32(x, 12)
+
+#define STBI_TRANSPOSE8_AVX2(r) {                                                        \
+   __m256i t0 = _mm256_unpacklo_epi32(r[0],r[1]), t1 = _mm256_unpackhi_epi32(r[0],r[1]); \
+   __m256i t2 = _mm256_unpacklo_epi32(r[2],r[3]), t3 = _mm256_unpackhi_epi32(r[2],r[3]); \
+   __m256i t4 = _mm256_unpacklo_epi32(r[4],r[5]), t5 = _mm256_unpackhi_epi32(r[4],r[5]); \
+   __m256i t6 = _mm256_unpacklo_epi32(r[6],r[7]), t7 = _mm256_unpackhi_epi32(r[6],r[7]); \
+   __m256i u0 = _mm256_unpacklo_epi64(t0,t2), u1 = _mm256_unpackhi_epi64(t0,t2);         \
+   __m256i u2 = _mm256_unpacklo_epi64(t1,t3), u3 = _mm256_unpackhi_epi64(t1,t3);         \
+   __m256i u4 = _mm256_unpacklo_epi64(t4,t6), u5 = _mm256_unpackhi_epi64(t4,t6);         \
+   __m256i u6 = _mm256_unpacklo_epi64(t5,t7), u7 = _mm256_unpackhi_epi64(t5,t7);         \
+   r[0] = _mm256_permute2x128_si256(u0,u4,0x20);                                         \
+   r[1] = _mm256_permute2x128_si256(u1,u5,0x20);                                         \
+   r[2] = _mm256_permute2x128_si256(u2,u6,0x20);                                         \
+   r[3] = _mm256_permute2x128_si256(u3,u7,0x20);                                         \
+   r[4] = _mm256_permute2x128_si256(u0,u4,0x31);                                         \
+   r[5] = _mm256_permute2x128_si256(u1,u5,0x31);                                         \
+   r[6] = _mm256_permute2x128_si256(u2,u6,0x31);                                         \
+   r[7] = _mm256_permute2x128_si256(u3,u7,0x31);                                         \
+}
+
+// idct_block with a whole row of the block in each vector, for blocks that
+// don't fit the 16-bit version
+static STBI_TARGET_AVX2 void idct_block_avx2(uint8 *out, int out_stride, short data[64], stbi_dequantize_t *dequantize)
+{
+   __m256i s[8], o[8], dc_only;
+   __m128i zero = _mm_setzero_si128();
+   __m128i ac = zero;
+   int i;
+
+   if (idct_block_16(out, out_stride, data, dequantize)) return;
+
+   for (i=0; i < 8; ++i) {
+      __m128i d = _mm_loadu_si128((const __m128i *) (data + i*8));
+      __m128i q = _mm_loadl_epi64((const __m128i *) (dequantize + i*8));
+      s[i] = _mm256_mullo_epi32(_mm256_cvtepi16_epi32(d), _mm256_cvtepu8_epi32(q));
+      if (i) ac = _mm_or_si128(ac, d);
+   }
+
+   // columns, with the scalar version's shortcut for columns with no AC terms
+   dc_only = _mm256_cvtepi16_epi32(_mm_cmpeq_epi16(ac, zero));
+   {
+      __m256i dcterm = _mm256_slli_epi32(s[0], 2);
+      if (_mm256_movemask_epi8(dc_only) == -1) {
+         for (i=0; i < 8; ++i) s[i] = dcterm;
+      } else {
+         __m256i bias = _mm256_set1_epi32(512);
+         IDCT_1D_SIMD(__m256i, _mm256_add_epi32, _mm256_sub_epi32, STBI_MUL_AVX2, STBI_FSH_AVX2,
+                      s[0],s[1],s[2],s[3],s[4],s[5],s[6],s[7])
+         x0 = _mm256_add_epi32(x0, bias); x1 = _mm256_add_epi32(x1, bias);
+         x2 = _mm256_add_epi32(x2, bias); x3 = _mm256_add_epi32(x3, bias);
+         s[0] = _mm256_srai_epi32(_mm256_add_epi32(x0,t3), 10);
+         s[7] = _mm256_srai_epi32(_mm256_sub_epi32(x0,t3), 10);
+         s[1] = _mm256_srai_epi32(_mm256_add_epi32(x1,t2), 10);
+         s[6] = _mm256_srai_epi32(_mm256_sub_epi32(x1,t2), 10);
+         s[2] = _mm256_srai_epi32(_mm256_add_epi32(x2,t1), 10);
+         s[5] = _mm256_srai_epi32(_mm256_sub_epi32(x2,t1), 10);
+         s[3] = _mm256_srai_epi32(_mm256_add_epi32(x3,t0), 10);
+         s[4] = _mm256_srai_epi32(_mm256_sub_epi32(x3,t0), 10);
+         for (i=0; i < 8; ++i)
+            s[i] = _mm256_blendv_epi8(s[i], dcterm, dc_only);
+      }
+   }
+
+   // rows
+   STBI_TRANSPOSE8_AVX2(s);
+   {
+      __m256i bias = _mm256_set1_epi32(65536 + (128<<17));
+      IDCT_1D_SIMD(__m256i, _mm256_add_epi32, _mm256_sub_epi32, STBI_MUL_AVX2, STBI_FSH_AVX2,
+                   s[0],s[1],s[2],s[3],s[4],s[5],s[6],s[7])
+      x0 = _mm256_add_epi32(x0, bias); x1 = _mm256_add_epi32(x1, bias);
+      x2 = _mm256_add_epi32(x2, bias); x3 = _mm256_add_epi32(x3, bias);
+      o[0] = _mm256_srai_epi32(_mm256_add_epi32(x0,t3), 17);
+      o[7] = _mm256_srai_epi32(_mm256_sub_epi32(x0,t3), 17);
+      o[1] = _mm256_srai_epi32(_mm256_add_epi32(x1,t2), 17);
+      o[6] = _mm256_srai_epi32(_mm256_sub_epi32(x1,t2), 17);
+      o[2] = _mm256_srai_epi32(_mm256_add_epi32(x2,t1), 17);
+      o[5] = _mm256_srai_epi32(_mm256_sub_epi32(x2,t1), 17);
+      o[3] = _mm256_srai_epi32(_mm256_add_epi32(x3,t0), 17);
+      o[4] = _mm256_srai_epi32(_mm256_sub_epi32(x3,t0), 17);
+   }
+   STBI_TRANSPOSE8_AVX2(o);
+   for (i=0; i < 8; ++i) {
+      __m128i row = _mm_packs_epi32(_mm256_castsi256_si128(o[i]), _mm256_extracti128_si256(o[i], 1));
+      _mm_storel_epi64((__m128i *) (out + i*out_stride), _mm_packus_epi16(row, row));
+   }
+}
+#endif // STBI_AVX2
+#endif // STBI_SSE2
+
 #ifdef STBI_SIMD
 static stbi_idct_8x8 stbi_idct_installed = idct_block;
 
@@ -1319,6 +1955,86 @@ void stbi_install_idct(stbi_idct_8x8 func)
 }
 #endif
 
+// reduced IDCTs, for decoding at 1/2, 1/4 and 1/8 size: an n-point IDCT of
+// just the top left n x n coefficients. each basis function is also scaled by
+// how much averaging 8/n pixels attenuates it, so the result is a box filter
+// of the full size block's low frequencies. the constants are the n-point
+// IDCT matrix entries, 4096 = 1.0, and like idct_block the column pass keeps
+// 2 bits more than the input, which the row pass removes with the level shift
+
+// 4-point even part: 0.5/sqrt(2) and 0.5*cos(2pi/8), attenuated
+#define IDCT4_0   1448
+#define IDCT4_2   1338
+// 4-point odd part, 0.5*cos(pi/8) and 0.5*cos(3pi/8) attenuated, in the order
+// outputs 0 and 3 use them (A) and the order outputs 1 and 2 do (B)
+#define IDCT4_1A  1856
+#define IDCT4_3A  652
+#define IDCT4_1B  769
+#define IDCT4_3B  1573
+// 2-point: 0.5/sqrt(2) and 0.5*cos(pi/4), attenuated
+#define IDCT2_0   1448
+#define IDCT2_1   1312
+
+#define IDCT4_1D(s0,s1,s2,s3) \
+   int e0 = IDCT4_0 * (s0) + IDCT4_2 * (s2); \
+   int e1 = IDCT4_0 * (s0) - IDCT4_2 * (s2); \
+   int o0 = IDCT4_1A * (s1) + IDCT4_3A * (s3); \
+   int o1 = IDCT4_1B * (s1) - IDCT4_3B * (s3);
+
+static void idct_block_4x4(uint8 *out, int out_stride, short data[64], uint8 *dq)
+{
+   int i, tmp[16];
+
+   // columns
+   for (i=0; i < 4; ++i) {
+      short *d = data + i;
+      uint8 *q = dq + i;
+      if (d[8] == 0 && d[16] == 0 && d[24] == 0) {
+         // just the DC, so the whole column is the same
+         int dc = (IDCT4_0 * d[0] * q[0] + 512) >> 10;
+         tmp[i] = tmp[4+i] = tmp[8+i] = tmp[12+i] = dc;
+      } else {
+         IDCT4_1D(d[0]*q[0], d[8]*q[8], d[16]*q[16], d[24]*q[24])
+         tmp[i]    = (e0 + o0 + 512) >> 10;
+         tmp[12+i] = (e0 - o0 + 512) >> 10;
+         tmp[4+i]  = (e1 + o1 + 512) >> 10;
+         tmp[8+i]  = (e1 - o1 + 512) >> 10;
+      }
+   }
+
+   // rows
+   for (i=0; i < 4; ++i, out += out_stride) {
+      int *t = tmp + i*4;
+      IDCT4_1D(t[0], t[1], t[2], t[3])
+      e0 += (1 << 13) + (128 << 14);
+      e1 += (1 << 13) + (128 << 14);
+      out[0] = clamp((e0 + o0) >> 14);
+      out[3] = clamp((e0 - o0) >> 14);
+      out[1] = clamp((e1 + o1) >> 14);
+      out[2] = clamp((e1 - o1) >> 14);
+   }
+}
+
+static void idct_block_2x2(uint8 *out, int out_stride, short data[64], uint8 *dq)
+{
+   int dc = IDCT2_0 * (data[0]*dq[0]), ac = IDCT2_1 * (data[8]*dq[8]);
+   int t0 = (dc + ac + 512) >> 10, t1 = (dc - ac + 512) >> 10;
+   int t2 = (IDCT2_0 * (data[1]*dq[1]) + IDCT2_1 * (data[9]*dq[9]) + 512) >> 10;
+   int t3 = (IDCT2_0 * (data[1]*dq[1]) - IDCT2_1 * (data[9]*dq[9]) + 512) >> 10;
+   int bias = (1 << 13) + (128 << 14);
+   // t0,t1 are the first column, t2,t3 the second
+   out[0]            = clamp((IDCT2_0 * t0 + IDCT2_1 * t2 + bias) >> 14);
+   out[1]            = clamp((IDCT2_0 * t0 - IDCT2_1 * t2 + bias) >> 14);
+   out[out_stride]   = clamp((IDCT2_0 * t1 + IDCT2_1 * t3 + bias) >> 14);
+   out[out_stride+1] = clamp((IDCT2_0 * t1 - IDCT2_1 * t3 + bias) >> 14);
+}
+
+static void idct_block_1x1(uint8 *out, short data[64], uint8 *dq)
+{
+   // the DC coefficient is already the block's average
+   out[0] = clamp(((data[0] * dq[0] + 4) >> 3) + 128);
+}
+
 #define MARKER_none  0xff
 // if there's a pending marker from the entropy stream, return that
 // otherwise, fetch from the stream and get a marker. if there's no
@@ -1352,6 +2068,31 @@ static void reset(jpeg *j)
    // since we don't even allow 1<<30 pixels
 }
 
+// runs the IDCT of a decoded block into its component's buffer, at the decode
+// scale. bx and by are in blocks from the top left of the image, and blocks
+// outside the window are dropped (they still had to be huffman decoded)
+static void jpeg_output_block(jpeg *z, int n, int bx, int by, short data[64])
+{
+   int bs = 8 >> z->scale_shift;
+   int x = (bx - z->win_x0 * z->img_comp[n].h) * bs;
+   int y = (by - z->win_y0 * z->img_comp[n].v) * bs;
+   uint8 *out;
+   if (x < 0 || y < 0 || x >= z->img_comp[n].w2 || y >= z->img_comp[n].h2) return;
+   out = z->img_comp[n].data + z->img_comp[n].w2*y + x;
+   if (z->scale_shift == 0) {
+      #ifdef STBI_SIMD
+      stbi_idct_installed(out, z->img_comp[n].w2, data, z->dequant2[z->img_comp[n].tq]);
+      #else
+      z->idct_block_kernel(out, z->img_comp[n].w2, data, z->dequant[z->img_comp[n].tq]);
+      #endif
+   } else {
+      uint8 *dq = z->dequant[z->img_comp[n].tq];
+      if (bs == 4)      idct_block_4x4(out, z->img_comp[n].w2, data, dq);
+      else if (bs == 2) idct_block_2x2(out, z->img_comp[n].w2, data, dq);
+      else              idct_block_1x1(out, data, dq);
+   }
+}
+
 static int parse_entropy_coded_data(jpeg *z)
 {
    reset(z);
@@ -1371,11 +2112,7 @@ static int parse_entropy_coded_data(jpeg *z)
       for (j=0; j < h; ++j) {
          for (i=0; i < w; ++i) {
             if (!decode_block(z, data, z->huff_dc+z->img_comp[n].hd, z->huff_ac+z->img_comp[n].ha, n)) return 0;
-            #ifdef STBI_SIMD
-            stbi_idct_installed(z->img_comp[n].data+z->img_comp[n].w2*j*8+i*8, z->img_comp[n].w2, data, z->dequant2[z->img_comp[n].tq]);
-            #else
-            idct_block(z->img_comp[n].data+z->img_comp[n].w2*j*8+i*8, z->img_comp[n].w2, data, z->dequant[z->img_comp[n].tq]);
-            #endif
+            jpeg_output_block(z, n, i, j, data);
             // every data block is an MCU, so countdown the restart interval
             if (--z->todo <= 0) {
                if (z->code_bits < 24) grow_buffer_unsafe(z);
@@ -1385,6 +2122,11 @@ static int parse_entropy_coded_data(jpeg *z)
                reset(z);
             }
          }
+         // the rest of a lone component isn't needed
+         if (z->scan_n == z->s->img_n && z->win_y1 < z->img_mcu_y && j+1 >= z->win_y1 * z->img_comp[n].v) {
+            z->stopped = 1;
+            return 1;
+         }
       }
    } else { // interleaved!
       int i,j,k,x,y;
@@ -1398,14 +2140,8 @@ static int parse_entropy_coded_data(jpeg *z)
                // by the basic H and V specified for the component
                for (y=0; y < z->img_comp[n].v; ++y) {
                   for (x=0; x < z->img_comp[n].h; ++x) {
-                     int x2 = (i*z->img_comp[n].h + x)*8;
-                     int y2 = (j*z->img_comp[n].v + y)*8;
                      if (!decode_block(z, data, z->huff_dc+z->img_comp[n].hd, z->huff_ac+z->img_comp[n].ha, n)) return 0;
-                     #ifdef STBI_SIMD
-                     stbi_idct_installed(z->img_comp[n].data+z->img_comp[n].w2*y2+x2, z->img_comp[n].w2, data, z->dequant2[z->img_comp[n].tq]);
-                     #else
-                     idct_block(z->img_comp[n].data+z->img_comp[n].w2*y2+x2, z->img_comp[n].w2, data, z->dequant[z->img_comp[n].tq]);
-                     #endif
+                     jpeg_output_block(z, n, i*z->img_comp[n].h + x, j*z->img_comp[n].v + y, data);
                   }
                }
             }
@@ -1419,6 +2155,11 @@ static int parse_entropy_coded_data(jpeg *z)
                reset(z);
             }
          }
+         // a scan of every component can stop after the window's last MCU row
+         if (z->scan_n == z->s->img_n && z->win_y1 < z->img_mcu_y && j+1 >= z->win_y1) {
+            z->stopped = 1;
+            return 1;
+         }
       }
    }
    return 1;
@@ -1480,6 +2221,8 @@ static int process_marker(jpeg *z, int m)
             }
             for (i=0; i < m; ++i)
                v[i] = get8u(z->s);
+            if (tc != 0)
+               build_fast_ac(z->fast_ac[th], z->huff_ac+th);
             L -= m;
          }
          return L==0;
@@ -1564,6 +2307,30 @@ static int process_frame_header(jpeg *z, int scan)
    z->img_mcu_x = (s->img_x + z->img_mcu_w-1) / z->img_mcu_w;
    z->img_mcu_y = (s->img_y + z->img_mcu_h-1) / z->img_mcu_h;
 
+   // the output region in scaled pixels, and the window of MCUs it needs,
+   // with one more MCU on each side so upsampling sees the same neighbours
+   // as it would in a full decode
+   {
+      int sh = z->scale_shift, up = (1 << sh) - 1;
+      int mw = z->img_mcu_w >> sh, mh = z->img_mcu_h >> sh;
+      int x0 = 0, y0 = 0, x1 = s->img_x, y1 = s->img_y;
+      if (z->region[2] != 0) {
+         if (z->region[0] > x0) x0 = z->region[0];
+         if (z->region[1] > y0) y0 = z->region[1];
+         if (z->region[2] < x1) x1 = z->region[2];
+         if (z->region[3] < y1) y1 = z->region[3];
+         if (x0 >= x1 || y0 >= y1) return e("bad region","Region is outside the image");
+      }
+      z->out_x0 = x0 >> sh;
+      z->out_y0 = y0 >> sh;
+      z->out_x1 = (x1 + up) >> sh;
+      z->out_y1 = (y1 + up) >> sh;
+      z->win_x0 = z->out_x0 / mw - 1;              if (z->win_x0 < 0) z->win_x0 = 0;
+      z->win_y0 = z->out_y0 / mh - 1;              if (z->win_y0 < 0) z->win_y0 = 0;
+      z->win_x1 = (z->out_x1 + mw-1) / mw + 1;     if (z->win_x1 > z->img_mcu_x) z->win_x1 = z->img_mcu_x;
+      z->win_y1 = (z->out_y1 + mh-1) / mh + 1;     if (z->win_y1 > z->img_mcu_y) z->win_y1 = z->img_mcu_y;
+   }
+
    for (i=0; i < s->img_n; ++i) {
       // number of effective pixels (e.g. for non-interleaved MCU)
       z->img_comp[i].x = (s->img_x * z->img_comp[i].h + h_max-1) / h_max;
@@ -1571,13 +2338,14 @@ static int process_frame_header(jpeg *z, int scan)
       // to simplify generation, we'll allocate enough memory to decode
       // the bogus oversized data from using interleaved MCUs and their
       // big blocks (e.g. a 16x16 iMCU on an image of width 33); we won't
-      // discard the extra data until colorspace conversion
-      z->img_comp[i].w2 = z->img_mcu_x * z->img_comp[i].h * 8;
-      z->img_comp[i].h2 = z->img_mcu_y * z->img_comp[i].v * 8;
-      z->img_comp[i].raw_data = malloc(z->img_comp[i].w2 * z->img_comp[i].h2+15);
+      // discard the extra data until colorspace conversion. only the window
+      // is kept, at the decode scale
+      z->img_comp[i].w2 = (z->win_x1 - z->win_x0) * z->img_comp[i].h * (8 >> z->scale_shift);
+      z->img_comp[i].h2 = (z->win_y1 - z->win_y0) * z->img_comp[i].v * (8 >> z->scale_shift);
+      z->img_comp[i].raw_data = STBI_MALLOC(z->img_comp[i].w2 * z->img_comp[i].h2+15);
       if (z->img_comp[i].raw_data == NULL) {
          for(--i; i >= 0; --i) {
-            free(z->img_comp[i].raw_data);
+            STBI_FREE(z->img_comp[i].raw_data);
             z->img_comp[i].data = NULL;
          }
          return e("outofmem", "Out of memory");
@@ -1622,12 +2390,14 @@ static int decode_jpeg_image(jpeg *j)
 {
    int m;
    j->restart_interval = 0;
+   j->stopped = 0;
    if (!decode_jpeg_header(j, SCAN_load)) return 0;
    m = get_marker(j);
    while (!EOI(m)) {
       if (SOS(m)) {
          if (!process_scan_header(j)) return 0;
          if (!parse_entropy_coded_data(j)) return 0;
+         if (j->stopped) return 1;
          if (j->marker == MARKER_none ) {
             // handle 0s at the end of image data from IP Kamera 9060
             while (!at_eof(j->s)) {
@@ -1651,9 +2421,6 @@ static int decode_jpeg_image(jpeg *j)
 
 // static jfif-centered resampling (across block boundaries)
 
-typedef uint8 *(*resample_row_func)(uint8 *out, uint8 *in0, uint8 *in1,
-                                    int w, int hs);
-
 #define div4(x) ((uint8) ((x) >> 2))
 
 static uint8 *resample_row_1(uint8 *out, uint8 *in_near, uint8 *in_far, int w, int hs)
@@ -1739,6 +2506,114 @@ static uint8 *resample_row_generic(uint8 *out, uint8 *in_near, uint8 * /*in_far*
    return out;
 }
 
+#ifdef STBI_SSE2
+// SSE2 versions of the resamplers above, eight or sixteen samples at a time.
+// the sums fit in 16 bits, so the results are identical
+
+static uint8 *resample_row_v_2_sse2(uint8 *out, uint8 *in_near, uint8 *in_far, int w, int hs)
+{
+   int i = 0;
+   __m128i zero = _mm_setzero_si128();
+   __m128i two = _mm_set1_epi16(2);
+   for (; i+16 <= w; i += 16) {
+      __m128i n = _mm_loadu_si128((const __m128i *) (in_near + i));
+      __m128i f = _mm_loadu_si128((const __m128i *) (in_far + i));
+      __m128i n_lo = _mm_unpacklo_epi8(n, zero), n_hi = _mm_unpackhi_epi8(n, zero);
+      __m128i lo = _mm_add_epi16(_mm_add_epi16(_mm_slli_epi16(n_lo, 1), n_lo), _mm_unpacklo_epi8(f, zero));
+      __m128i hi = _mm_add_epi16(_mm_add_epi16(_mm_slli_epi16(n_hi, 1), n_hi), _mm_unpackhi_epi8(f, zero));
+      lo = _mm_srli_epi16(_mm_add_epi16(lo, two), 2);
+      hi = _mm_srli_epi16(_mm_add_epi16(hi, two), 2);
+      _mm_storeu_si128((__m128i *) (out + i), _mm_packus_epi16(lo, hi));
+   }
+   for (; i < w; ++i)
+      out[i] = div4(3*in_near[i] + in_far[i] + 2);
+   STBI_NOTUSED(hs);
+   return out;
+}
+
+static uint8 *resample_row_h_2_sse2(uint8 *out, uint8 *in_near, uint8 *in_far, int w, int hs)
+{
+   int i;
+   uint8 *input = in_near;
+   __m128i zero = _mm_setzero_si128();
+   __m128i two = _mm_set1_epi16(2);
+
+   if (w == 1) {
+      out[0] = out[1] = input[0];
+      return out;
+   }
+
+   out[0] = input[0];
+   out[1] = div4(input[0]*3 + input[1] + 2);
+   // input samples i-1..i+8 make the sixteen outputs from out[i*2]
+   for (i=1; i+9 <= w; i += 8) {
+      __m128i prev = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *) (input + i - 1)), zero);
+      __m128i cur  = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *) (input + i)), zero);
+      __m128i next = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *) (input + i + 1)), zero);
+      __m128i n = _mm_add_epi16(_mm_add_epi16(_mm_slli_epi16(cur, 1), cur), two);
+      __m128i even = _mm_srli_epi16(_mm_add_epi16(n, prev), 2);
+      __m128i odd  = _mm_srli_epi16(_mm_add_epi16(n, next), 2);
+      _mm_storeu_si128((__m128i *) (out + i*2),
+                       _mm_packus_epi16(_mm_unpacklo_epi16(even, odd), _mm_unpackhi_epi16(even, odd)));
+   }
+   for (; i < w-1; ++i) {
+      int n = 3*input[i]+2;
+      out[i*2+0] = div4(n+input[i-1]);
+      out[i*2+1] = div4(n+input[i+1]);
+   }
+   out[i*2+0] = div4(input[w-2]*3 + input[w-1] + 2);
+   out[i*2+1] = input[w-1];
+
+   STBI_NOTUSED(in_far);
+   STBI_NOTUSED(hs);
+
+   return out;
+}
+
+static uint8 *resample_row_hv_2_sse2(uint8 *out, uint8 *in_near, uint8 *in_far, int w, int hs)
+{
+   int i,t0,t1;
+   __m128i zero = _mm_setzero_si128();
+   __m128i eight = _mm_set1_epi16(8);
+
+   if (w == 1) {
+      out[0] = out[1] = div4(3*in_near[0] + in_far[0] + 2);
+      return out;
+   }
+
+   t1 = 3*in_near[0] + in_far[0];
+   out[0] = div4(t1+2);
+   // the vertical sums of samples i-1..i+6 and i..i+7 make the sixteen
+   // outputs from out[i*2-1]
+   for (i=1; i+8 <= w; i += 8) {
+      __m128i n0 = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *) (in_near + i - 1)), zero);
+      __m128i f0 = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *) (in_far + i - 1)), zero);
+      __m128i n1 = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *) (in_near + i)), zero);
+      __m128i f1 = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *) (in_far + i)), zero);
+      __m128i prev = _mm_add_epi16(_mm_add_epi16(_mm_slli_epi16(n0, 1), n0), f0);
+      __m128i cur  = _mm_add_epi16(_mm_add_epi16(_mm_slli_epi16(n1, 1), n1), f1);
+      __m128i odd  = _mm_add_epi16(_mm_add_epi16(_mm_slli_epi16(prev, 1), prev), _mm_add_epi16(cur, eight));
+      __m128i even = _mm_add_epi16(_mm_add_epi16(_mm_slli_epi16(cur, 1), cur), _mm_add_epi16(prev, eight));
+      odd  = _mm_srli_epi16(odd, 4);
+      even = _mm_srli_epi16(even, 4);
+      _mm_storeu_si128((__m128i *) (out + i*2 - 1),
+                       _mm_packus_epi16(_mm_unpacklo_epi16(odd, even), _mm_unpackhi_epi16(odd, even)));
+   }
+   t1 = 3*in_near[i-1] + in_far[i-1];
+   for (; i < w; ++i) {
+      t0 = t1;
+      t1 = 3*in_near[i]+in_far[i];
+      out[i*2-1] = div16(3*t0 + t1 + 8);
+      out[i*2  ] = div16(3*t1 + t0 + 8);
+   }
+   out[w*2-1] = div4(t1+2);
+
+   STBI_NOTUSED(hs);
+
+   return out;
+}
+#endif // STBI_SSE2
+
 #define float2fixed(x)  ((int) ((x) * 65536 + 0.5))
 
 // 0.38 seconds on 3*anemones.jpg   (0.25 with processor = Pro)
@@ -1777,6 +2652,124 @@ void stbi_install_YCbCr_to_RGB(stbi_YCbCr_to_RGB_run func)
 }
 #endif
 
+#ifdef STBI_SSE2
+// splits a 16.16 constant into a multiple of 65536 and a signed 16-bit remainder
+static void stbi_split_fixed(int c, int *hi, int *lo)
+{
+   *hi = (c + 32768) >> 16;
+   *lo = c - *hi * 65536;
+}
+
+// YCbCr_to_RGB_row, eight pixels at a time. each product c*x is computed as
+// (hi*x << 16) + lo*x with 16-bit multiplies, which is exactly c*x because
+// nothing overflows, so the results are identical
+static void YCbCr_to_RGB_row_sse2(uint8 *out, const uint8 *y, const uint8 *pcb, const uint8 *pcr, int count, int step)
+{
+   int i = 0;
+   int r_hi,r_lo,gr_hi,gr_lo,gb_hi,gb_lo,b_hi,b_lo;
+   __m128i zero = _mm_setzero_si128();
+   __m128i bias = _mm_set1_epi16(128);
+   __m128i round = _mm_set1_epi32(32768);
+   __m128i alpha = _mm_set1_epi16(255);
+   __m128i k_r_hi, k_r_lo, k_g_hi, k_g_lo, k_b_hi, k_b_lo;
+
+   stbi_split_fixed( float2fixed(1.40200f), &r_hi, &r_lo);
+   stbi_split_fixed(-float2fixed(0.71414f), &gr_hi, &gr_lo);
+   stbi_split_fixed(-float2fixed(0.34414f), &gb_hi, &gb_lo);
+   stbi_split_fixed( float2fixed(1.77200f), &b_hi, &b_lo);
+   k_r_hi = stbi_pair_epi16(r_hi, 0);
+   k_r_lo = stbi_pair_epi16(r_lo, 0);
+   k_g_hi = stbi_pair_epi16(gr_hi, gb_hi);
+   k_g_lo = stbi_pair_epi16(gr_lo, gb_lo);
+   k_b_hi = stbi_pair_epi16(0, b_hi);
+   k_b_lo = stbi_pair_epi16(0, b_lo);
+
+   #define STBI_YCC_CHANNEL(y32, c, k_hi, k_lo)                                   \
+      _mm_srai_epi32(_mm_add_epi32(                                               \
+         _mm_slli_epi32(_mm_add_epi32(y32, _mm_madd_epi16(c, k_hi)), 16),         \
+         _mm_add_epi32(_mm_madd_epi16(c, k_lo), round)), 16)
+
+   for (; i+8 <= count; i += 8) {
+      __m128i y16 = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *) (y + i)), zero);
+      __m128i cb = _mm_sub_epi16(_mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *) (pcb + i)), zero), bias);
+      __m128i cr = _mm_sub_epi16(_mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *) (pcr + i)), zero), bias);
+      __m128i c_lo = _mm_unpacklo_epi16(cr, cb), c_hi = _mm_unpackhi_epi16(cr, cb);
+      __m128i y_lo = _mm_unpacklo_epi16(y16, zero), y_hi = _mm_unpackhi_epi16(y16, zero);
+      __m128i r = _mm_packs_epi32(STBI_YCC_CHANNEL(y_lo, c_lo, k_r_hi, k_r_lo), STBI_YCC_CHANNEL(y_hi, c_hi, k_r_hi, k_r_lo));
+      __m128i g = _mm_packs_epi32(STBI_YCC_CHANNEL(y_lo, c_lo, k_g_hi, k_g_lo), STBI_YCC_CHANNEL(y_hi, c_hi, k_g_hi, k_g_lo));
+      __m128i b = _mm_packs_epi32(STBI_YCC_CHANNEL(y_lo, c_lo, k_b_hi, k_b_lo), STBI_YCC_CHANNEL(y_hi, c_hi, k_b_hi, k_b_lo));
+      // saturate to 0..255 like the scalar clamps, then interleave into RGBA
+      __m128i rg = _mm_packus_epi16(r, g);
+      __m128i ba = _mm_packus_epi16(b, alpha);
+      __m128i rgrg = _mm_unpacklo_epi8(rg, _mm_srli_si128(rg, 8));
+      __m128i baba = _mm_unpacklo_epi8(ba, _mm_srli_si128(ba, 8));
+      __m128i px[2];
+      px[0] = _mm_unpacklo_epi16(rgrg, baba);
+      px[1] = _mm_unpackhi_epi16(rgrg, baba);
+      if (step == 4) {
+         _mm_storeu_si128((__m128i *) out, px[0]);
+         _mm_storeu_si128((__m128i *) (out + 16), px[1]);
+         out += 32;
+      } else {
+         // like the scalar version, each pixel writes a 4th byte that the next
+         // one overwrites (the output buffer has a spare byte for the last)
+         int j;
+         for (j=0; j < 2; ++j) {
+            uint32 p;
+            p = (uint32) _mm_cvtsi128_si32(px[j]);                        memcpy(out,     &p, 4);
+            p = (uint32) _mm_cvtsi128_si32(_mm_srli_si128(px[j], 4));     memcpy(out + 3, &p, 4);
+            p = (uint32) _mm_cvtsi128_si32(_mm_srli_si128(px[j], 8));     memcpy(out + 6, &p, 4);
+            p = (uint32) _mm_cvtsi128_si32(_mm_srli_si128(px[j], 12));    memcpy(out + 9, &p, 4);
+            out += 12;
+         }
+      }
+   }
+   #undef STBI_YCC_CHANNEL
+
+   YCbCr_to_RGB_row(out, y + i, pcb + i, pcr + i, count - i, step);
+}
+#endif // STBI_SSE2
+
+#ifdef STBI_AVX2
+static int stbi_cpu_has_avx2(void)
+{
+#ifdef _MSC_VER
+   int info[4];
+   __cpuid(info, 0);
+   if (info[0] < 7) return 0;
+   // the OS has to save the AVX registers too: OSXSAVE, AVX, and XCR0 bits 1 and 2
+   __cpuid(info, 1);
+   if ((info[2] & 0x18000000) != 0x18000000 || (_xgetbv(0) & 6) != 6) return 0;
+   __cpuidex(info, 7, 0);
+   return (info[1] & 0x20) != 0;
+#else
+   __builtin_cpu_init();
+   return __builtin_cpu_supports("avx2");
+#endif
+}
+#endif
+
+// picks the fastest kernels this machine can run
+static void jpeg_setup_kernels(jpeg *j)
+{
+   j->idct_block_kernel = idct_block;
+   j->YCbCr_to_RGB_kernel = YCbCr_to_RGB_row;
+   j->resample_row_v_2_kernel = resample_row_v_2;
+   j->resample_row_h_2_kernel = resample_row_h_2;
+   j->resample_row_hv_2_kernel = resample_row_hv_2;
+#ifdef STBI_SSE2
+   j->idct_block_kernel = idct_block_sse2;
+   j->YCbCr_to_RGB_kernel = YCbCr_to_RGB_row_sse2;
+   j->resample_row_v_2_kernel = resample_row_v_2_sse2;
+   j->resample_row_h_2_kernel = resample_row_h_2_sse2;
+   j->resample_row_hv_2_kernel = resample_row_hv_2_sse2;
+#endif
+#ifdef STBI_AVX2
+   if (stbi_cpu_has_avx2())
+      j->idct_block_kernel = idct_block_avx2;
+#endif
+}
+
 
 // clean up the temporary component buffers
 static void cleanup_jpeg(jpeg *j)
@@ -1784,11 +2777,11 @@ static void cleanup_jpeg(jpeg *j)
    int i;
    for (i=0; i < j->s->img_n; ++i) {
       if (j->img_comp[i].data) {
-         free(j->img_comp[i].raw_data);
+         STBI_FREE(j->img_comp[i].raw_data);
          j->img_comp[i].data = NULL;
       }
       if (j->img_comp[i].linebuf) {
-         free(j->img_comp[i].linebuf);
+         STBI_FREE(j->img_comp[i].linebuf);
          j->img_comp[i].linebuf = NULL;
       }
    }
@@ -1800,6 +2793,7 @@ typedef struct
    uint8 *line0,*line1;
    int hs,vs;   // expansion factor in each axis
    int w_lores; // horizontal pixels pre-expansion 
+   int h_lores; // rows pre-expansion
    int ystep;   // how far through vertical expansion we are
    int ypos;    // which pre-expansion row we're on
 } stbi_resample;
@@ -1828,38 +2822,57 @@ static uint8 *load_jpeg_image(jpeg *z, int *out_x, int *out_y, int *comp, int re
       uint i,j;
       uint8 *output;
       uint8 *coutput[4];
+      // the decoded window in scaled pixels, clipped to the image, and the
+      // output region within it
+      int sh      = z->scale_shift;
+      int sx      = (int) ((z->s->img_x + (1 << sh)-1) >> sh);
+      int sy      = (int) ((z->s->img_y + (1 << sh)-1) >> sh);
+      int rx0     = z->win_x0 * (z->img_mcu_w >> sh);
+      int ry0     = z->win_y0 * (z->img_mcu_h >> sh);
+      uint rw     = (uint) (stbi_min(z->win_x1 * (z->img_mcu_w >> sh), sx) - rx0);
+      uint rh     = (uint) (stbi_min(z->win_y1 * (z->img_mcu_h >> sh), sy) - ry0);
+      uint ow     = (uint) (z->out_x1 - z->out_x0);
+      uint oh     = (uint) (z->out_y1 - z->out_y0);
+      int ox      = z->out_x0 - rx0;
 
       stbi_resample res_comp[4];
 
       for (k=0; k < decode_n; ++k) {
          stbi_resample *r = &res_comp[k];
+         int rows;
 
          // allocate line buffer big enough for upsampling off the edges
          // with upsample factor of 4
-         z->img_comp[k].linebuf = (uint8 *) malloc(z->s->img_x + 3);
+         z->img_comp[k].linebuf = (uint8 *) STBI_MALLOC(rw + 3);
          if (!z->img_comp[k].linebuf) { cleanup_jpeg(z); return epuc("outofmem", "Out of memory"); }
 
          r->hs      = z->img_h_max / z->img_comp[k].h;
          r->vs      = z->img_v_max / z->img_comp[k].v;
          r->ystep   = r->vs >> 1;
-         r->w_lores = (z->s->img_x + r->hs-1) / r->hs;
+         r->w_lores = (rw + r->hs-1) / r->hs;
+         // rows of this component that are real image, not MCU padding
+         rows       = ((z->img_comp[k].y + (1 << sh)-1) >> sh) - z->win_y0 * z->img_comp[k].v * (8 >> sh);
+         r->h_lores = stbi_min(rows, z->img_comp[k].h2);
          r->ypos    = 0;
          r->line0   = r->line1 = z->img_comp[k].data;
 
          if      (r->hs == 1 && r->vs == 1) r->resample = resample_row_1;
-         else if (r->hs == 1 && r->vs == 2) r->resample = resample_row_v_2;
-         else if (r->hs == 2 && r->vs == 1) r->resample = resample_row_h_2;
-         else if (r->hs == 2 && r->vs == 2) r->resample = resample_row_hv_2;
+         else if (r->hs == 1 && r->vs == 2) r->resample = z->resample_row_v_2_kernel;
+         else if (r->hs == 2 && r->vs == 1) r->resample = z->resample_row_h_2_kernel;
+         else if (r->hs == 2 && r->vs == 2) r->resample = z->resample_row_hv_2_kernel;
          else                               r->resample = resample_row_generic;
       }
 
       // can't error after this so, this is safe
-      output = (uint8 *) malloc(n * z->s->img_x * z->s->img_y + 1);
+      output = (uint8 *) STBI_MALLOC(n * ow * oh + 1);
       if (!output) { cleanup_jpeg(z); return epuc("outofmem", "Out of memory"); }
 
-      // now go ahead and resample
-      for (j=0; j < z->s->img_y; ++j) {
-         uint8 *out = output + n * z->s->img_x * j;
+      // now go ahead and resample. rows above the output region still have
+      // to go through the resamplers to keep their state right
+      for (j=0; j < rh; ++j) {
+         int row = ry0 + (int) j;
+         uint8 *out = output + n * ow * (row - z->out_y0);
+         if (row >= z->out_y1) break;
          for (k=0; k < decode_n; ++k) {
             stbi_resample *r = &res_comp[k];
             int y_bot = r->ystep >= (r->vs >> 1);
@@ -1870,47 +2883,61 @@ static uint8 *load_jpeg_image(jpeg *z, int *out_x, int *out_y, int *comp, int re
             if (++r->ystep >= r->vs) {
                r->ystep = 0;
                r->line0 = r->line1;
-               if (++r->ypos < z->img_comp[k].y)
+               if (++r->ypos < r->h_lores)
                   r->line1 += z->img_comp[k].w2;
             }
          }
+         if (row < z->out_y0) continue;
          if (n >= 3) {
-            uint8 *y = coutput[0];
+            uint8 *y = coutput[0] + ox;
             if (z->s->img_n == 3) {
                #ifdef STBI_SIMD
-               stbi_YCbCr_installed(out, y, coutput[1], coutput[2], z->s.img_x, n);
+               stbi_YCbCr_installed(out, y, coutput[1] + ox, coutput[2] + ox, ow, n);
                #else
-               YCbCr_to_RGB_row(out, y, coutput[1], coutput[2], z->s->img_x, n);
+               z->YCbCr_to_RGB_kernel(out, y, coutput[1] + ox, coutput[2] + ox, ow, n);
                #endif
             } else
-               for (i=0; i < z->s->img_x; ++i) {
+               for (i=0; i < ow; ++i) {
                   out[0] = out[1] = out[2] = y[i];
                   out[3] = 255; // not used if n==3
                   out += n;
                }
          } else {
-            uint8 *y = coutput[0];
+            uint8 *y = coutput[0] + ox;
             if (n == 1)
-               for (i=0; i < z->s->img_x; ++i) out[i] = y[i];
+               for (i=0; i < ow; ++i) out[i] = y[i];
             else
-               for (i=0; i < z->s->img_x; ++i) *out++ = y[i], *out++ = 255;
+               for (i=0; i < ow; ++i) *out++ = y[i], *out++ = 255;
          }
       }
       cleanup_jpeg(z);
-      *out_x = z->s->img_x;
-      *out_y = z->s->img_y;
+      *out_x = ow;
+      *out_y = oh;
       if (comp) *comp  = z->s->img_n; // report original components, not output
       return output;
    }
 }
 
-static unsigned char *stbi_jpeg_load(stbi *s, int *x, int *y, int *comp, int req_comp)
+static unsigned char *stbi_jpeg_load_reduced(stbi *s, int *x, int *y, int *comp, int req_comp, int scale_shift, int const *region)
 {
    jpeg j;
    j.s = s;
+   jpeg_setup_kernels(&j);
+   // a scan using an AC table that was never defined just goes the slow way
+   memset(j.fast_ac, 0, sizeof(j.fast_ac));
+   j.scale_shift = scale_shift;
+   if (region)
+      memcpy(j.region, region, sizeof(j.region));
+   else
+      memset(j.region, 0, sizeof(j.region));
    return load_jpeg_image(&j, x,y,comp,req_comp);
 }
 
+static unsigned char *stbi_jpeg_load(stbi *s, int *x, int *y, int *comp, int req_comp)
+{
+   return stbi_jpeg_load_reduced(s, x,y,comp,req_comp, 0, NULL);
+}
+
 static int stbi_jpeg_test(stbi *s)
 {
    int r;
@@ -1921,6 +2948,24 @@ static int stbi_jpeg_test(stbi *s)
    return r;
 }
 
+int stbi_jpeg_test_memory(stbi_uc const *buffer, int len)
+{
+   stbi s;
+   start_mem(&s,buffer,len);
+   return stbi_jpeg_test(&s);
+}
+
+stbi_uc *stbi_jpeg_load_scaled_from_memory(stbi_uc const *buffer, int len, int *x, int *y, int *comp, int req_comp, int scale_shift, int const *region)
+{
+   stbi s;
+   if (scale_shift < 0 || scale_shift > 3) return epuc("bad scale_shift", "Internal error");
+   if (region && region[2] != 0 && (region[2] <= region[0] || region[3] <= region[1]))
+      return epuc("bad region", "Region is outside the image");
+   start_mem(&s,buffer,len);
+   if (!stbi_jpeg_test(&s)) return epuc("not JPEG", "Image is not a JPEG");
+   return stbi_jpeg_load_reduced(&s, x,y,comp,req_comp, scale_shift, region);
+}
+
 static int stbi_jpeg_info_raw(jpeg *j, int *x, int *y, int *comp)
 {
    if (!decode_jpeg_header(j, SCAN_header)) {
@@ -1945,17 +2990,28 @@ static int stbi_jpeg_info(stbi *s, int *x, int *y, int *comp)
 //      - all input must be provided in an upfront buffer
 //      - all output is written to a single output buffer (can malloc/realloc)
 //    performance
-//      - fast huffman
+//      - fast huffman, which can decode two literals at once
+//      - 64-bit bit buffer, refilled 8 bytes at a time
+//      - matches copied 8 or 16 bytes at a time when they don't overlap that much
 
 // fast-way is faster to check than jpeg huffman, but slow way is slower
-#define ZFAST_BITS  9 // accelerate all cases in default tables
+#define ZFAST_BITS  10 // accelerate all cases in default tables
 #define ZFAST_MASK  ((1 << ZFAST_BITS) - 1)
 
+// a fast table entry is the symbol in bits 0-8 and its code length in bits
+// 9-12, or 0 if the code is longer than ZFAST_BITS. in the literal/length
+// table, when the bits after a literal hold another whole literal, that is in
+// bits 16-23 with the total length of both codes in bits 24-28
+#define ZFAST_SYMBOL(f)       ((f) & 511)
+#define ZFAST_LENGTH(f)       (((f) >> 9) & 15)
+#define ZFAST_SECOND(f)       (((f) >> 16) & 255)
+#define ZFAST_PAIR_LENGTH(f)  ((f) >> 24)
+
 // zlib-style huffman encoding
 // (jpegs packs from left, zlib from right, so can't share code)
 typedef struct
 {
-   uint16 fast[1 << ZFAST_BITS];
+   uint32 fast[1 << ZFAST_BITS];
    uint16 firstcode[16];
    int maxcode[17];
    uint16 firstsymbol[16];
@@ -1987,7 +3043,7 @@ static int zbuild_huffman(zhuffman *z, uint8 *sizelist, int num)
 
    // DEFLATE spec for generating codes
    memset(sizes, 0, sizeof(sizes));
-   memset(z->fast, 255, sizeof(z->fast));
+   memset(z->fast, 0, sizeof(z->fast));
    for (i=0; i < num; ++i) 
       ++sizes[sizelist[i]];
    sizes[0] = 0;
@@ -2015,7 +3071,7 @@ static int zbuild_huffman(zhuffman *z, uint8 *sizelist, int num)
          if (s <= ZFAST_BITS) {
             int k = bit_reverse(next_code[s],s);
             while (k < (1 << ZFAST_BITS)) {
-               z->fast[k] = (uint16) c;
+               z->fast[k] = (uint32) ((s << 9) | i);
                k += (1 << s);
             }
          }
@@ -2025,66 +3081,117 @@ static int zbuild_huffman(zhuffman *z, uint8 *sizelist, int num)
    return 1;
 }
 
+// lets the literal/length table decode two literals with one lookup, when
+// both their codes fit in ZFAST_BITS
+static void zbuild_pairs(zhuffman *z)
+{
+   int i;
+   for (i=0; i < (1 << ZFAST_BITS); ++i) {
+      uint32 first = z->fast[i];
+      int len = ZFAST_LENGTH(first);
+      if (first && ZFAST_SYMBOL(first) < 256 && len < ZFAST_BITS) {
+         // the bits after the first code are a complete index if the second
+         // code fits in them. entries below i may already be pairs, but only
+         // their first symbol is used
+         uint32 second = z->fast[i >> len];
+         int len2 = ZFAST_LENGTH(second);
+         if (second && ZFAST_SYMBOL(second) < 256 && len + len2 <= ZFAST_BITS)
+            z->fast[i] = first | (ZFAST_SYMBOL(second) << 16) | ((uint32) (len + len2) << 24);
+      }
+   }
+}
+
 // zlib-from-memory implementation for PNG reading
 //    because PNG allows splitting the zlib stream arbitrarily,
 //    and it's annoying structurally to have PNG call ZLIB call PNG,
 //    we require PNG read all the IDATs and combine them into a single
 //    memory buffer
 
-typedef struct
+typedef struct zbuf
 {
    uint8 *zbuffer, *zbuffer_end;
    int num_bits;
-   uint32 code_buffer;
+   uint64 code_buffer; // bits above num_bits are the start of the next byte of zbuffer
+   int end_bits;       // zero bits at the top of code_buffer that come from past the end
 
    char *zout;
    char *zout_start;
    char *zout_end;
    int   z_expandable;
 
+   // streaming only (NULL otherwise): refill points zbuffer at more input,
+   // and flush makes room for n more bytes of output instead of expanding
+   int (*refill)(struct zbuf *z);
+   int (*flush)(struct zbuf *z, int n);
+   void *stream;
+
    zhuffman z_length, z_distance;
 } zbuf;
 
 stbi_inline static int zget8(zbuf *z)
 {
-   if (z->zbuffer >= z->zbuffer_end) return 0;
+   if (z->zbuffer >= z->zbuffer_end)
+      if (!z->refill || !z->refill(z)) return 0;
    return *z->zbuffer++;
 }
 
-static void fill_bits(zbuf *z)
+stbi_inline static uint64 zload64(uint8 const *p)
 {
+   // compilers turn this into a single load on little-endian machines
+   return (uint64) p[0]         | ((uint64) p[1] <<  8) | ((uint64) p[2] << 16) | ((uint64) p[3] << 24) |
+         ((uint64) p[4] << 32) | ((uint64) p[5] << 40) | ((uint64) p[6] << 48) | ((uint64) p[7] << 56);
+}
+
+// true if the decoder has used bits from past the end of the input
+#define ZPAST_END(z)  ((z)->num_bits < (z)->end_bits)
+
+// near the end of the input, and when streaming needs the next IDAT. past the
+// end it reads zeros, which are fine as lookahead but mean the stream is
+// corrupt if they get used, so it returns 0 if any have been
+static int fill_bits_slow(zbuf *z)
+{
+   int ok = !ZPAST_END(z);
    do {
-      assert(z->code_buffer < (1U << z->num_bits));
-      z->code_buffer |= zget8(z) << z->num_bits;
+      if (z->zbuffer < z->zbuffer_end || (z->refill && z->refill(z)))
+         z->code_buffer |= (uint64) *z->zbuffer++ << z->num_bits;
+      else
+         z->end_bits += 8;
       z->num_bits += 8;
-   } while (z->num_bits <= 24);
+   } while (z->num_bits <= 56);
+   return ok;
+}
+
+// tops the bit buffer up to at least 56 bits
+stbi_inline static int fill_bits(zbuf *z)
+{
+   if (z->zbuffer_end - z->zbuffer >= 8) {
+      // take as many whole bytes as fit. the top bits of the load are the
+      // start of the next byte, which is what the next refill ors in there
+      z->code_buffer |= zload64(z->zbuffer) << z->num_bits;
+      z->zbuffer += (63 - z->num_bits) >> 3;
+      z->num_bits |= 56;
+      return 1;
+   }
+   return fill_bits_slow(z);
 }
 
 stbi_inline static unsigned int zreceive(zbuf *z, int n)
 {
    unsigned int k;
    if (z->num_bits < n) fill_bits(z);
-   k = z->code_buffer & ((1 << n) - 1);
+   k = (unsigned int) z->code_buffer & ((1 << n) - 1);
    z->code_buffer >>= n;
    z->num_bits -= n;
    return k;   
 }
 
-stbi_inline static int zhuffman_decode(zbuf *a, zhuffman *z)
+// decodes a code longer than ZFAST_BITS, or an invalid one. needs 16 bits in the buffer
+static int zhuffman_decode_slow(zbuf *a, zhuffman *z)
 {
    int b,s,k;
-   if (a->num_bits < 16) fill_bits(a);
-   b = z->fast[a->code_buffer & ZFAST_MASK];
-   if (b < 0xffff) {
-      s = z->size[b];
-      a->code_buffer >>= s;
-      a->num_bits -= s;
-      return z->value[b];
-   }
 
-   // not resolved by fast table, so compute it the slow way
    // use jpeg approach, which requires MSbits at top
-   k = bit_reverse(a->code_buffer, 16);
+   k = bit_reverse((int) (a->code_buffer & 0xffff), 16);
    for (s=ZFAST_BITS+1; ; ++s)
       if (k < z->maxcode[s])
          break;
@@ -2097,16 +3204,32 @@ stbi_inline static int zhuffman_decode(zbuf *a, zhuffman *z)
    return z->value[b];
 }
 
+stbi_inline static int zhuffman_decode(zbuf *a, zhuffman *z)
+{
+   uint32 f;
+   if (a->num_bits < 16) fill_bits(a);
+   f = z->fast[a->code_buffer & ZFAST_MASK];
+   if (f) {
+      int s = ZFAST_LENGTH(f);
+      a->code_buffer >>= s;
+      a->num_bits -= s;
+      return ZFAST_SYMBOL(f);
+   }
+   // not resolved by fast table, so compute it the slow way
+   return zhuffman_decode_slow(a, z);
+}
+
 static int expand(zbuf *z, int n)  // need to make room for n bytes
 {
    char *q;
    int cur, limit;
+   if (z->flush) return z->flush(z, n);
    if (!z->z_expandable) return e("output buffer limit","Corrupt PNG");
    cur   = (int) (z->zout     - z->zout_start);
    limit = (int) (z->zout_end - z->zout_start);
    while (cur + n > limit)
       limit *= 2;
-   q = (char *) realloc(z->zout_start, limit);
+   q = (char *) STBI_REALLOC(z->zout_start, limit);
    if (q == NULL) return e("outofmem", "Out of memory");
    z->zout_start = q;
    z->zout       = q + cur;
@@ -2128,30 +3251,109 @@ static int dist_base[32] = { 1,2,3,4,5,7,9,13,17,25,33,49,65,97,129,193,
 static int dist_extra[32] =
 { 0,0,0,0,1,1,2,2,3,3,4,4,5,5,6,6,7,7,8,8,9,9,10,10,11,11,12,12,13,13};
 
+// consumes n bits that are known to be in the buffer
+#define ZCONSUME(a,n)   ((a)->code_buffer >>= (n), (a)->num_bits -= (n))
+#define ZPEEK(a,n)      ((int) ((a)->code_buffer & ((1 << (n)) - 1)))
+
 static int parse_huffman_block(zbuf *a)
 {
+   // the output pointer is kept in a local, and written back around expand
+   char *zout = a->zout;
    for(;;) {
-      int z = zhuffman_decode(a, &a->z_length);
+      uint32 f;
+      int z;
+      // one refill covers the longest length code, distance code and extra bits.
+      // it also stops a corrupt stream that runs on past the end of the input
+      if (a->num_bits < 48)
+         if (!fill_bits(a)) return e("unexpected end","Corrupt PNG");
+      f = a->z_length.fast[a->code_buffer & ZFAST_MASK];
+      if (ZFAST_PAIR_LENGTH(f)) {
+         if (a->zout_end - zout < 2) {
+            a->zout = zout;
+            if (!expand(a, 2)) return 0;
+            zout = a->zout;
+         }
+         zout[0] = (char) ZFAST_SYMBOL(f);
+         zout[1] = (char) ZFAST_SECOND(f);
+         zout += 2;
+         ZCONSUME(a, ZFAST_PAIR_LENGTH(f));
+         continue;
+      }
+      if (f) {
+         z = ZFAST_SYMBOL(f);
+         ZCONSUME(a, ZFAST_LENGTH(f));
+      } else {
+         z = zhuffman_decode_slow(a, &a->z_length);
+      }
       if (z < 256) {
          if (z < 0) return e("bad huffman code","Corrupt PNG"); // error in huffman codes
-         if (a->zout >= a->zout_end) if (!expand(a, 1)) return 0;
-         *a->zout++ = (char) z;
+         if (zout >= a->zout_end) {
+            a->zout = zout;
+            if (!expand(a, 1)) return 0;
+            zout = a->zout;
+         }
+         *zout++ = (char) z;
       } else {
          uint8 *p;
          int len,dist;
-         if (z == 256) return 1;
+         if (z == 256) {
+            a->zout = zout;
+            if (ZPAST_END(a)) return e("unexpected end","Corrupt PNG");
+            return 1;
+         }
          z -= 257;
+         if (z >= 29) return e("bad huffman code","Corrupt PNG"); // 286 and 287 are unused
          len = length_base[z];
-         if (length_extra[z]) len += zreceive(a, length_extra[z]);
-         z = zhuffman_decode(a, &a->z_distance);
-         if (z < 0) return e("bad huffman code","Corrupt PNG");
+         if (length_extra[z]) {
+            len += ZPEEK(a, length_extra[z]);
+            ZCONSUME(a, length_extra[z]);
+         }
+         f = a->z_distance.fast[a->code_buffer & ZFAST_MASK];
+         if (f) {
+            z = ZFAST_SYMBOL(f);
+            ZCONSUME(a, ZFAST_LENGTH(f));
+         } else {
+            z = zhuffman_decode_slow(a, &a->z_distance);
+         }
+         if (z < 0 || z >= 30) return e("bad huffman code","Corrupt PNG"); // 30 and 31 are unused
          dist = dist_base[z];
-         if (dist_extra[z]) dist += zreceive(a, dist_extra[z]);
-         if (a->zout - a->zout_start < dist) return e("bad dist","Corrupt PNG");
-         if (a->zout + len > a->zout_end) if (!expand(a, len)) return 0;
-         p = (uint8 *) (a->zout - dist);
-         while (len--)
-            *a->zout++ = *p++;
+         if (dist_extra[z]) {
+            dist += ZPEEK(a, dist_extra[z]);
+            ZCONSUME(a, dist_extra[z]);
+         }
+         if (zout - a->zout_start < dist) return e("bad dist","Corrupt PNG");
+         if (zout + len > a->zout_end) {
+            a->zout = zout;
+            if (!expand(a, len)) return 0;
+            zout = a->zout;
+         }
+         p = (uint8 *) (zout - dist);
+         // whole chunks can be copied when each one only reads bytes that are
+         // already written. they may write up to 15 bytes past the match, so
+         // there has to be room for that
+         if (dist >= 16 && a->zout_end - zout >= len + 16) {
+            char *end = zout + len;
+            do {
+               memcpy(zout, p, 16);
+               zout += 16;
+               p += 16;
+            } while (zout < end);
+            zout = end;
+         } else if (dist >= 8 && a->zout_end - zout >= len + 8) {
+            char *end = zout + len;
+            do {
+               memcpy(zout, p, 8);
+               zout += 8;
+               p += 8;
+            } while (zout < end);
+            zout = end;
+         } else if (dist == 1) {
+            memset(zout, *p, len);
+            zout += len;
+         } else {
+            while (len--)
+               *zout++ = *p++;
+         }
       }
    }
 }
@@ -2178,10 +3380,11 @@ static int compute_huffman_codes(zbuf *a)
    n = 0;
    while (n < hlit + hdist) {
       int c = zhuffman_decode(a, &z_codelength);
-      assert(c >= 0 && c < 19);
+      if (c < 0 || c >= 19) return e("bad codelengths","Corrupt PNG");
       if (c < 16)
          lencodes[n++] = (uint8) c;
       else if (c == 16) {
+         if (n == 0) return e("bad codelengths","Corrupt PNG"); // nothing to repeat
          c = zreceive(a,2)+3;
          memset(lencodes+n, lencodes[n-1], c);
          n += c;
@@ -2190,7 +3393,6 @@ static int compute_huffman_codes(zbuf *a)
          memset(lencodes+n, 0, c);
          n += c;
       } else {
-         assert(c == 18);
          c = zreceive(a,7)+11;
          memset(lencodes+n, 0, c);
          n += c;
@@ -2199,6 +3401,7 @@ static int compute_huffman_codes(zbuf *a)
    if (n != hlit+hdist) return e("bad codelengths","Corrupt PNG");
    if (!zbuild_huffman(&a->z_length, lencodes, hlit)) return 0;
    if (!zbuild_huffman(&a->z_distance, lencodes+hlit, hdist)) return 0;
+   zbuild_pairs(&a->z_length);
    return 1;
 }
 
@@ -2210,24 +3413,42 @@ static int parse_uncompressed_block(zbuf *a)
       zreceive(a, a->num_bits & 7); // discard
    // drain the bit-packed data into header
    k = 0;
-   while (a->num_bits > 0) {
+   while (a->num_bits > 0 && k < 4) {
       header[k++] = (uint8) (a->code_buffer & 255); // wtf this warns?
       a->code_buffer >>= 8;
       a->num_bits -= 8;
    }
-   assert(a->num_bits == 0);
    // now fill header the normal way
    while (k < 4)
       header[k++] = (uint8) zget8(a);
    len  = header[1] * 256 + header[0];
    nlen = header[3] * 256 + header[2];
    if (nlen != (len ^ 0xffff)) return e("zlib corrupt","Corrupt PNG");
-   if (a->zbuffer + len > a->zbuffer_end) return e("read past buffer","Corrupt PNG");
-   if (a->zout + len > a->zout_end)
-      if (!expand(a, len)) return 0;
-   memcpy(a->zout, a->zbuffer, len);
-   a->zbuffer += len;
-   a->zout += len;
+   // the bit buffer can hold the first few bytes of the block too
+   while (a->num_bits > 0 && len > 0) {
+      if (a->zout >= a->zout_end) if (!expand(a, 1)) return 0;
+      *a->zout++ = (char) (a->code_buffer & 255);
+      a->code_buffer >>= 8;
+      a->num_bits -= 8;
+      --len;
+   }
+   if (ZPAST_END(a)) return e("unexpected end","Corrupt PNG");
+   // the rest is read straight from zbuffer, so the bits of it in the buffer are stale
+   if (a->num_bits == 0) a->code_buffer = 0;
+   // copied a piece at a time, because a streamed block can span several IDATs
+   while (len > 0) {
+      int n;
+      if (a->zbuffer >= a->zbuffer_end)
+         if (!a->refill || !a->refill(a)) return e("read past buffer","Corrupt PNG");
+      n = (int) (a->zbuffer_end - a->zbuffer);
+      if (n > len) n = len;
+      if (a->zout + n > a->zout_end)
+         if (!expand(a, n)) return 0;
+      memcpy(a->zout, a->zbuffer, n);
+      a->zbuffer += n;
+      a->zout += n;
+      len -= n;
+   }
    return 1;
 }
 
@@ -2244,9 +3465,8 @@ static int parse_zlib_header(zbuf *a)
    return 1;
 }
 
-// @TODO: should statically initialize these for optimal thread safety
-static uint8 default_length[288], default_distance[32];
-static void init_defaults(void)
+// filled in on the stack by each caller, so concurrent decodes don't race on shared tables
+static void init_defaults(uint8 *default_length, uint8 *default_distance)
 {
    int i;   // use <= to match clearly with spec
    for (i=0; i <= 143; ++i)     default_length[i]   = 8;
@@ -2265,6 +3485,7 @@ static int parse_zlib(zbuf *a, int parse_header)
       if (!parse_zlib_header(a)) return 0;
    a->num_bits = 0;
    a->code_buffer = 0;
+   a->end_bits = 0;
    do {
       final = zreceive(a,1);
       type = zreceive(a,2);
@@ -2275,9 +3496,11 @@ static int parse_zlib(zbuf *a, int parse_header)
       } else {
          if (type == 1) {
             // use fixed code lengths
-            if (!default_distance[31]) init_defaults();
+            uint8 default_length[288], default_distance[32];
+            init_defaults(default_length, default_distance);
             if (!zbuild_huffman(&a->z_length  , default_length  , 288)) return 0;
             if (!zbuild_huffman(&a->z_distance, default_distance,  32)) return 0;
+            zbuild_pairs(&a->z_length);
          } else {
             if (!compute_huffman_codes(a)) return 0;
          }
@@ -2295,6 +3518,8 @@ static int do_zlib(zbuf *a, char *obuf, int olen, int exp, int parse_header)
    a->zout       = obuf;
    a->zout_end   = obuf + olen;
    a->z_expandable = exp;
+   a->refill = NULL;
+   a->flush = NULL;
 
    return parse_zlib(a, parse_header);
 }
@@ -2302,7 +3527,7 @@ static int do_zlib(zbuf *a, char *obuf, int olen, int exp, int parse_header)
 char *stbi_zlib_decode_malloc_guesssize(const char *buffer, int len, int initial_size, int *outlen)
 {
    zbuf a;
-   char *p = (char *) malloc(initial_size);
+   char *p = (char *) STBI_MALLOC(initial_size);
    if (p == NULL) return NULL;
    a.zbuffer = (uint8 *) buffer;
    a.zbuffer_end = (uint8 *) buffer + len;
@@ -2310,7 +3535,7 @@ char *stbi_zlib_decode_malloc_guesssize(const char *buffer, int len, int initial
       if (outlen) *outlen = (int) (a.zout - a.zout_start);
       return a.zout_start;
    } else {
-      free(a.zout_start);
+      STBI_FREE(a.zout_start);
       return NULL;
    }
 }
@@ -2323,7 +3548,7 @@ char *stbi_zlib_decode_malloc(char const *buffer, int len, int *outlen)
 char *stbi_zlib_decode_malloc_guesssize_headerflag(const char *buffer, int len, int initial_size, int *outlen, int parse_header)
 {
    zbuf a;
-   char *p = (char *) malloc(initial_size);
+   char *p = (char *) STBI_MALLOC(initial_size);
    if (p == NULL) return NULL;
    a.zbuffer = (uint8 *) buffer;
    a.zbuffer_end = (uint8 *) buffer + len;
@@ -2331,7 +3556,7 @@ char *stbi_zlib_decode_malloc_guesssize_headerflag(const char *buffer, int len,
       if (outlen) *outlen = (int) (a.zout - a.zout_start);
       return a.zout_start;
    } else {
-      free(a.zout_start);
+      STBI_FREE(a.zout_start);
       return NULL;
    }
 }
@@ -2350,7 +3575,7 @@ int stbi_zlib_decode_buffer(char *obuffer, int olen, char const *ibuffer, int il
 char *stbi_zlib_decode_noheader_malloc(char const *buffer, int len, int *outlen)
 {
    zbuf a;
-   char *p = (char *) malloc(16384);
+   char *p = (char *) STBI_MALLOC(16384);
    if (p == NULL) return NULL;
    a.zbuffer = (uint8 *) buffer;
    a.zbuffer_end = (uint8 *) buffer+len;
@@ -2358,7 +3583,7 @@ char *stbi_zlib_decode_noheader_malloc(char const *buffer, int len, int *outlen)
       if (outlen) *outlen = (int) (a.zout - a.zout_start);
       return a.zout_start;
    } else {
-      free(a.zout_start);
+      STBI_FREE(a.zout_start);
       return NULL;
    }
 }
@@ -2410,10 +3635,23 @@ static int check_png_header(stbi *s)
    return 1;
 }
 
+// the layout of a png up to its first IDAT, as found by SCAN_stream
+typedef struct
+{
+   uint8 palette[1024];
+   uint32 pal_len;
+   int pal_img_n, has_trans, interlace, iphone;
+   uint8 tc[3];
+   uint8 *idat;        // the data of the first IDAT chunk
+   uint32 idat_length;
+} png_layout;
+
 typedef struct
 {
    stbi *s;
    uint8 *idata, *expanded, *out;
+   int depth;          // bits per channel, 8 or 16
+   png_layout *stream; // only used by SCAN_stream
 } png;
 
 
@@ -2438,96 +3676,244 @@ static int paeth(int a, int b, int c)
    return c;
 }
 
-// create the png data from post-deflated data
+#ifdef STBI_SSE2
+// the SSE2 unfilters handle 3 and 4 byte pixels (8-bit RGB and RGBA, and
+// 16-bit gray+alpha). each returns how many bytes of the row it did, which is
+// a whole number of pixels and at least the first one unless it is 0. Up
+// works on any pixel size, so it is done inline in png_unfilter_row
+
+stbi_inline static __m128i png_load32(uint8 const *p)
+{
+   int v;
+   memcpy(&v, p, 4);
+   return _mm_cvtsi32_si128(v);
+}
+
+stbi_inline static void png_store32(uint8 *p, __m128i v)
+{
+   int x = _mm_cvtsi128_si32(v);
+   memcpy(p, &x, 4);
+}
+
+// a running sum of the pixels, 4 pixels a step. the left neighbour of the
+// first pixel is added to its lane first, so the prefix sum carries it along
+static uint32 png_sub_sse2(uint8 *cur, uint8 const *raw, uint32 len, int n)
+{
+   __m128i left = _mm_setzero_si128();
+   uint32 i = 0;
+   if (n == 4) {
+      for (; i + 16 <= len; i += 16) {
+         __m128i x = _mm_add_epi8(_mm_loadu_si128((__m128i const *) (raw+i)), left);
+         x = _mm_add_epi8(x, _mm_slli_si128(x, 4));
+         x = _mm_add_epi8(x, _mm_slli_si128(x, 8));
+         _mm_storeu_si128((__m128i *) (cur+i), x);
+         left = _mm_srli_si128(x, 12);
+      }
+   } else if (n == 3) {
+      // 4 pixels are 12 bytes, and the last 4 bytes stored are overwritten next time
+      for (; i + 16 <= len; i += 12) {
+         __m128i x = _mm_add_epi8(_mm_loadu_si128((__m128i const *) (raw+i)), left);
+         x = _mm_add_epi8(x, _mm_slli_si128(x, 3));
+         x = _mm_add_epi8(x, _mm_slli_si128(x, 6));
+         _mm_storeu_si128((__m128i *) (cur+i), x);
+         left = _mm_srli_si128(_mm_slli_si128(x, 4), 13);
+      }
+   }
+   return i;
+}
+
+// one pixel a step, with the 4th byte of a 3 byte pixel overwritten by the next one
+static uint32 png_avg_sse2(uint8 *cur, uint8 const *prior, uint8 const *raw, uint32 len, int n)
+{
+   __m128i ones = _mm_set1_epi8(1);
+   __m128i left = _mm_setzero_si128();
+   uint32 i = 0;
+   if (n != 3 && n != 4) return 0;
+   for (; i + 4 <= len; i += n) {
+      __m128i up = png_load32(prior+i);
+      // pavgb rounds up, (a+b)>>1 rounds down
+      __m128i avg = _mm_sub_epi8(_mm_avg_epu8(left, up), _mm_and_si128(_mm_xor_si128(left, up), ones));
+      left = _mm_add_epi8(png_load32(raw+i), avg);
+      png_store32(cur+i, left);
+   }
+   return i;
+}
+
+// one pixel a step in 16-bit lanes. pa, pb and pc are the distances from
+// p = a + b - c to a, b and c, as in paeth()
+static uint32 png_paeth_sse2(uint8 *cur, uint8 const *prior, uint8 const *raw, uint32 len, int n)
+{
+   __m128i zero = _mm_setzero_si128();
+   __m128i a = zero, c = zero;
+   uint32 i = 0;
+   if (n != 3 && n != 4) return 0;
+   for (; i + 4 <= len; i += n) {
+      __m128i b = _mm_unpacklo_epi8(png_load32(prior+i), zero);
+      __m128i pa = _mm_sub_epi16(b, c);
+      __m128i pb = _mm_sub_epi16(a, c);
+      __m128i pc = _mm_add_epi16(pa, pb);
+      __m128i not_a, use_c, pred;
+      pa = _mm_max_epi16(pa, _mm_sub_epi16(zero, pa));
+      pb = _mm_max_epi16(pb, _mm_sub_epi16(zero, pb));
+      pc = _mm_max_epi16(pc, _mm_sub_epi16(zero, pc));
+      not_a = _mm_or_si128(_mm_cmpgt_epi16(pa, pb), _mm_cmpgt_epi16(pa, pc));
+      use_c = _mm_cmpgt_epi16(pb, pc);
+      pred = _mm_or_si128(_mm_andnot_si128(use_c, b), _mm_and_si128(use_c, c));
+      pred = _mm_or_si128(_mm_andnot_si128(not_a, a), _mm_and_si128(not_a, pred));
+      pred = _mm_add_epi8(png_load32(raw+i), _mm_packus_epi16(pred, pred));
+      png_store32(cur+i, pred);
+      a = _mm_unpacklo_epi8(pred, zero);
+      c = b;
+   }
+   return i;
+}
+#endif // STBI_SSE2
+
+// unfilters one row of len bytes, made of n byte pixels. prior is the
+// unfiltered row above, and isn't read for the first row's filters
+static void png_unfilter_row(uint8 *cur, uint8 const *prior, uint8 const *raw, int filter, uint32 len, int n)
+{
+   uint32 i = 0;
+   switch (filter) {
+      case F_none:
+         memcpy(cur, raw, len);
+         break;
+      case F_sub:
+         #ifdef STBI_SSE2
+         i = png_sub_sse2(cur, raw, len, n);
+         #endif
+         for (   ; i < (uint32) n; ++i) cur[i] = raw[i];
+         for (   ; i < len; ++i) cur[i] = raw[i] + cur[i-n];
+         break;
+      case F_up:
+         #ifdef STBI_SSE2
+         for (   ; i + 16 <= len; i += 16)
+            _mm_storeu_si128((__m128i *) (cur+i), _mm_add_epi8(_mm_loadu_si128((__m128i const *) (raw+i)),
+                                                               _mm_loadu_si128((__m128i const *) (prior+i))));
+         #endif
+         for (   ; i < len; ++i) cur[i] = raw[i] + prior[i];
+         break;
+      case F_avg:
+         #ifdef STBI_SSE2
+         i = png_avg_sse2(cur, prior, raw, len, n);
+         #endif
+         for (   ; i < (uint32) n; ++i) cur[i] = raw[i] + (prior[i]>>1);
+         for (   ; i < len; ++i) cur[i] = raw[i] + ((prior[i] + cur[i-n])>>1);
+         break;
+      case F_paeth:
+         #ifdef STBI_SSE2
+         i = png_paeth_sse2(cur, prior, raw, len, n);
+         #endif
+         for (   ; i < (uint32) n; ++i) cur[i] = raw[i] + prior[i];
+         for (   ; i < len; ++i) cur[i] = (uint8) (raw[i] + paeth(cur[i-n],prior[i],prior[i-n]));
+         break;
+      case F_avg_first:
+         for (   ; i < (uint32) n; ++i) cur[i] = raw[i];
+         for (   ; i < len; ++i) cur[i] = raw[i] + (cur[i-n] >> 1);
+         break;
+      case F_paeth_first:
+         // with no row above, paeth always picks the left neighbour
+         #ifdef STBI_SSE2
+         i = png_sub_sse2(cur, raw, len, n);
+         #endif
+         for (   ; i < (uint32) n; ++i) cur[i] = raw[i];
+         for (   ; i < len; ++i) cur[i] = raw[i] + cur[i-n];
+         break;
+   }
+}
+
+// create the png data from post-deflated data. 16-bit images are unfiltered
+// bytewise like 8-bit ones, leaving each channel big-endian
 static int create_png_image_raw(png *a, uint8 *raw, uint32 raw_len, int out_n, uint32 x, uint32 y)
 {
    stbi *s = a->s;
-   uint32 i,j,stride = x*out_n;
+   int bytes = a->depth / 8;
+   uint32 i,j,stride = x*out_n*bytes;
    int k;
    int img_n = s->img_n; // copy it into a local for later
+   int img_bytes = img_n * bytes; // filters work on bytes this far apart
+   int out_bytes = out_n * bytes;
+   uint8 *line = NULL;
    assert(out_n == s->img_n || out_n == s->img_n+1);
    if (stbi_png_partial) y = 1;
-   a->out = (uint8 *) malloc(x * y * out_n);
+   a->out = (uint8 *) STBI_MALLOC((size_t) x * y * out_bytes);
    if (!a->out) return e("outofmem", "Out of memory");
    if (!stbi_png_partial) {
       if (s->img_x == x && s->img_y == y) {
-         if (raw_len != (img_n * x + 1) * y) return e("not enough pixels","Corrupt PNG");
+         if (raw_len != (img_bytes * x + 1) * y) return e("not enough pixels","Corrupt PNG");
       } else { // interlaced:
-         if (raw_len < (img_n * x + 1) * y) return e("not enough pixels","Corrupt PNG");
+         if (raw_len < (img_bytes * x + 1) * y) return e("not enough pixels","Corrupt PNG");
       }
    }
+   if (img_n != out_n) {
+      // unfilter a row at a time into line, since the filters need the row
+      // above without the added alpha channel
+      line = (uint8 *) STBI_MALLOC((size_t) x * img_bytes * 2);
+      if (!line) return e("outofmem", "Out of memory");
+   }
    for (j=0; j < y; ++j) {
       uint8 *cur = a->out + stride*j;
-      uint8 *prior = cur - stride;
       int filter = *raw++;
-      if (filter > 4) return e("invalid filter","Corrupt PNG");
+      if (filter > 4) {
+         STBI_FREE(line);
+         return e("invalid filter","Corrupt PNG");
+      }
       // if first row, use special filter that doesn't sample previous row
       if (j == 0) filter = first_row_filter[filter];
-      // handle first pixel explicitly
-      for (k=0; k < img_n; ++k) {
-         switch (filter) {
-            case F_none       : cur[k] = raw[k]; break;
-            case F_sub        : cur[k] = raw[k]; break;
-            case F_up         : cur[k] = raw[k] + prior[k]; break;
-            case F_avg        : cur[k] = raw[k] + (prior[k]>>1); break;
-            case F_paeth      : cur[k] = (uint8) (raw[k] + paeth(0,prior[k],0)); break;
-            case F_avg_first  : cur[k] = raw[k]; break;
-            case F_paeth_first: cur[k] = raw[k]; break;
-         }
-      }
-      if (img_n != out_n) cur[img_n] = 255;
-      raw += img_n;
-      cur += out_n;
-      prior += out_n;
-      // this is a little gross, so that we don't switch per-pixel or per-component
       if (img_n == out_n) {
-         #define CASE(f) \
-             case f:     \
-                for (i=x-1; i >= 1; --i, raw+=img_n,cur+=img_n,prior+=img_n) \
-                   for (k=0; k < img_n; ++k)
-         switch (filter) {
-            CASE(F_none)  cur[k] = raw[k]; break;
-            CASE(F_sub)   cur[k] = raw[k] + cur[k-img_n]; break;
-            CASE(F_up)    cur[k] = raw[k] + prior[k]; break;
-            CASE(F_avg)   cur[k] = raw[k] + ((prior[k] + cur[k-img_n])>>1); break;
-            CASE(F_paeth)  cur[k] = (uint8) (raw[k] + paeth(cur[k-img_n],prior[k],prior[k-img_n])); break;
-            CASE(F_avg_first)    cur[k] = raw[k] + (cur[k-img_n] >> 1); break;
-            CASE(F_paeth_first)  cur[k] = (uint8) (raw[k] + paeth(cur[k-img_n],0,0)); break;
-         }
-         #undef CASE
+         png_unfilter_row(cur, cur - stride, raw, filter, x*img_bytes, img_bytes);
       } else {
+         uint8 *unfiltered = line + (j & 1) * x * img_bytes;
+         uint8 *prior = line + ((j & 1) ^ 1) * x * img_bytes;
          assert(img_n+1 == out_n);
-         #define CASE(f) \
-             case f:     \
-                for (i=x-1; i >= 1; --i, cur[img_n]=255,raw+=img_n,cur+=out_n,prior+=out_n) \
-                   for (k=0; k < img_n; ++k)
-         switch (filter) {
-            CASE(F_none)  cur[k] = raw[k]; break;
-            CASE(F_sub)   cur[k] = raw[k] + cur[k-out_n]; break;
-            CASE(F_up)    cur[k] = raw[k] + prior[k]; break;
-            CASE(F_avg)   cur[k] = raw[k] + ((prior[k] + cur[k-out_n])>>1); break;
-            CASE(F_paeth)  cur[k] = (uint8) (raw[k] + paeth(cur[k-out_n],prior[k],prior[k-out_n])); break;
-            CASE(F_avg_first)    cur[k] = raw[k] + (cur[k-out_n] >> 1); break;
-            CASE(F_paeth_first)  cur[k] = (uint8) (raw[k] + paeth(cur[k-out_n],0,0)); break;
+         png_unfilter_row(unfiltered, prior, raw, filter, x*img_bytes, img_bytes);
+         // an added alpha channel is opaque, which is all ones at either depth
+         for (i=0; i < x; ++i, cur += out_bytes, unfiltered += img_bytes) {
+            for (k=0; k < img_bytes; ++k)
+               cur[k] = unfiltered[k];
+            cur[img_bytes] = cur[out_bytes-1] = 255;
          }
-         #undef CASE
       }
+      raw += x*img_bytes;
    }
+   STBI_FREE(line);
    return 1;
 }
 
+// the size of the filtered image data, so inflate can allocate it up front
+static uint32 png_raw_size(stbi *s, int img_bytes, int interlaced)
+{
+   uint32 size = 0;
+   int p;
+   if (!interlaced)
+      return (s->img_x * img_bytes + 1) * s->img_y;
+   for (p=0; p < 7; ++p) {
+      int xorig[] = { 0,4,0,2,0,1,0 };
+      int yorig[] = { 0,0,4,0,2,0,1 };
+      int xspc[]  = { 8,8,4,4,2,2,1 };
+      int yspc[]  = { 8,8,8,4,4,2,2 };
+      uint32 x = (s->img_x - xorig[p] + xspc[p]-1) / xspc[p];
+      uint32 y = (s->img_y - yorig[p] + yspc[p]-1) / yspc[p];
+      if (x && y)
+         size += (x * img_bytes + 1) * y;
+   }
+   return size;
+}
+
 static int create_png_image(png *a, uint8 *raw, uint32 raw_len, int out_n, int interlaced)
 {
    uint8 *final;
    int p;
    int save;
+   int out_bytes = out_n * (a->depth / 8);
+   int img_bytes = a->s->img_n * (a->depth / 8);
    if (!interlaced)
       return create_png_image_raw(a, raw, raw_len, out_n, a->s->img_x, a->s->img_y);
    save = stbi_png_partial;
    stbi_png_partial = 0;
 
    // de-interlacing
-   final = (uint8 *) malloc(a->s->img_x * a->s->img_y * out_n);
+   final = (uint8 *) STBI_MALLOC((size_t) a->s->img_x * a->s->img_y * out_bytes);
    for (p=0; p < 7; ++p) {
       int xorig[] = { 0,4,0,2,0,1,0 };
       int yorig[] = { 0,0,4,0,2,0,1 };
@@ -2539,16 +3925,17 @@ static int create_png_image(png *a, uint8 *raw, uint32 raw_len, int out_n, int i
       y = (a->s->img_y - yorig[p] + yspc[p]-1) / yspc[p];
       if (x && y) {
          if (!create_png_image_raw(a, raw, raw_len, out_n, x, y)) {
-            free(final);
+            STBI_FREE(final);
             return 0;
          }
          for (j=0; j < y; ++j)
             for (i=0; i < x; ++i)
-               memcpy(final + (j*yspc[p]+yorig[p])*a->s->img_x*out_n + (i*xspc[p]+xorig[p])*out_n,
-                      a->out + (j*x+i)*out_n, out_n);
-         free(a->out);
-         raw += (x*out_n+1)*y;
-         raw_len -= (x*out_n+1)*y;
+               memcpy(final + (j*yspc[p]+yorig[p])*a->s->img_x*out_bytes + (i*xspc[p]+xorig[p])*out_bytes,
+                      a->out + (j*x+i)*out_bytes, out_bytes);
+         STBI_FREE(a->out);
+         // the raw data has the channels from the file, not the output channels
+         raw += (x*img_bytes+1)*y;
+         raw_len -= (x*img_bytes+1)*y;
       }
    }
    a->out = final;
@@ -2557,6 +3944,16 @@ static int create_png_image(png *a, uint8 *raw, uint32 raw_len, int out_n, int i
    return 1;
 }
 
+// byte swaps the big-endian 16-bit channels from create_png_image, in place
+static void png_native_16(png *z)
+{
+   size_t i, count = (size_t) z->s->img_x * z->s->img_y * z->s->img_out_n;
+   uint8 *in = z->out;
+   uint16 *out = (uint16 *) z->out;
+   for (i=0; i < count; ++i, in += 2)
+      out[i] = (uint16) ((in[0] << 8) | in[1]);
+}
+
 static int compute_transparency(png *z, uint8 tc[3], int out_n)
 {
    stbi *s = z->s;
@@ -2582,12 +3979,36 @@ static int compute_transparency(png *z, uint8 tc[3], int out_n)
    return 1;
 }
 
+static int compute_transparency16(png *z, uint16 tc[3], int out_n)
+{
+   stbi *s = z->s;
+   uint32 i, pixel_count = s->img_x * s->img_y;
+   uint16 *p = (uint16 *) z->out;
+
+   // like compute_transparency, with 65535 as the alpha value in the output
+   assert(out_n == 2 || out_n == 4);
+
+   if (out_n == 2) {
+      for (i=0; i < pixel_count; ++i) {
+         p[1] = (p[0] == tc[0] ? 0 : 65535);
+         p += 2;
+      }
+   } else {
+      for (i=0; i < pixel_count; ++i) {
+         if (p[0] == tc[0] && p[1] == tc[1] && p[2] == tc[2])
+            p[3] = 0;
+         p += 4;
+      }
+   }
+   return 1;
+}
+
 static int expand_palette(png *a, uint8 *palette, int len, int pal_img_n)
 {
    uint32 i, pixel_count = a->s->img_x * a->s->img_y;
    uint8 *p, *temp_out, *orig = a->out;
 
-   p = (uint8 *) malloc(pixel_count * pal_img_n);
+   p = (uint8 *) STBI_MALLOC(pixel_count * pal_img_n);
    if (p == NULL) return e("outofmem", "Out of memory");
 
    // between here and free(out) below, exitting would leak
@@ -2611,7 +4032,7 @@ static int expand_palette(png *a, uint8 *palette, int len, int pal_img_n)
          p += 4;
       }
    }
-   free(a->out);
+   STBI_FREE(a->out);
    a->out = temp_out;
 
    STBI_NOTUSED(len);
@@ -2677,6 +4098,7 @@ static int parse_png_file(png *z, int scan, int req_comp)
 {
    uint8 palette[1024], pal_img_n=0;
    uint8 has_trans=0, tc[3];
+   uint16 tc16[3];
    uint32 ioff=0, idata_limit=0, i, pal_len=0;
    int first=1,k,interlace=0, iphone=0;
    stbi *s = z->s;
@@ -2703,22 +4125,25 @@ static int parse_png_file(png *z, int scan, int req_comp)
             if (c.length != 13) return e("bad IHDR len","Corrupt PNG");
             s->img_x = get32(s); if (s->img_x > (1 << 24)) return e("too large","Very large image (corrupt?)");
             s->img_y = get32(s); if (s->img_y > (1 << 24)) return e("too large","Very large image (corrupt?)");
-            depth = get8(s);  if (depth != 8)        return e("8bit only","PNG not supported: 8-bit only");
+            depth = get8(s);  if (depth != 8 && depth != 16) return e("8/16bit only","PNG not supported: 8-bit and 16-bit only");
             color = get8(s);  if (color > 6)         return e("bad ctype","Corrupt PNG");
             if (color == 3) pal_img_n = 3; else if (color & 1) return e("bad ctype","Corrupt PNG");
+            if (color == 3 && depth == 16) return e("bad depth","Corrupt PNG");
+            z->depth = depth;
             comp  = get8(s);  if (comp) return e("bad comp method","Corrupt PNG");
             filter= get8(s);  if (filter) return e("bad filter method","Corrupt PNG");
             interlace = get8(s); if (interlace>1) return e("bad interlace method","Corrupt PNG");
             if (!s->img_x || !s->img_y) return e("0-pixel image","Corrupt PNG");
             if (!pal_img_n) {
                s->img_n = (color & 2 ? 3 : 1) + (color & 4 ? 1 : 0);
-               if ((1 << 30) / s->img_x / s->img_n < s->img_y) return e("too large", "Image too large to decode");
+               // streamed images are never held in memory all at once, so can be bigger
+               if (scan != SCAN_stream && (1 << 30) / s->img_x / (s->img_n * (depth / 8)) < s->img_y) return e("too large", "Image too large to decode");
                if (scan == SCAN_header) return 1;
             } else {
                // if paletted, then pal_n is our final components, and
                // img_n is # components to decompress/filter.
                s->img_n = 1;
-               if ((1 << 30) / s->img_x / 4 < s->img_y) return e("too large","Corrupt PNG");
+               if (scan != SCAN_stream && (1 << 30) / s->img_x / 4 < s->img_y) return e("too large","Corrupt PNG");
                // if SCAN_header, have to scan to see if we have a tRNS
             }
             break;
@@ -2752,8 +4177,10 @@ static int parse_png_file(png *z, int scan, int req_comp)
                if (!(s->img_n & 1)) return e("tRNS with alpha","Corrupt PNG");
                if (c.length != (uint32) s->img_n*2) return e("bad tRNS len","Corrupt PNG");
                has_trans = 1;
-               for (k=0; k < s->img_n; ++k)
-                  tc[k] = (uint8) get16(s); // non 8-bit images will be larger
+               for (k=0; k < s->img_n; ++k) {
+                  tc16[k] = (uint16) get16(s);
+                  tc[k] = (uint8) tc16[k]; // only 16-bit images use more than 8 bits
+               }
             }
             break;
          }
@@ -2762,12 +4189,25 @@ static int parse_png_file(png *z, int scan, int req_comp)
             if (first) return e("first not IHDR", "Corrupt PNG");
             if (pal_img_n && !pal_len) return e("no PLTE","Corrupt PNG");
             if (scan == SCAN_header) { s->img_n = pal_img_n; return 1; }
+            if (scan == SCAN_stream) {
+               png_layout *l = z->stream;
+               memcpy(l->palette, palette, sizeof(palette));
+               l->pal_len = pal_len;
+               l->pal_img_n = pal_img_n;
+               l->has_trans = has_trans;
+               l->interlace = interlace;
+               l->iphone = iphone;
+               memcpy(l->tc, tc, sizeof(tc));
+               l->idat = s->img_buffer;
+               l->idat_length = c.length;
+               return 1;
+            }
             if (ioff + c.length > idata_limit) {
                uint8 *p;
                if (idata_limit == 0) idata_limit = c.length > 4096 ? c.length : 4096;
                while (ioff + c.length > idata_limit)
                   idata_limit *= 2;
-               p = (uint8 *) realloc(z->idata, idata_limit); if (p == NULL) return e("outofmem", "Out of memory");
+               p = (uint8 *) STBI_REALLOC(z->idata, idata_limit); if (p == NULL) return e("outofmem", "Out of memory");
                z->idata = p;
             }
             if (!getn(s, z->idata+ioff,c.length)) return e("outofdata","Corrupt PNG");
@@ -2778,19 +4218,30 @@ static int parse_png_file(png *z, int scan, int req_comp)
          case PNG_TYPE('I','E','N','D'): {
             uint32 raw_len;
             if (first) return e("first not IHDR", "Corrupt PNG");
+            if (scan == SCAN_stream) return e("no IDAT","Corrupt PNG");
             if (scan != SCAN_load) return 1;
             if (z->idata == NULL) return e("no IDAT","Corrupt PNG");
-            z->expanded = (uint8 *) stbi_zlib_decode_malloc_guesssize_headerflag((char *) z->idata, ioff, 16384, (int *) &raw_len, !iphone);
+            raw_len = png_raw_size(s, s->img_n * (z->depth / 8), interlace);
+            z->expanded = (uint8 *) stbi_zlib_decode_malloc_guesssize_headerflag((char *) z->idata, ioff, (int) raw_len, (int *) &raw_len, !iphone);
             if (z->expanded == NULL) return 0; // zlib should set error
-            free(z->idata); z->idata = NULL;
+            STBI_FREE(z->idata); z->idata = NULL;
             if ((req_comp == s->img_n+1 && req_comp != 3 && !pal_img_n) || has_trans)
                s->img_out_n = s->img_n+1;
             else
                s->img_out_n = s->img_n;
             if (!create_png_image(z, z->expanded, raw_len, s->img_out_n, interlace)) return 0;
-            if (has_trans)
-               if (!compute_transparency(z, tc, s->img_out_n)) return 0;
-            if (iphone && s->img_out_n > 2)
+            if (z->depth == 16)
+               png_native_16(z);
+            if (has_trans) {
+               if (z->depth == 16) {
+                  if (!compute_transparency16(z, tc16, s->img_out_n)) return 0;
+               } else {
+                  if (!compute_transparency(z, tc, s->img_out_n)) return 0;
+               }
+               // the output has the alpha channel, so report it
+               s->img_n = s->img_out_n;
+            }
+            if (iphone && s->img_out_n > 2 && z->depth == 8)
                stbi_de_iphone(z);
             if (pal_img_n) {
                // pal_img_n == 3 or 4
@@ -2800,7 +4251,7 @@ static int parse_png_file(png *z, int scan, int req_comp)
                if (!expand_palette(z, palette, pal_len, s->img_out_n))
                   return 0;
             }
-            free(z->expanded); z->expanded = NULL;
+            STBI_FREE(z->expanded); z->expanded = NULL;
             return 1;
          }
 
@@ -2826,15 +4277,24 @@ static int parse_png_file(png *z, int scan, int req_comp)
    }
 }
 
-static unsigned char *do_png(png *p, int *x, int *y, int *n, int req_comp)
+// `bits` is the bits per channel to return, whatever the depth of the file
+static unsigned char *do_png(png *p, int *x, int *y, int *n, int req_comp, int bits)
 {
    unsigned char *result=NULL;
    if (req_comp < 0 || req_comp > 4) return epuc("bad req_comp", "Internal error");
    if (parse_png_file(p, SCAN_load, req_comp)) {
       result = p->out;
       p->out = NULL;
+      if (bits == 8 && p->depth == 16)
+         result = convert_16_to_8((stbi_us *) result, p->s->img_x, p->s->img_y, p->s->img_out_n);
+      else if (bits == 16 && p->depth == 8)
+         result = (unsigned char *) convert_8_to_16(result, p->s->img_x, p->s->img_y, p->s->img_out_n);
+      if (result == NULL) return result;
       if (req_comp && req_comp != p->s->img_out_n) {
-         result = convert_format(result, p->s->img_out_n, req_comp, p->s->img_x, p->s->img_y);
+         if (bits == 16)
+            result = (unsigned char *) convert_format16((stbi_us *) result, p->s->img_out_n, req_comp, p->s->img_x, p->s->img_y);
+         else
+            result = convert_format(result, p->s->img_out_n, req_comp, p->s->img_x, p->s->img_y);
          p->s->img_out_n = req_comp;
          if (result == NULL) return result;
       }
@@ -2842,9 +4302,9 @@ static unsigned char *do_png(png *p, int *x, int *y, int *n, int req_comp)
       *y = p->s->img_y;
       if (n) *n = p->s->img_n;
    }
-   free(p->out);      p->out      = NULL;
-   free(p->expanded); p->expanded = NULL;
-   free(p->idata);    p->idata    = NULL;
+   STBI_FREE(p->out);      p->out      = NULL;
+   STBI_FREE(p->expanded); p->expanded = NULL;
+   STBI_FREE(p->idata);    p->idata    = NULL;
 
    return result;
 }
@@ -2853,7 +4313,14 @@ static unsigned char *stbi_png_load(stbi *s, int *x, int *y, int *comp, int req_
 {
    png p;
    p.s = s;
-   return do_png(&p, x,y,comp,req_comp);
+   return do_png(&p, x,y,comp,req_comp, 8);
+}
+
+static stbi_us *stbi_png_load_16(stbi *s, int *x, int *y, int *comp, int req_comp)
+{
+   png p;
+   p.s = s;
+   return (stbi_us *) do_png(&p, x,y,comp,req_comp, 16);
 }
 
 static int stbi_png_test(stbi *s)
@@ -2883,6 +4350,211 @@ static int      stbi_png_info(stbi *s, int *x, int *y, int *comp)
    return stbi_png_info_raw(&p, x, y, comp);
 }
 
+// streaming PNG decoding: the zlib output goes through a fixed size window,
+// and rows are unfiltered and handed out in bands as soon as they are complete
+
+typedef struct
+{
+   png_layout l;
+   uint8 *next_chunk;      // just past the data of the IDAT being inflated
+   uint8 *buffer_end;
+   uint32 x, y, row;
+   int img_n, out_n;
+   uint32 raw_row_len;     // filter byte + x*img_n
+   char *consumed;         // first byte of the window not yet unfiltered
+   uint8 *cur, *prior;     // unfiltered rows, img_n components
+   uint8 *band;            // output rows, out_n components
+   int band_rows, band_count;
+   stbi_band_callback callback;
+   void *user;
+} png_stream;
+
+static uint32 png_stream_be32(uint8 const *p)
+{
+   return ((uint32) p[0] << 24) | ((uint32) p[1] << 16) | ((uint32) p[2] << 8) | (uint32) p[3];
+}
+
+// moves the zlib input on to the next IDAT, skipping the CRC of the current one
+static int png_stream_refill(zbuf *z)
+{
+   png_stream *p = (png_stream *) z->stream;
+   for (;;) {
+      uint8 *c = p->next_chunk + 4;
+      uint32 len;
+      if (c > p->buffer_end || p->buffer_end - c < 8) return 0;
+      len = png_stream_be32(c);
+      if (png_stream_be32(c+4) != PNG_TYPE('I','D','A','T')) return 0;
+      c += 8;
+      if (len > (size_t) (p->buffer_end - c)) return 0;
+      z->zbuffer = c;
+      z->zbuffer_end = c + len;
+      p->next_chunk = c + len;
+      if (len > 0) return 1;
+   }
+}
+
+// expands the palette or applies tRNS, like the non-streaming path does
+static void png_stream_output_row(png_stream *p, uint8 *out)
+{
+   uint8 const *in = p->cur;
+   uint32 i;
+   if (p->l.pal_img_n) {
+      for (i=0; i < p->x; ++i, out += p->out_n) {
+         uint8 const *c = p->l.palette + in[i]*4;
+         out[0] = c[0]; out[1] = c[1]; out[2] = c[2];
+         if (p->out_n == 4) out[3] = c[3];
+      }
+   } else if (p->l.has_trans) {
+      if (p->img_n == 1) {
+         for (i=0; i < p->x; ++i, out += 2) {
+            out[0] = in[i];
+            out[1] = (in[i] == p->l.tc[0] ? 0 : 255);
+         }
+      } else {
+         for (i=0; i < p->x; ++i, in += 3, out += 4) {
+            out[0] = in[0]; out[1] = in[1]; out[2] = in[2];
+            out[3] = (in[0] == p->l.tc[0] && in[1] == p->l.tc[1] && in[2] == p->l.tc[2]) ? 0 : 255;
+         }
+      }
+   } else {
+      memcpy(out, in, p->x * p->img_n);
+   }
+}
+
+// unfilters every complete row in the window, handing out full bands
+static int png_stream_rows(zbuf *z)
+{
+   png_stream *p = (png_stream *) z->stream;
+   while (p->row < p->y && (uint32) (z->zout - p->consumed) >= p->raw_row_len) {
+      uint8 *raw = (uint8 *) p->consumed;
+      uint8 *t;
+      int filter = *raw++;
+      if (filter > 4) return e("invalid filter","Corrupt PNG");
+      if (p->row == 0) filter = first_row_filter[filter];
+      png_unfilter_row(p->cur, p->prior, raw, filter, p->x * p->img_n, p->img_n);
+      png_stream_output_row(p, p->band + (size_t) p->band_count * p->x * p->out_n);
+      t = p->cur; p->cur = p->prior; p->prior = t;
+      p->consumed += p->raw_row_len;
+      ++p->row;
+      ++p->band_count;
+      if (p->band_count == p->band_rows || p->row == p->y) {
+         int first_row = (int) (p->row - p->band_count);
+         int row_count = p->band_count;
+         p->band_count = 0;
+         if (!p->callback(p->user, p->band, first_row, row_count))
+            return e("stopped","Decoding stopped by the caller");
+      }
+   }
+   // anything after the last row is ignored, like the non-streaming path
+   if (p->row == p->y) p->consumed = z->zout;
+   return 1;
+}
+
+// called instead of expanding the window when it fills up
+static int png_stream_flush(zbuf *z, int n)
+{
+   png_stream *p = (png_stream *) z->stream;
+   char *keep;
+   if (!png_stream_rows(z)) return 0;
+   // keep everything not yet unfiltered, and the last 32K for back references
+   keep = z->zout - 32768;
+   if (keep > p->consumed) keep = p->consumed;
+   if (keep < z->zout_start) keep = z->zout_start;
+   memmove(z->zout_start, keep, z->zout - keep);
+   p->consumed -= keep - z->zout_start;
+   z->zout -= keep - z->zout_start;
+   if (z->zout + n > z->zout_end) return e("output buffer limit","Corrupt PNG");
+   return 1;
+}
+
+static int png_stream_begin(png_stream *p, stbi *s, stbi_uc const *buffer, size_t len)
+{
+   png z;
+   s->io.read = NULL;
+   s->read_from_callbacks = 0;
+   s->img_buffer = s->img_buffer_original = (uint8 *) buffer;
+   s->img_buffer_end = (uint8 *) buffer + len;
+   z.s = s;
+   z.stream = &p->l;
+   if (!parse_png_file(&z, SCAN_stream, 0)) return 0;
+   if (p->l.interlace) return e("interlaced","PNG not supported: can't stream interlaced images");
+   if (p->l.iphone) return e("iphone","PNG not supported: can't stream iPhone images");
+   if (z.depth != 8) return e("16bit","PNG not supported: can't stream 16-bit images");
+   if (p->l.idat_length > (size_t) (s->img_buffer_end - p->l.idat)) return e("outofdata","Corrupt PNG");
+   p->x = s->img_x;
+   p->y = s->img_y;
+   p->img_n = s->img_n;
+   if (p->l.pal_img_n)
+      p->out_n = p->l.pal_img_n;
+   else
+      p->out_n = p->l.has_trans ? s->img_n+1 : s->img_n;
+   p->buffer_end = s->img_buffer_end;
+   return 1;
+}
+
+int stbi_png_stream_info(stbi_uc const *buffer, size_t len, int *x, int *y, int *comp)
+{
+   stbi s;
+   png_stream p;
+   if (!png_stream_begin(&p, &s, buffer, len)) return 0;
+   if (x) *x = (int) p.x;
+   if (y) *y = (int) p.y;
+   if (comp) *comp = p.out_n;
+   return 1;
+}
+
+int stbi_png_stream(stbi_uc const *buffer, size_t len, int band_rows, stbi_band_callback band, void *user)
+{
+   stbi s;
+   png_stream p;
+   zbuf a;
+   size_t window_len;
+   char *window;
+   int ok;
+
+   if (band_rows < 1) return e("bad band_rows", "Internal error");
+   if (!png_stream_begin(&p, &s, buffer, len)) return 0;
+   if ((uint32) band_rows > p.y) band_rows = (int) p.y;
+
+   p.raw_row_len = p.x * p.img_n + 1;
+   p.row = 0;
+   p.band_rows = band_rows;
+   p.band_count = 0;
+   p.callback = band;
+   p.user = user;
+
+   // room for the 32K history, a partial row, and the biggest single write
+   // (a 64K stored block) after flushing
+   window_len = 32768 + p.raw_row_len + 65536;
+   window = (char *) STBI_MALLOC(window_len);
+   p.cur = (uint8 *) STBI_MALLOC(p.x * p.img_n);
+   p.prior = (uint8 *) STBI_MALLOC(p.x * p.img_n);
+   p.band = (uint8 *) STBI_MALLOC((size_t) band_rows * p.x * p.out_n);
+   if (!window || !p.cur || !p.prior || !p.band) {
+      ok = e("outofmem", "Out of memory");
+   } else {
+      p.consumed = window;
+      p.next_chunk = p.l.idat + p.l.idat_length;
+      a.zbuffer = p.l.idat;
+      a.zbuffer_end = p.l.idat + p.l.idat_length;
+      a.zout_start = a.zout = window;
+      a.zout_end = window + window_len;
+      a.z_expandable = 0;
+      a.refill = png_stream_refill;
+      a.flush = png_stream_flush;
+      a.stream = &p;
+      ok = parse_zlib(&a, 1);
+      if (ok) ok = png_stream_rows(&a);
+      if (ok && p.row < p.y) ok = e("not enough pixels","Corrupt PNG");
+   }
+
+   STBI_FREE(window);
+   STBI_FREE(p.cur);
+   STBI_FREE(p.prior);
+   STBI_FREE(p.band);
+   return ok;
+}
+
 // Microsoft/Windows BMP image
 
 static int bmp_test(stbi *s)
@@ -3035,11 +4707,11 @@ static stbi_uc *bmp_load(stbi *s, int *x, int *y, int *comp, int req_comp)
       target = req_comp;
    else
       target = s->img_n; // if they want monochrome, we'll post-convert
-   out = (stbi_uc *) malloc(target * s->img_x * s->img_y);
+   out = (stbi_uc *) STBI_MALLOC(target * s->img_x * s->img_y);
    if (!out) return epuc("outofmem", "Out of memory");
    if (bpp < 16) {
       int z=0;
-      if (psize == 0 || psize > 256) { free(out); return epuc("invalid", "Corrupt BMP"); }
+      if (psize == 0 || psize > 256) { STBI_FREE(out); return epuc("invalid", "Corrupt BMP"); }
       for (i=0; i < psize; ++i) {
          pal[i][2] = get8u(s);
          pal[i][1] = get8u(s);
@@ -3050,7 +4722,7 @@ static stbi_uc *bmp_load(stbi *s, int *x, int *y, int *comp, int req_comp)
       skip(s, offset - 14 - hsz - psize * (hsz == 12 ? 3 : 4));
       if (bpp == 4) width = (s->img_x + 1) >> 1;
       else if (bpp == 8) width = s->img_x;
-      else { free(out); return epuc("bad bpp", "Corrupt BMP"); }
+      else { STBI_FREE(out); return epuc("bad bpp", "Corrupt BMP"); }
       pad = (-width)&3;
       for (j=0; j < (int) s->img_y; ++j) {
          for (i=0; i < (int) s->img_x; i += 2) {
@@ -3088,7 +4760,7 @@ static stbi_uc *bmp_load(stbi *s, int *x, int *y, int *comp, int req_comp)
             easy = 2;
       }
       if (!easy) {
-         if (!mr || !mg || !mb) { free(out); return epuc("bad masks", "Corrupt BMP"); }
+         if (!mr || !mg || !mb) { STBI_FREE(out); return epuc("bad masks", "Corrupt BMP"); }
          // right shift amt to put high bit in position #7
          rshift = high_bit(mr)-7; rcount = bitcount(mr);
          gshift = high_bit(mg)-7; gcount = bitcount(mr);
@@ -3285,7 +4957,7 @@ static stbi_uc *tga_load(stbi *s, int *x, int *y, int *comp, int req_comp)
       //   force a new number of components
       *comp = tga_bits_per_pixel/8;
    }
-   tga_data = (unsigned char*)malloc( tga_width * tga_height * req_comp );
+   tga_data = (unsigned char*)STBI_MALLOC( tga_width * tga_height * req_comp );
    if (!tga_data) return epuc("outofmem", "Out of memory");
 
    //   skip to the data's starting position (offset usually = 0)
@@ -3296,11 +4968,11 @@ static stbi_uc *tga_load(stbi *s, int *x, int *y, int *comp, int req_comp)
       //   any data to skip? (offset usually = 0)
       skip(s, tga_palette_start );
       //   load the palette
-      tga_palette = (unsigned char*)malloc( tga_palette_len * tga_palette_bits / 8 );
+      tga_palette = (unsigned char*)STBI_MALLOC( tga_palette_len * tga_palette_bits / 8 );
       if (!tga_palette) return epuc("outofmem", "Out of memory");
       if (!getn(s, tga_palette, tga_palette_len * tga_palette_bits / 8 )) {
-         free(tga_data);
-         free(tga_palette);
+         STBI_FREE(tga_data);
+         STBI_FREE(tga_palette);
          return epuc("bad palette", "Corrupt TGA");
       }
    }
@@ -3436,7 +5108,7 @@ static stbi_uc *tga_load(stbi *s, int *x, int *y, int *comp, int req_comp)
    //   clear my palette, if I had one
    if ( tga_palette != NULL )
    {
-      free( tga_palette );
+      STBI_FREE( tga_palette );
    }
    //   the things I do to get rid of an error message, and yet keep
    //   Microsoft's C compilers happy... [8^(
@@ -3531,7 +5203,7 @@ static stbi_uc *psd_load(stbi *s, int *x, int *y, int *comp, int req_comp)
       return epuc("bad compression", "PSD has an unknown compression format");
 
    // Create the destination image.
-   out = (stbi_uc *) malloc(4 * w*h);
+   out = (stbi_uc *) STBI_MALLOC(4 * w*h);
    if (!out) return epuc("outofmem", "Out of memory");
    pixelCount = w*h;
 
@@ -3821,11 +5493,11 @@ static stbi_uc *pic_load(stbi *s,int *px,int *py,int *comp,int req_comp)
    get16(s); //skip `pad'
 
    // intermediate buffer is RGBA
-   result = (stbi_uc *) malloc(x*y*4);
+   result = (stbi_uc *) STBI_MALLOC(x*y*4);
    memset(result, 0xff, x*y*4);
 
    if (!pic_load2(s,x,y,comp, result)) {
-      free(result);
+      STBI_FREE(result);
       result=0;
    }
    *px = x;
@@ -4076,14 +5748,14 @@ static uint8 *stbi_gif_load_next(stbi *s, stbi_gif *g, int *comp, int req_comp)
 
    if (g->out == 0) {
       if (!stbi_gif_header(s, g, comp,0))     return 0; // failure_reason set by stbi_gif_header
-      g->out = (uint8 *) malloc(4 * g->w * g->h);
+      g->out = (uint8 *) STBI_MALLOC(4 * g->w * g->h);
       if (g->out == 0)                      return epuc("outofmem", "Out of memory");
       stbi_fill_gif_background(g);
    } else {
       // animated-gif-only path
       if (((g->eflags & 0x1C) >> 2) == 3) {
          old_out = g->out;
-         g->out = (uint8 *) malloc(4 * g->w * g->h);
+         g->out = (uint8 *) STBI_MALLOC(4 * g->w * g->h);
          if (g->out == 0)                   return epuc("outofmem", "Out of memory");
          memcpy(g->out, old_out, g->w*g->h*4);
       }
@@ -4305,7 +5977,7 @@ static float *hdr_load(stbi *s, int *x, int *y, int *comp, int req_comp)
    if (req_comp == 0) req_comp = 3;
 
    // Read data
-   hdr_data = (float *) malloc(height * width * req_comp * sizeof(float));
+   hdr_data = (float *) STBI_MALLOC(height * width * req_comp * sizeof(float));
 
    // Load image data
    // image data is stored as some number of sca
@@ -4338,13 +6010,13 @@ static float *hdr_load(stbi *s, int *x, int *y, int *comp, int req_comp)
             hdr_convert(hdr_data, rgbe, req_comp);
             i = 1;
             j = 0;
-            free(scanline);
+            STBI_FREE(scanline);
             goto main_decode_loop; // yes, this makes no sense
          }
          len <<= 8;
          len |= get8(s);
-         if (len != width) { free(hdr_data); free(scanline); return epf("invalid decoded scanline length", "corrupt HDR"); }
-         if (scanline == NULL) scanline = (stbi_uc *) malloc(width * 4);
+         if (len != width) { STBI_FREE(hdr_data); STBI_FREE(scanline); return epf("invalid decoded scanline length", "corrupt HDR"); }
+         if (scanline == NULL) scanline = (stbi_uc *) STBI_MALLOC(width * 4);
             
          for (k = 0; k < 4; ++k) {
             i = 0;
@@ -4366,7 +6038,7 @@ static float *hdr_load(stbi *s, int *x, int *y, int *comp, int req_comp)
          for (i=0; i < width; ++i)
             hdr_convert(hdr_data+(j*width + i)*req_comp, scanline + i*4, req_comp);
       }
-      free(scanline);
+      STBI_FREE(scanline);
    }
 
    return hdr_data;
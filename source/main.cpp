@@ -8,9 +8,11 @@
 #include <stdexcept>
 #include <cmath>
 #include <list>
+#include <map>
 
 #include "tdogl/Program.h"
 #include "tdogl/Texture.h"
+#include "tdogl/TextureCache.h"
 #include "tdogl/Camera.h"
 
 /*
@@ -83,6 +85,11 @@ std::list<ModelInstance> gInstances;
 GLfloat gDegreesRotated = 0.0f;
 Light gLight;
 
+// loaded textures, keyed by the contents of their image files
+std::map<tdogl::TextureCache::SourceKey, tdogl::Texture*> gTextures;
+unsigned gDuplicateTextures = 0;
+size_t gDuplicateTextureBytes = 0; //video memory not used, thanks to sharing
+
 static std::string ResourcePath(std::string fileName) {
     return "../../resources/" + fileName;
 }
@@ -100,10 +107,26 @@ static tdogl::Program* LoadShaders(const char* vertFileName, const char* fragFil
     return new tdogl::Program(shaders);
 }
 
-static tdogl::Texture* LoadTexture(const char* filename) {
-    tdogl::Bitmap bmp = tdogl::Bitmap::bitmapFromFile(ResourcePath(filename));
-    bmp.flipVertically();
-    return new tdogl::Texture(bmp);
+// maxTextureSize caps the width and height of the texture, or 0 for no cap
+static tdogl::Texture* LoadTexture(const char* filename, unsigned maxTextureSize = 0) {
+    // decoded images are cached, so only the first run has to decode them. The
+    // cache lives next to the executable in the build output, not in resources/
+    static tdogl::TextureCache cache("texture-cache");
+    tdogl::CachedImage image = cache.load(ResourcePath(filename), maxTextureSize);
+
+    // image files with identical contents share one texture
+    tdogl::TextureCache::SourceKey key = { image.sourceHash(), image.sourceSize(), maxTextureSize };
+    std::map<tdogl::TextureCache::SourceKey, tdogl::Texture*>::iterator found = gTextures.find(key);
+    if(found != gTextures.end()){
+        ++gDuplicateTextures;
+        for(unsigned level = 0; level < image.levelCount(); ++level)
+            gDuplicateTextureBytes += image.levelSize(level);
+        return found->second;
+    }
+
+    tdogl::Texture* texture = new tdogl::Texture(image);
+    gTextures[key] = texture;
+    return texture;
 }
 
 // initialises the gWoodenCrate global
@@ -358,6 +381,9 @@ void AppMain() {
     LoadWoodenCrateAsset();
     CreateInstances();
 
+    std::cout << gTextures.size() << " texture(s) loaded, " << gDuplicateTextures
+              << " duplicate(s) shared, saving " << gDuplicateTextureBytes << " bytes of video memory" << std::endl;
+
     gCamera.setPosition(glm::vec3(-4,0,17));
     gCamera.setViewportAspectRatio(SCREEN_SIZE.x / SCREEN_SIZE.y);
     gCamera.setNearAndFarPlanes(0.5f, 100.0f);
@@ -0,0 +1,47 @@
+/*
+ tdogl::Allocator
+ 
+ Copyright 2012 Thomas Dalling - http://tomdalling.com/
+ 
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+ 
+ http://www.apache.org/licenses/LICENSE-2.0
+ 
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#include "Allocator.h"
+#include <cstdlib>
+
+using namespace tdogl;
+
+namespace {
+    class SystemAllocator : public Allocator {
+    public:
+        void* allocate(size_t size) {
+            return malloc(size);
+        }
+        
+        void* reallocate(void* block, size_t newSize) {
+            return realloc(block, newSize);
+        }
+        
+        void deallocate(void* block) {
+            free(block);
+        }
+    };
+}
+
+Allocator::~Allocator() {
+}
+
+Allocator& Allocator::system() {
+    static SystemAllocator allocator;
+    return allocator;
+}
@@ -0,0 +1,61 @@
+/*
+ tdogl::Allocator
+ 
+ Copyright 2012 Thomas Dalling - http://tomdalling.com/
+ 
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+ 
+ http://www.apache.org/licenses/LICENSE-2.0
+ 
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#pragma once
+
+#include <cstddef>
+
+namespace tdogl {
+    
+    /**
+     Somewhere to get blocks of memory from, like malloc/realloc/free.
+     
+     Bitmaps get their pixel buffers from an Allocator (see
+     Bitmap::setDefaultAllocator), so the strategy can be swapped, e.g. to reuse
+     buffers between loads with tdogl::PoolAllocator. Implementations must be
+     safe to use from several threads at once, unless documented otherwise.
+     */
+    class Allocator {
+    public:
+        virtual ~Allocator();
+        
+        /**
+         Returns a block of at least `size` bytes, aligned to 16 bytes, or NULL
+         if there isn't enough memory.
+         */
+        virtual void* allocate(size_t size) = 0;
+        
+        /**
+         Resizes a block, like realloc. The block may move, keeping its contents
+         up to the smaller of the old and new sizes. A NULL block acts like
+         `allocate`. Returns NULL on failure, leaving the block untouched.
+         */
+        virtual void* reallocate(void* block, size_t newSize) = 0;
+        
+        /**
+         Frees a block returned by `allocate` or `reallocate`. NULL is ignored.
+         */
+        virtual void deallocate(void* block) = 0;
+        
+        /**
+         The allocator that uses malloc, realloc and free.
+         */
+        static Allocator& system();
+    };
+    
+}
@@ -0,0 +1,124 @@
+/*
+ tdogl::BandDecoder
+ 
+ Copyright 2012 Thomas Dalling - http://tomdalling.com/
+ 
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+ 
+ http://www.apache.org/licenses/LICENSE-2.0
+ 
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#include "BandDecoder.h"
+#include "ScratchArena.h"
+#include <stdexcept>
+#include <exception>
+#include <climits>
+#include <algorithm>
+
+//the stb_image implementation is compiled in Bitmap.cpp
+#define STBI_HEADER_FILE_ONLY
+#include <stb_image.c>
+
+using namespace tdogl;
+
+namespace {
+    struct StreamState {
+        const BandDecoder::BandFunc* func;
+        unsigned width;
+        Bitmap::Format format;
+        bool stopped;
+        std::exception_ptr error;
+    };
+}
+
+// stb_image is C, so exceptions are caught here and rethrown once it has cleaned up
+static int StreamBand(void* user, const stbi_uc* rows, int firstRow, int rowCount) {
+    StreamState* state = (StreamState*)user;
+    try {
+        BitmapView band(const_cast<unsigned char*>(rows), state->width, (unsigned)rowCount,
+                        state->format, (ptrdiff_t)state->width * state->format);
+        if(!(*state->func)(band, (unsigned)firstRow)){
+            state->stopped = true;
+            return 0;
+        }
+        return 1;
+    } catch(...) {
+        state->error = std::current_exception();
+        return 0;
+    }
+}
+
+BandDecoder::BandDecoder(const std::string& filePath) :
+    _filePath(filePath),
+    _file(filePath),
+    _streamed(false)
+{
+    int width, height, channels;
+    if(stbi_png_stream_info(_file.data(), _file.size(), &width, &height, &channels)){
+        _streamed = true;
+    } else if(_file.size() > INT_MAX || !stbi_info_from_memory(_file.data(), (int)_file.size(), &width, &height, &channels)){
+        throw std::runtime_error(filePath + ": " + stbi_failure_reason());
+    }
+    
+    _width = (unsigned)width;
+    _height = (unsigned)height;
+    _format = (Bitmap::Format)channels;
+}
+
+unsigned BandDecoder::width() const {
+    return _width;
+}
+
+unsigned BandDecoder::height() const {
+    return _height;
+}
+
+Bitmap::Format BandDecoder::format() const {
+    return _format;
+}
+
+bool BandDecoder::isStreamed() const {
+    return _streamed;
+}
+
+bool BandDecoder::decode(unsigned bandRows, const BandFunc& func) const {
+    if(bandRows == 0)
+        throw std::runtime_error("Bands need at least one row");
+    
+    if(!_streamed){
+        Bitmap bitmap = Bitmap::bitmapFromMemory(_file.data(), _file.size());
+        BitmapView whole(bitmap);
+        for(unsigned row = 0; row < whole.height(); row += bandRows){
+            unsigned rowCount = std::min(bandRows, whole.height() - row);
+            if(!func(whole.subView(0, row, whole.width(), rowCount), row))
+                return false;
+        }
+        return true;
+    }
+    
+    StreamState state;
+    state.func = &func;
+    state.width = _width;
+    state.format = _format;
+    state.stopped = false;
+    
+    ScratchArena::Scope scratch(ScratchArena::threadLocal());
+    int bandLimit = (bandRows > INT_MAX) ? INT_MAX : (int)bandRows;
+    bool finished = stbi_png_stream(_file.data(), _file.size(), bandLimit, StreamBand, &state) != 0;
+    
+    if(state.error)
+        std::rethrow_exception(state.error);
+    if(state.stopped)
+        return false;
+    if(!finished)
+        throw std::runtime_error(_filePath + ": " + stbi_failure_reason());
+    return true;
+}
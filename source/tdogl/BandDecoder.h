@@ -0,0 +1,95 @@
+/*
+ tdogl::BandDecoder
+ 
+ Copyright 2012 Thomas Dalling - http://tomdalling.com/
+ 
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+ 
+ http://www.apache.org/licenses/LICENSE-2.0
+ 
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#pragma once
+
+#include "Bitmap.h"
+#include "BitmapView.h"
+#include "MappedFile.h"
+#include <functional>
+#include <string>
+
+namespace tdogl {
+    
+    /**
+     Decodes an image file a band of rows at a time, for images too big to
+     hold in memory all at once (e.g. multi-gigapixel maps).
+     
+     Each band is handed to a callback, which can tile, downscale or upload it
+     before the next band is decoded, so peak memory is bounded by the band
+     size rather than the image size. The file itself is memory mapped, so it
+     is paged in and out by the OS as needed.
+     
+     8-bit, non-interlaced PNGs are truly streamed. Anything else has to be
+     decoded whole first, and is then handed out in bands the same way, so
+     consumers work with every format (see isStreamed).
+     */
+    class BandDecoder {
+    public:
+        /**
+         Receives one band of decoded rows.
+         
+         @param band      The rows, top row first. Only valid during the call.
+         @param firstRow  The row of the whole image that is row 0 of the band
+         @result          True to carry on decoding, false to stop
+         */
+        typedef std::function<bool(const BitmapView& band, unsigned firstRow)> BandFunc;
+        
+        /**
+         Maps the file, and reads the image dimensions from its header.
+         
+         @throws std::exception if the file can't be mapped, or isn't an image
+         */
+        explicit BandDecoder(const std::string& filePath);
+        
+        /** width of the image in pixels */
+        unsigned width() const;
+        
+        /** height of the image in pixels */
+        unsigned height() const;
+        
+        /** the pixel format of the decoded bands */
+        Bitmap::Format format() const;
+        
+        /**
+         True if the image can be decoded in bounded memory. False if the whole
+         image has to be decoded before the first band is handed out.
+         */
+        bool isStreamed() const;
+        
+        /**
+         Decodes the image, calling `func` with each band in order from the top.
+         Every band has `bandRows` rows, except the last one, which may have
+         fewer.
+         
+         @result True if every band was decoded, false if `func` stopped early
+         @throws std::exception if the image is corrupt, or rethrows anything
+                 thrown by `func`
+         */
+        bool decode(unsigned bandRows, const BandFunc& func) const;
+        
+    private:
+        std::string _filePath;
+        MappedFile _file;
+        unsigned _width;
+        unsigned _height;
+        Bitmap::Format _format;
+        bool _streamed;
+    };
+    
+}
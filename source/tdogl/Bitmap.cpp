@@ -17,86 +17,372 @@
  */
 
 #include "Bitmap.h"
+#include "BitmapView.h"
+#include "ColorSpace.h"
+#include "DistanceField.h"
+#include "HalfFloat.h"
+#include "MappedFile.h"
+#include "MipChain.h"
+#include "PoolAllocator.h"
+#include "Resample.h"
+#include "ScratchArena.h"
+#include "ThreadPool.h"
 #include <stdexcept>
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <climits>
+#include <cstring>
+#include <stdint.h>
+#include <functional>
+#include <vector>
+
+using namespace tdogl;
+
+// stb_image's small temporaries come from the decoding thread's scratch arena,
+// and anything big (including the decoded pixels) comes from the pixel pool
+static const size_t StbiScratchLimit = 64 * 1024;
+
+static void* StbiMalloc(size_t size) {
+    if(size < StbiScratchLimit)
+        return ScratchArena::threadLocal().allocate(size);
+    else
+        return PoolAllocator::shared().allocate(size);
+}
+
+static void* StbiRealloc(void* block, size_t newSize) {
+    ScratchArena& arena = ScratchArena::threadLocal();
+    if(!block || !arena.owns(block))
+        return block ? PoolAllocator::shared().reallocate(block, newSize) : StbiMalloc(newSize);
+    
+    if(newSize < StbiScratchLimit)
+        return arena.reallocate(block, newSize);
+    
+    //outgrew the arena
+    void* newBlock = PoolAllocator::shared().allocate(newSize);
+    if(newBlock){
+        memcpy(newBlock, block, std::min(arena.blockSize(block), newSize));
+        arena.deallocate(block);
+    }
+    return newBlock;
+}
+
+static void StbiFree(void* block) {
+    ScratchArena& arena = ScratchArena::threadLocal();
+    if(arena.owns(block))
+        arena.deallocate(block);
+    else
+        PoolAllocator::shared().deallocate(block);
+}
 
 //uses stb_image to try load files
 #define STBI_FAILURE_USERMSG
+#define STBI_MALLOC(size) StbiMalloc(size)
+#define STBI_REALLOC(block, size) StbiRealloc(block, size)
+#define STBI_FREE(block) StbiFree(block)
+#ifdef TDOGL_DISABLE_SIMD
+    #define STBI_NO_SIMD
+#endif
 #include <stb_image.c>
 
-using namespace tdogl;
 
+/*
+ * Row format converters
+ *
+ * Each converter turns `count` consecutive pixels of one format into another.
+ * The SIMD paths handle as many whole blocks as they can, and the scalar loop
+ * at the end of each function handles the remainder (or everything, when
+ * SIMD is unavailable). Both paths produce identical output.
+ */
+
+#if !defined(TDOGL_DISABLE_SIMD) && (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+    #define TDOGL_SSE2 1
+    #include <emmintrin.h>
+    #if defined(__SSSE3__)
+        #define TDOGL_SSSE3 1
+        #include <tmmintrin.h>
+    #endif
+#endif
+
+// floor(sum / 3) for sum <= 765, without the division: 0xAAAB / 2^17 is 1/3 rounded up,
+// which is exact for every 16-bit sum
+inline unsigned char AverageRGB(const unsigned char* rgb) {
+    unsigned sum = (unsigned)rgb[0] + rgb[1] + rgb[2];
+    return (unsigned char)((sum * 0xAAABu) >> 17);
+}
+
+#ifdef TDOGL_SSE2
+
+// 8 x 16-bit sums of r+g+b  ->  8 x 16-bit averages
+static inline __m128i Average3_epu16(__m128i sums) {
+    return _mm_srli_epi16(_mm_mulhi_epu16(sums, _mm_set1_epi16((short)0xAAAB)), 1);
+}
+
+// 4 RGBX pixels in 32-bit lanes  ->  4 x 32-bit sums of r+g+b
+static inline __m128i SumRGB_epi32(__m128i px) {
+    const __m128i lowByte = _mm_set1_epi32(0xFF);
+    __m128i r = _mm_and_si128(px, lowByte);
+    __m128i g = _mm_and_si128(_mm_srli_epi32(px, 8), lowByte);
+    __m128i b = _mm_and_si128(_mm_srli_epi32(px, 16), lowByte);
+    return _mm_add_epi32(_mm_add_epi32(r, g), b);
+}
 
-inline unsigned char AverageRGB(unsigned char rgb[3]) {
-    return (unsigned char)(((double)rgb[0] + (double)rgb[1] + (double)rgb[2]) / 3.0);
+// 8 RGBX pixels (two registers)  ->  8 x 16-bit gray averages
+static inline __m128i AverageRGBX_epu16(__m128i px0, __m128i px1) {
+    return Average3_epu16(_mm_packs_epi32(SumRGB_epi32(px0), SumRGB_epi32(px1)));
 }
 
-static void Grayscale2GrayscaleAlpha(unsigned char* src, unsigned char* dest){
-    dest[0] = src[0];
-    dest[1] = 255;
+// 8 RGBA pixels (two registers)  ->  8 x 16-bit alphas
+static inline __m128i Alpha_epu16(__m128i px0, __m128i px1) {
+    return _mm_packs_epi32(_mm_srli_epi32(px0, 24), _mm_srli_epi32(px1, 24));
 }
 
-static void Grayscale2RGB(unsigned char* src, unsigned char* dest){
-    dest[0] = src[0];
-    dest[1] = src[0];
-    dest[2] = src[0];
+// 16 GA pixels (two registers)  ->  16 gray bytes
+static inline __m128i GrayFromGrayscaleAlpha(__m128i ga0, __m128i ga1) {
+    const __m128i lowByte = _mm_set1_epi16(0xFF);
+    return _mm_packus_epi16(_mm_and_si128(ga0, lowByte), _mm_and_si128(ga1, lowByte));
 }
 
-static void Grayscale2RGBA(unsigned char* src, unsigned char* dest){
-    dest[0] = src[0];
-    dest[1] = src[0];
-    dest[2] = src[0];
-    dest[3] = 255;
+#endif
+
+#ifdef TDOGL_SSSE3
+
+// 4 RGB pixels (12 bytes, starting at byte `offset` of the register)  ->  4 RGB0 pixels
+static inline __m128i ExpandRGB(__m128i v, int offset) {
+    const __m128i lo = _mm_setr_epi8(0,1,2,-1, 3,4,5,-1, 6,7,8,-1, 9,10,11,-1);
+    const __m128i hi = _mm_setr_epi8(4,5,6,-1, 7,8,9,-1, 10,11,12,-1, 13,14,15,-1);
+    return _mm_shuffle_epi8(v, offset == 0 ? lo : hi);
 }
 
-static void GrayscaleAlpha2Grayscale(unsigned char* src, unsigned char* dest){
-    dest[0] = src[0];
+// 16 gray bytes  ->  48 RGB bytes
+static inline void StoreGrayAsRGB(__m128i g, unsigned char* dest) {
+    const __m128i m0 = _mm_setr_epi8(0,0,0, 1,1,1, 2,2,2, 3,3,3, 4,4,4, 5);
+    const __m128i m1 = _mm_setr_epi8(5,5, 6,6,6, 7,7,7, 8,8,8, 9,9,9, 10,10);
+    const __m128i m2 = _mm_setr_epi8(10, 11,11,11, 12,12,12, 13,13,13, 14,14,14, 15,15,15);
+    _mm_storeu_si128((__m128i*)(dest +  0), _mm_shuffle_epi8(g, m0));
+    _mm_storeu_si128((__m128i*)(dest + 16), _mm_shuffle_epi8(g, m1));
+    _mm_storeu_si128((__m128i*)(dest + 32), _mm_shuffle_epi8(g, m2));
 }
 
-static void GrayscaleAlpha2RGB(unsigned char* src, unsigned char* dest){
-    dest[0] = src[0];
-    dest[1] = src[0];
-    dest[2] = src[0];
+// loads 16 RGB pixels (48 bytes) as four RGB0 registers, without reading past the end
+static inline void LoadRGBx16(const unsigned char* src, __m128i out[4]) {
+    __m128i a = _mm_loadu_si128((const __m128i*)(src +  0));
+    __m128i b = _mm_loadu_si128((const __m128i*)(src + 12));
+    __m128i c = _mm_loadu_si128((const __m128i*)(src + 24));
+    __m128i d = _mm_loadu_si128((const __m128i*)(src + 32));
+    out[0] = ExpandRGB(a, 0);
+    out[1] = ExpandRGB(b, 0);
+    out[2] = ExpandRGB(c, 0);
+    out[3] = ExpandRGB(d, 4);
 }
 
-static void GrayscaleAlpha2RGBA(unsigned char* src, unsigned char* dest){
-    dest[0] = src[0];
-    dest[1] = src[0];
-    dest[2] = src[0];
-    dest[3] = src[1];
+#endif
+
+static void Grayscale2GrayscaleAlpha(const unsigned char* src, unsigned char* dest, unsigned count){
+    unsigned i = 0;
+#ifdef TDOGL_SSE2
+    const __m128i alpha = _mm_set1_epi8((char)0xFF);
+    for(; i + 16 <= count; i += 16){
+        __m128i g = _mm_loadu_si128((const __m128i*)(src + i));
+        _mm_storeu_si128((__m128i*)(dest + i*2),      _mm_unpacklo_epi8(g, alpha));
+        _mm_storeu_si128((__m128i*)(dest + i*2 + 16), _mm_unpackhi_epi8(g, alpha));
+    }
+#endif
+    for(; i < count; ++i){
+        dest[i*2 + 0] = src[i];
+        dest[i*2 + 1] = 255;
+    }
 }
 
-static void RGB2Grayscale(unsigned char* src, unsigned char* dest){
-    dest[0] = AverageRGB(src);
+static void Grayscale2RGB(const unsigned char* src, unsigned char* dest, unsigned count){
+    unsigned i = 0;
+#ifdef TDOGL_SSSE3
+    for(; i + 16 <= count; i += 16)
+        StoreGrayAsRGB(_mm_loadu_si128((const __m128i*)(src + i)), dest + i*3);
+#endif
+    for(; i < count; ++i){
+        dest[i*3 + 0] = src[i];
+        dest[i*3 + 1] = src[i];
+        dest[i*3 + 2] = src[i];
+    }
+}
+
+static void Grayscale2RGBA(const unsigned char* src, unsigned char* dest, unsigned count){
+    unsigned i = 0;
+#ifdef TDOGL_SSE2
+    const __m128i alpha = _mm_set1_epi8((char)0xFF);
+    for(; i + 16 <= count; i += 16){
+        __m128i g = _mm_loadu_si128((const __m128i*)(src + i));
+        __m128i gg_lo = _mm_unpacklo_epi8(g, g), gg_hi = _mm_unpackhi_epi8(g, g);
+        __m128i ga_lo = _mm_unpacklo_epi8(g, alpha), ga_hi = _mm_unpackhi_epi8(g, alpha);
+        unsigned char* d = dest + i*4;
+        _mm_storeu_si128((__m128i*)(d +  0), _mm_unpacklo_epi16(gg_lo, ga_lo));
+        _mm_storeu_si128((__m128i*)(d + 16), _mm_unpackhi_epi16(gg_lo, ga_lo));
+        _mm_storeu_si128((__m128i*)(d + 32), _mm_unpacklo_epi16(gg_hi, ga_hi));
+        _mm_storeu_si128((__m128i*)(d + 48), _mm_unpackhi_epi16(gg_hi, ga_hi));
+    }
+#endif
+    for(; i < count; ++i){
+        dest[i*4 + 0] = src[i];
+        dest[i*4 + 1] = src[i];
+        dest[i*4 + 2] = src[i];
+        dest[i*4 + 3] = 255;
+    }
 }
 
-static void RGB2GrayscaleAlpha(unsigned char* src, unsigned char* dest){
-    dest[0] = AverageRGB(src);
-    dest[1] = 255;
+static void GrayscaleAlpha2Grayscale(const unsigned char* src, unsigned char* dest, unsigned count){
+    unsigned i = 0;
+#ifdef TDOGL_SSE2
+    for(; i + 16 <= count; i += 16){
+        __m128i ga0 = _mm_loadu_si128((const __m128i*)(src + i*2));
+        __m128i ga1 = _mm_loadu_si128((const __m128i*)(src + i*2 + 16));
+        _mm_storeu_si128((__m128i*)(dest + i), GrayFromGrayscaleAlpha(ga0, ga1));
+    }
+#endif
+    for(; i < count; ++i)
+        dest[i] = src[i*2];
 }
 
-static void RGB2RGBA(unsigned char* src, unsigned char* dest){
-    dest[0] = src[0];
-    dest[1] = src[1];
-    dest[2] = src[2];
-    dest[3] = 255;
+static void GrayscaleAlpha2RGB(const unsigned char* src, unsigned char* dest, unsigned count){
+    unsigned i = 0;
+#ifdef TDOGL_SSSE3
+    for(; i + 16 <= count; i += 16){
+        __m128i ga0 = _mm_loadu_si128((const __m128i*)(src + i*2));
+        __m128i ga1 = _mm_loadu_si128((const __m128i*)(src + i*2 + 16));
+        StoreGrayAsRGB(GrayFromGrayscaleAlpha(ga0, ga1), dest + i*3);
+    }
+#endif
+    for(; i < count; ++i){
+        dest[i*3 + 0] = src[i*2];
+        dest[i*3 + 1] = src[i*2];
+        dest[i*3 + 2] = src[i*2];
+    }
 }
 
-static void RGBA2Grayscale(unsigned char* src, unsigned char* dest){
-    dest[0] = AverageRGB(src);
+static void GrayscaleAlpha2RGBA(const unsigned char* src, unsigned char* dest, unsigned count){
+    unsigned i = 0;
+#ifdef TDOGL_SSE2
+    const __m128i lowByte = _mm_set1_epi16(0xFF);
+    for(; i + 8 <= count; i += 8){
+        __m128i ga = _mm_loadu_si128((const __m128i*)(src + i*2));
+        __m128i g = _mm_and_si128(ga, lowByte);
+        __m128i gg = _mm_or_si128(g, _mm_slli_epi16(g, 8));
+        _mm_storeu_si128((__m128i*)(dest + i*4),      _mm_unpacklo_epi16(gg, ga));
+        _mm_storeu_si128((__m128i*)(dest + i*4 + 16), _mm_unpackhi_epi16(gg, ga));
+    }
+#endif
+    for(; i < count; ++i){
+        dest[i*4 + 0] = src[i*2];
+        dest[i*4 + 1] = src[i*2];
+        dest[i*4 + 2] = src[i*2];
+        dest[i*4 + 3] = src[i*2 + 1];
+    }
 }
 
-static void RGBA2GrayscaleAlpha(unsigned char* src, unsigned char* dest){
-    dest[0] = AverageRGB(src);
-    dest[1] = src[3];
+static void RGB2Grayscale(const unsigned char* src, unsigned char* dest, unsigned count){
+    unsigned i = 0;
+#ifdef TDOGL_SSSE3
+    for(; i + 16 <= count; i += 16){
+        __m128i px[4];
+        LoadRGBx16(src + i*3, px);
+        __m128i avg = _mm_packus_epi16(AverageRGBX_epu16(px[0], px[1]), AverageRGBX_epu16(px[2], px[3]));
+        _mm_storeu_si128((__m128i*)(dest + i), avg);
+    }
+#endif
+    for(; i < count; ++i)
+        dest[i] = AverageRGB(src + i*3);
 }
 
-static void RGBA2RGB(unsigned char* src, unsigned char* dest){
-    dest[0] = src[0];
-    dest[1] = src[1];
-    dest[2] = src[2];
+static void RGB2GrayscaleAlpha(const unsigned char* src, unsigned char* dest, unsigned count){
+    unsigned i = 0;
+#ifdef TDOGL_SSSE3
+    const __m128i alpha = _mm_set1_epi16((short)0xFF00);
+    for(; i + 16 <= count; i += 16){
+        __m128i px[4];
+        LoadRGBx16(src + i*3, px);
+        _mm_storeu_si128((__m128i*)(dest + i*2),      _mm_or_si128(AverageRGBX_epu16(px[0], px[1]), alpha));
+        _mm_storeu_si128((__m128i*)(dest + i*2 + 16), _mm_or_si128(AverageRGBX_epu16(px[2], px[3]), alpha));
+    }
+#endif
+    for(; i < count; ++i){
+        dest[i*2 + 0] = AverageRGB(src + i*3);
+        dest[i*2 + 1] = 255;
+    }
 }
 
-typedef void(*FormatConverterFunc)(unsigned char*, unsigned char*);
+static void RGB2RGBA(const unsigned char* src, unsigned char* dest, unsigned count){
+    unsigned i = 0;
+#ifdef TDOGL_SSSE3
+    const __m128i alpha = _mm_set1_epi32((int)0xFF000000);
+    for(; i + 16 <= count; i += 16){
+        __m128i px[4];
+        LoadRGBx16(src + i*3, px);
+        for(int j = 0; j < 4; ++j)
+            _mm_storeu_si128((__m128i*)(dest + i*4 + j*16), _mm_or_si128(px[j], alpha));
+    }
+#endif
+    for(; i < count; ++i){
+        dest[i*4 + 0] = src[i*3 + 0];
+        dest[i*4 + 1] = src[i*3 + 1];
+        dest[i*4 + 2] = src[i*3 + 2];
+        dest[i*4 + 3] = 255;
+    }
+}
+
+static void RGBA2Grayscale(const unsigned char* src, unsigned char* dest, unsigned count){
+    unsigned i = 0;
+#ifdef TDOGL_SSE2
+    for(; i + 16 <= count; i += 16){
+        const __m128i* s = (const __m128i*)(src + i*4);
+        __m128i avg0 = AverageRGBX_epu16(_mm_loadu_si128(s + 0), _mm_loadu_si128(s + 1));
+        __m128i avg1 = AverageRGBX_epu16(_mm_loadu_si128(s + 2), _mm_loadu_si128(s + 3));
+        _mm_storeu_si128((__m128i*)(dest + i), _mm_packus_epi16(avg0, avg1));
+    }
+#endif
+    for(; i < count; ++i)
+        dest[i] = AverageRGB(src + i*4);
+}
+
+static void RGBA2GrayscaleAlpha(const unsigned char* src, unsigned char* dest, unsigned count){
+    unsigned i = 0;
+#ifdef TDOGL_SSE2
+    for(; i + 8 <= count; i += 8){
+        const __m128i* s = (const __m128i*)(src + i*4);
+        __m128i px0 = _mm_loadu_si128(s + 0), px1 = _mm_loadu_si128(s + 1);
+        __m128i ga = _mm_or_si128(AverageRGBX_epu16(px0, px1), _mm_slli_epi16(Alpha_epu16(px0, px1), 8));
+        _mm_storeu_si128((__m128i*)(dest + i*2), ga);
+    }
+#endif
+    for(; i < count; ++i){
+        dest[i*2 + 0] = AverageRGB(src + i*4);
+        dest[i*2 + 1] = src[i*4 + 3];
+    }
+}
+
+static void RGBA2RGB(const unsigned char* src, unsigned char* dest, unsigned count){
+    unsigned i = 0;
+#ifdef TDOGL_SSSE3
+    const __m128i pack = _mm_setr_epi8(0,1,2, 4,5,6, 8,9,10, 12,13,14, -1,-1,-1,-1);
+    for(; i + 16 <= count; i += 16){
+        const __m128i* s = (const __m128i*)(src + i*4);
+        __m128i p0 = _mm_shuffle_epi8(_mm_loadu_si128(s + 0), pack);
+        __m128i p1 = _mm_shuffle_epi8(_mm_loadu_si128(s + 1), pack);
+        __m128i p2 = _mm_shuffle_epi8(_mm_loadu_si128(s + 2), pack);
+        __m128i p3 = _mm_shuffle_epi8(_mm_loadu_si128(s + 3), pack);
+        unsigned char* d = dest + i*3;
+        _mm_storeu_si128((__m128i*)(d +  0), _mm_or_si128(p0, _mm_slli_si128(p1, 12)));
+        _mm_storeu_si128((__m128i*)(d + 16), _mm_or_si128(_mm_srli_si128(p1, 4), _mm_slli_si128(p2, 8)));
+        _mm_storeu_si128((__m128i*)(d + 32), _mm_or_si128(_mm_srli_si128(p2, 8), _mm_slli_si128(p3, 4)));
+    }
+#endif
+    for(; i < count; ++i){
+        dest[i*3 + 0] = src[i*4 + 0];
+        dest[i*3 + 1] = src[i*4 + 1];
+        dest[i*3 + 2] = src[i*4 + 2];
+    }
+}
+
+typedef void(*FormatConverterFunc)(const unsigned char* src, unsigned char* dest, unsigned pixelCount);
 
 static FormatConverterFunc ConverterFuncForFormats(Bitmap::Format srcFormat, Bitmap::Format destFormat){
     if(srcFormat == destFormat)
@@ -150,24 +436,600 @@ static FormatConverterFunc ConverterFuncForFormats(Bitmap::Format srcFormat, Bit
 }
 
 
+/*
+ * Channel type converters
+ *
+ * Pixels are converted between channel types through rows of floats, where
+ * every channel type runs from 0 to 1, and the format conversion (if any) is
+ * done on the floats. Conversions between 8-bit formats use the converters
+ * above instead.
+ */
+
+static void ChannelsToFloats(const unsigned char* src, Bitmap::ChannelType type, float* dest, size_t count) {
+    switch(type){
+        case Bitmap::ChannelType_UInt8:
+            for(size_t i = 0; i < count; ++i)
+                dest[i] = src[i] / 255.0f;
+            break;
+        case Bitmap::ChannelType_UInt16: {
+            const unsigned short* channels = (const unsigned short*)src;
+            for(size_t i = 0; i < count; ++i)
+                dest[i] = channels[i] / 65535.0f;
+            break;
+        }
+        case Bitmap::ChannelType_Half:
+            HalfToFloat((const unsigned short*)src, dest, count);
+            break;
+        case Bitmap::ChannelType_Float:
+            memcpy(dest, src, count * sizeof(float));
+            break;
+        default:
+            throw std::runtime_error("Unhandled bitmap channel type");
+    }
+}
+
+// rounds to the nearest integer channel value, clamping anything outside 0 to 1 (and NaN to 0)
+inline unsigned short FloatToUInt16(float value) {
+    float scaled = value * 65535.0f + 0.5f;
+    if(!(scaled > 0.0f)) return 0;
+    if(scaled >= 65535.0f) return 65535;
+    return (unsigned short)scaled;
+}
+
+static void FloatsToChannels(const float* src, Bitmap::ChannelType type, unsigned char* dest, size_t count) {
+    switch(type){
+        case Bitmap::ChannelType_UInt8:
+            for(size_t i = 0; i < count; ++i)
+                dest[i] = LinearToByte(src[i]);
+            break;
+        case Bitmap::ChannelType_UInt16: {
+            unsigned short* channels = (unsigned short*)dest;
+            for(size_t i = 0; i < count; ++i)
+                channels[i] = FloatToUInt16(src[i]);
+            break;
+        }
+        case Bitmap::ChannelType_Half:
+            FloatToHalf(src, (unsigned short*)dest, count);
+            break;
+        case Bitmap::ChannelType_Float:
+            memcpy(dest, src, count * sizeof(float));
+            break;
+        default:
+            throw std::runtime_error("Unhandled bitmap channel type");
+    }
+}
+
+// converts `count` pixels of float channels between formats. Gray is the average of
+// the color channels, and alpha is 1 for formats without alpha
+static void ConvertFloatFormat(const float* src, Bitmap::Format srcFormat, float* dest, Bitmap::Format destFormat, unsigned count) {
+    unsigned srcChannels = srcFormat;
+    unsigned destChannels = destFormat;
+    bool srcHasColor = srcFormat >= Bitmap::Format_RGB;
+    bool srcHasAlpha = srcFormat == Bitmap::Format_GrayscaleAlpha || srcFormat == Bitmap::Format_RGBA;
+    bool destHasColor = destFormat >= Bitmap::Format_RGB;
+    bool destHasAlpha = destFormat == Bitmap::Format_GrayscaleAlpha || destFormat == Bitmap::Format_RGBA;
+    
+    for(unsigned i = 0; i < count; ++i, src += srcChannels, dest += destChannels){
+        if(destHasColor){
+            dest[0] = src[0];
+            dest[1] = srcHasColor ? src[1] : src[0];
+            dest[2] = srcHasColor ? src[2] : src[0];
+        } else {
+            dest[0] = srcHasColor ? (src[0] + src[1] + src[2]) / 3.0f : src[0];
+        }
+        if(destHasAlpha)
+            dest[destChannels - 1] = srcHasAlpha ? src[srcChannels - 1] : 1.0f;
+    }
+}
+
+
+/*
+ * Transpose and rotation kernels
+ *
+ * Rotations by 90 degrees are transposes with one axis of the destination
+ * reversed. Rows are addressed by their pitch in bytes, so padded rows work.
+ * The source is walked in square tiles so that the column-wise writes into
+ * the destination stay within a few cache lines and pages at a time. Each
+ * tile is processed in blocks; the generic block is a single pixel, and the
+ * SSE2 specializations transpose 4x4 RGBA and 8x8 grayscale+alpha blocks in
+ * registers.
+ */
+
+template <unsigned N>
+struct PixelBytes {
+    unsigned char c[N];
+};
+
+static const unsigned TransposeTileSize = 32;
+
+template <typename Pixel>
+struct TransposeKernel {
+    enum { BlockSize = 1 };
+    
+    // `dest` is where src[0] goes. Moving one source row moves `srcPitch` bytes.
+    // Moving one pixel along a source row moves `destRowStep` bytes in the
+    // destination, and moving one source row moves `destColStep` (+1 or -1) pixels.
+    static inline void block(const Pixel* src, ptrdiff_t /*srcPitch*/, Pixel* dest, ptrdiff_t /*destRowStep*/, ptrdiff_t /*destColStep*/) {
+        *dest = *src;
+    }
+};
+
+// moves `pixel` by `bytes`, which needn't be a whole number of pixels
+template <typename Pixel>
+inline Pixel* OffsetPixel(Pixel* pixel, ptrdiff_t bytes) {
+    return (Pixel*)((unsigned char*)pixel + bytes);
+}
+
+template <typename Pixel>
+inline const Pixel* OffsetPixel(const Pixel* pixel, ptrdiff_t bytes) {
+    return (const Pixel*)((const unsigned char*)pixel + bytes);
+}
+
+#ifdef TDOGL_SSE2
+
+template <>
+struct TransposeKernel< PixelBytes<4> > {
+    enum { BlockSize = 4 };
+    
+    static inline void block(const PixelBytes<4>* src, ptrdiff_t srcPitch, PixelBytes<4>* dest, ptrdiff_t destRowStep, ptrdiff_t destColStep) {
+        __m128i r0 = _mm_loadu_si128((const __m128i*)OffsetPixel(src, 0*srcPitch));
+        __m128i r1 = _mm_loadu_si128((const __m128i*)OffsetPixel(src, 1*srcPitch));
+        __m128i r2 = _mm_loadu_si128((const __m128i*)OffsetPixel(src, 2*srcPitch));
+        __m128i r3 = _mm_loadu_si128((const __m128i*)OffsetPixel(src, 3*srcPitch));
+        
+        __m128i t0 = _mm_unpacklo_epi32(r0, r1);
+        __m128i t1 = _mm_unpacklo_epi32(r2, r3);
+        __m128i t2 = _mm_unpackhi_epi32(r0, r1);
+        __m128i t3 = _mm_unpackhi_epi32(r2, r3);
+        
+        __m128i cols[4] = {
+            _mm_unpacklo_epi64(t0, t1),
+            _mm_unpackhi_epi64(t0, t1),
+            _mm_unpacklo_epi64(t2, t3),
+            _mm_unpackhi_epi64(t2, t3)
+        };
+        
+        for(int i = 0; i < 4; ++i){
+            if(destColStep > 0){
+                _mm_storeu_si128((__m128i*)OffsetPixel(dest, i*destRowStep), cols[i]);
+            } else {
+                _mm_storeu_si128((__m128i*)(OffsetPixel(dest, i*destRowStep) - 3), _mm_shuffle_epi32(cols[i], 0x1B));
+            }
+        }
+    }
+};
+
+template <>
+struct TransposeKernel< PixelBytes<2> > {
+    enum { BlockSize = 8 };
+    
+    static inline void block(const PixelBytes<2>* src, ptrdiff_t srcPitch, PixelBytes<2>* dest, ptrdiff_t destRowStep, ptrdiff_t destColStep) {
+        __m128i a[8];
+        for(int i = 0; i < 8; ++i)
+            a[i] = _mm_loadu_si128((const __m128i*)OffsetPixel(src, i*srcPitch));
+        
+        __m128i b0 = _mm_unpacklo_epi16(a[0], a[1]), b1 = _mm_unpackhi_epi16(a[0], a[1]);
+        __m128i b2 = _mm_unpacklo_epi16(a[2], a[3]), b3 = _mm_unpackhi_epi16(a[2], a[3]);
+        __m128i b4 = _mm_unpacklo_epi16(a[4], a[5]), b5 = _mm_unpackhi_epi16(a[4], a[5]);
+        __m128i b6 = _mm_unpacklo_epi16(a[6], a[7]), b7 = _mm_unpackhi_epi16(a[6], a[7]);
+        
+        __m128i c0 = _mm_unpacklo_epi32(b0, b2), c1 = _mm_unpackhi_epi32(b0, b2);
+        __m128i c2 = _mm_unpacklo_epi32(b1, b3), c3 = _mm_unpackhi_epi32(b1, b3);
+        __m128i c4 = _mm_unpacklo_epi32(b4, b6), c5 = _mm_unpackhi_epi32(b4, b6);
+        __m128i c6 = _mm_unpacklo_epi32(b5, b7), c7 = _mm_unpackhi_epi32(b5, b7);
+        
+        __m128i cols[8] = {
+            _mm_unpacklo_epi64(c0, c4), _mm_unpackhi_epi64(c0, c4),
+            _mm_unpacklo_epi64(c1, c5), _mm_unpackhi_epi64(c1, c5),
+            _mm_unpacklo_epi64(c2, c6), _mm_unpackhi_epi64(c2, c6),
+            _mm_unpacklo_epi64(c3, c7), _mm_unpackhi_epi64(c3, c7)
+        };
+        
+        for(int i = 0; i < 8; ++i){
+            if(destColStep > 0){
+                _mm_storeu_si128((__m128i*)OffsetPixel(dest, i*destRowStep), cols[i]);
+            } else {
+                __m128i reversed = _mm_shuffle_epi32(cols[i], 0x4E);
+                reversed = _mm_shufflelo_epi16(reversed, 0x1B);
+                reversed = _mm_shufflehi_epi16(reversed, 0x1B);
+                _mm_storeu_si128((__m128i*)(OffsetPixel(dest, i*destRowStep) - 7), reversed);
+            }
+        }
+    }
+};
+
+#endif
+
+template <typename Pixel>
+static void TransposePixels(const Pixel* src, unsigned width, unsigned height, ptrdiff_t srcPitch, Pixel* dest, ptrdiff_t destRowStep, ptrdiff_t destColStep) {
+    typedef TransposeKernel<Pixel> Kernel;
+    const unsigned B = Kernel::BlockSize;
+    
+    for(unsigned tileRow = 0; tileRow < height; tileRow += TransposeTileSize){
+        unsigned rowEnd = std::min(tileRow + TransposeTileSize, height);
+        unsigned blockRowEnd = tileRow + (rowEnd - tileRow) / B * B;
+        
+        for(unsigned tileCol = 0; tileCol < width; tileCol += TransposeTileSize){
+            unsigned colEnd = std::min(tileCol + TransposeTileSize, width);
+            unsigned blockColEnd = tileCol + (colEnd - tileCol) / B * B;
+            
+            for(unsigned row = tileRow; row < rowEnd; row += (row < blockRowEnd ? B : 1)){
+                for(unsigned col = tileCol; col < colEnd; ){
+                    const Pixel* s = OffsetPixel(src, (ptrdiff_t)row*srcPitch) + col;
+                    Pixel* d = OffsetPixel(dest, (ptrdiff_t)col*destRowStep) + (ptrdiff_t)row*destColStep;
+                    if(row < blockRowEnd && col < blockColEnd){
+                        Kernel::block(s, srcPitch, d, destRowStep, destColStep);
+                        col += B;
+                    } else if(row < blockRowEnd){
+                        // right edge of the tile: finish the B rows of this block row one pixel at a time
+                        for(unsigned i = 0; i < B; ++i)
+                            d[i*destColStep] = *OffsetPixel(s, i*srcPitch);
+                        ++col;
+                    } else {
+                        *d = *s;
+                        ++col;
+                    }
+                }
+            }
+        }
+    }
+}
+
+// Writes the src image transposed into dest, optionally reversing the rows
+// and/or columns of the destination.
+template <typename Pixel>
+static void TransposeInto(const unsigned char* src, unsigned width, unsigned height, ptrdiff_t srcPitch, unsigned char* dest, ptrdiff_t destPitch, bool reverseRows, bool reverseCols) {
+    // destination is `height` pixels wide and `width` pixels tall
+    ptrdiff_t destRowStep = reverseRows ? -destPitch : destPitch;
+    ptrdiff_t destColStep = reverseCols ? -1 : 1;
+    Pixel* destStart = (Pixel*)dest;
+    if(reverseRows) destStart = OffsetPixel(destStart, (ptrdiff_t)(width - 1) * destPitch);
+    if(reverseCols) destStart += height - 1;
+    
+    TransposePixels((const Pixel*)src, width, height, srcPitch, destStart, destRowStep, destColStep);
+}
+
+// pixels are moved as opaque blocks of bytes, so only their size matters
+// pitches may be negative, for vertically flipped views
+static void TransposeInto(const unsigned char* src, unsigned width, unsigned height, ptrdiff_t srcPitch, unsigned pixelSize, unsigned char* dest, ptrdiff_t destPitch, bool reverseRows, bool reverseCols) {
+    switch(pixelSize){
+        case 1:  TransposeInto< PixelBytes<1> >(src, width, height, srcPitch, dest, destPitch, reverseRows, reverseCols); break;
+        case 2:  TransposeInto< PixelBytes<2> >(src, width, height, srcPitch, dest, destPitch, reverseRows, reverseCols); break;
+        case 3:  TransposeInto< PixelBytes<3> >(src, width, height, srcPitch, dest, destPitch, reverseRows, reverseCols); break;
+        case 4:  TransposeInto< PixelBytes<4> >(src, width, height, srcPitch, dest, destPitch, reverseRows, reverseCols); break;
+        case 6:  TransposeInto< PixelBytes<6> >(src, width, height, srcPitch, dest, destPitch, reverseRows, reverseCols); break;
+        case 8:  TransposeInto< PixelBytes<8> >(src, width, height, srcPitch, dest, destPitch, reverseRows, reverseCols); break;
+        case 12: TransposeInto< PixelBytes<12> >(src, width, height, srcPitch, dest, destPitch, reverseRows, reverseCols); break;
+        case 16: TransposeInto< PixelBytes<16> >(src, width, height, srcPitch, dest, destPitch, reverseRows, reverseCols); break;
+        default:
+            throw std::runtime_error("Unhandled bitmap pixel size");
+    }
+}
+
+// Swaps row `a` with row `b` reversed (and vice versa), for the first `count`
+// pixels of `a`. Reverses a single row in place when a == b and count == width/2.
+template <typename Pixel>
+static void SwapReversedRows(Pixel* a, Pixel* b, unsigned width, unsigned count) {
+    unsigned i = 0;
+#ifdef TDOGL_SSE2
+    if(sizeof(Pixel) == 4){
+        for(; i + 4 <= count; i += 4){
+            __m128i* pa = (__m128i*)(a + i);
+            __m128i* pb = (__m128i*)(b + width - 4 - i);
+            __m128i va = _mm_shuffle_epi32(_mm_loadu_si128(pa), 0x1B);
+            __m128i vb = _mm_shuffle_epi32(_mm_loadu_si128(pb), 0x1B);
+            _mm_storeu_si128(pa, vb);
+            _mm_storeu_si128(pb, va);
+        }
+    }
+#endif
+    for(; i < count; ++i){
+        Pixel tmp = a[i];
+        a[i] = b[width - 1 - i];
+        b[width - 1 - i] = tmp;
+    }
+}
+
+template <typename Pixel>
+static void Rotate180InPlace(unsigned char* pixels, unsigned width, unsigned height, size_t pitch) {
+    for(unsigned row = 0; row < height / 2; ++row)
+        SwapReversedRows((Pixel*)(pixels + row*pitch), (Pixel*)(pixels + (height - 1 - row)*pitch), width, width);
+    
+    if(height % 2){
+        Pixel* middle = (Pixel*)(pixels + (height / 2)*pitch);
+        SwapReversedRows(middle, middle, width, width / 2);
+    }
+}
+
+
+/*
+ * Color space and alpha kernels
+ *
+ * Each kernel works on `count` consecutive pixels, in place. Only the color
+ * channels of RGB and RGBA pixels can be sRGB encoded; grayscale and alpha are
+ * always linear, so premultiplying them is plain integer arithmetic. Every
+ * sRGB result only depends on one or two bytes, so those go through tables,
+ * which are built with the batch LinearToSRGB encoder.
+ */
+
+// bitmaps with fewer pixels than this are processed on the calling thread
+static const size_t ParallelPixelThreshold = 256 * 256;
+
+namespace {
+    // sRGB encoding and decoding of bytes, rounded to the nearest byte
+    struct ByteCurves {
+        unsigned char toLinear[256];
+        unsigned char toSRGB[256];
+        
+        ByteCurves() {
+            for(unsigned i = 0; i < 256; ++i){
+                toLinear[i] = LinearToByte(SRGBToLinear((unsigned char)i));
+                toSRGB[i] = LinearToSRGB(i / 255.0f);
+            }
+        }
+    };
+    
+    // 255 / alpha, or zero for zero alpha so fully transparent pixels become black
+    struct UnpremultiplyScales {
+        float scale[256];
+        
+        UnpremultiplyScales() {
+            scale[0] = 0.0f;
+            for(unsigned a = 1; a < 256; ++a)
+                scale[a] = 255.0f / a;
+        }
+    };
+    
+    // sRGB encoded colors multiplied by alpha in linear space, indexed by [alpha][color]
+    struct AlphaCurves {
+        unsigned char premultiply[256][256];
+        unsigned char unpremultiply[256][256];
+        
+        explicit AlphaCurves(const float* unpremultiplyScales) {
+            const float* linear = SRGBToLinearTable();
+            float scaled[256];
+            for(unsigned a = 0; a < 256; ++a){
+                for(unsigned c = 0; c < 256; ++c)
+                    scaled[c] = linear[c] * (a / 255.0f);
+                LinearToSRGB(scaled, premultiply[a], 256);
+                
+                //colors brighter than their alpha get clamped by the encoder
+                for(unsigned c = 0; c < 256; ++c)
+                    scaled[c] = linear[c] * unpremultiplyScales[a];
+                LinearToSRGB(scaled, unpremultiply[a], 256);
+            }
+        }
+    };
+}
+
+static const ByteCurves& Curves() {
+    static const ByteCurves curves;
+    return curves;
+}
+
+static const float* UnpremultiplyTable() {
+    static const UnpremultiplyScales scales;
+    return scales.scale;
+}
+
+static const AlphaCurves& SRGBAlphaCurves() {
+    static const AlphaCurves curves(UnpremultiplyTable());
+    return curves;
+}
+
+// (a * b) / 255, rounded to the nearest integer, for a and b up to 255
+inline unsigned MulDiv255(unsigned a, unsigned b) {
+    unsigned t = a * b + 128;
+    return (t + (t >> 8)) >> 8;
+}
+
+static void ApplyColorCurve(unsigned char* pixels, size_t count, unsigned channels, const unsigned char* curve) {
+    for(size_t i = 0; i < count; ++i, pixels += channels){
+        pixels[0] = curve[pixels[0]];
+        pixels[1] = curve[pixels[1]];
+        pixels[2] = curve[pixels[2]];
+    }
+}
+
+#ifdef TDOGL_SSE2
+// MulDiv255 on eight 16-bit lanes
+inline __m128i MulDiv255x8(__m128i channels, __m128i alphas) {
+    __m128i t = _mm_add_epi16(_mm_mullo_epi16(channels, alphas), _mm_set1_epi16(128));
+    return _mm_srli_epi16(_mm_add_epi16(t, _mm_srli_epi16(t, 8)), 8);
+}
+#endif
+
+// premultiplies GrayscaleAlpha pixels, or RGBA pixels with linear color
+static void PremultiplyLinear(unsigned char* pixels, size_t count, unsigned channels) {
+    size_t i = 0;
+#ifdef TDOGL_SSE2
+    const __m128i zero = _mm_setzero_si128();
+    // the bytes of the alpha channels, which are kept as they are
+    const __m128i alphaMask = channels == 4 ? _mm_set1_epi32((int)0xFF000000) : _mm_set1_epi16((short)0xFF00);
+    size_t pixelsPerBlock = 16 / channels;
+    for(; i + pixelsPerBlock <= count; i += pixelsPerBlock){
+        unsigned char* p = pixels + i*channels;
+        __m128i px = _mm_loadu_si128((const __m128i*)p);
+        __m128i lo = _mm_unpacklo_epi8(px, zero);
+        __m128i hi = _mm_unpackhi_epi8(px, zero);
+        __m128i alphaLo, alphaHi;
+        if(channels == 4){
+            alphaLo = _mm_shufflehi_epi16(_mm_shufflelo_epi16(lo, _MM_SHUFFLE(3,3,3,3)), _MM_SHUFFLE(3,3,3,3));
+            alphaHi = _mm_shufflehi_epi16(_mm_shufflelo_epi16(hi, _MM_SHUFFLE(3,3,3,3)), _MM_SHUFFLE(3,3,3,3));
+        } else {
+            alphaLo = _mm_shufflehi_epi16(_mm_shufflelo_epi16(lo, _MM_SHUFFLE(3,3,1,1)), _MM_SHUFFLE(3,3,1,1));
+            alphaHi = _mm_shufflehi_epi16(_mm_shufflelo_epi16(hi, _MM_SHUFFLE(3,3,1,1)), _MM_SHUFFLE(3,3,1,1));
+        }
+        __m128i result = _mm_packus_epi16(MulDiv255x8(lo, alphaLo), MulDiv255x8(hi, alphaHi));
+        result = _mm_or_si128(_mm_andnot_si128(alphaMask, result), _mm_and_si128(alphaMask, px));
+        _mm_storeu_si128((__m128i*)p, result);
+    }
+#endif
+    for(; i < count; ++i){
+        unsigned char* p = pixels + i*channels;
+        unsigned alpha = p[channels - 1];
+        for(unsigned c = 0; c + 1 < channels; ++c)
+            p[c] = (unsigned char)MulDiv255(p[c], alpha);
+    }
+}
+
+// unpremultiplies GrayscaleAlpha pixels, or RGBA pixels with linear color
+static void UnpremultiplyLinear(unsigned char* pixels, size_t count, unsigned channels) {
+    const float* scales = UnpremultiplyTable();
+    size_t i = 0;
+#ifdef TDOGL_SSE2
+    if(channels == 4){
+        const __m128i zero = _mm_setzero_si128();
+        const __m128 half = _mm_set1_ps(0.5f);
+        const __m128 max = _mm_set1_ps(255.0f);
+        for(; i + 2 <= count; i += 2){
+            unsigned char* p = pixels + i*4;
+            __m128i px = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)p), zero);
+            __m128 first = _mm_cvtepi32_ps(_mm_unpacklo_epi16(px, zero));
+            __m128 second = _mm_cvtepi32_ps(_mm_unpackhi_epi16(px, zero));
+            // alpha is scaled by one, so it comes through unchanged
+            float scale0 = scales[p[3]];
+            float scale1 = scales[p[7]];
+            first = _mm_min_ps(_mm_add_ps(_mm_mul_ps(first, _mm_setr_ps(scale0, scale0, scale0, 1.0f)), half), max);
+            second = _mm_min_ps(_mm_add_ps(_mm_mul_ps(second, _mm_setr_ps(scale1, scale1, scale1, 1.0f)), half), max);
+            __m128i result = _mm_packs_epi32(_mm_cvttps_epi32(first), _mm_cvttps_epi32(second));
+            _mm_storel_epi64((__m128i*)p, _mm_packus_epi16(result, zero));
+        }
+    }
+#endif
+    for(; i < count; ++i){
+        unsigned char* p = pixels + i*channels;
+        float scale = scales[p[channels - 1]];
+        for(unsigned c = 0; c + 1 < channels; ++c)
+            p[c] = (unsigned char)std::min(255.0f, p[c] * scale + 0.5f);
+    }
+}
+
+// premultiplies or unpremultiplies RGBA pixels with sRGB encoded color, using a table from AlphaCurves
+static void ApplyAlphaCurve(unsigned char* pixels, size_t count, const unsigned char (*curves)[256]) {
+    for(size_t i = 0; i < count; ++i, pixels += 4){
+        const unsigned char* curve = curves[pixels[3]];
+        pixels[0] = curve[pixels[0]];
+        pixels[1] = curve[pixels[1]];
+        pixels[2] = curve[pixels[2]];
+    }
+}
+
+// runs `kernel` over every pixel of the bitmap, in runs of whole rows spread across threads.
+// When the row pitch is a whole number of pixels, the padding at the end of each row is
+// processed too, so the rows join up into one long run
+static void ForEachPixelRun(const Bitmap& bitmap, const std::function<void(unsigned char* pixels, size_t count)>& kernel) {
+    size_t width = bitmap.width();
+    size_t pixelSize = bitmap.bytesPerPixel();
+    bool joined = (bitmap.rowPitch() % pixelSize == 0);
+    size_t pitchPixels = bitmap.rowPitch() / pixelSize;
+    auto rows = [&](size_t begin, size_t end) {
+        if(joined){
+            kernel(bitmap.row((unsigned)begin), (end - begin) * pitchPixels);
+        } else {
+            for(size_t row = begin; row < end; ++row)
+                kernel(bitmap.row((unsigned)row), width);
+        }
+    };
+    
+    if(width * bitmap.height() >= ParallelPixelThreshold)
+        ThreadPool::shared().parallelFor(bitmap.height(), 16, rows);
+    else
+        rows(0, bitmap.height());
+}
+
+
 /*
  * Misc funcs
  */
 
-inline unsigned GetPixelOffset(unsigned col, unsigned row, unsigned width, unsigned height, Bitmap::Format format) {
-    return (row*width + col)*format;
+// size_t, because row*pitch overflows 32 bits past 4GB of pixels
+inline size_t GetPixelOffset(unsigned col, unsigned row, size_t pitch, unsigned pixelSize) {
+    return row*pitch + (size_t)col*pixelSize;
+}
+
+inline size_t RoundUp(size_t value, size_t multiple) {
+    return (value + multiple - 1) / multiple * multiple;
+}
+
+// Gets a block of at least `size` bytes from `allocator` in `block`, and returns the
+// first byte in it that is aligned to Bitmap::PixelAlignment. PoolAllocator blocks are
+// aligned already, but other allocators may need a bigger block to align within.
+static unsigned char* AllocateAligned(Allocator& allocator, size_t size, void*& block) {
+    const size_t alignment = Bitmap::PixelAlignment;
+    block = allocator.allocate(size);
+    if(block && (uintptr_t)block % alignment != 0){
+        allocator.deallocate(block);
+        block = (size <= (size_t)-1 - alignment) ? allocator.allocate(size + alignment - 1) : NULL;
+    }
+    
+    if(!block)
+        throw std::runtime_error("Failed to allocate bitmap pixels");
+    return (unsigned char*)RoundUp((uintptr_t)block, alignment);
 }
 
 inline bool RectsOverlap(unsigned srcCol, unsigned srcRow, unsigned destCol, unsigned destRow, unsigned width, unsigned height){
     unsigned colDiff = srcCol > destCol ? srcCol - destCol : destCol - srcCol;
-    if(colDiff < width)
-        return true;
-    
     unsigned rowDiff = srcRow > destRow ? srcRow - destRow : destRow - srcRow;
-    if(rowDiff < height)
-        return true;
+    return colDiff < width && rowDiff < height;
+}
+
+
+/*
+ * View functions
+ *
+ * Declared in BitmapView.h, but defined here to share the conversion and
+ * transpose kernels with Bitmap.
+ */
+
+void tdogl::CopyPixels(const BitmapView& src, const BitmapView& dest) {
+    if(src.width() != dest.width() || src.height() != dest.height())
+        throw std::runtime_error("Can't copy pixels between views of different sizes");
+    
+    Bitmap::Format destFormat = dest.format();
+    Bitmap::ChannelType destType = dest.channelType();
+    bool sameFormat = (destFormat == src.format() && destType == src.channelType());
+    bool bytes = (destType == Bitmap::ChannelType_UInt8 && src.channelType() == Bitmap::ChannelType_UInt8);
+    FormatConverterFunc converter = NULL;
+    if(!sameFormat && bytes)
+        converter = ConverterFuncForFormats(src.format(), destFormat);
+    
+    //everything else goes through a row of floats in the source format, then the destination format
+    std::vector<float> floats;
+    if(!sameFormat && !bytes)
+        floats.resize((size_t)src.width() * (src.format() + destFormat));
+    
+    size_t channelCount = (size_t)src.width() * destFormat;
+    size_t rowSize = (size_t)src.width() * dest.bytesPerPixel();
+    for(unsigned rowIdx = 0; rowIdx < src.height(); ++rowIdx){
+        const unsigned char* srcRowPtr = src.row(rowIdx);
+        unsigned char* destRowPtr = dest.row(rowIdx);
+        
+        if(converter){
+            converter(srcRowPtr, destRowPtr, src.width());
+        } else if(!floats.empty()){
+            float* srcFloats = &floats[0];
+            float* destFloats = srcFloats;
+            ChannelsToFloats(srcRowPtr, src.channelType(), srcFloats, (size_t)src.width() * src.format());
+            if(destFormat != src.format()){
+                destFloats = srcFloats + (size_t)src.width() * src.format();
+                ConvertFloatFormat(srcFloats, src.format(), destFloats, destFormat, src.width());
+            }
+            FloatsToChannels(destFloats, destType, destRowPtr, channelCount);
+        } else {
+            memcpy(destRowPtr, srcRowPtr, rowSize);
+        }
+    }
+}
+
+void tdogl::CopyTransposedPixels(const BitmapView& src, const BitmapView& dest, bool reverseRows, bool reverseCols) {
+    if(src.width() != dest.height() || src.height() != dest.width())
+        throw std::runtime_error("Transposed view has the wrong size");
+    if(src.format() != dest.format() || src.channelType() != dest.channelType())
+        throw std::runtime_error("Can't transpose pixels between different formats");
     
-    return false;
+    TransposeInto(src.origin(), src.width(), src.height(), src.rowStride(), src.bytesPerPixel(),
+                  dest.origin(), dest.rowStride(), reverseRows, reverseCols);
 }
 
 
@@ -175,37 +1037,296 @@ inline bool RectsOverlap(unsigned srcCol, unsigned srcRow, unsigned destCol, uns
  * Bitmap class
  */
 
+const size_t Bitmap::PixelAlignment;
+const size_t Bitmap::RowAlignment;
+
 Bitmap::Bitmap(unsigned width, 
                unsigned height, 
                Format format,
                const unsigned char* pixels) :
-    _pixels(NULL)
+    _pixels(NULL),
+    _block(NULL),
+    _allocator(NULL),
+    _deleter(NULL)
+{
+    _set(width, height, format, ChannelType_UInt8, pixels);
+}
+
+Bitmap::Bitmap(unsigned width,
+               unsigned height,
+               Format format,
+               ChannelType channelType,
+               const void* pixels) :
+    _pixels(NULL),
+    _block(NULL),
+    _allocator(NULL),
+    _deleter(NULL)
 {
-    _set(width, height, format, pixels);
+    _set(width, height, format, channelType, pixels);
+}
+
+Bitmap::Bitmap(unsigned width,
+               unsigned height,
+               Format format,
+               unsigned char* pixels,
+               PixelDeleter deleter) :
+    Bitmap(width, height, format, ChannelType_UInt8, pixels, deleter)
+{
+}
+
+Bitmap::Bitmap(unsigned width,
+               unsigned height,
+               Format format,
+               ChannelType channelType,
+               void* pixels,
+               PixelDeleter deleter,
+               size_t rowPitch) :
+    _format(format),
+    _channelType(channelType),
+    _width(width),
+    _height(height),
+    _rowPitch(rowPitch ? rowPitch : (size_t)width * format * channelSize(channelType)),
+    _pixels((unsigned char*)pixels),
+    _block(pixels),
+    _allocator(NULL),
+    _deleter(deleter)
+{
+    if(!pixels || !deleter)
+        throw std::runtime_error("Adopted bitmap needs both pixels and a deleter");
+    if(width == 0 || height == 0 || format <= 0 || format > 4 || (unsigned)channelType > ChannelType_Float) {
+        deleter(pixels);
+        throw std::runtime_error("Invalid bitmap dimensions or format");
+    }
+    if(_rowPitch < (size_t)width * bytesPerPixel()) {
+        deleter(pixels);
+        throw std::runtime_error("Bitmap row pitch is smaller than a row of pixels");
+    }
+}
+
+Bitmap::Bitmap(const BitmapView& view) :
+    _pixels(NULL),
+    _block(NULL),
+    _allocator(NULL),
+    _deleter(NULL)
+{
+    _set(view.width(), view.height(), view.format(), view.channelType(), NULL);
+    CopyPixels(view, BitmapView(*this));
 }
 
 Bitmap::~Bitmap() {
-    if(_pixels) free(_pixels);
+    _release();
+}
+
+static void FreeStbiPixels(void* pixels) {
+    PoolAllocator::shared().deallocate(pixels);
 }
 
-Bitmap Bitmap::bitmapFromFile(std::string filePath) {    
+// makes a bitmap from pixels decoded by stb_image. Small images are decoded into the
+// scratch arena, so they have to be moved to the pool before the arena's scope ends,
+// and stb_image only decodes floats, so Half bitmaps are converted into a new buffer
+static Bitmap AdoptStbiPixels(void* pixels, int width, int height, int channels, Bitmap::ChannelType channelType) {
+    size_t channelCount = (size_t)width * height * channels;
+    Bitmap::ChannelType decodedType = (channelType == Bitmap::ChannelType_Half) ? Bitmap::ChannelType_Float : channelType;
+    size_t size = channelCount * Bitmap::channelSize(channelType);
+    
+    void* kept = pixels;
+    if(decodedType != channelType || ScratchArena::threadLocal().owns(pixels)){
+        kept = PoolAllocator::shared().allocate(size);
+        if(!kept){
+            StbiFree(pixels);
+            throw std::runtime_error("Failed to allocate bitmap pixels");
+        }
+        if(decodedType != channelType)
+            FloatToHalf((const float*)pixels, (unsigned short*)kept, channelCount);
+        else
+            memcpy(kept, pixels, size);
+        StbiFree(pixels);
+    }
+    return Bitmap(width, height, (Bitmap::Format)channels, channelType, kept, FreeStbiPixels);
+}
+
+Bitmap Bitmap::bitmapFromFile(std::string filePath, ChannelType channelType) {    
+    ScratchArena::Scope scratch(ScratchArena::threadLocal());
     int width, height, channels;
-    unsigned char* pixels = stbi_load(filePath.c_str(), &width, &height, &channels, 0);
+    void* pixels;
+    switch(channelType){
+        case ChannelType_UInt8:  pixels = stbi_load(filePath.c_str(), &width, &height, &channels, 0); break;
+        case ChannelType_UInt16: pixels = stbi_load_16(filePath.c_str(), &width, &height, &channels, 0); break;
+        default:                 pixels = stbi_loadf(filePath.c_str(), &width, &height, &channels, 0); break;
+    }
     if(!pixels) throw std::runtime_error(stbi_failure_reason());
     
-    Bitmap bmp(width, height, (Format)channels, pixels);
-    stbi_image_free(pixels);
-    return bmp;
+    return AdoptStbiPixels(pixels, width, height, channels, channelType);
 }
 
-Bitmap::Bitmap(const Bitmap& other) :
-    _pixels(NULL)
+Bitmap Bitmap::bitmapFromMemory(const void* data, size_t size, ChannelType channelType) {
+    if(!data || size == 0)
+        throw std::runtime_error("No image data to decode");
+    if(size > INT_MAX)
+        throw std::runtime_error("Image data is too large to decode");
+    
+    ScratchArena::Scope scratch(ScratchArena::threadLocal());
+    int width, height, channels;
+    const stbi_uc* buffer = (const stbi_uc*)data;
+    void* pixels;
+    switch(channelType){
+        case ChannelType_UInt8:  pixels = stbi_load_from_memory(buffer, (int)size, &width, &height, &channels, 0); break;
+        case ChannelType_UInt16: pixels = stbi_load_16_from_memory(buffer, (int)size, &width, &height, &channels, 0); break;
+        default:                 pixels = stbi_loadf_from_memory(buffer, (int)size, &width, &height, &channels, 0); break;
+    }
+    if(!pixels) throw std::runtime_error(stbi_failure_reason());
+    
+    return AdoptStbiPixels(pixels, width, height, channels, channelType);
+}
+
+Bitmap Bitmap::bitmapFromMappedFile(const std::string& filePath, ChannelType channelType) {
+    MappedFile file(filePath);
+    return bitmapFromMemory(file.data(), file.size(), channelType);
+}
+
+Bitmap Bitmap::bitmapFromMemoryScaled(const void* data,
+                                      size_t size,
+                                      unsigned scaleShift,
+                                      unsigned regionX,
+                                      unsigned regionY,
+                                      unsigned regionWidth,
+                                      unsigned regionHeight)
 {
-    _set(other._width, other._height, other._format, other._pixels);
+    if(!data || size == 0)
+        throw std::runtime_error("No image data to decode");
+    if(size > INT_MAX)
+        throw std::runtime_error("Image data is too large to decode");
+    if(scaleShift > 3)
+        throw std::runtime_error("Scale shift must be between 0 and 3");
+
+    bool wholeImage = (regionWidth == 0 || regionHeight == 0);
+    const stbi_uc* buffer = (const stbi_uc*)data;
+    if(stbi_jpeg_test_memory(buffer, (int)size)){
+        // stb_image takes the region as x0,y0,x1,y1, and clips it to the image
+        int region[4] = {
+            (int)std::min(regionX, (unsigned)INT_MAX),
+            (int)std::min(regionY, (unsigned)INT_MAX),
+            (int)std::min((uint64_t)regionX + regionWidth, (uint64_t)INT_MAX),
+            (int)std::min((uint64_t)regionY + regionHeight, (uint64_t)INT_MAX)
+        };
+
+        ScratchArena::Scope scratch(ScratchArena::threadLocal());
+        int width, height, channels;
+        void* pixels = stbi_jpeg_load_scaled_from_memory(buffer, (int)size, &width, &height, &channels, 0,
+                                                         (int)scaleShift, wholeImage ? NULL : region);
+        if(!pixels) throw std::runtime_error(stbi_failure_reason());
+
+        return AdoptStbiPixels(pixels, width, height, channels, ChannelType_UInt8);
+    }
+
+    // nothing else can skip any decoding work, so crop and shrink a full decode
+    Bitmap bitmap = bitmapFromMemory(data, size);
+    if(!wholeImage){
+        if(regionX >= bitmap.width() || regionY >= bitmap.height())
+            throw std::runtime_error("Region is outside the image");
+        unsigned width = (unsigned)std::min((uint64_t)regionWidth, (uint64_t)bitmap.width() - regionX);
+        unsigned height = (unsigned)std::min((uint64_t)regionHeight, (uint64_t)bitmap.height() - regionY);
+        if(scaleShift == 0)
+            return Bitmap(BitmapView(bitmap).subView(regionX, regionY, width, height));
+
+        // round the edges out the same way as the JPEG decode, so the size matches
+        unsigned right = regionX + width, bottom = regionY + height;
+        regionX = (regionX >> scaleShift) << scaleShift;
+        regionY = (regionY >> scaleShift) << scaleShift;
+        bitmap = Bitmap(BitmapView(bitmap).subView(regionX, regionY, right - regionX, bottom - regionY));
+    }
+    if(scaleShift != 0){
+        unsigned round = (1u << scaleShift) - 1;
+        bitmap.resize((bitmap.width() + round) >> scaleShift, (bitmap.height() + round) >> scaleShift, ResizeFilter_Box);
+    }
+    return bitmap;
 }
 
-Bitmap& Bitmap::operator = (const Bitmap& other) {
-    _set(other._width, other._height, other._format, other._pixels);
+unsigned Bitmap::jpegScaleShift(const void* data, size_t size, unsigned minSize) {
+    if(!data || size == 0 || size > INT_MAX)
+        return 0;
+
+    const stbi_uc* buffer = (const stbi_uc*)data;
+    int width, height;
+    if(!stbi_jpeg_test_memory(buffer, (int)size) || !stbi_info_from_memory(buffer, (int)size, &width, &height, NULL))
+        return 0;
+
+    unsigned longest = (unsigned)std::max(width, height);
+    unsigned scaleShift = 0;
+    while(scaleShift < 3 && ((longest + (2u << scaleShift) - 1) >> (scaleShift + 1)) >= minSize)
+        ++scaleShift;
+    return scaleShift;
+}
+
+MipChain Bitmap::generateMipChain(bool srgb) const {
+    _requireUInt8("Generating mipmaps");
+    return MipChain(BitmapView(*this), srgb);
+}
+
+Bitmap Bitmap::generateDistanceField(float spread, ChannelType channelType) const {
+    _requireUInt8("Generating distance fields");
+    return GenerateDistanceField(BitmapView(*this), spread, channelType);
+}
+
+Bitmap Bitmap::clone() const {
+    Bitmap copy(_width, _height, _format, _channelType);
+    copy.setRowPitch(_rowPitch);
+    memcpy(copy._pixels, _pixels, _rowPitch * _height);
+    return copy;
+}
+
+static std::atomic<Allocator*> gDefaultAllocator(NULL);
+
+Allocator& Bitmap::defaultAllocator() {
+    Allocator* allocator = gDefaultAllocator.load();
+    return allocator ? *allocator : PoolAllocator::shared();
+}
+
+void Bitmap::setDefaultAllocator(Allocator& allocator) {
+    gDefaultAllocator.store(&allocator);
+}
+
+Bitmap::Bitmap(Bitmap&& other) :
+    _format(other._format),
+    _channelType(other._channelType),
+    _width(other._width),
+    _height(other._height),
+    _rowPitch(other._rowPitch),
+    _pixels(other._pixels),
+    _block(other._block),
+    _allocator(other._allocator),
+    _deleter(other._deleter)
+{
+    other._width = 0;
+    other._height = 0;
+    other._rowPitch = 0;
+    other._pixels = NULL;
+    other._block = NULL;
+    other._allocator = NULL;
+    other._deleter = NULL;
+}
+
+Bitmap& Bitmap::operator = (Bitmap&& other) {
+    if(this != &other){
+        _release();
+        _format = other._format;
+        _channelType = other._channelType;
+        _width = other._width;
+        _height = other._height;
+        _rowPitch = other._rowPitch;
+        _pixels = other._pixels;
+        _block = other._block;
+        _allocator = other._allocator;
+        _deleter = other._deleter;
+        
+        other._width = 0;
+        other._height = 0;
+        other._rowPitch = 0;
+        other._pixels = NULL;
+        other._block = NULL;
+        other._allocator = NULL;
+        other._deleter = NULL;
+    }
     return *this;
 }
 
@@ -221,6 +1342,43 @@ Bitmap::Format Bitmap::format() const {
     return _format;
 }
 
+Bitmap::ChannelType Bitmap::channelType() const {
+    return _channelType;
+}
+
+size_t Bitmap::rowPitch() const {
+    return _rowPitch;
+}
+
+size_t Bitmap::defaultRowPitch(unsigned width, Format format, ChannelType channelType) {
+    // the fewest pixels that are a multiple of RowAlignment bytes, e.g. 16 RGB pixels
+    size_t pixelSize = (size_t)format * channelSize(channelType);
+    size_t pixelsPerStep = RowAlignment;
+    while(pixelsPerStep > 1 && (pixelSize * (pixelsPerStep / 2)) % RowAlignment == 0)
+        pixelsPerStep /= 2;
+    return RoundUp(width, pixelsPerStep) * pixelSize;
+}
+
+void Bitmap::setRowPitch(size_t rowPitch) {
+    size_t rowSize = (size_t)_width * bytesPerPixel();
+    if(rowPitch < rowSize)
+        throw std::runtime_error("Bitmap row pitch is smaller than a row of pixels");
+    if(rowPitch == _rowPitch)
+        return;
+    
+    Allocator& allocator = defaultAllocator();
+    void* newBlock;
+    unsigned char* newPixels = AllocateAligned(allocator, rowPitch * _height, newBlock);
+    for(unsigned rowIdx = 0; rowIdx < _height; ++rowIdx)
+        memcpy(newPixels + rowIdx * rowPitch, row(rowIdx), rowSize);
+    
+    _release();
+    _pixels = newPixels;
+    _block = newBlock;
+    _allocator = &allocator;
+    _rowPitch = rowPitch;
+}
+
 unsigned char* Bitmap::pixelBuffer() const {
     return _pixels;
 }
@@ -229,48 +1387,116 @@ unsigned char* Bitmap::getPixel(unsigned int column, unsigned int row) const {
     if(column >= _width || row >= _height)
         throw std::runtime_error("Pixel coordinate out of bounds");
     
-    return _pixels + GetPixelOffset(column, row, _width, _height, _format);
+    return _pixels + GetPixelOffset(column, row, _rowPitch, bytesPerPixel());
 }
 
 void Bitmap::setPixel(unsigned int column, unsigned int row, const unsigned char* pixel) {
     unsigned char* myPixel = getPixel(column, row);
-    memcpy(myPixel, pixel, _format);
+    memcpy(myPixel, pixel, bytesPerPixel());
 }
 
 void Bitmap::flipVertically() {
-    unsigned long rowSize = _format*_width;
-    unsigned char* rowBuffer = new unsigned char[rowSize];
+    size_t rowSize = (size_t)bytesPerPixel() * _width;
     unsigned halfRows = _height / 2;
     
     for(unsigned rowIdx = 0; rowIdx < halfRows; ++rowIdx){
-        unsigned char* row = _pixels + GetPixelOffset(0, rowIdx, _width, _height, _format);
-        unsigned char* oppositeRow = _pixels + GetPixelOffset(0, _height - rowIdx - 1, _width, _height, _format);
-        
-        memcpy(rowBuffer, row, rowSize);
-        memcpy(row, oppositeRow, rowSize);
-        memcpy(oppositeRow, rowBuffer, rowSize);
+        unsigned char* top = row(rowIdx);
+        unsigned char* bottom = row(_height - rowIdx - 1);
+        std::swap_ranges(top, top + rowSize, bottom);
     }
-    
-    delete rowBuffer;
 }
 
 void Bitmap::rotate90CounterClockwise() {
-    unsigned char* newPixels = (unsigned char*) malloc(_format*_width*_height);
-    
-    for(unsigned row = 0; row < _height; ++row){
-        for(unsigned col = 0; col < _width; ++col){
-            unsigned srcOffset = GetPixelOffset(col, row, _width, _height, _format);
-            unsigned destOffset = GetPixelOffset(row, _width - col - 1, _height, _width, _format);
-            memcpy(newPixels + destOffset, _pixels + srcOffset, _format); //copy one pixel
-        }
+    _transpose(true, false);
+}
+
+void Bitmap::rotate90Clockwise() {
+    _transpose(false, true);
+}
+
+void Bitmap::rotate180() {
+    switch(bytesPerPixel()){
+        case 1:  Rotate180InPlace< PixelBytes<1> >(_pixels, _width, _height, _rowPitch); break;
+        case 2:  Rotate180InPlace< PixelBytes<2> >(_pixels, _width, _height, _rowPitch); break;
+        case 3:  Rotate180InPlace< PixelBytes<3> >(_pixels, _width, _height, _rowPitch); break;
+        case 4:  Rotate180InPlace< PixelBytes<4> >(_pixels, _width, _height, _rowPitch); break;
+        case 6:  Rotate180InPlace< PixelBytes<6> >(_pixels, _width, _height, _rowPitch); break;
+        case 8:  Rotate180InPlace< PixelBytes<8> >(_pixels, _width, _height, _rowPitch); break;
+        case 12: Rotate180InPlace< PixelBytes<12> >(_pixels, _width, _height, _rowPitch); break;
+        case 16: Rotate180InPlace< PixelBytes<16> >(_pixels, _width, _height, _rowPitch); break;
+        default:
+            throw std::runtime_error("Unhandled bitmap pixel size");
     }
+}
+
+void Bitmap::transpose() {
+    _transpose(false, false);
+}
+
+void Bitmap::convertSRGBToLinear() {
+    _requireUInt8("Converting to linear");
+    if(_format != Format_RGB && _format != Format_RGBA)
+        return;
     
-    free(_pixels);
-    _pixels = newPixels;
+    const unsigned char* curve = Curves().toLinear;
+    unsigned channels = _format;
+    ForEachPixelRun(*this, [=](unsigned char* pixels, size_t count) {
+        ApplyColorCurve(pixels, count, channels, curve);
+    });
+}
+
+void Bitmap::convertLinearToSRGB() {
+    _requireUInt8("Converting to sRGB");
+    if(_format != Format_RGB && _format != Format_RGBA)
+        return;
     
-    unsigned swapTmp = _height;
-    _height = _width;
-    _width = swapTmp;
+    const unsigned char* curve = Curves().toSRGB;
+    unsigned channels = _format;
+    ForEachPixelRun(*this, [=](unsigned char* pixels, size_t count) {
+        ApplyColorCurve(pixels, count, channels, curve);
+    });
+}
+
+void Bitmap::premultiplyAlpha(bool srgb) {
+    _requireUInt8("Premultiplying alpha");
+    if(_format != Format_GrayscaleAlpha && _format != Format_RGBA)
+        return;
+    
+    unsigned channels = _format;
+    const unsigned char (*curves)[256] = (srgb && _format == Format_RGBA) ? SRGBAlphaCurves().premultiply : NULL;
+    ForEachPixelRun(*this, [=](unsigned char* pixels, size_t count) {
+        if(curves)
+            ApplyAlphaCurve(pixels, count, curves);
+        else
+            PremultiplyLinear(pixels, count, channels);
+    });
+}
+
+void Bitmap::unpremultiplyAlpha(bool srgb) {
+    _requireUInt8("Unpremultiplying alpha");
+    if(_format != Format_GrayscaleAlpha && _format != Format_RGBA)
+        return;
+    
+    unsigned channels = _format;
+    const unsigned char (*curves)[256] = (srgb && _format == Format_RGBA) ? SRGBAlphaCurves().unpremultiply : NULL;
+    ForEachPixelRun(*this, [=](unsigned char* pixels, size_t count) {
+        if(curves)
+            ApplyAlphaCurve(pixels, count, curves);
+        else
+            UnpremultiplyLinear(pixels, count, channels);
+    });
+}
+
+void Bitmap::resize(unsigned width, unsigned height, ResizeFilter filter, bool srgb) {
+    if(width == 0 || height == 0)
+        throw std::runtime_error("Can't resize a bitmap to zero width or height");
+    if(width == _width && height == _height)
+        return;
+    _requireUInt8("Resizing");
+    
+    Bitmap resized(width, height, _format);
+    Resample(BitmapView(*this), BitmapView(resized), filter, srgb);
+    *this = std::move(resized);
 }
 
 void Bitmap::copyRectFromBitmap(const Bitmap& src, 
@@ -289,64 +1515,99 @@ void Bitmap::copyRectFromBitmap(const Bitmap& src,
     if(width == 0 || height == 0)
         throw std::runtime_error("Can't copy zero height/width rectangle");
     
-    if(srcCol + width >= src.width() || srcRow + height >= src.height())
+    if(srcCol + width > src.width() || srcRow + height > src.height())
         throw std::runtime_error("Rectangle doesn't fit within source bitmap");
 
-    if(destCol + width >= _width || destRow + height >= _height)
+    if(destCol + width > _width || destRow + height > _height)
         throw std::runtime_error("Rectangle doesn't fit within destination bitmap");
     
     if(_pixels == src._pixels && RectsOverlap(srcCol, srcRow, destCol, destRow, width, height))
         throw std::runtime_error("Source and destination are the same bitmap, and rects overlap. Not allowed!");
     
-    FormatConverterFunc converter = NULL;
-    if(_format != src._format)
-        converter = ConverterFuncForFormats(_format, src._format);
+    CopyPixels(BitmapView(src).subView(srcCol, srcRow, width, height), BitmapView(*this).subView(destCol, destRow, width, height));
+}
+
+void Bitmap::copyFromView(const BitmapView& src, unsigned destCol, unsigned destRow) {
+    if(destCol + src.width() > _width || destRow + src.height() > _height)
+        throw std::runtime_error("View doesn't fit within destination bitmap");
     
-    for(unsigned row = 0; row < height; ++row){
-        for(unsigned col = 0; col < width; ++col){
-            unsigned char* srcPixel = src._pixels + GetPixelOffset(srcCol + col, srcRow + row, src._width, src._height, src._format);
-            unsigned char* destPixel = _pixels + GetPixelOffset(destCol + col, destRow + row, _width, _height, _format);
-            
-            if(converter){
-                converter(srcPixel, destPixel);
-            } else {
-                memcpy(destPixel, srcPixel, _format);
-            }
-        }
-    }
+    // conservative: rejects any source whose memory range touches the destination rows
+    const unsigned char* srcFirst = src.rowStride() < 0 ? src.row(src.height() - 1) : src.origin();
+    const unsigned char* srcLast = (src.rowStride() < 0 ? src.origin() : src.row(src.height() - 1)) + (size_t)src.width() * src.bytesPerPixel();
+    const unsigned char* destFirst = row(destRow);
+    const unsigned char* destLast = row(destRow + src.height() - 1) + (size_t)_width * bytesPerPixel();
+    if(srcFirst < destLast && destFirst < srcLast)
+        throw std::runtime_error("Source view points into the destination area. Not allowed!");
+    
+    CopyPixels(src, BitmapView(*this).subView(destCol, destRow, src.width(), src.height()));
 }
 
 void Bitmap::_set(unsigned width, 
                   unsigned height, 
                   Format format, 
-                  const unsigned char* pixels)
+                  ChannelType channelType,
+                  const void* pixels)
 {
     if(width == 0) throw std::runtime_error("Zero width bitmap");
     if(height == 0) throw std::runtime_error("Zero height bitmap");
     if(format <= 0 || format > 4) throw std::runtime_error("Invalid bitmap format");
+    if((unsigned)channelType > ChannelType_Float) throw std::runtime_error("Invalid bitmap channel type");
 
     _width = width;
     _height = height;
     _format = format;
+    _channelType = channelType;
+    _rowPitch = defaultRowPitch(width, format, channelType);
     
-    size_t newSize = _width * _height * _format;
-    if(_pixels){
-        _pixels = (unsigned char*)realloc(_pixels, newSize);
-    } else {
-        _pixels = (unsigned char*)malloc(newSize);
-    }
+    Allocator& allocator = defaultAllocator();
+    void* newBlock;
+    unsigned char* newPixels = AllocateAligned(allocator, _rowPitch * _height, newBlock);
+    _release();
+    _pixels = newPixels;
+    _block = newBlock;
+    _allocator = &allocator;
     
-    if(pixels)
-        memcpy(_pixels, pixels, newSize);
+    //the given pixels are tightly packed
+    if(pixels){
+        size_t rowSize = (size_t)_width * bytesPerPixel();
+        for(unsigned rowIdx = 0; rowIdx < _height; ++rowIdx)
+            memcpy(row(rowIdx), (const unsigned char*)pixels + rowIdx * rowSize, rowSize);
+    }
 }
 
+void Bitmap::_transpose(bool reverseRows, bool reverseCols) {
+    Allocator& allocator = defaultAllocator();
+    size_t newPitch = defaultRowPitch(_height, _format, _channelType);
+    void* newBlock;
+    unsigned char* newPixels = AllocateAligned(allocator, newPitch * _width, newBlock);
+    
+    TransposeInto(_pixels, _width, _height, (ptrdiff_t)_rowPitch, bytesPerPixel(), newPixels, (ptrdiff_t)newPitch, reverseRows, reverseCols);
+    
+    _release();
+    _pixels = newPixels;
+    _block = newBlock;
+    _allocator = &allocator;
+    _rowPitch = newPitch;
+    
+    unsigned swapTmp = _height;
+    _height = _width;
+    _width = swapTmp;
+}
 
+void Bitmap::_requireUInt8(const char* operation) const {
+    if(_channelType != ChannelType_UInt8)
+        throw std::runtime_error(std::string(operation) + " only works on bitmaps with 8-bit channels");
+}
 
-
-
-
-
-
-
-
-
+void Bitmap::_release() {
+    if(_block){
+        if(_allocator)
+            _allocator->deallocate(_block);
+        else
+            _deleter(_block);
+    }
+    _pixels = NULL;
+    _block = NULL;
+    _allocator = NULL;
+    _deleter = NULL;
+}
@@ -19,9 +19,14 @@
 #pragma once
 
 #include <string>
+#include <cstddef>
 
 namespace tdogl {
     
+    class Allocator;
+    class BitmapView;
+    class MipChain;
+    
     /**
      A bitmap image (i.e. a grid of pixels).
      
@@ -33,7 +38,7 @@ namespace tdogl {
         /**
          Represents the number of channels per pixel, and the order of the channels.
          
-         Each channel is one byte (unsigned char).
+         The size of each channel is given by the `ChannelType` of the bitmap.
          */
         enum Format {
             Format_Grayscale = 1, /**< one channel: grayscale */
@@ -42,23 +47,188 @@ namespace tdogl {
             Format_RGBA = 4 /**< four channels: red, green, blue, alpha */
         };
         
+        /**
+         The type of every channel in a pixel.
+         
+         Only UInt8 channels are sRGB encoded. The other types hold linear
+         values, where 0 is black and 1 (or 65535 for UInt16) is white, and
+         Half and Float channels can go beyond 1, e.g. in HDR images.
+         */
+        enum ChannelType {
+            ChannelType_UInt8, /**< one byte (unsigned char) per channel */
+            ChannelType_UInt16, /**< 16-bit unsigned normalized integer (unsigned short) per channel */
+            ChannelType_Half, /**< IEEE 754 half precision float per channel, see tdogl::FloatToHalf */
+            ChannelType_Float /**< 32-bit float per channel */
+        };
+        
+        /** the size in bytes of one channel of the given type */
+        static unsigned channelSize(ChannelType channelType) {
+            return channelType == ChannelType_UInt8 ? 1 : (channelType == ChannelType_Float ? 4 : 2);
+        }
+        
+        /**
+         The filters that `resize` can use.
+         */
+        enum ResizeFilter {
+            ResizeFilter_Box, /**< averages the pixels under each new pixel. Fast, but blurry when upscaling */
+            ResizeFilter_Mitchell, /**< Mitchell-Netravali cubic. Smooth, with very little ringing */
+            ResizeFilter_Lanczos3 /**< windowed sinc with three lobes. Sharpest, with slight ringing at hard edges */
+        };
+        
+        /**
+         A function that frees a pixel buffer adopted by a bitmap, e.g. `free` or
+         `stbi_image_free`.
+         */
+        typedef void (*PixelDeleter)(void* pixels);
+        
+        /**
+         The alignment in bytes of the pixel buffers that bitmaps allocate: one
+         cache line.
+         */
+        static const size_t PixelAlignment = 64;
+        
+        /**
+         Rows of the bitmaps made by the constructors start on a multiple of this
+         many bytes, so every row is aligned for SSE. See `defaultRowPitch`.
+         */
+        static const size_t RowAlignment = 16;
+        
         /**
          Creates a new image with the specified width, height and format.
          
          Width and height are in pixels. Image will contain random garbage if
-         pixels = NULL.
+         pixels = NULL. The given pixels are tightly packed, and the rows of the
+         new image are `defaultRowPitch` bytes apart.
          */
         Bitmap(unsigned width, 
                unsigned height, 
                Format format,
                const unsigned char* pixels = NULL);
+        
+        /**
+         Creates a new image with the specified width, height, format and
+         channel type.
+         
+         `pixels` must hold `width * height * format * channelSize(channelType)`
+         bytes, tightly packed. Image will contain random garbage if pixels = NULL.
+         */
+        Bitmap(unsigned width,
+               unsigned height,
+               Format format,
+               ChannelType channelType,
+               const void* pixels = NULL);
+        
+        /**
+         Creates a new image that takes ownership of an existing pixel buffer,
+         without copying it.
+         
+         The buffer must hold `width * height * format` bytes, tightly packed,
+         and will be freed with `deleter` when the bitmap is destroyed.
+         */
+        Bitmap(unsigned width,
+               unsigned height,
+               Format format,
+               unsigned char* pixels,
+               PixelDeleter deleter);
+        
+        /**
+         Creates a new image with any channel type that takes ownership of an
+         existing pixel buffer, without copying it.
+         
+         The buffer must hold `rowPitch * height` bytes, and will be freed with
+         `deleter` when the bitmap is destroyed.
+         
+         @param rowPitch  The distance in bytes between the start of each row, at
+                          least `width * format * channelSize(channelType)`. Zero
+                          means the rows are tightly packed.
+         */
+        Bitmap(unsigned width,
+               unsigned height,
+               Format format,
+               ChannelType channelType,
+               void* pixels,
+               PixelDeleter deleter,
+               size_t rowPitch = 0);
+        
+        /**
+         Creates a new image by copying the pixels of a view. The rows of the new
+         image are `defaultRowPitch` bytes apart, regardless of the row stride of
+         the view.
+         */
+        explicit Bitmap(const BitmapView& view);
+        
         ~Bitmap();
         
         /**
          Tries to load the given file into a tdogl::Bitmap.
+         
+         The bitmap adopts the buffer decoded by stb_image, so no pixels are
+         copied after decoding, and its rows are tightly packed. The decoder's
+         temporary buffers come from the calling thread's ScratchArena, and its
+         pixels from PoolAllocator::shared.
+         
+         @param channelType  The channel type of the bitmap. UInt16 keeps all the
+                             bits of 16-bit PNGs, and Half or Float keep the range
+                             of HDR images. 8-bit images are widened, and stb_image
+                             decodes them to linear for Half and Float.
+         */
+        static Bitmap bitmapFromFile(std::string filePath, ChannelType channelType = ChannelType_UInt8);
+        
+        /**
+         Tries to decode an image file that is already in memory, e.g. an entry
+         in a pack file, into a tdogl::Bitmap.
+         
+         @param data  The encoded image (PNG, JPEG, etc.), not raw pixels
+         @param size  The size of the encoded image in bytes
+         @param channelType  The channel type of the bitmap, as in `bitmapFromFile`
+         */
+        static Bitmap bitmapFromMemory(const void* data, size_t size, ChannelType channelType = ChannelType_UInt8);
+        
+        /**
+         Tries to load the given file into a tdogl::Bitmap by memory mapping it,
+         and decoding straight from the mapping.
+         
+         This avoids copying the file through stdio buffers, and the file
+         descriptor is closed before decoding starts.
          */
-        static Bitmap bitmapFromFile(std::string filePath);
-                
+        static Bitmap bitmapFromMappedFile(const std::string& filePath, ChannelType channelType = ChannelType_UInt8);
+        
+        /**
+         Decodes a smaller version of an image, or just part of it, for
+         thumbnails and low quality tiers. Always makes a UInt8 bitmap.
+         
+         JPEGs are scaled in the DCT domain, by leaving out the high frequencies
+         before the inverse DCT, so they decode several times faster and into a
+         fraction of the memory. Only the MCUs around the region go through the
+         inverse DCT, and decoding stops after the last row of them. Other
+         formats are decoded at full size, then cropped and box filtered.
+         
+         @param data        The encoded image, as in `bitmapFromMemory`
+         @param size        The size of the encoded image in bytes
+         @param scaleShift  Decode at 1 / (1 << scaleShift) of the full size, from
+                            0 to 3. Sizes round up, so a 33 pixel wide image is
+                            17 pixels wide with a scaleShift of 1.
+         @param regionX, regionY, regionWidth, regionHeight
+                            The part of the image to decode, in full size
+                            pixels, clipped to the image. A zero width or height
+                            decodes the whole image.
+         */
+        static Bitmap bitmapFromMemoryScaled(const void* data,
+                                             size_t size,
+                                             unsigned scaleShift,
+                                             unsigned regionX = 0,
+                                             unsigned regionY = 0,
+                                             unsigned regionWidth = 0,
+                                             unsigned regionHeight = 0);
+        
+        /**
+         The biggest scaleShift that `bitmapFromMemoryScaled` can decode the image
+         at in the DCT domain, while keeping its longest side at least `minSize`
+         pixels. Zero for images that aren't JPEGs, because scaling those saves
+         no decoding work.
+         */
+        static unsigned jpegScaleShift(const void* data, size_t size, unsigned minSize);
+        
         /** width in pixels */
         unsigned width() const;
         
@@ -68,27 +238,69 @@ namespace tdogl {
         /** the pixel format of the bitmap */
         Format format() const;
         
+        /** the type of each channel of the pixels */
+        ChannelType channelType() const;
+        
+        /** the size of one pixel in bytes */
+        unsigned bytesPerPixel() const {
+            return _format * channelSize(_channelType);
+        }
+        
+        /**
+         The distance in bytes between the start of each row. At least
+         `width() * bytesPerPixel()`, and any bytes past the end of a row are
+         padding.
+         */
+        size_t rowPitch() const;
+        
         /**
-         Pointer to the raw pixel data of the bitmap.
+         Changes the distance in bytes between the start of each row, moving the
+         pixels into a new buffer if the pitch is different.
          
-         Each channel is 1 byte. The number and meaning of channels per pixel is specified
-         by the `Format` of the image. The pointer points to all the columns of
-         the top row of the image, followed by each remaining row down to the bottom.
-         i.e. c0r0, c1r0, c2r0, ..., c0r1, c1r1, c2r1, etc
+         Throws an exception if the pitch is smaller than a row of pixels. Row
+         pitches that are a whole number of pixels upload to OpenGL in one call.
+         */
+        void setRowPitch(size_t rowPitch);
+        
+        /**
+         The row pitch of new bitmaps: a row of pixels rounded up to a whole
+         number of pixels that is also a multiple of RowAlignment bytes.
+         */
+        static size_t defaultRowPitch(unsigned width, Format format, ChannelType channelType = ChannelType_UInt8);
+        
+        /**
+         Pointer to the raw pixel data of the bitmap, aligned to PixelAlignment
+         bytes unless the buffer was adopted.
+         
+         The size of each channel is specified by the `ChannelType` of the image,
+         and the number and meaning of channels per pixel is specified by the
+         `Format` of the image. The pointer points to all the columns of the top
+         row of the image, followed by each remaining row down to the bottom,
+         `rowPitch()` bytes apart. i.e. c0r0, c1r0, c2r0, ..., c0r1, c1r1, c2r1, etc
          */
         unsigned char* pixelBuffer() const;
         
         /**
          Returns a pointer to the start of the pixel at the given coordinates. 
          
-         The size of the pixel depends on the `Format` of the image.
+         The size of the pixel is `bytesPerPixel()`.
          */
         unsigned char* getPixel(unsigned int column, unsigned int row) const;
         
+        /**
+         Returns a pointer to the first pixel of the given row.
+         
+         Unlike `getPixel`, this does no bounds checking, so it is suitable for
+         inner loops.
+         */
+        unsigned char* row(unsigned int row) const {
+            return _pixels + (size_t)row * _rowPitch;
+        }
+        
         /**
          Sets the raw pixel data at the given coordinates.
          
-         The size of the pixel depends on the `Format` of the bitmap.
+         The size of the pixel is `bytesPerPixel()`.
          */
         void setPixel(unsigned int column, unsigned int row, const unsigned char* pixel);
         
@@ -102,14 +314,81 @@ namespace tdogl {
          */
         void rotate90CounterClockwise();
         
+        /**
+         Rotates the image 90 degrees clockwise.
+         */
+        void rotate90Clockwise();
+        
+        /**
+         Rotates the image 180 degrees. Done in place, without allocating.
+         */
+        void rotate180();
+        
+        /**
+         Swaps the rows and columns of the image, i.e. mirrors it along the
+         diagonal from the top left corner to the bottom right corner.
+         */
+        void transpose();
+        
+        /**
+         Resizes the image to the given width and height, filtering the pixels
+         with `filter`. Does nothing if the size is unchanged. See tdogl::Resample.
+         Only UInt8 bitmaps can be resized.
+         
+         @param srgb  True if the color channels are sRGB encoded, like
+                      tdogl::Texture assumes for RGB and RGBA bitmaps
+         */
+        void resize(unsigned width, unsigned height, ResizeFilter filter = ResizeFilter_Lanczos3, bool srgb = true);
+        
+        /**
+         Decodes the sRGB color channels of RGB and RGBA bitmaps to linear, in
+         place. Grayscale and alpha channels are already linear, so they are
+         unchanged, as are bitmaps without color channels.
+         
+         Linear values only get 8 bits here, which loses a lot of precision in
+         dark colors, so this is mainly for data that will be processed as
+         linear. Upload the result as a linear texture, not an sRGB one. Throws
+         an exception for other channel types, which are always linear.
+         */
+        void convertSRGBToLinear();
+        
+        /**
+         Encodes the linear color channels of RGB and RGBA bitmaps to sRGB, in
+         place. The opposite of `convertSRGBToLinear`. Only for UInt8 bitmaps.
+         */
+        void convertLinearToSRGB();
+        
+        /**
+         Multiplies the color channels of GrayscaleAlpha and RGBA bitmaps by
+         their alpha, in place, for blending with GL_ONE, GL_ONE_MINUS_SRC_ALPHA.
+         Bitmaps without alpha are unchanged. Only for UInt8 bitmaps.
+         
+         @param srgb  True if the color channels are sRGB encoded, like
+                      tdogl::Texture assumes for RGBA bitmaps. They are then
+                      multiplied in linear space and encoded again, so the
+                      bitmap can still be uploaded as an sRGB texture.
+         */
+        void premultiplyAlpha(bool srgb = true);
+        
+        /**
+         Divides the color channels of GrayscaleAlpha and RGBA bitmaps by their
+         alpha, in place. The opposite of `premultiplyAlpha`. Fully transparent
+         pixels become black. Only for UInt8 bitmaps.
+         
+         @param srgb  True if the color channels are sRGB encoded
+         */
+        void unpremultiplyAlpha(bool srgb = true);
+        
         /**
          Copies a rectangular area from the given source bitmap into this bitmap.
          
          If srcCol, srcRow, width, and height are all zero, the entire source
          bitmap will be copied (full width and height).
          
-         If the source bitmap has a different format to the destination bitmap, 
-         the pixels will be converted to match the destination format.
+         If the source bitmap has a different format or channel type to the
+         destination bitmap, the pixels will be converted to match the destination.
+         Values that don't fit the destination channel type, such as HDR values in
+         an 8-bit bitmap, are clamped.
          
          Will throw and exception if the source and destination bitmaps are the 
          same, and the source and destination rectangles overlap. If you want to
@@ -123,19 +402,86 @@ namespace tdogl {
                                 unsigned width,
                                 unsigned height);
         
-        /** Copy constructor */
-        Bitmap(const Bitmap& other);
+        /**
+         Copies all the pixels of the given view into this bitmap, with the top
+         left corner at the given coordinates.
+         
+         Pixels are converted to match the destination format and channel type, like in 
+         `copyRectFromBitmap`. Will throw an exception if the view doesn't fit
+         within this bitmap, or if it points into the area being written to.
+         */
+        void copyFromView(const BitmapView& src, unsigned destCol, unsigned destRow);
+        
+        /**
+         Generates all the mipmap levels of this bitmap, down to 1x1, in one
+         contiguous allocation. See tdogl::MipChain. Only for UInt8 bitmaps.
+         
+         @param srgb  True if the color channels are sRGB encoded, like
+                      tdogl::Texture assumes for RGB and RGBA bitmaps
+         */
+        MipChain generateMipChain(bool srgb = true) const;
+        
+        /**
+         Makes a signed distance field of the shape in this bitmap's alpha
+         channel, or its gray channel if it has no alpha. See
+         tdogl::GenerateDistanceField. Only for UInt8 bitmaps.
+         
+         @param spread       How far from the edge, in pixels, distances are kept
+         @param channelType  UInt8 or UInt16
+         */
+        Bitmap generateDistanceField(float spread, ChannelType channelType = ChannelType_UInt8) const;
+        
+        /**
+         Makes a deep copy of the bitmap, including all its pixels.
+         
+         Bitmaps can't be copied implicitly because of the cost of copying the
+         pixels. Use this, or move the bitmap instead.
+         */
+        Bitmap clone() const;
+        
+        /**
+         The allocator that bitmaps get new pixel buffers from, which is
+         PoolAllocator::shared unless changed with setDefaultAllocator.
+         */
+        static Allocator& defaultAllocator();
+        
+        /**
+         Changes the allocator that bitmaps get new pixel buffers from.
+         
+         Existing bitmaps keep using the allocator their pixels came from, so
+         the allocator must outlive every bitmap that uses it.
+         */
+        static void setDefaultAllocator(Allocator& allocator);
+        
+        /**
+         Move constructor. Takes the pixels of `other`, leaving it empty.
+         */
+        Bitmap(Bitmap&& other);
         
-        /** Assignment operator */
-        Bitmap& operator = (const Bitmap& other);
+        /**
+         Move assignment operator. Takes the pixels of `other`, leaving it empty.
+         */
+        Bitmap& operator = (Bitmap&& other);
         
     private:
         Format _format;
+        ChannelType _channelType;
         unsigned _width;
         unsigned _height;
+        size_t _rowPitch;
         unsigned char* _pixels;
+        void* _block; //the block holding _pixels, which may start before them to align them
+        Allocator* _allocator; //where _block came from, or NULL if adopted
+        PixelDeleter _deleter; //frees adopted _pixels
+        
+        void _set(unsigned width, unsigned height, Format format, ChannelType channelType, const void* pixels);
+        void _requireUInt8(const char* operation) const;
+        void _release();
+        void _transpose(bool reverseRows, bool reverseCols);
         
-        void _set(unsigned width, unsigned height, Format format, const unsigned char* pixels);
+        //copying disabled, use clone() instead
+        Bitmap(const Bitmap&) = delete;
+        Bitmap& operator = (const Bitmap&) = delete;
         static void _getPixelOffset(unsigned col, unsigned row, unsigned width, unsigned height, Format format);
     };
     
@@ -0,0 +1,47 @@
+/*
+ tdogl::BitmapLoader
+ 
+ Copyright 2012 Thomas Dalling - http://tomdalling.com/
+ 
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+ 
+ http://www.apache.org/licenses/LICENSE-2.0
+ 
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#include "BitmapLoader.h"
+#include <stdexcept>
+
+using namespace tdogl;
+
+static Bitmap DecodeFile(const std::string& filePath) {
+    try {
+        return Bitmap::bitmapFromMappedFile(filePath);
+    } catch(const std::exception& e) {
+        throw std::runtime_error(filePath + ": " + e.what());
+    }
+}
+
+BitmapLoader::BitmapLoader(unsigned threadCount) :
+    _pool(threadCount)
+{
+}
+
+std::future<Bitmap> BitmapLoader::load(const std::string& filePath) {
+    return _pool.enqueue([filePath]() { return DecodeFile(filePath); });
+}
+
+std::vector< std::future<Bitmap> > BitmapLoader::load(const std::vector<std::string>& filePaths) {
+    std::vector< std::future<Bitmap> > results;
+    results.reserve(filePaths.size());
+    for(size_t i = 0; i < filePaths.size(); ++i)
+        results.push_back(load(filePaths[i]));
+    return results;
+}
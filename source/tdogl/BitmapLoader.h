@@ -0,0 +1,64 @@
+/*
+ tdogl::BitmapLoader
+ 
+ Copyright 2012 Thomas Dalling - http://tomdalling.com/
+ 
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+ 
+ http://www.apache.org/licenses/LICENSE-2.0
+ 
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#pragma once
+
+#include "Bitmap.h"
+#include "ThreadPool.h"
+#include <future>
+#include <string>
+#include <vector>
+
+namespace tdogl {
+    
+    /**
+     Decodes image files into tdogl::Bitmap objects on a pool of worker threads.
+     
+     Decoding is CPU bound, so loading many files in parallel scales with the
+     number of cores. Each load returns a future, and a file that fails to load
+     only affects its own future: `get` rethrows the error, with the file path
+     in the message.
+     
+     The bitmaps can be turned into tdogl::Texture objects once they arrive, on
+     the thread that owns the OpenGL context.
+     */
+    class BitmapLoader {
+    public:
+        /**
+         @param threadCount  Number of decoding threads. Zero means one per
+                             hardware thread.
+         */
+        explicit BitmapLoader(unsigned threadCount = 0);
+        
+        /**
+         Queues a file to be decoded, as if by Bitmap::bitmapFromMappedFile.
+         */
+        std::future<Bitmap> load(const std::string& filePath);
+        
+        /**
+         Queues several files to be decoded.
+         
+         @result One future per file, in the same order as `filePaths`
+         */
+        std::vector< std::future<Bitmap> > load(const std::vector<std::string>& filePaths);
+        
+    private:
+        ThreadPool _pool;
+    };
+    
+}
@@ -0,0 +1,100 @@
+/*
+ tdogl::BitmapView
+ 
+ Copyright 2012 Thomas Dalling - http://tomdalling.com/
+ 
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+ 
+ http://www.apache.org/licenses/LICENSE-2.0
+ 
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#include "BitmapView.h"
+#include <stdexcept>
+
+using namespace tdogl;
+
+BitmapView::BitmapView(const Bitmap& bitmap) :
+    _origin(bitmap.pixelBuffer()),
+    _width(bitmap.width()),
+    _height(bitmap.height()),
+    _format(bitmap.format()),
+    _channelType(bitmap.channelType()),
+    _rowStride((ptrdiff_t)bitmap.rowPitch())
+{
+    if(!_origin)
+        throw std::runtime_error("Can't view an empty bitmap");
+}
+
+BitmapView::BitmapView(unsigned char* origin,
+                       unsigned width,
+                       unsigned height,
+                       Bitmap::Format format,
+                       ptrdiff_t rowStride,
+                       Bitmap::ChannelType channelType) :
+    _origin(origin),
+    _width(width),
+    _height(height),
+    _format(format),
+    _channelType(channelType),
+    _rowStride(rowStride)
+{
+    if(!origin) throw std::runtime_error("Bitmap view has no pixels");
+    if(width == 0) throw std::runtime_error("Zero width bitmap view");
+    if(height == 0) throw std::runtime_error("Zero height bitmap view");
+    if(format <= 0 || format > 4) throw std::runtime_error("Invalid bitmap format");
+    if((unsigned)channelType > Bitmap::ChannelType_Float) throw std::runtime_error("Invalid bitmap channel type");
+    
+    ptrdiff_t rowSize = (ptrdiff_t)width * bytesPerPixel();
+    if(height > 1 && rowStride < rowSize && rowStride > -rowSize)
+        throw std::runtime_error("Bitmap view rows overlap");
+}
+
+unsigned BitmapView::width() const {
+    return _width;
+}
+
+unsigned BitmapView::height() const {
+    return _height;
+}
+
+Bitmap::Format BitmapView::format() const {
+    return _format;
+}
+
+Bitmap::ChannelType BitmapView::channelType() const {
+    return _channelType;
+}
+
+ptrdiff_t BitmapView::rowStride() const {
+    return _rowStride;
+}
+
+unsigned char* BitmapView::origin() const {
+    return _origin;
+}
+
+bool BitmapView::isContiguous() const {
+    return _height == 1 || _rowStride == (ptrdiff_t)_width * bytesPerPixel();
+}
+
+BitmapView BitmapView::subView(unsigned column, unsigned row, unsigned width, unsigned height) const {
+    if(width == 0 || height == 0)
+        throw std::runtime_error("Can't view a zero height/width rectangle");
+    
+    if(column + width > _width || row + height > _height || column + width < column || row + height < row)
+        throw std::runtime_error("Rectangle doesn't fit within bitmap view");
+    
+    return BitmapView(pixel(column, row), width, height, _format, _rowStride, _channelType);
+}
+
+BitmapView BitmapView::flippedVertically() const {
+    return BitmapView(row(_height - 1), _width, _height, _format, -_rowStride, _channelType);
+}
@@ -0,0 +1,147 @@
+/*
+ tdogl::BitmapView
+ 
+ Copyright 2012 Thomas Dalling - http://tomdalling.com/
+ 
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+ 
+ http://www.apache.org/licenses/LICENSE-2.0
+ 
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#pragma once
+
+#include "Bitmap.h"
+#include <cstddef>
+
+namespace tdogl {
+    
+    /**
+     A non-owning view of a rectangle of pixels inside a tdogl::Bitmap (or any
+     other pixel buffer).
+     
+     A view is an origin pointer, a size, a format, a channel type and a row
+     stride in bytes. The stride may be negative, which is how vertically flipped
+     views work. Making sub-rectangles and flipped views is O(1) and never copies
+     pixels.
+     
+     The view does not keep the pixels alive. It is invalidated by anything that
+     reallocates the bitmap it points into, such as rotating it.
+     */
+    class BitmapView {
+    public:
+        /**
+         Creates a view of the entire bitmap.
+         */
+        BitmapView(const Bitmap& bitmap);
+        
+        /**
+         Creates a view of arbitrary pixel memory.
+         
+         @param origin     Pointer to the first (left-most) pixel of the top row
+         @param rowStride  Distance in bytes from the start of one row to the start
+                           of the next row down. May be negative.
+         @param channelType  The type of each channel of the pixels
+         */
+        BitmapView(unsigned char* origin,
+                   unsigned width,
+                   unsigned height,
+                   Bitmap::Format format,
+                   ptrdiff_t rowStride,
+                   Bitmap::ChannelType channelType = Bitmap::ChannelType_UInt8);
+        
+        /** width in pixels */
+        unsigned width() const;
+        
+        /** height in pixels */
+        unsigned height() const;
+        
+        /** the pixel format of the viewed pixels */
+        Bitmap::Format format() const;
+        
+        /** the type of each channel of the viewed pixels */
+        Bitmap::ChannelType channelType() const;
+        
+        /** the size of one pixel in bytes */
+        unsigned bytesPerPixel() const {
+            return _format * Bitmap::channelSize(_channelType);
+        }
+        
+        /** distance in bytes between the start of consecutive rows (may be negative) */
+        ptrdiff_t rowStride() const;
+        
+        /** pointer to the top left pixel */
+        unsigned char* origin() const;
+        
+        /**
+         Returns a pointer to the first pixel of the given row. The following
+         `width() * bytesPerPixel()` bytes are the pixels of that row.
+         
+         Does no bounds checking, so it is suitable for inner loops.
+         */
+        unsigned char* row(unsigned row) const {
+            return _origin + (ptrdiff_t)row * _rowStride;
+        }
+        
+        /**
+         Returns a pointer to the pixel at the given coordinates.
+         
+         Does no bounds checking, so it is suitable for inner loops.
+         */
+        unsigned char* pixel(unsigned column, unsigned row) const {
+            return this->row(row) + (size_t)column * bytesPerPixel();
+        }
+        
+        /**
+         True if the rows are top-down and directly follow each other in memory.
+         */
+        bool isContiguous() const;
+        
+        /**
+         Returns a view of a rectangle inside this view.
+         
+         Throws an exception if the rectangle doesn't fit within this view.
+         */
+        BitmapView subView(unsigned column, unsigned row, unsigned width, unsigned height) const;
+        
+        /**
+         Returns a view of the same pixels with the row order reversed, so it
+         will be upside down.
+         */
+        BitmapView flippedVertically() const;
+        
+    private:
+        unsigned char* _origin;
+        unsigned _width;
+        unsigned _height;
+        Bitmap::Format _format;
+        Bitmap::ChannelType _channelType;
+        ptrdiff_t _rowStride;
+    };
+    
+    /**
+     Copies the pixels of `src` into `dest`, converting them to the format and
+     channel type of `dest` like Bitmap::copyFromView. The views must be the
+     same size, and must not overlap.
+     */
+    void CopyPixels(const BitmapView& src, const BitmapView& dest);
+    
+    /**
+     Copies the pixels of `src` into `dest` transposed, so each column of `src`
+     becomes a row of `dest`. Reversing the rows of the result makes it a 90
+     degree counter clockwise rotation, and reversing the columns makes it a
+     clockwise one.
+     
+     `dest` must be `src.height()` pixels wide and `src.width()` pixels tall,
+     with the same format and channel type, and must not overlap `src`.
+     */
+    void CopyTransposedPixels(const BitmapView& src, const BitmapView& dest, bool reverseRows, bool reverseCols);
+    
+}
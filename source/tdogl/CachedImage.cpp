@@ -0,0 +1,343 @@
+/*
+ tdogl::CachedImage
+ 
+ Copyright 2012 Thomas Dalling - http://tomdalling.com/
+ 
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+ 
+ http://www.apache.org/licenses/LICENSE-2.0
+ 
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#include "CachedImage.h"
+#include <stdexcept>
+#include <fstream>
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+#include <unistd.h>
+
+using namespace tdogl;
+
+/*
+ File layout. All integers are little-endian.
+ 
+   header (56 bytes):
+     char[8]  magic "TDOGLTEX"
+     uint32   version
+     uint32   pixel format (Bitmap::Format), or 0 if compressed
+     uint32   compressed format (CompressedBitmap::Format + 1), or 0 if uncompressed
+     uint32   width of level 0
+     uint32   height of level 0
+     uint32   level count
+     uint64   source hash
+     uint64   source size
+     uint32   compression quality (CompressedBitmap::Quality + 1), or 0 if uncompressed
+     uint32   pipeline version
+ 
+   level table (24 bytes per level):
+     uint32   width
+     uint32   height
+     uint64   offset of the level data from the start of the file
+     uint64   size of the level data
+ 
+   level data, each level starting on a 16 byte boundary
+ */
+static const char Magic[8] = { 'T', 'D', 'O', 'G', 'L', 'T', 'E', 'X' };
+static const uint32_t Version = 3;
+static const size_t HeaderSize = 56;
+static const size_t LevelEntrySize = 24;
+static const size_t LevelAlignment = 16;
+static const unsigned MaxLevelCount = 32;
+
+static void Put32(unsigned char* p, uint32_t value) {
+    for(int i = 0; i < 4; ++i)
+        p[i] = (unsigned char)(value >> (8 * i));
+}
+
+static void Put64(unsigned char* p, uint64_t value) {
+    for(int i = 0; i < 8; ++i)
+        p[i] = (unsigned char)(value >> (8 * i));
+}
+
+static uint32_t Get32(const unsigned char* p) {
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static uint64_t Get64(const unsigned char* p) {
+    return (uint64_t)Get32(p) | ((uint64_t)Get32(p + 4) << 32);
+}
+
+static size_t AlignUp(size_t value) {
+    return (value + LevelAlignment - 1) & ~(LevelAlignment - 1);
+}
+
+// the size in bytes of a level, given the formats stored in the header
+static uint64_t ExpectedLevelSize(unsigned pixelFormat, unsigned compressedFormat, unsigned width, unsigned height) {
+    if(compressedFormat != 0)
+        return CompressedBitmap::blockDataSize((CompressedBitmap::Format)(compressedFormat - 1), width, height);
+    else
+        return (uint64_t)width * height * pixelFormat;
+}
+
+namespace {
+    struct LevelSource {
+        unsigned width;
+        unsigned height;
+        const unsigned char* data;
+        size_t size;
+    };
+}
+
+static void WriteCacheFile(const std::string& filePath,
+                           unsigned pixelFormat,
+                           unsigned compressedFormat,
+                           unsigned compressionQuality,
+                           const std::vector<LevelSource>& levels,
+                           uint64_t sourceHash,
+                           uint64_t sourceSize,
+                           uint32_t pipelineVersion)
+{
+    if(levels.empty() || levels.size() > MaxLevelCount)
+        throw std::runtime_error("Invalid level count for cache file '" + filePath + "'");
+    
+    std::vector<unsigned char> header(AlignUp(HeaderSize + LevelEntrySize * levels.size()), 0);
+    memcpy(&header[0], Magic, sizeof(Magic));
+    Put32(&header[8], Version);
+    Put32(&header[12], pixelFormat);
+    Put32(&header[16], compressedFormat);
+    Put32(&header[20], levels[0].width);
+    Put32(&header[24], levels[0].height);
+    Put32(&header[28], (uint32_t)levels.size());
+    Put64(&header[32], sourceHash);
+    Put64(&header[40], sourceSize);
+    Put32(&header[48], compressionQuality);
+    Put32(&header[52], pipelineVersion);
+    
+    size_t offset = header.size();
+    for(size_t i = 0; i < levels.size(); ++i){
+        unsigned char* entry = &header[HeaderSize + LevelEntrySize * i];
+        Put32(entry, levels[i].width);
+        Put32(entry + 4, levels[i].height);
+        Put64(entry + 8, offset);
+        Put64(entry + 16, levels[i].size);
+        offset = AlignUp(offset + levels[i].size);
+    }
+    
+    //write to a temporary file, then rename it over the real one
+    std::string tempPath = filePath + ".tmp" + std::to_string((long long)getpid());
+    std::ofstream f(tempPath.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+    if(!f.is_open())
+        throw std::runtime_error("Failed to open cache file for writing: " + tempPath);
+    
+    static const char padding[LevelAlignment] = {0};
+    f.write((const char*)&header[0], (std::streamsize)header.size());
+    for(size_t i = 0; i < levels.size(); ++i){
+        f.write((const char*)levels[i].data, (std::streamsize)levels[i].size);
+        f.write(padding, (std::streamsize)(AlignUp(levels[i].size) - levels[i].size));
+    }
+    f.close();
+    
+    if(f.fail()){
+        remove(tempPath.c_str());
+        throw std::runtime_error("Failed to write cache file: " + tempPath);
+    }
+    
+    if(rename(tempPath.c_str(), filePath.c_str()) != 0){
+        remove(tempPath.c_str());
+        throw std::runtime_error("Failed to rename cache file to: " + filePath);
+    }
+}
+
+CachedImage::CachedImage(const std::string& filePath) :
+    _file(new MappedFile(filePath))
+{
+    const unsigned char* data = _file->data();
+    const uint64_t fileSize = _file->size();
+    const std::string invalid = "Invalid cache file '" + filePath + "': ";
+    
+    if(fileSize < HeaderSize || memcmp(data, Magic, sizeof(Magic)) != 0)
+        throw std::runtime_error(invalid + "bad header");
+    if(Get32(data + 8) != Version)
+        throw std::runtime_error(invalid + "unsupported version");
+    
+    _pixelFormat = Get32(data + 12);
+    _compressedFormat = Get32(data + 16);
+    unsigned width = Get32(data + 20);
+    unsigned height = Get32(data + 24);
+    unsigned levelCount = Get32(data + 28);
+    _sourceHash = Get64(data + 32);
+    _sourceSize = Get64(data + 40);
+    _compressionQuality = Get32(data + 48);
+    _pipelineVersion = Get32(data + 52);
+    
+    if(_compressedFormat > CompressedBitmap::Format_BC5 + 1)
+        throw std::runtime_error(invalid + "unknown compressed format");
+    if(_compressedFormat == 0 && (_pixelFormat < Bitmap::Format_Grayscale || _pixelFormat > Bitmap::Format_RGBA))
+        throw std::runtime_error(invalid + "unknown pixel format");
+    if(_compressionQuality > CompressedBitmap::Quality_High + 1 || (_compressionQuality == 0) != (_compressedFormat == 0))
+        throw std::runtime_error(invalid + "bad compression quality");
+    if(levelCount == 0 || levelCount > MaxLevelCount)
+        throw std::runtime_error(invalid + "bad level count");
+    if(fileSize < HeaderSize + LevelEntrySize * levelCount)
+        throw std::runtime_error(invalid + "truncated level table");
+    
+    _levels.resize(levelCount);
+    for(unsigned i = 0; i < levelCount; ++i){
+        const unsigned char* entry = data + HeaderSize + LevelEntrySize * i;
+        unsigned levelWidth = Get32(entry);
+        unsigned levelHeight = Get32(entry + 4);
+        uint64_t offset = Get64(entry + 8);
+        uint64_t size = Get64(entry + 16);
+        
+        unsigned expectedWidth = (i == 0) ? width : std::max(1u, _levels[i-1].width / 2);
+        unsigned expectedHeight = (i == 0) ? height : std::max(1u, _levels[i-1].height / 2);
+        if(levelWidth == 0 || levelHeight == 0 || levelWidth != expectedWidth || levelHeight != expectedHeight)
+            throw std::runtime_error(invalid + "bad level dimensions");
+        if(size != ExpectedLevelSize(_pixelFormat, _compressedFormat, levelWidth, levelHeight))
+            throw std::runtime_error(invalid + "bad level size");
+        if(offset > fileSize || size > fileSize - offset)
+            throw std::runtime_error(invalid + "truncated level data");
+        
+        _levels[i].width = levelWidth;
+        _levels[i].height = levelHeight;
+        _levels[i].offset = (size_t)offset;
+        _levels[i].size = (size_t)size;
+    }
+}
+
+void CachedImage::write(const std::string& filePath,
+                        const MipChain& mips,
+                        uint64_t sourceHash,
+                        uint64_t sourceSize,
+                        uint32_t pipelineVersion)
+{
+    std::vector<LevelSource> levels(mips.levelCount());
+    for(unsigned i = 0; i < mips.levelCount(); ++i){
+        BitmapView view = mips.level(i);
+        if(!view.isContiguous())
+            throw std::runtime_error("Mipmap levels must be tightly packed to be cached");
+        levels[i].width = view.width();
+        levels[i].height = view.height();
+        levels[i].data = view.origin();
+        levels[i].size = (size_t)view.width() * view.height() * view.format();
+    }
+    WriteCacheFile(filePath, mips.format(), 0, 0, levels, sourceHash, sourceSize, pipelineVersion);
+}
+
+void CachedImage::write(const std::string& filePath,
+                        const std::vector<CompressedBitmap>& levels,
+                        CompressedBitmap::Quality quality,
+                        uint64_t sourceHash,
+                        uint64_t sourceSize,
+                        uint32_t pipelineVersion)
+{
+    if(levels.empty())
+        throw std::runtime_error("Can't cache an image with no levels");
+    
+    std::vector<LevelSource> sources(levels.size());
+    for(size_t i = 0; i < levels.size(); ++i){
+        if(levels[i].format() != levels[0].format())
+            throw std::runtime_error("Cached compressed levels must all have the same format");
+        sources[i].width = levels[i].width();
+        sources[i].height = levels[i].height();
+        sources[i].data = levels[i].blocks();
+        sources[i].size = levels[i].size();
+    }
+    WriteCacheFile(filePath, 0, levels[0].format() + 1, quality + 1, sources, sourceHash, sourceSize, pipelineVersion);
+}
+
+uint64_t CachedImage::sourceHash() const {
+    return _sourceHash;
+}
+
+uint64_t CachedImage::sourceSize() const {
+    return _sourceSize;
+}
+
+uint32_t CachedImage::pipelineVersion() const {
+    return _pipelineVersion;
+}
+
+bool CachedImage::isCompressed() const {
+    return _compressedFormat != 0;
+}
+
+Bitmap::Format CachedImage::pixelFormat() const {
+    if(isCompressed())
+        throw std::runtime_error("Cached image is compressed, and has no pixel format");
+    return (Bitmap::Format)_pixelFormat;
+}
+
+CompressedBitmap::Format CachedImage::compressedFormat() const {
+    if(!isCompressed())
+        throw std::runtime_error("Cached image is not compressed");
+    return (CompressedBitmap::Format)(_compressedFormat - 1);
+}
+
+CompressedBitmap::Quality CachedImage::compressionQuality() const {
+    if(!isCompressed())
+        throw std::runtime_error("Cached image is not compressed");
+    return (CompressedBitmap::Quality)(_compressionQuality - 1);
+}
+
+unsigned CachedImage::levelCount() const {
+    return (unsigned)_levels.size();
+}
+
+unsigned CachedImage::levelWidth(unsigned level) const {
+    return _levels.at(level).width;
+}
+
+unsigned CachedImage::levelHeight(unsigned level) const {
+    return _levels.at(level).height;
+}
+
+const unsigned char* CachedImage::levelData(unsigned level) const {
+    return _file->data() + _levels.at(level).offset;
+}
+
+size_t CachedImage::levelSize(unsigned level) const {
+    return _levels.at(level).size;
+}
+
+BitmapView CachedImage::level(unsigned level) const {
+    const Level& l = _levels.at(level);
+    Bitmap::Format format = pixelFormat();
+    //views are writable in general, but the mapping is read-only
+    unsigned char* origin = const_cast<unsigned char*>(_file->data()) + l.offset;
+    return BitmapView(origin, l.width, l.height, format, (ptrdiff_t)l.width * format);
+}
+
+CachedImage::CachedImage(CachedImage&& other) :
+    _file(std::move(other._file)),
+    _levels(std::move(other._levels)),
+    _pixelFormat(other._pixelFormat),
+    _compressedFormat(other._compressedFormat),
+    _compressionQuality(other._compressionQuality),
+    _sourceHash(other._sourceHash),
+    _sourceSize(other._sourceSize),
+    _pipelineVersion(other._pipelineVersion)
+{
+}
+
+CachedImage& CachedImage::operator = (CachedImage&& other) {
+    if(this != &other){
+        _file = std::move(other._file);
+        _levels = std::move(other._levels);
+        _pixelFormat = other._pixelFormat;
+        _compressedFormat = other._compressedFormat;
+        _compressionQuality = other._compressionQuality;
+        _sourceHash = other._sourceHash;
+        _sourceSize = other._sourceSize;
+        _pipelineVersion = other._pipelineVersion;
+    }
+    return *this;
+}
@@ -0,0 +1,164 @@
+/*
+ tdogl::CachedImage
+ 
+ Copyright 2012 Thomas Dalling - http://tomdalling.com/
+ 
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+ 
+ http://www.apache.org/licenses/LICENSE-2.0
+ 
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#pragma once
+
+#include "Bitmap.h"
+#include "BitmapView.h"
+#include "MipChain.h"
+#include "CompressedBitmap.h"
+#include "MappedFile.h"
+#include <memory>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+namespace tdogl {
+    
+    /**
+     A pre-decoded image in the tdogl texture cache file format, mapped into
+     memory straight from disk.
+     
+     Cache files hold every mipmap level of an image, either as raw pixels or
+     as compressed blocks, ready to be given to OpenGL without decoding or
+     converting anything. Levels are stored bottom row first (the way OpenGL
+     expects), so they are already the right way up. Each file also records
+     the hash and size of the source image it was made from, so it can be
+     recognised as stale when the source changes, the quality compressed
+     levels were made with, and the version of the code that made the pixels,
+     so it can be recognised as stale when that changes too.
+     
+     Files are written with CachedImage::write and used through
+     tdogl::TextureCache and the tdogl::Texture constructor that takes a
+     CachedImage.
+     */
+    class CachedImage {
+    public:
+        /**
+         Maps and validates an existing cache file.
+         
+         @throws std::exception if the file can't be mapped, or is not a valid
+                 cache file (e.g. truncated, or from another version).
+         */
+        explicit CachedImage(const std::string& filePath);
+        
+        /**
+         Writes a cache file of uncompressed mipmap levels.
+         
+         The file is written under a temporary name and then renamed, so other
+         processes never see a partially written file.
+         
+         @param mips  The levels, bottom row first
+         @param sourceHash  ContentHasher hash of the source image file
+         @param sourceSize  Size in bytes of the source image file
+         @param pipelineVersion  The version of the code that made the levels
+                                 from the source, e.g. TextureCache's
+         */
+        static void write(const std::string& filePath,
+                          const MipChain& mips,
+                          uint64_t sourceHash,
+                          uint64_t sourceSize,
+                          uint32_t pipelineVersion);
+        
+        /**
+         Writes a cache file of compressed mipmap levels, like the other
+         overload. The levels must all have the same format, and each must be
+         half the size of the previous one.
+         
+         @param quality  The quality the levels were compressed at, recorded so
+                         files made with other settings can be told apart
+         */
+        static void write(const std::string& filePath,
+                          const std::vector<CompressedBitmap>& levels,
+                          CompressedBitmap::Quality quality,
+                          uint64_t sourceHash,
+                          uint64_t sourceSize,
+                          uint32_t pipelineVersion);
+        
+        /** the ContentHasher hash of the source image file */
+        uint64_t sourceHash() const;
+        
+        /** size in bytes of the source image file */
+        uint64_t sourceSize() const;
+        
+        /** the version of the code that made the levels, as given to `write` */
+        uint32_t pipelineVersion() const;
+        
+        /** true if the levels are compressed blocks, false if they are pixels */
+        bool isCompressed() const;
+        
+        /** the pixel format of uncompressed levels. Throws if compressed. */
+        Bitmap::Format pixelFormat() const;
+        
+        /** the block format of compressed levels. Throws if uncompressed. */
+        CompressedBitmap::Format compressedFormat() const;
+        
+        /** the quality compressed levels were made with. Throws if uncompressed. */
+        CompressedBitmap::Quality compressionQuality() const;
+        
+        /** number of mipmap levels, including the base level */
+        unsigned levelCount() const;
+        
+        /** width of the given level in pixels */
+        unsigned levelWidth(unsigned level) const;
+        
+        /** height of the given level in pixels */
+        unsigned levelHeight(unsigned level) const;
+        
+        /** pointer to the pixels or blocks of the given level, inside the mapping */
+        const unsigned char* levelData(unsigned level) const;
+        
+        /** size in bytes of the pixels or blocks of the given level */
+        size_t levelSize(unsigned level) const;
+        
+        /**
+         A view of the pixels of the given level, inside the mapping. Row 0 of
+         the view is the bottom row of the image. The mapping is read-only, so
+         the pixels must not be written to. Throws if compressed.
+         */
+        BitmapView level(unsigned level) const;
+        
+        /** Move constructor */
+        CachedImage(CachedImage&& other);
+        
+        /** Move assignment operator */
+        CachedImage& operator = (CachedImage&& other);
+        
+    private:
+        struct Level {
+            unsigned width;
+            unsigned height;
+            size_t offset;
+            size_t size;
+        };
+        
+        std::unique_ptr<MappedFile> _file;
+        std::vector<Level> _levels;
+        unsigned _pixelFormat;
+        unsigned _compressedFormat;
+        unsigned _compressionQuality;
+        uint64_t _sourceHash;
+        uint64_t _sourceSize;
+        uint32_t _pipelineVersion;
+        
+        //copying disabled
+        CachedImage(const CachedImage&) = delete;
+        CachedImage& operator = (const CachedImage&) = delete;
+    };
+    
+}
@@ -0,0 +1,138 @@
+/*
+ tdogl::ColorSpace
+ 
+ Copyright 2012 Thomas Dalling - http://tomdalling.com/
+ 
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+ 
+ http://www.apache.org/licenses/LICENSE-2.0
+ 
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#include "ColorSpace.h"
+#include <cmath>
+
+#if !defined(TDOGL_DISABLE_SIMD) && (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+    #define TDOGL_SSE2 1
+    #include <emmintrin.h>
+#endif
+
+using namespace tdogl;
+
+static double DecodeSRGB(double srgb) {
+    return srgb <= 0.04045 ? srgb / 12.92 : std::pow((srgb + 0.055) / 1.055, 2.4);
+}
+
+namespace {
+    struct SRGBTables {
+        float toLinear[256];
+        
+        // thresholds[i] is the linear value halfway (in sRGB space) between
+        // the encoded bytes i and i + 1
+        float thresholds[255];
+        
+        SRGBTables() {
+            for(int i = 0; i < 256; ++i)
+                toLinear[i] = (float)DecodeSRGB(i / 255.0);
+            for(int i = 0; i < 255; ++i)
+                thresholds[i] = (float)DecodeSRGB((i + 0.5) / 255.0);
+        }
+    };
+}
+
+static const SRGBTables& Tables() {
+    static const SRGBTables tables;
+    return tables;
+}
+
+const float* tdogl::SRGBToLinearTable() {
+    return Tables().toLinear;
+}
+
+unsigned char tdogl::LinearToSRGB(float linear) {
+    // binary search for the number of thresholds below `linear`
+    const float* thresholds = Tables().thresholds;
+    unsigned result = 0;
+    for(unsigned step = 128; step > 0; step >>= 1){
+        unsigned probe = result + step;
+        if(probe <= 255 && linear >= thresholds[probe - 1])
+            result = probe;
+    }
+    return (unsigned char)result;
+}
+
+void tdogl::SRGBToLinear(const unsigned char* src, float* dest, size_t count) {
+    const float* table = Tables().toLinear;
+    size_t i = 0;
+    for(; i + 4 <= count; i += 4){
+        dest[i] = table[src[i]];
+        dest[i + 1] = table[src[i + 1]];
+        dest[i + 2] = table[src[i + 2]];
+        dest[i + 3] = table[src[i + 3]];
+    }
+    for(; i < count; ++i)
+        dest[i] = table[src[i]];
+}
+
+// moves an encoded byte that may be off by one to the exact result
+static unsigned char CorrectSRGB(float linear, int approx, const float* thresholds) {
+    if(approx < 255 && linear >= thresholds[approx])
+        return (unsigned char)(approx + 1);
+    if(approx > 0 && linear < thresholds[approx - 1])
+        return (unsigned char)(approx - 1);
+    return (unsigned char)approx;
+}
+
+void tdogl::LinearToSRGB(const float* src, unsigned char* dest, size_t count) {
+    const float* thresholds = Tables().thresholds;
+    size_t i = 0;
+#ifdef TDOGL_SSE2
+    /*
+     Above the linear segment, 255 * (1.055 * x^(1/2.4) - 0.055) is a smooth
+     function of sqrt(x), which this polynomial fits to within 0.18. That is
+     always within one of the exact byte, so checking the two neighbouring
+     thresholds fixes it up.
+     */
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 one = _mm_set1_ps(1.0f);
+    const __m128 linearEnd = _mm_set1_ps(0.0031308f);
+    const __m128 linearScale = _mm_set1_ps(12.92f * 255.0f);
+    const __m128 c0 = _mm_set1_ps(-9.77231077f);
+    const __m128 c1 = _mm_set1_ps(378.142074f);
+    const __m128 c2 = _mm_set1_ps(-306.389696f);
+    const __m128 c3 = _mm_set1_ps(397.394252f);
+    const __m128 c4 = _mm_set1_ps(-290.291424f);
+    const __m128 c5 = _mm_set1_ps(85.9423564f);
+    const __m128 half = _mm_set1_ps(0.5f);
+    for(; i + 4 <= count; i += 4){
+        //max first, so NaN becomes zero like in the scalar version
+        __m128 x = _mm_min_ps(_mm_max_ps(_mm_loadu_ps(src + i), zero), one);
+        __m128 u = _mm_sqrt_ps(x);
+        __m128 curve = _mm_add_ps(_mm_mul_ps(c5, u), c4);
+        curve = _mm_add_ps(_mm_mul_ps(curve, u), c3);
+        curve = _mm_add_ps(_mm_mul_ps(curve, u), c2);
+        curve = _mm_add_ps(_mm_mul_ps(curve, u), c1);
+        curve = _mm_add_ps(_mm_mul_ps(curve, u), c0);
+        __m128 isLinear = _mm_cmplt_ps(x, linearEnd);
+        __m128 encoded = _mm_or_ps(_mm_and_ps(isLinear, _mm_mul_ps(x, linearScale)),
+                                   _mm_andnot_ps(isLinear, curve));
+        encoded = _mm_min_ps(_mm_max_ps(_mm_add_ps(encoded, half), zero), _mm_set1_ps(255.0f));
+        
+        float clamped[4];
+        int approx[4];
+        _mm_storeu_ps(clamped, x);
+        _mm_storeu_si128((__m128i*)approx, _mm_cvttps_epi32(encoded));
+        for(unsigned k = 0; k < 4; ++k)
+            dest[i + k] = CorrectSRGB(clamped[k], approx[k], thresholds);
+    }
+#endif
+    for(; i < count; ++i)
+        dest[i] = LinearToSRGB(src[i]);
+}
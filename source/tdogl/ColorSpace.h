@@ -0,0 +1,72 @@
+/*
+ tdogl::ColorSpace
+ 
+ Copyright 2012 Thomas Dalling - http://tomdalling.com/
+ 
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+ 
+ http://www.apache.org/licenses/LICENSE-2.0
+ 
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#pragma once
+
+#include <cstddef>
+
+namespace tdogl {
+    
+    /**
+     Returns a table of 256 floats, mapping each sRGB encoded byte to its
+     linear intensity between 0 and 1.
+     */
+    const float* SRGBToLinearTable();
+    
+    /**
+     Converts an sRGB encoded byte to a linear intensity between 0 and 1.
+     */
+    inline float SRGBToLinear(unsigned char srgb) {
+        return SRGBToLinearTable()[srgb];
+    }
+    
+    /**
+     Converts a linear intensity to the nearest sRGB encoded byte, rounding in
+     sRGB space. Values outside of 0 to 1 are clamped.
+     
+     Exact for every input, so LinearToSRGB(SRGBToLinear(x)) == x.
+     */
+    unsigned char LinearToSRGB(float linear);
+    
+    /**
+     Converts a linear intensity between 0 and 1 to the nearest byte, without
+     any gamma encoding. Used for alpha and non-color channels.
+     */
+    inline unsigned char LinearToByte(float linear) {
+        float scaled = linear * 255.0f + 0.5f;
+        if(!(scaled > 0.0f)) return 0;
+        if(scaled >= 255.0f) return 255;
+        return (unsigned char)scaled;
+    }
+    
+    /**
+     Converts `count` sRGB encoded bytes to linear intensities, using
+     SRGBToLinearTable.
+     */
+    void SRGBToLinear(const unsigned char* src, float* dest, size_t count);
+    
+    /**
+     Converts `count` linear intensities to sRGB encoded bytes.
+     
+     Gives exactly the same results as the single value LinearToSRGB, but is
+     much faster for long runs of values. Four values at a time are encoded
+     with a polynomial, which is then corrected to the exact result.
+     */
+    void LinearToSRGB(const float* src, unsigned char* dest, size_t count);
+    
+}
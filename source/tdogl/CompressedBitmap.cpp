@@ -0,0 +1,690 @@
+/*
+ tdogl::CompressedBitmap
+ 
+ Copyright 2012 Thomas Dalling - http://tomdalling.com/
+ 
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+ 
+ http://www.apache.org/licenses/LICENSE-2.0
+ 
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#include "CompressedBitmap.h"
+#include "ThreadPool.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+
+#if !defined(TDOGL_DISABLE_SIMD) && (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+    #define TDOGL_SSE2 1
+    #include <emmintrin.h>
+#endif
+
+using namespace tdogl;
+
+/*
+ * Color blocks (BC1, and the color half of BC3)
+ *
+ * Two RGB565 endpoints, plus a 2-bit index per pixel choosing between the two
+ * endpoints and the two colors 1/3 and 2/3 of the way between them.
+ */
+
+namespace {
+    // the 16 pixels of a block, one float array per channel
+    struct ColorBlock {
+        float r[16], g[16], b[16];
+    };
+}
+
+static inline int Clamp255(float v) {
+    int i = (int)(v + 0.5f);
+    return i < 0 ? 0 : (i > 255 ? 255 : i);
+}
+
+static unsigned short PackRGB565(const float color[3]) {
+    unsigned r = (Clamp255(color[0]) * 31 + 127) / 255;
+    unsigned g = (Clamp255(color[1]) * 63 + 127) / 255;
+    unsigned b = (Clamp255(color[2]) * 31 + 127) / 255;
+    return (unsigned short)((r << 11) | (g << 5) | b);
+}
+
+static void UnpackRGB565(unsigned short packed, int color[3]) {
+    int r = (packed >> 11) & 31, g = (packed >> 5) & 63, b = packed & 31;
+    color[0] = (r << 3) | (r >> 2);
+    color[1] = (g << 2) | (g >> 4);
+    color[2] = (b << 3) | (b >> 2);
+}
+
+// the 4 colors a decoder makes from the endpoints, in index order
+static void ColorPalette(unsigned short c0, unsigned short c1, float palette[4][3]) {
+    int e0[3], e1[3];
+    UnpackRGB565(c0, e0);
+    UnpackRGB565(c1, e1);
+    for(int c = 0; c < 3; ++c){
+        palette[0][c] = (float)e0[c];
+        palette[1][c] = (float)e1[c];
+        palette[2][c] = (float)((2*e0[c] + e1[c]) / 3);
+        palette[3][c] = (float)((e0[c] + 2*e1[c]) / 3);
+    }
+}
+
+// picks the nearest palette entry for every pixel; returns the total squared error
+static float NearestColorIndices(const ColorBlock& block, const float palette[4][3], unsigned char indices[16]) {
+    float totalError = 0.0f;
+    int i = 0;
+#ifdef TDOGL_SSE2
+    for(; i < 16; i += 4){
+        __m128 r = _mm_loadu_ps(block.r + i), g = _mm_loadu_ps(block.g + i), b = _mm_loadu_ps(block.b + i);
+        __m128 best = _mm_set1_ps(1e30f);
+        __m128i bestIndex = _mm_setzero_si128();
+        for(int k = 0; k < 4; ++k){
+            __m128 dr = _mm_sub_ps(r, _mm_set1_ps(palette[k][0]));
+            __m128 dg = _mm_sub_ps(g, _mm_set1_ps(palette[k][1]));
+            __m128 db = _mm_sub_ps(b, _mm_set1_ps(palette[k][2]));
+            __m128 d = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dr, dr), _mm_mul_ps(dg, dg)), _mm_mul_ps(db, db));
+            __m128i closer = _mm_castps_si128(_mm_cmplt_ps(d, best));
+            best = _mm_min_ps(best, d);
+            bestIndex = _mm_or_si128(_mm_andnot_si128(closer, bestIndex), _mm_and_si128(closer, _mm_set1_epi32(k)));
+        }
+        float errors[4];
+        int idx[4];
+        _mm_storeu_ps(errors, best);
+        _mm_storeu_si128((__m128i*)idx, bestIndex);
+        for(int j = 0; j < 4; ++j){
+            indices[i + j] = (unsigned char)idx[j];
+            totalError += errors[j];
+        }
+    }
+#endif
+    for(; i < 16; ++i){
+        float best = 1e30f;
+        for(int k = 0; k < 4; ++k){
+            float dr = block.r[i] - palette[k][0], dg = block.g[i] - palette[k][1], db = block.b[i] - palette[k][2];
+            float d = dr*dr + dg*dg + db*db;
+            if(d < best){
+                best = d;
+                indices[i] = (unsigned char)k;
+            }
+        }
+        totalError += best;
+    }
+    return totalError;
+}
+
+// fast index selection: projects each pixel onto the line between the endpoints
+static float ProjectedColorIndices(const ColorBlock& block, const float palette[4][3], unsigned char indices[16]) {
+    static const unsigned char StepToIndex[4] = { 1, 3, 2, 0 };
+    float axis[3] = { palette[0][0] - palette[1][0], palette[0][1] - palette[1][1], palette[0][2] - palette[1][2] };
+    float lengthSq = axis[0]*axis[0] + axis[1]*axis[1] + axis[2]*axis[2];
+    float scale = lengthSq > 0.0f ? 3.0f / lengthSq : 0.0f;
+    float totalError = 0.0f;
+    for(int i = 0; i < 16; ++i){
+        float t = ((block.r[i] - palette[1][0])*axis[0] + (block.g[i] - palette[1][1])*axis[1] + (block.b[i] - palette[1][2])*axis[2]) * scale;
+        int step = std::min(3, std::max(0, (int)(t + 0.5f)));
+        indices[i] = StepToIndex[step];
+        const float* p = palette[indices[i]];
+        float dr = block.r[i] - p[0], dg = block.g[i] - p[1], db = block.b[i] - p[2];
+        totalError += dr*dr + dg*dg + db*db;
+    }
+    return totalError;
+}
+
+static void BoundingBoxEndpoints(const ColorBlock& block, float e0[3], float e1[3]) {
+    float lo[3] = { 255, 255, 255 }, hi[3] = { 0, 0, 0 };
+    for(int i = 0; i < 16; ++i){
+        lo[0] = std::min(lo[0], block.r[i]); hi[0] = std::max(hi[0], block.r[i]);
+        lo[1] = std::min(lo[1], block.g[i]); hi[1] = std::max(hi[1], block.g[i]);
+        lo[2] = std::min(lo[2], block.b[i]); hi[2] = std::max(hi[2], block.b[i]);
+    }
+    // inset by 1/16 of the range, so the endpoints sit closer to the bulk of the colors
+    for(int c = 0; c < 3; ++c){
+        float inset = (hi[c] - lo[c]) / 16.0f;
+        e0[c] = hi[c] - inset;
+        e1[c] = lo[c] + inset;
+    }
+}
+
+// endpoints at the extremes of the colors along their principal axis, moved
+// inwards by the given fraction of the distance between them
+static void PrincipalAxisEndpoints(const ColorBlock& block, float insetFraction, float e0[3], float e1[3]) {
+    float mean[3] = { 0, 0, 0 };
+    for(int i = 0; i < 16; ++i){
+        mean[0] += block.r[i]; mean[1] += block.g[i]; mean[2] += block.b[i];
+    }
+    for(int c = 0; c < 3; ++c)
+        mean[c] /= 16.0f;
+    
+    float cov[6] = { 0, 0, 0, 0, 0, 0 }; // rr rg rb gg gb bb
+    for(int i = 0; i < 16; ++i){
+        float r = block.r[i] - mean[0], g = block.g[i] - mean[1], b = block.b[i] - mean[2];
+        cov[0] += r*r; cov[1] += r*g; cov[2] += r*b;
+        cov[3] += g*g; cov[4] += g*b; cov[5] += b*b;
+    }
+    
+    // power iteration for the largest eigenvector
+    float axis[3] = { 1, 1, 1 };
+    for(int iteration = 0; iteration < 8; ++iteration){
+        float x = cov[0]*axis[0] + cov[1]*axis[1] + cov[2]*axis[2];
+        float y = cov[1]*axis[0] + cov[3]*axis[1] + cov[4]*axis[2];
+        float z = cov[2]*axis[0] + cov[4]*axis[1] + cov[5]*axis[2];
+        float length = std::max(std::fabs(x), std::max(std::fabs(y), std::fabs(z)));
+        if(length <= 0.0f)
+            break;
+        axis[0] = x / length; axis[1] = y / length; axis[2] = z / length;
+    }
+    
+    float lo = 1e30f, hi = -1e30f;
+    for(int i = 0; i < 16; ++i){
+        float t = (block.r[i] - mean[0])*axis[0] + (block.g[i] - mean[1])*axis[1] + (block.b[i] - mean[2])*axis[2];
+        lo = std::min(lo, t);
+        hi = std::max(hi, t);
+    }
+    
+    float lengthSq = axis[0]*axis[0] + axis[1]*axis[1] + axis[2]*axis[2];
+    if(lengthSq > 0.0f){
+        lo /= lengthSq;
+        hi /= lengthSq;
+    }
+    
+    float inset = (hi - lo) * insetFraction;
+    hi -= inset;
+    lo += inset;
+    for(int c = 0; c < 3; ++c){
+        e0[c] = mean[c] + axis[c] * hi;
+        e1[c] = mean[c] + axis[c] * lo;
+    }
+}
+
+// solves for the endpoints that best fit the colors, given the current indices
+static bool LeastSquaresEndpoints(const ColorBlock& block, const unsigned char indices[16], float e0[3], float e1[3]) {
+    static const float Weight0[4] = { 1.0f, 0.0f, 2.0f/3.0f, 1.0f/3.0f };
+    float aa = 0, ab = 0, bb = 0;
+    float ax[3] = { 0, 0, 0 }, bx[3] = { 0, 0, 0 };
+    for(int i = 0; i < 16; ++i){
+        float a = Weight0[indices[i]], b = 1.0f - a;
+        aa += a*a; ab += a*b; bb += b*b;
+        ax[0] += a*block.r[i]; ax[1] += a*block.g[i]; ax[2] += a*block.b[i];
+        bx[0] += b*block.r[i]; bx[1] += b*block.g[i]; bx[2] += b*block.b[i];
+    }
+    float det = aa*bb - ab*ab;
+    if(std::fabs(det) < 1e-6f)
+        return false;
+    for(int c = 0; c < 3; ++c){
+        e0[c] = (bb*ax[c] - ab*bx[c]) / det;
+        e1[c] = (aa*bx[c] - ab*ax[c]) / det;
+    }
+    return true;
+}
+
+static void WriteColorBlock(unsigned short c0, unsigned short c1, const unsigned char indices[16], unsigned char* out) {
+    static const unsigned char SwappedIndex[4] = { 1, 0, 3, 2 };
+    unsigned bits = 0;
+    if(c0 == c1){
+        // all indices 0 gives exactly c0 in both BC1 modes
+    } else {
+        bool swap = c0 < c1; // c0 > c1 selects the four color mode
+        if(swap) std::swap(c0, c1);
+        for(int i = 0; i < 16; ++i)
+            bits |= (unsigned)(swap ? SwappedIndex[indices[i]] : indices[i]) << (2*i);
+    }
+    out[0] = (unsigned char)(c0 & 0xFF); out[1] = (unsigned char)(c0 >> 8);
+    out[2] = (unsigned char)(c1 & 0xFF); out[3] = (unsigned char)(c1 >> 8);
+    out[4] = (unsigned char)(bits & 0xFF); out[5] = (unsigned char)((bits >> 8) & 0xFF);
+    out[6] = (unsigned char)((bits >> 16) & 0xFF); out[7] = (unsigned char)(bits >> 24);
+}
+
+// quantizes the endpoints and picks the indices; returns the total squared error
+static float FitColorEndpoints(const ColorBlock& block, const float e0[3], const float e1[3], bool fast,
+                               unsigned short& c0, unsigned short& c1, unsigned char indices[16])
+{
+    float palette[4][3];
+    c0 = PackRGB565(e0);
+    c1 = PackRGB565(e1);
+    ColorPalette(c0, c1, palette);
+    return fast ? ProjectedColorIndices(block, palette, indices) : NearestColorIndices(block, palette, indices);
+}
+
+static void EncodeColorBlock(const ColorBlock& block, CompressedBitmap::Quality quality, unsigned char* out) {
+    float e0[3], e1[3];
+    unsigned short c0, c1;
+    unsigned char indices[16];
+    float error;
+    
+    if(quality == CompressedBitmap::Quality_Fast){
+        BoundingBoxEndpoints(block, e0, e1);
+        error = FitColorEndpoints(block, e0, e1, true, c0, c1, indices);
+    } else {
+        // extremes suit blocks of a few distinct colors, and inset endpoints
+        // suit gradients, so try both
+        PrincipalAxisEndpoints(block, 0.0f, e0, e1);
+        error = FitColorEndpoints(block, e0, e1, false, c0, c1, indices);
+        
+        unsigned short i0, i1;
+        unsigned char insetIndices[16];
+        PrincipalAxisEndpoints(block, 1.0f / 16.0f, e0, e1);
+        float insetError = FitColorEndpoints(block, e0, e1, false, i0, i1, insetIndices);
+        if(insetError < error){
+            error = insetError;
+            c0 = i0; c1 = i1;
+            memcpy(indices, insetIndices, sizeof(indices));
+        }
+    }
+    
+    if(quality == CompressedBitmap::Quality_High){
+        for(int iteration = 0; iteration < 2 && error > 0.0f; ++iteration){
+            if(!LeastSquaresEndpoints(block, indices, e0, e1))
+                break;
+            unsigned short n0, n1;
+            unsigned char newIndices[16];
+            float newError = FitColorEndpoints(block, e0, e1, false, n0, n1, newIndices);
+            if(newError >= error)
+                break;
+            c0 = n0; c1 = n1; error = newError;
+            memcpy(indices, newIndices, sizeof(indices));
+        }
+    }
+    
+    WriteColorBlock(c0, c1, indices, out);
+}
+
+// decodes a color block to RGBA. BC3 color blocks always use the four color mode.
+static void DecodeColorBlock(const unsigned char* in, bool allowThreeColors, unsigned char pixels[16][4]) {
+    unsigned short c0 = (unsigned short)(in[0] | (in[1] << 8));
+    unsigned short c1 = (unsigned short)(in[2] | (in[3] << 8));
+    unsigned bits = (unsigned)in[4] | ((unsigned)in[5] << 8) | ((unsigned)in[6] << 16) | ((unsigned)in[7] << 24);
+    
+    float palette[4][3];
+    unsigned char alpha[4] = { 255, 255, 255, 255 };
+    ColorPalette(c0, c1, palette);
+    if(allowThreeColors && c0 <= c1){
+        // three colors, and transparent black
+        for(int c = 0; c < 3; ++c){
+            palette[2][c] = (float)(((int)palette[0][c] + (int)palette[1][c]) / 2);
+            palette[3][c] = 0.0f;
+        }
+        alpha[3] = 0;
+    }
+    
+    for(int i = 0; i < 16; ++i){
+        unsigned index = (bits >> (2*i)) & 3;
+        for(int c = 0; c < 3; ++c)
+            pixels[i][c] = (unsigned char)palette[index][c];
+        pixels[i][3] = alpha[index];
+    }
+}
+
+
+/*
+ * Single channel blocks (BC4, both halves of BC5, and the alpha half of BC3)
+ *
+ * Two 8-bit endpoints, plus a 3-bit index per pixel. With a0 > a1 the indices
+ * choose between the endpoints and 6 values between them. With a0 <= a1 they
+ * choose between the endpoints, 4 values between them, 0 and 255.
+ */
+
+static void ChannelPalette(int a0, int a1, int palette[8]) {
+    palette[0] = a0;
+    palette[1] = a1;
+    if(a0 > a1){
+        for(int i = 1; i <= 6; ++i)
+            palette[i + 1] = ((7 - i)*a0 + i*a1) / 7;
+    } else {
+        for(int i = 1; i <= 4; ++i)
+            palette[i + 1] = ((5 - i)*a0 + i*a1) / 5;
+        palette[6] = 0;
+        palette[7] = 255;
+    }
+}
+
+static int NearestChannelIndices(const unsigned char values[16], const int palette[8], unsigned char indices[16]) {
+    int totalError = 0;
+    int i = 0;
+#ifdef TDOGL_SSE2
+    __m128i v0 = _mm_unpacklo_epi8(_mm_loadu_si128((const __m128i*)values), _mm_setzero_si128());
+    __m128i v1 = _mm_unpackhi_epi8(_mm_loadu_si128((const __m128i*)values), _mm_setzero_si128());
+    __m128i best0 = _mm_set1_epi16(0x7FFF), best1 = best0;
+    __m128i index0 = _mm_setzero_si128(), index1 = index0;
+    for(int k = 0; k < 8; ++k){
+        __m128i p = _mm_set1_epi16((short)palette[k]);
+        __m128i k16 = _mm_set1_epi16((short)k);
+        __m128i d0 = _mm_max_epi16(_mm_sub_epi16(v0, p), _mm_sub_epi16(p, v0));
+        __m128i d1 = _mm_max_epi16(_mm_sub_epi16(v1, p), _mm_sub_epi16(p, v1));
+        __m128i closer0 = _mm_cmplt_epi16(d0, best0), closer1 = _mm_cmplt_epi16(d1, best1);
+        best0 = _mm_min_epi16(best0, d0);
+        best1 = _mm_min_epi16(best1, d1);
+        index0 = _mm_or_si128(_mm_andnot_si128(closer0, index0), _mm_and_si128(closer0, k16));
+        index1 = _mm_or_si128(_mm_andnot_si128(closer1, index1), _mm_and_si128(closer1, k16));
+    }
+    short errors[16], idx[16];
+    _mm_storeu_si128((__m128i*)errors, best0);
+    _mm_storeu_si128((__m128i*)(errors + 8), best1);
+    _mm_storeu_si128((__m128i*)idx, index0);
+    _mm_storeu_si128((__m128i*)(idx + 8), index1);
+    for(; i < 16; ++i){
+        indices[i] = (unsigned char)idx[i];
+        totalError += errors[i] * errors[i];
+    }
+#endif
+    for(; i < 16; ++i){
+        int best = 1 << 30;
+        for(int k = 0; k < 8; ++k){
+            int d = std::abs((int)values[i] - palette[k]);
+            if(d < best){
+                best = d;
+                indices[i] = (unsigned char)k;
+            }
+        }
+        totalError += best * best;
+    }
+    return totalError;
+}
+
+static void WriteChannelBlock(int a0, int a1, const unsigned char indices[16], unsigned char* out) {
+    out[0] = (unsigned char)a0;
+    out[1] = (unsigned char)a1;
+    unsigned long long bits = 0;
+    for(int i = 0; i < 16; ++i)
+        bits |= (unsigned long long)indices[i] << (3*i);
+    for(int i = 0; i < 6; ++i)
+        out[2 + i] = (unsigned char)(bits >> (8*i));
+}
+
+static void EncodeChannelBlock(const unsigned char values[16], CompressedBitmap::Quality quality, unsigned char* out) {
+    int lo = 255, hi = 0;
+    for(int i = 0; i < 16; ++i){
+        lo = std::min(lo, (int)values[i]);
+        hi = std::max(hi, (int)values[i]);
+    }
+    
+    unsigned char indices[16];
+    if(lo == hi){
+        memset(indices, 0, sizeof(indices));
+        WriteChannelBlock(hi, lo, indices, out);
+        return;
+    }
+    
+    if(quality == CompressedBitmap::Quality_Fast){
+        // palette is evenly spaced from hi (index 0) to lo (index 1), so round arithmetically
+        for(int i = 0; i < 16; ++i){
+            int step = ((hi - values[i]) * 14 + (hi - lo)) / ((hi - lo) * 2);
+            indices[i] = (unsigned char)(step == 0 ? 0 : (step == 7 ? 1 : step + 1));
+        }
+        WriteChannelBlock(hi, lo, indices, out);
+        return;
+    }
+    
+    int palette[8];
+    ChannelPalette(hi, lo, palette);
+    int error = NearestChannelIndices(values, palette, indices);
+    
+    if(quality == CompressedBitmap::Quality_High){
+        // the 6 value mode has exact 0 and 255, so it can fit the other values more tightly
+        int innerLo = 255, innerHi = 0;
+        for(int i = 0; i < 16; ++i){
+            if(values[i] != 0 && values[i] != 255){
+                innerLo = std::min(innerLo, (int)values[i]);
+                innerHi = std::max(innerHi, (int)values[i]);
+            }
+        }
+        if(innerLo <= innerHi){
+            int altPalette[8];
+            unsigned char altIndices[16];
+            ChannelPalette(innerLo, innerHi, altPalette);
+            int altError = NearestChannelIndices(values, altPalette, altIndices);
+            if(altError < error){
+                WriteChannelBlock(innerLo, innerHi, altIndices, out);
+                return;
+            }
+        }
+    }
+    
+    WriteChannelBlock(hi, lo, indices, out);
+}
+
+static void DecodeChannelBlock(const unsigned char* in, unsigned char values[16]) {
+    int palette[8];
+    ChannelPalette(in[0], in[1], palette);
+    unsigned long long bits = 0;
+    for(int i = 0; i < 6; ++i)
+        bits |= (unsigned long long)in[2 + i] << (8*i);
+    for(int i = 0; i < 16; ++i)
+        values[i] = (unsigned char)palette[(bits >> (3*i)) & 7];
+}
+
+
+/*
+ * CompressedBitmap class
+ */
+
+unsigned CompressedBitmap::blockSize(Format format) {
+    switch(format){
+        case Format_BC1: return 8;
+        case Format_BC3: return 16;
+        case Format_BC4: return 8;
+        case Format_BC5: return 16;
+        default:
+            throw std::runtime_error("Unhandled block compression format");
+    }
+}
+
+size_t CompressedBitmap::blockDataSize(Format format, unsigned width, unsigned height) {
+    return (size_t)((width + 3) / 4) * ((height + 3) / 4) * blockSize(format);
+}
+
+void CompressedBitmap::textureSwizzle(Format format, Swizzle swizzle[4]) {
+    switch(format){
+        case Format_BC1:
+        case Format_BC3:
+            swizzle[0] = Swizzle_Red; swizzle[1] = Swizzle_Green; swizzle[2] = Swizzle_Blue; swizzle[3] = Swizzle_Alpha;
+            break;
+        case Format_BC4:
+            swizzle[0] = swizzle[1] = swizzle[2] = Swizzle_Red; swizzle[3] = Swizzle_One;
+            break;
+        case Format_BC5:
+            swizzle[0] = swizzle[1] = swizzle[2] = Swizzle_Red; swizzle[3] = Swizzle_Green;
+            break;
+        default:
+            throw std::runtime_error("Unhandled block compression format");
+    }
+}
+
+CompressedBitmap::CompressedBitmap(const BitmapView& src, Format format, Quality quality) :
+    _format(format),
+    _width(src.width()),
+    _height(src.height()),
+    _blocks(NULL)
+{
+    if(src.channelType() != Bitmap::ChannelType_UInt8)
+        throw std::runtime_error("Only 8-bit channels can be block compressed");
+    
+    size_t size = blockDataSize(format, _width, _height);
+    _blocks = (unsigned char*)malloc(size);
+    if(!_blocks)
+        throw std::runtime_error("Failed to allocate compressed blocks");
+    
+    unsigned blocksWide = (_width + 3) / 4;
+    unsigned blocksHigh = (_height + 3) / 4;
+    unsigned bytesPerBlock = blockSize(format);
+    
+    // BC4 and BC5 encode the first channel(s) of the source, which are at
+    // these positions once converted to RGBA
+    unsigned secondChannel = src.format() <= Bitmap::Format_GrayscaleAlpha ? 3 : 1;
+    
+    auto encodeBlockRows = [&](size_t begin, size_t end) {
+        // 4 rows of pixels, converted to RGBA
+        Bitmap rows(_width, 4, Bitmap::Format_RGBA);
+        
+        for(size_t blockRow = begin; blockRow < end; ++blockRow){
+            unsigned firstRow = (unsigned)blockRow * 4;
+            unsigned rowCount = std::min(4u, _height - firstRow);
+            rows.copyFromView(src.subView(0, firstRow, _width, rowCount), 0, 0);
+            for(unsigned r = rowCount; r < 4; ++r)
+                memcpy(rows.row(r), rows.row(rowCount - 1), (size_t)_width * 4);
+            
+            for(unsigned blockCol = 0; blockCol < blocksWide; ++blockCol){
+                ColorBlock color;
+                unsigned char channels[4][16];
+                for(unsigned i = 0; i < 16; ++i){
+                    unsigned x = std::min(blockCol*4 + i % 4, _width - 1);
+                    const unsigned char* p = rows.row(i / 4) + x*4;
+                    color.r[i] = p[0]; color.g[i] = p[1]; color.b[i] = p[2];
+                    for(int c = 0; c < 4; ++c)
+                        channels[c][i] = p[c];
+                }
+                
+                unsigned char* out = _blocks + (blockRow * blocksWide + blockCol) * bytesPerBlock;
+                switch(format){
+                    case Format_BC1:
+                        EncodeColorBlock(color, quality, out);
+                        break;
+                    case Format_BC3:
+                        EncodeChannelBlock(channels[3], quality, out);
+                        EncodeColorBlock(color, quality, out + 8);
+                        break;
+                    case Format_BC4:
+                        EncodeChannelBlock(channels[0], quality, out);
+                        break;
+                    case Format_BC5:
+                        EncodeChannelBlock(channels[0], quality, out);
+                        EncodeChannelBlock(channels[secondChannel], quality, out + 8);
+                        break;
+                }
+            }
+        }
+    };
+    
+    try {
+        ThreadPool::shared().parallelFor(blocksHigh, 4, encodeBlockRows);
+    } catch(...) {
+        free(_blocks);
+        throw;
+    }
+}
+
+CompressedBitmap::CompressedBitmap(unsigned width, unsigned height, Format format, const unsigned char* blocks) :
+    _format(format),
+    _width(width),
+    _height(height),
+    _blocks(NULL)
+{
+    if(width == 0 || height == 0)
+        throw std::runtime_error("Zero width or height compressed bitmap");
+    
+    size_t size = blockDataSize(format, width, height);
+    _blocks = (unsigned char*)malloc(size);
+    if(!_blocks)
+        throw std::runtime_error("Failed to allocate compressed blocks");
+    memcpy(_blocks, blocks, size);
+}
+
+Bitmap CompressedBitmap::decompress() const {
+    Swizzle swizzle[4];
+    textureSwizzle(_format, swizzle);
+    
+    Bitmap pixels(_width, _height, Bitmap::Format_RGBA);
+    unsigned blocksWide = (_width + 3) / 4;
+    unsigned blocksHigh = (_height + 3) / 4;
+    unsigned bytesPerBlock = blockSize(_format);
+    for(unsigned blockRow = 0; blockRow < blocksHigh; ++blockRow){
+        for(unsigned blockCol = 0; blockCol < blocksWide; ++blockCol){
+            const unsigned char* in = _blocks + (blockRow * blocksWide + blockCol) * bytesPerBlock;
+            
+            // what the GPU decodes, before swizzling. RGTC channels it doesn't
+            // store decode to 0, and alpha to 1.
+            unsigned char decoded[16][4];
+            unsigned char values[16], secondValues[16];
+            switch(_format){
+                case Format_BC1:
+                    DecodeColorBlock(in, true, decoded);
+                    break;
+                case Format_BC3:
+                    DecodeColorBlock(in + 8, false, decoded);
+                    DecodeChannelBlock(in, values);
+                    for(int i = 0; i < 16; ++i)
+                        decoded[i][3] = values[i];
+                    break;
+                case Format_BC4:
+                case Format_BC5:
+                    DecodeChannelBlock(in, values);
+                    if(_format == Format_BC5)
+                        DecodeChannelBlock(in + 8, secondValues);
+                    for(int i = 0; i < 16; ++i){
+                        decoded[i][0] = values[i];
+                        decoded[i][1] = (_format == Format_BC5) ? secondValues[i] : 0;
+                        decoded[i][2] = 0;
+                        decoded[i][3] = 255;
+                    }
+                    break;
+            }
+            
+            for(unsigned i = 0; i < 16; ++i){
+                unsigned x = blockCol*4 + i % 4, y = blockRow*4 + i / 4;
+                if(x >= _width || y >= _height)
+                    continue;
+                unsigned char* p = pixels.row(y) + x*4;
+                for(int c = 0; c < 4; ++c)
+                    p[c] = (swizzle[c] == Swizzle_One) ? 255 : decoded[i][swizzle[c]];
+            }
+        }
+    }
+    return pixels;
+}
+
+CompressedBitmap::~CompressedBitmap() {
+    if(_blocks) free(_blocks);
+}
+
+unsigned CompressedBitmap::width() const {
+    return _width;
+}
+
+unsigned CompressedBitmap::height() const {
+    return _height;
+}
+
+CompressedBitmap::Format CompressedBitmap::format() const {
+    return _format;
+}
+
+const unsigned char* CompressedBitmap::blocks() const {
+    return _blocks;
+}
+
+size_t CompressedBitmap::size() const {
+    return blockDataSize(_format, _width, _height);
+}
+
+CompressedBitmap::CompressedBitmap(CompressedBitmap&& other) :
+    _format(other._format),
+    _width(other._width),
+    _height(other._height),
+    _blocks(other._blocks)
+{
+    other._width = 0;
+    other._height = 0;
+    other._blocks = NULL;
+}
+
+CompressedBitmap& CompressedBitmap::operator = (CompressedBitmap&& other) {
+    if(this != &other){
+        if(_blocks) free(_blocks);
+        _format = other._format;
+        _width = other._width;
+        _height = other._height;
+        _blocks = other._blocks;
+        
+        other._width = 0;
+        other._height = 0;
+        other._blocks = NULL;
+    }
+    return *this;
+}
@@ -0,0 +1,151 @@
+/*
+ tdogl::CompressedBitmap
+ 
+ Copyright 2012 Thomas Dalling - http://tomdalling.com/
+ 
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+ 
+ http://www.apache.org/licenses/LICENSE-2.0
+ 
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#pragma once
+
+#include "Bitmap.h"
+#include "BitmapView.h"
+#include <cstddef>
+
+namespace tdogl {
+    
+    /**
+     A block-compressed image (BC1/BC3/BC4/BC5, a.k.a. DXT1/DXT5/RGTC1/RGTC2).
+     
+     Every 4x4 pixel block is compressed to 8 or 16 bytes, which GPUs can
+     sample directly, so these take 4-8x less video memory and bandwidth than
+     uncompressed bitmaps.
+     
+     The encoder is pure CPU code (no OpenGL context needed), so it can run in
+     offline tools and on headless machines. Block rows are encoded across the
+     threads of ThreadPool::shared. Use with the tdogl::Texture constructor that
+     takes a CompressedBitmap.
+     */
+    class CompressedBitmap {
+    public:
+        /**
+         The block compression format.
+         */
+        enum Format {
+            Format_BC1, /**< RGB, 8 bytes per block. Alpha is ignored. */
+            Format_BC3, /**< RGBA, 16 bytes per block: BC4-style alpha + BC1 color */
+            Format_BC4, /**< one channel (red or gray), 8 bytes per block */
+            Format_BC5  /**< two channels, 16 bytes per block. See the constructor. */
+        };
+        
+        /**
+         Where a texture takes one of its red, green, blue or alpha channels
+         from. See textureSwizzle.
+         */
+        enum Swizzle {
+            Swizzle_Red,   /**< the decoded red channel */
+            Swizzle_Green, /**< the decoded green channel */
+            Swizzle_Blue,  /**< the decoded blue channel */
+            Swizzle_Alpha, /**< the decoded alpha channel */
+            Swizzle_One    /**< a constant 1 */
+        };
+        
+        /**
+         Trades encoding speed for image quality.
+         */
+        enum Quality {
+            Quality_Fast,   /**< bounding box endpoints, arithmetic index selection */
+            Quality_Normal, /**< principal axis endpoints, best-fit indices */
+            Quality_High    /**< Quality_Normal, plus least-squares endpoint refinement */
+        };
+        
+        /**
+         Compresses the given pixels.
+         
+         BC1 and BC3 encode the color channels as sRGB, like tdogl::Texture does
+         for uncompressed bitmaps. BC4 encodes the first channel of the pixels
+         (gray or red). BC5 encodes gray and alpha for grayscale bitmaps, and red
+         and green for RGB(A) bitmaps (e.g. normal maps).
+         
+         Widths and heights that aren't multiples of 4 are padded by repeating
+         the edge pixels. The pixels must have 8-bit channels.
+         */
+        CompressedBitmap(const BitmapView& src, Format format, Quality quality = Quality_Normal);
+        
+        /**
+         Makes a compressed image from existing blocks, e.g. loaded from disk.
+         
+         @param blocks  blockDataSize(format, width, height) bytes of blocks
+         */
+        CompressedBitmap(unsigned width, unsigned height, Format format, const unsigned char* blocks);
+        
+        ~CompressedBitmap();
+        
+        /** width in pixels */
+        unsigned width() const;
+        
+        /** height in pixels */
+        unsigned height() const;
+        
+        /** the block compression format */
+        Format format() const;
+        
+        /** the compressed blocks, row by row of blocks, top row first */
+        const unsigned char* blocks() const;
+        
+        /** size of the compressed blocks in bytes */
+        size_t size() const;
+        
+        /** bytes per 4x4 block for the given format (8 or 16) */
+        static unsigned blockSize(Format format);
+        
+        /** size in bytes of the blocks for an image of the given size */
+        static size_t blockDataSize(Format format, unsigned width, unsigned height);
+        
+        /**
+         How tdogl::Texture swizzles textures of the given format, as the
+         sources of their red, green, blue and alpha channels.
+         
+         GPUs decode BC4 to red, and BC5 to red and green, so these are
+         swizzled to sample as gray (R,R,R,1) and gray with alpha (R,R,R,G),
+         like uncompressed Grayscale and GrayscaleAlpha textures. That includes
+         BC5 normal maps, whose second channel is then read from alpha. BC1 and
+         BC3 aren't swizzled.
+         */
+        static void textureSwizzle(Format format, Swizzle swizzle[4]);
+        
+        /**
+         Decodes the blocks to RGBA pixels, the way a texture made from them is
+         sampled (textureSwizzle included), before any sRGB decoding. For
+         checking the encoder and the texture setup without a GPU.
+         */
+        Bitmap decompress() const;
+        
+        /** Move constructor */
+        CompressedBitmap(CompressedBitmap&& other);
+        
+        /** Move assignment operator */
+        CompressedBitmap& operator = (CompressedBitmap&& other);
+        
+    private:
+        Format _format;
+        unsigned _width;
+        unsigned _height;
+        unsigned char* _blocks;
+        
+        //copying disabled
+        CompressedBitmap(const CompressedBitmap&) = delete;
+        CompressedBitmap& operator = (const CompressedBitmap&) = delete;
+    };
+    
+}
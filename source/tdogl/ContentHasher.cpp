@@ -0,0 +1,143 @@
+/*
+ tdogl::ContentHasher
+ 
+ Copyright 2012 Thomas Dalling - http://tomdalling.com/
+ 
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+ 
+ http://www.apache.org/licenses/LICENSE-2.0
+ 
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#include "ContentHasher.h"
+#include <cstring>
+
+using namespace tdogl;
+
+static const uint64_t Prime1 = 11400714785074694791ULL;
+static const uint64_t Prime2 = 14029467366897019727ULL;
+static const uint64_t Prime3 = 1609587929392839161ULL;
+static const uint64_t Prime4 = 9650029242287828579ULL;
+static const uint64_t Prime5 = 2870177450012600261ULL;
+
+static inline uint64_t RotateLeft(uint64_t value, int bits) {
+    return (value << bits) | (value >> (64 - bits));
+}
+
+// little-endian loads, regardless of alignment
+static inline uint64_t Read64(const unsigned char* p) {
+    uint64_t value = 0;
+    for(int i = 7; i >= 0; --i)
+        value = (value << 8) | p[i];
+    return value;
+}
+
+static inline uint32_t Read32(const unsigned char* p) {
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static inline uint64_t Round(uint64_t lane, uint64_t input) {
+    lane += input * Prime2;
+    lane = RotateLeft(lane, 31);
+    return lane * Prime1;
+}
+
+static inline uint64_t MergeRound(uint64_t hash, uint64_t lane) {
+    hash ^= Round(0, lane);
+    return hash * Prime1 + Prime4;
+}
+
+// consumes as many whole 32 byte stripes as possible, returning how many bytes were used
+static size_t ConsumeStripes(uint64_t lanes[4], const unsigned char* p, size_t size) {
+    size_t used = 0;
+    for(; used + 32 <= size; used += 32){
+        lanes[0] = Round(lanes[0], Read64(p + used));
+        lanes[1] = Round(lanes[1], Read64(p + used + 8));
+        lanes[2] = Round(lanes[2], Read64(p + used + 16));
+        lanes[3] = Round(lanes[3], Read64(p + used + 24));
+    }
+    return used;
+}
+
+ContentHasher::ContentHasher(uint64_t seed) :
+    _seed(seed),
+    _totalSize(0),
+    _bufferSize(0)
+{
+    _lanes[0] = seed + Prime1 + Prime2;
+    _lanes[1] = seed + Prime2;
+    _lanes[2] = seed;
+    _lanes[3] = seed - Prime1;
+}
+
+void ContentHasher::update(const void* data, size_t size) {
+    const unsigned char* p = (const unsigned char*)data;
+    _totalSize += size;
+    
+    if(_bufferSize > 0){
+        size_t fill = 32 - _bufferSize;
+        if(size < fill){
+            memcpy(_buffer + _bufferSize, p, size);
+            _bufferSize += size;
+            return;
+        }
+        memcpy(_buffer + _bufferSize, p, fill);
+        ConsumeStripes(_lanes, _buffer, 32);
+        _bufferSize = 0;
+        p += fill;
+        size -= fill;
+    }
+    
+    size_t used = ConsumeStripes(_lanes, p, size);
+    memcpy(_buffer, p + used, size - used);
+    _bufferSize = size - used;
+}
+
+uint64_t ContentHasher::digest() const {
+    uint64_t hash;
+    if(_totalSize >= 32){
+        hash = RotateLeft(_lanes[0], 1) + RotateLeft(_lanes[1], 7) + RotateLeft(_lanes[2], 12) + RotateLeft(_lanes[3], 18);
+        for(int i = 0; i < 4; ++i)
+            hash = MergeRound(hash, _lanes[i]);
+    } else {
+        hash = _seed + Prime5;
+    }
+    hash += _totalSize;
+    
+    const unsigned char* p = _buffer;
+    size_t left = _bufferSize;
+    for(; left >= 8; left -= 8, p += 8){
+        hash ^= Round(0, Read64(p));
+        hash = RotateLeft(hash, 27) * Prime1 + Prime4;
+    }
+    if(left >= 4){
+        hash ^= (uint64_t)Read32(p) * Prime1;
+        hash = RotateLeft(hash, 23) * Prime2 + Prime3;
+        left -= 4;
+        p += 4;
+    }
+    for(; left > 0; --left, ++p){
+        hash ^= (*p) * Prime5;
+        hash = RotateLeft(hash, 11) * Prime1;
+    }
+    
+    hash ^= hash >> 33;
+    hash *= Prime2;
+    hash ^= hash >> 29;
+    hash *= Prime3;
+    hash ^= hash >> 32;
+    return hash;
+}
+
+uint64_t ContentHasher::hash(const void* data, size_t size, uint64_t seed) {
+    ContentHasher hasher(seed);
+    hasher.update(data, size);
+    return hasher.digest();
+}
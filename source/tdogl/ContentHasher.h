@@ -0,0 +1,63 @@
+/*
+ tdogl::ContentHasher
+ 
+ Copyright 2012 Thomas Dalling - http://tomdalling.com/
+ 
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+ 
+ http://www.apache.org/licenses/LICENSE-2.0
+ 
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <stdint.h>
+
+namespace tdogl {
+    
+    /**
+     Computes a fast 64-bit hash of a stream of bytes (the XXH64 algorithm).
+     
+     Suitable for detecting whether file contents changed, or whether two
+     files are identical. Not suitable for anything security related.
+     
+     Bytes can be added in chunks of any size, e.g. while a file is being read,
+     and the result is the same as hashing all of them at once.
+     */
+    class ContentHasher {
+    public:
+        explicit ContentHasher(uint64_t seed = 0);
+        
+        /**
+         Adds more bytes to the hash.
+         */
+        void update(const void* data, size_t size);
+        
+        /**
+         The hash of all the bytes added so far. More bytes can still be added
+         afterwards.
+         */
+        uint64_t digest() const;
+        
+        /**
+         Hashes a single block of memory.
+         */
+        static uint64_t hash(const void* data, size_t size, uint64_t seed = 0);
+        
+    private:
+        uint64_t _seed;
+        uint64_t _lanes[4];
+        uint64_t _totalSize;
+        unsigned char _buffer[32];
+        size_t _bufferSize;
+    };
+    
+}
@@ -0,0 +1,223 @@
+/*
+ tdogl::DistanceField
+ 
+ Copyright 2012 Thomas Dalling - http://tomdalling.com/
+ 
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+ 
+ http://www.apache.org/licenses/LICENSE-2.0
+ 
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#include "DistanceField.h"
+#include "ThreadPool.h"
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include <stdint.h>
+#include <vector>
+
+using namespace tdogl;
+
+// masks with fewer pixels than this are transformed on the calling thread
+static const size_t ParallelPixelThreshold = 256 * 256;
+
+// columns per chunk of the column pass
+static const unsigned ColumnStrip = 64;
+
+/*
+ The column pass, Meijster's first phase: the distance from each pixel to the
+ nearest feature pixel in the same column, capped at `cap`. The features are
+ the inside pixels when measuring the outside pixels, and the other way round.
+ Sweeping down and then up the rows reads the image in memory order, one
+ strip of columns per chunk.
+ 
+ `Distance` is uint8_t when the cap fits, which halves the memory traffic of
+ both passes for the usual spreads of a few pixels.
+ */
+template <typename Distance>
+static void ColumnDistances(const BitmapView& mask,
+                            unsigned channel,
+                            unsigned char threshold,
+                            bool featureInside,
+                            unsigned cap,
+                            unsigned begin,
+                            unsigned end,
+                            Distance* columnDistances)
+{
+    unsigned width = mask.width();
+    unsigned bytesPerPixel = mask.bytesPerPixel();
+    
+    for(unsigned y = 0; y < mask.height(); ++y){
+        const unsigned char* m = mask.row(y) + channel;
+        Distance* row = columnDistances + (size_t)y * width;
+        const Distance* above = (y == 0) ? NULL : row - width;
+        for(unsigned x = begin; x < end; ++x){
+            bool inside = m[(size_t)x * bytesPerPixel] >= threshold;
+            if(inside == featureInside)
+                row[x] = 0;
+            else
+                row[x] = (Distance)(above ? std::min(cap, above[x] + 1u) : cap);
+        }
+    }
+    
+    for(unsigned y = mask.height() - 1; y-- > 0;){
+        Distance* row = columnDistances + (size_t)y * width;
+        const Distance* below = row + width;
+        for(unsigned x = begin; x < end; ++x){
+            if(below[x] + 1u < row[x])
+                row[x] = (Distance)(below[x] + 1u);
+        }
+    }
+}
+
+/*
+ The row pass, Meijster's second phase. Every feature candidate i along the
+ row is a parabola (x - i)^2 + g(i)^2, where g is its column distance, and
+ the lower envelope of them all is each pixel's exact squared distance to the
+ nearest feature. `s` holds the candidates on the envelope and `t` where each
+ one takes over, so the whole row takes linear time.
+ 
+ Candidates at the cap are left out. They are further away than the spread,
+ so any pixel they would be nearest to comes out clamped anyway, and in
+ sparse masks that is most of them.
+ 
+ Only the pixels that aren't features are written, so the outside and inside
+ passes fill in the two halves of the field.
+ */
+template <typename Distance>
+static void RowDistances(const Distance* g,
+                         unsigned width,
+                         unsigned cap,
+                         float scale,
+                         Bitmap::ChannelType channelType,
+                         unsigned char* out,
+                         int* s,
+                         int* t)
+{
+    // the squared distance from x to candidate i
+    auto f = [g](int x, int i) -> int64_t {
+        return (int64_t)(x - i) * (x - i) + (int64_t)g[i] * g[i];
+    };
+    
+    int q = -1;
+    for(int u = 0; u < (int)width; ++u){
+        if(g[u] >= cap)
+            continue;
+        while(q >= 0 && f(t[q], s[q]) > f(t[q], u))
+            --q;
+        if(q < 0){
+            q = 0;
+            s[0] = u;
+            t[0] = 0;
+        } else {
+            // the first x where u is closer than s[q]. The numerator is exact
+            // in a double, and much quicker to divide than as a 64-bit integer
+            int i = s[q];
+            double numerator = (double)u * u - (double)i * i + (double)g[u] * g[u] - (double)g[i] * g[i];
+            double sep = std::floor(numerator / (2 * (u - i)));
+            if(sep + 1 < width){
+                ++q;
+                s[q] = u;
+                t[q] = (int)sep + 1;
+            }
+        }
+    }
+    
+    // pixels at least this far away, squared, are clamped, so don't need a square root
+    float clamped = (scale > 0.0f) ? 1.0f : 0.0f;
+    int64_t clampedDistance = (int64_t)std::ceil(std::pow(0.5 / std::fabs(scale) + 0.5, 2.0));
+    
+    for(int u = (int)width - 1; u >= 0; --u){
+        if(g[u] != 0){
+            float value = clamped;
+            int64_t distance = (q >= 0) ? f(u, s[q]) : clampedDistance;
+            //distances are between pixel centers, and the edge is half way
+            if(distance < clampedDistance)
+                value = std::min(1.0f, std::max(0.0f, 0.5f + scale * (std::sqrt((float)distance) - 0.5f)));
+            if(channelType == Bitmap::ChannelType_UInt16)
+                ((uint16_t*)out)[u] = (uint16_t)(value * 65535.0f + 0.5f);
+            else
+                out[u] = (unsigned char)(value * 255.0f + 0.5f);
+        }
+        if(q >= 0 && u == t[q])
+            --q;
+    }
+}
+
+// both passes, into the UInt8 or UInt16 field `out`
+template <typename Distance>
+static void Transform(const BitmapView& mask,
+                      unsigned channel,
+                      unsigned char threshold,
+                      unsigned cap,
+                      float spread,
+                      const BitmapView& out)
+{
+    unsigned width = mask.width();
+    unsigned height = mask.height();
+    std::vector<Distance> columnDistances((size_t)width * height);
+    size_t strips = (width + ColumnStrip - 1) / ColumnStrip;
+    bool parallel = (size_t)width * height >= ParallelPixelThreshold;
+    
+    // the outside pixels' distances to the inside, then the inside pixels' distances to the outside
+    for(int pass = 0; pass < 2; ++pass){
+        bool featureInside = (pass == 0);
+        float scale = (featureInside ? -0.5f : 0.5f) / spread;
+        
+        auto columns = [&](size_t begin, size_t end) {
+            ColumnDistances(mask, channel, threshold, featureInside, cap,
+                            (unsigned)begin * ColumnStrip, (unsigned)std::min<size_t>(width, end * ColumnStrip),
+                            &columnDistances[0]);
+        };
+        auto rows = [&](size_t begin, size_t end) {
+            std::vector<int> s(width), t(width);
+            for(size_t y = begin; y < end; ++y)
+                RowDistances(&columnDistances[y * width], width, cap, scale, out.channelType(), out.row((unsigned)y), &s[0], &t[0]);
+        };
+        
+        if(parallel){
+            ThreadPool::shared().parallelFor(strips, 1, columns);
+            ThreadPool::shared().parallelFor(height, 16, rows);
+        } else {
+            columns(0, strips);
+            rows(0, height);
+        }
+    }
+}
+
+Bitmap tdogl::GenerateDistanceField(const BitmapView& mask,
+                                    float spread,
+                                    Bitmap::ChannelType channelType,
+                                    unsigned char threshold)
+{
+    if(mask.channelType() != Bitmap::ChannelType_UInt8)
+        throw std::runtime_error("Distance fields can only be made from masks with 8-bit channels");
+    if(channelType != Bitmap::ChannelType_UInt8 && channelType != Bitmap::ChannelType_UInt16)
+        throw std::runtime_error("Distance fields can only have UInt8 or UInt16 channels");
+    if(!(spread > 0.0f))
+        throw std::runtime_error("Distance field spread must be greater than zero");
+    if(mask.width() == 0 || mask.height() == 0)
+        throw std::runtime_error("Can't make a distance field from an empty mask");
+    
+    Bitmap::Format format = mask.format();
+    unsigned channel = (format == Bitmap::Format_GrayscaleAlpha || format == Bitmap::Format_RGBA) ? format - 1 : 0;
+    
+    // a pixel within the spread has its nearest feature within the spread in
+    // both axes, so column distances can be capped just past it
+    unsigned cap = (unsigned)std::min(65535.0, std::ceil((double)spread) + 2.0);
+    
+    Bitmap field(mask.width(), mask.height(), Bitmap::Format_Grayscale, channelType);
+    if(cap <= 255)
+        Transform<uint8_t>(mask, channel, threshold, cap, spread, BitmapView(field));
+    else
+        Transform<uint16_t>(mask, channel, threshold, cap, spread, BitmapView(field));
+    return field;
+}
@@ -0,0 +1,53 @@
+/*
+ tdogl::DistanceField
+ 
+ Copyright 2012 Thomas Dalling - http://tomdalling.com/
+ 
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+ 
+ http://www.apache.org/licenses/LICENSE-2.0
+ 
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#pragma once
+
+#include "Bitmap.h"
+#include "BitmapView.h"
+
+namespace tdogl {
+    
+    /**
+     Makes a signed distance field from a mask, for decals, icons and text that
+     stay crisp when drawn much bigger than their texture.
+     
+     A pixel of the mask is inside if its alpha, or its first channel for
+     formats without alpha, is at least `threshold`. The distance from every
+     pixel to the nearest pixel on the other side of the edge is found with an
+     exact Euclidean distance transform (Meijster et al.), which takes linear
+     time: one pass down the columns, then one along the rows, both across the
+     threads of ThreadPool::shared.
+     
+     The result is a Grayscale bitmap of the same size. 0.5 is the edge, half
+     way between an inside and an outside pixel. Values rise to 1 at `spread`
+     pixels inside the edge, and fall to 0 at `spread` pixels outside it.
+     
+     @param mask         The shape. Must have 8-bit channels.
+     @param spread       How far from the edge, in pixels, distances are kept.
+                         Must be greater than zero.
+     @param channelType  UInt8 or UInt16. 8 bits are enough for a spread of a
+                         few pixels, and 16 keep sub-pixel steps over big ones.
+     @param threshold    The smallest mask value that is inside
+     */
+    Bitmap GenerateDistanceField(const BitmapView& mask,
+                                 float spread,
+                                 Bitmap::ChannelType channelType = Bitmap::ChannelType_UInt8,
+                                 unsigned char threshold = 128);
+    
+}
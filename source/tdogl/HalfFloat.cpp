@@ -0,0 +1,168 @@
+/*
+ tdogl::HalfFloat
+ 
+ Copyright 2012 Thomas Dalling - http://tomdalling.com/
+ 
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+ 
+ http://www.apache.org/licenses/LICENSE-2.0
+ 
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#include "HalfFloat.h"
+#include <cstring>
+
+#if !defined(TDOGL_DISABLE_SIMD) && (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+    #define TDOGL_SSE2 1
+    #include <emmintrin.h>
+    #if defined(__F16C__)
+        #define TDOGL_F16C 1
+        #include <immintrin.h>
+    #endif
+#endif
+
+using namespace tdogl;
+
+// Both directions work on the bits of the float, with the exponent rebiased by
+// float arithmetic, so the scalar and SSE2 versions are the same steps. They
+// give the same results as the F16C instructions, apart from NaN payloads.
+
+static const unsigned FloatInfinity = 255u << 23;
+// the smallest float that rounds to infinity as a half: 65520
+static const unsigned HalfOverflow = (127u + 16) << 23;
+// floats below this become denormal halves
+static const unsigned HalfNormalMin = 113u << 23;
+// adding this float shifts a denormal half's mantissa into the low bits, rounding it to even
+static const unsigned DenormalMagic = ((127u - 15) + (23 - 10) + 1) << 23;
+// the exponent bias difference, plus the rounding bias for the 13 dropped mantissa bits
+static const unsigned RebiasRound = ((15u - 127) << 23) + 0xFFF;
+// multiplying by this float moves a half's exponent bias to a float's
+static const unsigned RebiasMagic = (254u - 15) << 23;
+
+inline float BitsToFloat(unsigned bits) {
+    float value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+inline unsigned FloatToBits(float value) {
+    unsigned bits;
+    memcpy(&bits, &value, sizeof(bits));
+    return bits;
+}
+
+unsigned short tdogl::FloatToHalf(float value) {
+    unsigned bits = FloatToBits(value);
+    unsigned sign = bits & 0x80000000u;
+    bits ^= sign;
+    
+    unsigned half;
+    if(bits >= HalfOverflow){
+        half = bits > FloatInfinity ? 0x7E00 : 0x7C00;
+    } else if(bits < HalfNormalMin){
+        half = FloatToBits(BitsToFloat(bits) + BitsToFloat(DenormalMagic)) - DenormalMagic;
+    } else {
+        unsigned mantissaOdd = (bits >> 13) & 1;
+        half = (bits + RebiasRound + mantissaOdd) >> 13;
+    }
+    return (unsigned short)(half | (sign >> 16));
+}
+
+float tdogl::HalfToFloat(unsigned short half) {
+    unsigned exponentMantissa = half & 0x7FFFu;
+    unsigned sign = (unsigned)(half & 0x8000u) << 16;
+    float scaled = BitsToFloat(exponentMantissa << 13) * BitsToFloat(RebiasMagic);
+    unsigned bits = FloatToBits(scaled);
+    if(exponentMantissa > 0x7BFF)
+        bits |= FloatInfinity;
+    return BitsToFloat(bits | sign);
+}
+
+#if defined(TDOGL_SSE2) && !defined(TDOGL_F16C)
+
+// 4 floats  ->  4 halves in the low 16 bits of each lane, sign extended
+static inline __m128i FloatToHalf4(__m128 value) {
+    const __m128i signMask = _mm_set1_epi32((int)0x80000000u);
+    __m128i bits = _mm_castps_si128(value);
+    __m128i sign = _mm_and_si128(bits, signMask);
+    bits = _mm_xor_si128(bits, sign);
+    
+    // infinity, or NaN (0x7E00) if bits > infinity. Signed compares are fine,
+    // since the sign bit has been cleared
+    __m128i isNaN = _mm_cmpgt_epi32(bits, _mm_set1_epi32((int)FloatInfinity));
+    __m128i special = _mm_or_si128(_mm_set1_epi32(0x7C00), _mm_and_si128(isNaN, _mm_set1_epi32(0x0200)));
+    __m128i isSpecial = _mm_cmpgt_epi32(bits, _mm_set1_epi32((int)HalfOverflow - 1));
+    
+    __m128 magic = _mm_castsi128_ps(_mm_set1_epi32((int)DenormalMagic));
+    __m128i denormal = _mm_sub_epi32(_mm_castps_si128(_mm_add_ps(_mm_castsi128_ps(bits), magic)), _mm_castps_si128(magic));
+    __m128i isDenormal = _mm_cmplt_epi32(bits, _mm_set1_epi32((int)HalfNormalMin));
+    
+    __m128i mantissaOdd = _mm_and_si128(_mm_srli_epi32(bits, 13), _mm_set1_epi32(1));
+    __m128i normal = _mm_add_epi32(bits, _mm_add_epi32(_mm_set1_epi32((int)RebiasRound), mantissaOdd));
+    normal = _mm_srli_epi32(normal, 13);
+    
+    __m128i half = _mm_or_si128(_mm_and_si128(isDenormal, denormal), _mm_andnot_si128(isDenormal, normal));
+    half = _mm_or_si128(_mm_and_si128(isSpecial, special), _mm_andnot_si128(isSpecial, half));
+    half = _mm_or_si128(half, _mm_srli_epi32(sign, 16));
+    
+    // sign extend, so packing with signed saturation keeps all 16 bits
+    return _mm_srai_epi32(_mm_slli_epi32(half, 16), 16);
+}
+
+// 4 halves in the low 16 bits of each lane  ->  4 floats
+static inline __m128 HalfToFloat4(__m128i half) {
+    __m128i exponentMantissa = _mm_and_si128(half, _mm_set1_epi32(0x7FFF));
+    __m128i sign = _mm_slli_epi32(_mm_xor_si128(half, exponentMantissa), 16);
+    __m128 scaled = _mm_mul_ps(_mm_castsi128_ps(_mm_slli_epi32(exponentMantissa, 13)),
+                               _mm_castsi128_ps(_mm_set1_epi32((int)RebiasMagic)));
+    __m128i infNaN = _mm_and_si128(_mm_cmpgt_epi32(exponentMantissa, _mm_set1_epi32(0x7BFF)), _mm_set1_epi32((int)FloatInfinity));
+    return _mm_castsi128_ps(_mm_or_si128(_mm_or_si128(_mm_castps_si128(scaled), infNaN), sign));
+}
+
+#endif
+
+void tdogl::FloatToHalf(const float* src, unsigned short* dest, size_t count) {
+    size_t i = 0;
+#if defined(TDOGL_F16C)
+    for(; i + 8 <= count; i += 8){
+        __m128i lo = _mm_cvtps_ph(_mm_loadu_ps(src + i), _MM_FROUND_TO_NEAREST_INT);
+        __m128i hi = _mm_cvtps_ph(_mm_loadu_ps(src + i + 4), _MM_FROUND_TO_NEAREST_INT);
+        _mm_storeu_si128((__m128i*)(dest + i), _mm_unpacklo_epi64(lo, hi));
+    }
+#elif defined(TDOGL_SSE2)
+    for(; i + 8 <= count; i += 8){
+        __m128i lo = FloatToHalf4(_mm_loadu_ps(src + i));
+        __m128i hi = FloatToHalf4(_mm_loadu_ps(src + i + 4));
+        _mm_storeu_si128((__m128i*)(dest + i), _mm_packs_epi32(lo, hi));
+    }
+#endif
+    for(; i < count; ++i)
+        dest[i] = FloatToHalf(src[i]);
+}
+
+void tdogl::HalfToFloat(const unsigned short* src, float* dest, size_t count) {
+    size_t i = 0;
+#if defined(TDOGL_F16C)
+    for(; i + 8 <= count; i += 8){
+        __m128i halves = _mm_loadu_si128((const __m128i*)(src + i));
+        _mm_storeu_ps(dest + i, _mm_cvtph_ps(halves));
+        _mm_storeu_ps(dest + i + 4, _mm_cvtph_ps(_mm_unpackhi_epi64(halves, halves)));
+    }
+#elif defined(TDOGL_SSE2)
+    const __m128i zero = _mm_setzero_si128();
+    for(; i + 8 <= count; i += 8){
+        __m128i halves = _mm_loadu_si128((const __m128i*)(src + i));
+        _mm_storeu_ps(dest + i, HalfToFloat4(_mm_unpacklo_epi16(halves, zero)));
+        _mm_storeu_ps(dest + i + 4, HalfToFloat4(_mm_unpackhi_epi16(halves, zero)));
+    }
+#endif
+    for(; i < count; ++i)
+        dest[i] = HalfToFloat(src[i]);
+}
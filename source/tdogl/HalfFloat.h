@@ -0,0 +1,50 @@
+/*
+ tdogl::HalfFloat
+ 
+ Copyright 2012 Thomas Dalling - http://tomdalling.com/
+ 
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+ 
+ http://www.apache.org/licenses/LICENSE-2.0
+ 
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#pragma once
+
+#include <cstddef>
+
+namespace tdogl {
+    
+    /**
+     Converts a float to the nearest IEEE 754 half precision float, with ties
+     rounded to even. Values too big for a half become infinity, and NaNs stay
+     NaNs.
+     */
+    unsigned short FloatToHalf(float value);
+    
+    /**
+     Converts an IEEE 754 half precision float to a float. Exact for every
+     input, including denormals, infinities and NaNs.
+     */
+    float HalfToFloat(unsigned short half);
+    
+    /**
+     Converts `count` floats to half floats. Gives exactly the same results as
+     the single value FloatToHalf, four values at a time.
+     */
+    void FloatToHalf(const float* src, unsigned short* dest, size_t count);
+    
+    /**
+     Converts `count` half floats to floats. Gives exactly the same results as
+     the single value HalfToFloat, four values at a time.
+     */
+    void HalfToFloat(const unsigned short* src, float* dest, size_t count);
+    
+}
@@ -0,0 +1,355 @@
+/*
+ tdogl::ImageCompare
+ 
+ Copyright 2012 Thomas Dalling - http://tomdalling.com/
+ 
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+ 
+ http://www.apache.org/licenses/LICENSE-2.0
+ 
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#include "ImageCompare.h"
+#include "ThreadPool.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <limits>
+#include <stdexcept>
+#include <stdint.h>
+#include <vector>
+
+#if !defined(TDOGL_DISABLE_SIMD) && (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+    #define TDOGL_SSE2 1
+    #include <emmintrin.h>
+#endif
+
+using namespace tdogl;
+
+// images with fewer pixels than this are compared on the calling thread
+static const size_t ParallelPixelThreshold = 256 * 256;
+
+static void RequireComparable(const BitmapView& a, const BitmapView& b) {
+    if(a.channelType() != Bitmap::ChannelType_UInt8 || b.channelType() != Bitmap::ChannelType_UInt8)
+        throw std::runtime_error("Only images with 8-bit channels can be compared");
+    if(a.width() != b.width() || a.height() != b.height() || a.format() != b.format())
+        throw std::runtime_error("Can't compare images of different sizes or formats");
+}
+
+// the largest difference between `count` bytes, and the sum of their squares
+static void DiffRow(const unsigned char* a, const unsigned char* b, size_t count, unsigned& maxDiff, uint64_t& sumSquares) {
+    size_t i = 0;
+    maxDiff = 0;
+    sumSquares = 0;
+#ifdef TDOGL_SSE2
+    const __m128i zero = _mm_setzero_si128();
+    __m128i maxDiffs = zero;
+    size_t vectorEnd = count & ~(size_t)15;
+    while(i < vectorEnd){
+        // each 32-bit lane gains at most 4 * 255^2 per 16 bytes, so it's moved
+        // into the 64-bit total every 4096 of them, well before it can overflow
+        size_t blockEnd = std::min(vectorEnd, i + 16 * 4096);
+        __m128i squares = zero;
+        for(; i < blockEnd; i += 16){
+            __m128i va = _mm_loadu_si128((const __m128i*)(a + i));
+            __m128i vb = _mm_loadu_si128((const __m128i*)(b + i));
+            __m128i diff = _mm_or_si128(_mm_subs_epu8(va, vb), _mm_subs_epu8(vb, va));
+            maxDiffs = _mm_max_epu8(maxDiffs, diff);
+            __m128i lo = _mm_unpacklo_epi8(diff, zero);
+            __m128i hi = _mm_unpackhi_epi8(diff, zero);
+            squares = _mm_add_epi32(squares, _mm_add_epi32(_mm_madd_epi16(lo, lo), _mm_madd_epi16(hi, hi)));
+        }
+        uint32_t lanes[4];
+        _mm_storeu_si128((__m128i*)lanes, squares);
+        sumSquares += (uint64_t)lanes[0] + lanes[1] + lanes[2] + lanes[3];
+    }
+    unsigned char maxLanes[16];
+    _mm_storeu_si128((__m128i*)maxLanes, maxDiffs);
+    for(int lane = 0; lane < 16; ++lane)
+        maxDiff = std::max<unsigned>(maxDiff, maxLanes[lane]);
+#endif
+    for(; i < count; ++i){
+        int diff = (int)a[i] - (int)b[i];
+        maxDiff = std::max(maxDiff, (unsigned)std::abs(diff));
+        sumSquares += (uint64_t)(diff * diff);
+    }
+}
+
+ImageDifference tdogl::CompareImages(const BitmapView& a, const BitmapView& b) {
+    RequireComparable(a, b);
+    
+    unsigned height = a.height();
+    size_t rowBytes = (size_t)a.width() * a.format();
+    std::vector<unsigned> rowMaxDiffs(height);
+    std::vector<uint64_t> rowSquares(height);
+    auto rows = [&](size_t begin, size_t end) {
+        for(size_t y = begin; y < end; ++y)
+            DiffRow(a.row((unsigned)y), b.row((unsigned)y), rowBytes, rowMaxDiffs[y], rowSquares[y]);
+    };
+    if((size_t)a.width() * height >= ParallelPixelThreshold)
+        ThreadPool::shared().parallelFor(height, 16, rows);
+    else
+        rows(0, height);
+    
+    ImageDifference difference;
+    difference.maxAbsDiff = 0;
+    uint64_t sumSquares = 0;
+    for(unsigned y = 0; y < height; ++y){
+        difference.maxAbsDiff = std::max(difference.maxAbsDiff, rowMaxDiffs[y]);
+        sumSquares += rowSquares[y];
+    }
+    
+    size_t count = rowBytes * height;
+    difference.meanSquaredError = (count != 0) ? (double)sumSquares / count : 0.0;
+    if(sumSquares == 0)
+        difference.psnr = std::numeric_limits<double>::infinity();
+    else
+        difference.psnr = 10.0 * std::log10(255.0 * 255.0 / difference.meanSquaredError);
+    return difference;
+}
+
+/*
+ SSIM of one window of `n` values of a channel, from the sums of its values
+ in both images, their squares and their products. Written in terms of sums
+ rather than means and variances, which are the same after multiplying out n.
+ */
+static double WindowSimilarity(double n, double a, double b, double aa, double bb, double ab) {
+    const double c1 = (0.01 * 255) * (0.01 * 255) * n * n;
+    const double c2 = (0.03 * 255) * (0.03 * 255) * n * n;
+    double variances = n * (aa + bb) - a*a - b*b;
+    double covariance = n * ab - a*b;
+    return (2*a*b + c1) * (2*covariance + c2) / ((a*a + b*b + c1) * (variances + c2));
+}
+
+// the same for an 8x8 window, where the sums are small enough for the
+// variances to be found exactly in 32-bit integers before going to float
+static float Window8x8Similarity(int a, int b, int aa, int bb, int ab) {
+    const float c1 = (0.01f * 255) * (0.01f * 255) * 64 * 64;
+    const float c2 = (0.03f * 255) * (0.03f * 255) * 64 * 64;
+    int variances = 64 * (aa + bb) - a*a - b*b;
+    int covariance = 64 * ab - a*b;
+    return ((float)(2*a*b) + c1) * ((float)(2*covariance) + c2) / (((float)(a*a + b*b) + c1) * ((float)variances + c2));
+}
+
+// images too small for 8x8 windows are one window the size of the whole image
+static double SingleWindowSimilarity(const BitmapView& a, const BitmapView& b) {
+    unsigned channels = a.format();
+    double total = 0.0;
+    for(unsigned c = 0; c < channels; ++c){
+        double sa = 0, sb = 0, saa = 0, sbb = 0, sab = 0;
+        for(unsigned y = 0; y < a.height(); ++y){
+            const unsigned char* rowA = a.row(y);
+            const unsigned char* rowB = b.row(y);
+            for(unsigned x = 0; x < a.width(); ++x){
+                double va = rowA[x * channels + c];
+                double vb = rowB[x * channels + c];
+                sa += va;
+                sb += vb;
+                saa += va * va;
+                sbb += vb * vb;
+                sab += va * vb;
+            }
+        }
+        total += WindowSimilarity((double)a.width() * a.height(), sa, sb, saa, sbb, sab);
+    }
+    return total / channels;
+}
+
+namespace {
+    // sums over one channel of a 4x4 block of pixels
+    struct BlockSums {
+        uint32_t a, b, aa, bb, ab;
+    };
+    
+    // sums down 4 rows of each byte of a row, before they're added across into blocks
+    struct ColumnSums {
+        std::vector<uint16_t> a, b;
+        std::vector<uint32_t> aa, bb, ab;
+        
+        explicit ColumnSums(size_t count) : a(count), b(count), aa(count), bb(count), ab(count) {}
+    };
+}
+
+// the block sums of every 4x4 block in the band of rows from `band * 4`
+static void BlockRow(const BitmapView& a, const BitmapView& b, unsigned band, unsigned blocksAcross, ColumnSums& columns, BlockSums* blocks) {
+    unsigned channels = a.format();
+    size_t rowBytes = (size_t)blocksAcross * 4 * channels;
+    const unsigned char* rowsA[4];
+    const unsigned char* rowsB[4];
+    for(unsigned r = 0; r < 4; ++r){
+        rowsA[r] = a.row(band * 4 + r);
+        rowsB[r] = b.row(band * 4 + r);
+    }
+    
+    size_t i = 0;
+#ifdef TDOGL_SSE2
+    // squares and products of bytes fit in 16 bits, but their sums need 32
+    const __m128i zero = _mm_setzero_si128();
+    for(; i + 8 <= rowBytes; i += 8){
+        __m128i sa = zero, sb = zero;
+        __m128i saaLo = zero, saaHi = zero, sbbLo = zero, sbbHi = zero, sabLo = zero, sabHi = zero;
+        for(unsigned r = 0; r < 4; ++r){
+            __m128i va = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)(rowsA[r] + i)), zero);
+            __m128i vb = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)(rowsB[r] + i)), zero);
+            sa = _mm_add_epi16(sa, va);
+            sb = _mm_add_epi16(sb, vb);
+            __m128i aa = _mm_mullo_epi16(va, va);
+            __m128i bb = _mm_mullo_epi16(vb, vb);
+            __m128i ab = _mm_mullo_epi16(va, vb);
+            saaLo = _mm_add_epi32(saaLo, _mm_unpacklo_epi16(aa, zero));
+            saaHi = _mm_add_epi32(saaHi, _mm_unpackhi_epi16(aa, zero));
+            sbbLo = _mm_add_epi32(sbbLo, _mm_unpacklo_epi16(bb, zero));
+            sbbHi = _mm_add_epi32(sbbHi, _mm_unpackhi_epi16(bb, zero));
+            sabLo = _mm_add_epi32(sabLo, _mm_unpacklo_epi16(ab, zero));
+            sabHi = _mm_add_epi32(sabHi, _mm_unpackhi_epi16(ab, zero));
+        }
+        _mm_storeu_si128((__m128i*)&columns.a[i], sa);
+        _mm_storeu_si128((__m128i*)&columns.b[i], sb);
+        _mm_storeu_si128((__m128i*)&columns.aa[i], saaLo);
+        _mm_storeu_si128((__m128i*)&columns.aa[i + 4], saaHi);
+        _mm_storeu_si128((__m128i*)&columns.bb[i], sbbLo);
+        _mm_storeu_si128((__m128i*)&columns.bb[i + 4], sbbHi);
+        _mm_storeu_si128((__m128i*)&columns.ab[i], sabLo);
+        _mm_storeu_si128((__m128i*)&columns.ab[i + 4], sabHi);
+    }
+#endif
+    for(; i < rowBytes; ++i){
+        unsigned sa = 0, sb = 0, saa = 0, sbb = 0, sab = 0;
+        for(unsigned r = 0; r < 4; ++r){
+            unsigned va = rowsA[r][i];
+            unsigned vb = rowsB[r][i];
+            sa += va;
+            sb += vb;
+            saa += va * va;
+            sbb += vb * vb;
+            sab += va * vb;
+        }
+        columns.a[i] = (uint16_t)sa;
+        columns.b[i] = (uint16_t)sb;
+        columns.aa[i] = saa;
+        columns.bb[i] = sbb;
+        columns.ab[i] = sab;
+    }
+    
+    for(unsigned k = 0; k < blocksAcross; ++k){
+        for(unsigned c = 0; c < channels; ++c){
+            BlockSums& block = blocks[k * channels + c];
+            block.a = block.b = block.aa = block.bb = block.ab = 0;
+            for(unsigned p = 0; p < 4; ++p){
+                size_t column = (k * 4 + p) * channels + c;
+                block.a += columns.a[column];
+                block.b += columns.b[column];
+                block.aa += columns.aa[column];
+                block.bb += columns.bb[column];
+                block.ab += columns.ab[column];
+            }
+        }
+    }
+}
+
+double tdogl::StructuralSimilarity(const BitmapView& a, const BitmapView& b) {
+    RequireComparable(a, b);
+    if(a.width() < 8 || a.height() < 8)
+        return SingleWindowSimilarity(a, b);
+    
+    unsigned channels = a.format();
+    unsigned blocksAcross = a.width() / 4;
+    unsigned windowsAcross = blocksAcross - 1;
+    unsigned windowRows = a.height() / 4 - 1;
+    
+    // each window row is totalled separately, then added up in order, so the
+    // result doesn't depend on how the rows were split between threads
+    std::vector<double> rowTotals(windowRows);
+    auto rows = [&](size_t begin, size_t end) {
+        ColumnSums columns((size_t)blocksAcross * 4 * channels);
+        std::vector<BlockSums> above((size_t)blocksAcross * channels);
+        std::vector<BlockSums> below((size_t)blocksAcross * channels);
+        BlockRow(a, b, (unsigned)begin, blocksAcross, columns, &above[0]);
+        for(size_t y = begin; y < end; ++y){
+            BlockRow(a, b, (unsigned)y + 1, blocksAcross, columns, &below[0]);
+            double total = 0.0;
+            for(size_t i = 0; i < (size_t)windowsAcross * channels; ++i){
+                const BlockSums& s0 = above[i];
+                const BlockSums& s1 = above[i + channels];
+                const BlockSums& s2 = below[i];
+                const BlockSums& s3 = below[i + channels];
+                total += Window8x8Similarity(s0.a + s1.a + s2.a + s3.a,
+                                             s0.b + s1.b + s2.b + s3.b,
+                                             s0.aa + s1.aa + s2.aa + s3.aa,
+                                             s0.bb + s1.bb + s2.bb + s3.bb,
+                                             s0.ab + s1.ab + s2.ab + s3.ab);
+            }
+            rowTotals[y] = total;
+            above.swap(below);
+        }
+    };
+    if((size_t)a.width() * a.height() >= ParallelPixelThreshold)
+        ThreadPool::shared().parallelFor(windowRows, 16, rows);
+    else
+        rows(0, windowRows);
+    
+    double total = 0.0;
+    for(unsigned y = 0; y < windowRows; ++y)
+        total += rowTotals[y];
+    return total / ((double)windowRows * windowsAcross * channels);
+}
+
+Bitmap tdogl::DifferenceHeatmap(const BitmapView& a, const BitmapView& b, float gain) {
+    RequireComparable(a, b);
+    if(!(gain > 0.0f))
+        throw std::runtime_error("Difference heatmap gain must be greater than zero");
+    
+    // the color for each difference: dark red, up through orange and yellow
+    // to white. Even the darkest red is brighter than the dim gray of
+    // unchanged pixels, so it can't be lost in them.
+    unsigned char colors[256][3];
+    for(unsigned diff = 1; diff < 256; ++diff){
+        float scaled = diff * gain + 0.5f;
+        unsigned i = (scaled >= 255.0f) ? 255 : std::max(1u, (unsigned)scaled);
+        colors[diff][0] = (unsigned char)std::min(255u, 96 + i * 159 / 85);
+        colors[diff][1] = (unsigned char)(i <= 85 ? 0 : std::min(255u, (i - 85) * 3));
+        colors[diff][2] = (unsigned char)(i <= 170 ? 0 : (i - 170) * 3);
+    }
+    
+    unsigned width = a.width();
+    unsigned height = a.height();
+    unsigned channels = a.format();
+    Bitmap heatmap(width, height, Bitmap::Format_RGB);
+    BitmapView dest(heatmap);
+    
+    // only made for images that failed a comparison, so this isn't vectorized
+    auto rows = [&](size_t begin, size_t end) {
+        for(size_t y = begin; y < end; ++y){
+            const unsigned char* rowA = a.row((unsigned)y);
+            const unsigned char* rowB = b.row((unsigned)y);
+            unsigned char* out = dest.row((unsigned)y);
+            for(unsigned x = 0; x < width; ++x, rowA += channels, rowB += channels, out += 3){
+                unsigned maxDiff = 0;
+                for(unsigned c = 0; c < channels; ++c)
+                    maxDiff = std::max(maxDiff, (unsigned)std::abs((int)rowA[c] - (int)rowB[c]));
+                
+                if(maxDiff == 0){
+                    unsigned gray = (channels >= 3) ? (rowA[0] * 2 + rowA[1] * 5 + rowA[2]) / 32 : rowA[0] / 4;
+                    out[0] = out[1] = out[2] = (unsigned char)gray;
+                } else {
+                    out[0] = colors[maxDiff][0];
+                    out[1] = colors[maxDiff][1];
+                    out[2] = colors[maxDiff][2];
+                }
+            }
+        }
+    };
+    if((size_t)width * height >= ParallelPixelThreshold)
+        ThreadPool::shared().parallelFor(height, 16, rows);
+    else
+        rows(0, height);
+    
+    return heatmap;
+}
@@ -0,0 +1,77 @@
+/*
+ tdogl::ImageCompare
+ 
+ Copyright 2012 Thomas Dalling - http://tomdalling.com/
+ 
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+ 
+ http://www.apache.org/licenses/LICENSE-2.0
+ 
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#pragma once
+
+#include "Bitmap.h"
+#include "BitmapView.h"
+
+namespace tdogl {
+    
+    /**
+     How much two images differ, from CompareImages.
+     */
+    struct ImageDifference {
+        /** the largest difference between the same channel of the same pixel, 0 to 255 */
+        unsigned maxAbsDiff;
+        
+        /** the mean of the squared channel differences, over every channel of every pixel */
+        double meanSquaredError;
+        
+        /** peak signal to noise ratio in decibels, or infinity if the images are identical */
+        double psnr;
+    };
+    
+    /**
+     Compares every channel of every pixel of two images, for checking fast
+     paths against reference output.
+     
+     The images must be the same size and format, with 8-bit channels. Rows
+     are compared with SSE2 where it's available, across the threads of
+     ThreadPool::shared for big images.
+     */
+    ImageDifference CompareImages(const BitmapView& a, const BitmapView& b);
+    
+    /**
+     Returns the mean structural similarity (SSIM) of two images, from 1 for
+     identical images down towards 0 (or even below) as they stop looking alike.
+     
+     Like x264 and libvpx, this uses 8x8 pixel windows stepped 4 pixels at a
+     time instead of the 11x11 gaussian windows of the original paper, which
+     is much cheaper and gives very close results. Each channel is measured
+     separately, and the result is the mean over all windows of all channels.
+     The last `width % 4` columns and `height % 4` rows are left out. Images
+     smaller than 8x8 are measured as a single window.
+     
+     The images must be the same size and format, with 8-bit channels.
+     */
+    double StructuralSimilarity(const BitmapView& a, const BitmapView& b);
+    
+    /**
+     Makes an RGB picture of where two images differ.
+     
+     Each pixel is colored by the largest difference between its channels in
+     the two images, multiplied by `gain`: dark red for the smallest ones,
+     through orange and yellow, to white for 255 or more. Pixels that are the
+     same are a dim gray copy of `a`, so the differences can be found on it.
+     
+     The images must be the same size and format, with 8-bit channels.
+     */
+    Bitmap DifferenceHeatmap(const BitmapView& a, const BitmapView& b, float gain = 1.0f);
+    
+}
@@ -0,0 +1,219 @@
+/*
+ tdogl::LZCodec
+ 
+ Copyright 2012 Thomas Dalling - http://tomdalling.com/
+ 
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+ 
+ http://www.apache.org/licenses/LICENSE-2.0
+ 
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#include "LZCodec.h"
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <stdint.h>
+#include <vector>
+
+/*
+ Each sequence is:
+ 
+   token            high 4 bits: literal count, low 4 bits: match length - MinMatch.
+                    15 means more length bytes follow.
+   [length bytes]   added to the literal count while they are 255, and once more after
+   literals
+   offset           2 bytes, little-endian: how far back the match starts (1 to 65535)
+   [length bytes]   extra match length, like the literal count
+ 
+ The last sequence has no offset or match, and ends at the end of the data.
+ */
+
+static const size_t MinMatch = 4;
+static const size_t MaxOffset = 65535;
+static const unsigned HashBits = 14;
+
+// matches stop this far from the end, so the last sequence always has some
+// literals and the match finder can always read 4 bytes
+static const size_t EndLiterals = 5;
+static const size_t MinCompressSize = 12;
+
+static inline uint32_t Load32(const unsigned char* p) {
+    uint32_t value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+static inline uint32_t Hash(uint32_t fourBytes) {
+    return (fourBytes * 2654435761u) >> (32 - HashBits);
+}
+
+// number of bytes that are the same at `a` and `b`, stopping at `aEnd`
+static inline size_t CountMatching(const unsigned char* a, const unsigned char* b, const unsigned char* aEnd) {
+    const unsigned char* start = a;
+#if defined(__GNUC__) && defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    while(a + 8 <= aEnd){
+        uint64_t x, y;
+        memcpy(&x, a, 8);
+        memcpy(&y, b, 8);
+        if(x != y)
+            return (size_t)(a - start) + (size_t)(__builtin_ctzll(x ^ y) >> 3);
+        a += 8;
+        b += 8;
+    }
+#endif
+    while(a < aEnd && *a == *b){
+        ++a;
+        ++b;
+    }
+    return (size_t)(a - start);
+}
+
+static inline unsigned char* WriteLength(unsigned char* op, size_t length) {
+    for(; length >= 255; length -= 255)
+        *op++ = 255;
+    *op++ = (unsigned char)length;
+    return op;
+}
+
+static unsigned char* WriteSequence(unsigned char* op, const unsigned char* literals, size_t literalCount, size_t offset, size_t matchLength) {
+    unsigned char* token = op++;
+    *token = (unsigned char)((literalCount >= 15 ? 15 : literalCount) << 4);
+    if(literalCount >= 15)
+        op = WriteLength(op, literalCount - 15);
+    if(literalCount > 0)
+        memcpy(op, literals, literalCount);
+    op += literalCount;
+    
+    if(matchLength > 0){
+        *op++ = (unsigned char)(offset & 0xFF);
+        *op++ = (unsigned char)(offset >> 8);
+        size_t extra = matchLength - MinMatch;
+        *token |= (unsigned char)(extra >= 15 ? 15 : extra);
+        if(extra >= 15)
+            op = WriteLength(op, extra - 15);
+    }
+    return op;
+}
+
+size_t tdogl::LZCompressBound(size_t size) {
+    // all literals: a token, one length byte per 255, and the bytes themselves
+    return size + size / 255 + 16;
+}
+
+size_t tdogl::LZCompress(const unsigned char* src, size_t srcSize, unsigned char* dest) {
+    if((uint64_t)srcSize > UINT32_MAX)
+        throw std::runtime_error("LZCompress can only compress up to 4GB at a time");
+    
+    unsigned char* op = dest;
+    const unsigned char* anchor = src;
+    
+    if(srcSize >= MinCompressSize){
+        // positions are stored relative to `src`, so zero means "nothing yet" as well as the first byte
+        std::vector<uint32_t> table((size_t)1 << HashBits, 0);
+        const unsigned char* ip = src + 1;
+        const unsigned char* matchEnd = src + srcSize - EndLiterals;
+        const unsigned char* searchEnd = matchEnd - MinMatch;
+        
+        // the step grows the longer nothing matches, so incompressible data is skipped quickly
+        unsigned misses = 0;
+        while(ip < searchEnd){
+            uint32_t sequence = Load32(ip);
+            uint32_t& slot = table[Hash(sequence)];
+            const unsigned char* ref = src + slot;
+            slot = (uint32_t)(ip - src);
+            
+            if((size_t)(ip - ref) > MaxOffset || ref == ip || Load32(ref) != sequence){
+                ip += 1 + (misses++ >> 5);
+                continue;
+            }
+            misses = 0;
+            
+            while(ip > anchor && ref > src && ip[-1] == ref[-1]){
+                --ip;
+                --ref;
+            }
+            
+            size_t length = MinMatch + CountMatching(ip + MinMatch, ref + MinMatch, matchEnd);
+            op = WriteSequence(op, anchor, (size_t)(ip - anchor), (size_t)(ip - ref), length);
+            ip += length;
+            anchor = ip;
+            
+            if(ip < searchEnd)
+                table[Hash(Load32(ip - 2))] = (uint32_t)(ip - 2 - src);
+        }
+    }
+    
+    op = WriteSequence(op, anchor, (size_t)(src + srcSize - anchor), 0, 0);
+    return (size_t)(op - dest);
+}
+
+static inline bool ReadLength(const unsigned char*& ip, const unsigned char* ipEnd, size_t& length) {
+    unsigned char byte;
+    do {
+        if(ip >= ipEnd)
+            return false;
+        byte = *ip++;
+        length += byte;
+    } while(byte == 255);
+    return true;
+}
+
+void tdogl::LZDecompress(const unsigned char* src, size_t srcSize, unsigned char* dest, size_t destSize) {
+    const unsigned char* ip = src;
+    const unsigned char* ipEnd = src + srcSize;
+    unsigned char* op = dest;
+    unsigned char* opEnd = dest + destSize;
+    
+    for(;;){
+        if(ip >= ipEnd)
+            throw std::runtime_error("Corrupt LZ data: truncated");
+        unsigned token = *ip++;
+        
+        size_t literalCount = token >> 4;
+        if(literalCount == 15 && !ReadLength(ip, ipEnd, literalCount))
+            throw std::runtime_error("Corrupt LZ data: truncated");
+        if(literalCount > (size_t)(ipEnd - ip) || literalCount > (size_t)(opEnd - op))
+            throw std::runtime_error("Corrupt LZ data: literals out of bounds");
+        if(literalCount > 0)
+            memcpy(op, ip, literalCount);
+        ip += literalCount;
+        op += literalCount;
+        
+        if(ip == ipEnd)
+            break;
+        
+        if(ipEnd - ip < 2)
+            throw std::runtime_error("Corrupt LZ data: truncated");
+        size_t offset = (size_t)ip[0] | ((size_t)ip[1] << 8);
+        ip += 2;
+        size_t length = token & 15;
+        if(length == 15 && !ReadLength(ip, ipEnd, length))
+            throw std::runtime_error("Corrupt LZ data: truncated");
+        length += MinMatch;
+        if(offset == 0 || offset > (size_t)(op - dest) || length > (size_t)(opEnd - op))
+            throw std::runtime_error("Corrupt LZ data: match out of bounds");
+        
+        // An overlapping match repeats the last `offset` bytes. Copying whole repeats
+        // from the start of the match doubles the distance each time, so every copy
+        // is between separate bytes and runs of one or two repeated pixels are fast.
+        const unsigned char* match = op - offset;
+        size_t copied = 0;
+        while(copied < length){
+            size_t chunk = std::min(length - copied, offset + copied);
+            memcpy(op + copied, match, chunk);
+            copied += chunk;
+        }
+        op += length;
+    }
+    
+    if(op != opEnd)
+        throw std::runtime_error("Corrupt LZ data: wrong size");
+}
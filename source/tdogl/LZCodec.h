@@ -0,0 +1,58 @@
+/*
+ tdogl::LZCodec
+ 
+ Copyright 2012 Thomas Dalling - http://tomdalling.com/
+ 
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+ 
+ http://www.apache.org/licenses/LICENSE-2.0
+ 
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#pragma once
+
+#include <cstddef>
+
+namespace tdogl {
+    
+    /*
+     A small, fast LZ77 codec in the style of LZ4, for compressing pixels that
+     are kept in memory (see tdogl::PackedBitmap).
+     
+     The compressed data is a list of sequences. Each sequence is a run of
+     literal bytes followed by a match: a copy of earlier output, up to 64KB
+     back. There is no entropy coding, which keeps decompression at memory
+     speed, so it does best on images with repeated runs and flat areas.
+     */
+    
+    /**
+     The largest number of bytes `LZCompress` can produce from `size` bytes,
+     for sizing the destination buffer.
+     */
+    size_t LZCompressBound(size_t size);
+    
+    /**
+     Compresses `srcSize` bytes from `src` into `dest`, which must have room
+     for `LZCompressBound(srcSize)` bytes.
+     
+     @result The size of the compressed data in bytes
+     */
+    size_t LZCompress(const unsigned char* src, size_t srcSize, unsigned char* dest);
+    
+    /**
+     Decompresses data made by `LZCompress`. Exactly `destSize` bytes, the
+     size that was compressed, are written to `dest`.
+     
+     Every length and offset is checked, so corrupt data throws an exception
+     instead of reading or writing out of bounds.
+     */
+    void LZDecompress(const unsigned char* src, size_t srcSize, unsigned char* dest, size_t destSize);
+    
+}
@@ -0,0 +1,78 @@
+/*
+ tdogl::MappedFile
+ 
+ Copyright 2012 Thomas Dalling - http://tomdalling.com/
+ 
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+ 
+ http://www.apache.org/licenses/LICENSE-2.0
+ 
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#include "MappedFile.h"
+#include <stdexcept>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+using namespace tdogl;
+
+static std::string ErrorMessage(const std::string& what, const std::string& filePath) {
+    return what + " '" + filePath + "': " + strerror(errno);
+}
+
+MappedFile::MappedFile(const std::string& filePath) :
+    _data(NULL),
+    _size(0)
+{
+    int fd = open(filePath.c_str(), O_RDONLY);
+    if(fd < 0)
+        throw std::runtime_error(ErrorMessage("Failed to open file", filePath));
+    
+    struct stat info;
+    if(fstat(fd, &info) != 0){
+        std::string msg = ErrorMessage("Failed to stat file", filePath);
+        close(fd);
+        throw std::runtime_error(msg);
+    }
+    
+    if(info.st_size <= 0){
+        close(fd);
+        throw std::runtime_error("Can't map empty file '" + filePath + "'");
+    }
+    
+    _size = (size_t)info.st_size;
+    _data = mmap(NULL, _size, PROT_READ, MAP_PRIVATE, fd, 0);
+    
+    //the mapping stays valid after the descriptor is closed
+    std::string msg = (_data == MAP_FAILED) ? ErrorMessage("Failed to map file", filePath) : "";
+    close(fd);
+    
+    if(_data == MAP_FAILED)
+        throw std::runtime_error(msg);
+    
+    madvise(_data, _size, MADV_SEQUENTIAL);
+    madvise(_data, _size, MADV_WILLNEED);
+}
+
+MappedFile::~MappedFile() {
+    munmap(_data, _size);
+}
+
+const unsigned char* MappedFile::data() const {
+    return (const unsigned char*)_data;
+}
+
+size_t MappedFile::size() const {
+    return _size;
+}
@@ -0,0 +1,62 @@
+/*
+ tdogl::MappedFile
+ 
+ Copyright 2012 Thomas Dalling - http://tomdalling.com/
+ 
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+ 
+ http://www.apache.org/licenses/LICENSE-2.0
+ 
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#pragma once
+
+#include <string>
+#include <cstddef>
+
+namespace tdogl {
+    
+    /**
+     A read-only memory mapping of an entire file.
+     
+     The file descriptor is closed as soon as the file is mapped, so holding
+     many mappings does not hold many open files. The mapping is advised for
+     sequential access, because it is usually read once from start to end.
+     */
+    class MappedFile {
+    public:
+        /**
+         Maps the file at the given path into memory.
+         
+         @throws std::exception if the file can't be opened or mapped, or is empty.
+         */
+        MappedFile(const std::string& filePath);
+        
+        /**
+         Unmaps the file.
+         */
+        ~MappedFile();
+        
+        /** Pointer to the first byte of the file */
+        const unsigned char* data() const;
+        
+        /** Size of the file in bytes */
+        size_t size() const;
+        
+    private:
+        void* _data;
+        size_t _size;
+        
+        //copying disabled
+        MappedFile(const MappedFile&);
+        const MappedFile& operator=(const MappedFile&);
+    };
+    
+}
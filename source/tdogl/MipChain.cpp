@@ -0,0 +1,337 @@
+/*
+ tdogl::MipChain
+ 
+ Copyright 2012 Thomas Dalling - http://tomdalling.com/
+ 
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+ 
+ http://www.apache.org/licenses/LICENSE-2.0
+ 
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#include "MipChain.h"
+#include "ColorSpace.h"
+#include "ThreadPool.h"
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+
+#if !defined(TDOGL_DISABLE_SIMD) && (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+    #define TDOGL_SSE2 1
+    #include <emmintrin.h>
+#endif
+
+using namespace tdogl;
+
+// levels with fewer pixels than this are filtered on the calling thread
+static const size_t ParallelPixelThreshold = 256 * 256;
+
+/*
+ The source pixels that contribute to one destination pixel, along one axis.
+
+ Even sizes use two taps of 1/2. Odd sizes (2m + 1 source pixels into m) use
+ three taps that exactly cover each destination pixel's footprint.
+ */
+namespace {
+    struct Taps {
+        unsigned first;
+        unsigned count;
+        float weights[3];
+    };
+}
+
+static std::vector<Taps> TapsForAxis(unsigned srcSize, unsigned destSize) {
+    std::vector<Taps> taps(destSize);
+    for(unsigned i = 0; i < destSize; ++i){
+        Taps& t = taps[i];
+        if(srcSize == 1){
+            t.first = 0;
+            t.count = 1;
+            t.weights[0] = 1.0f;
+        } else if(srcSize % 2 == 0){
+            t.first = i * 2;
+            t.count = 2;
+            t.weights[0] = t.weights[1] = 0.5f;
+        } else {
+            float m = (float)destSize;
+            t.first = i * 2;
+            t.count = 3;
+            t.weights[0] = (m - i) / (2*m + 1);
+            t.weights[1] = m / (2*m + 1);
+            t.weights[2] = (i + 1) / (2*m + 1);
+        }
+    }
+    return taps;
+}
+
+static unsigned NextLevelSize(unsigned size) {
+    return std::max(1u, size / 2);
+}
+
+// the index of the alpha channel, or -1 if there isn't one
+static int AlphaChannel(unsigned channels) {
+    return (channels == 2 || channels == 4) ? (int)channels - 1 : -1;
+}
+
+namespace {
+    // a level being read, either as bytes (level 0) or as floats (a level this
+    // class made, kept at full precision so errors don't build up down the chain).
+    // Either way the rows are linear, with the other channels premultiplied by
+    // alpha, so transparent pixels don't bleed their color into their neighbours.
+    struct LevelSource {
+        BitmapView bytes;
+        const float* floats;
+        bool srgb;
+        
+        LevelSource(const BitmapView& view, const float* floats, bool srgb) : bytes(view), floats(floats), srgb(srgb) {}
+        
+        const float* row(unsigned y, float* scratch) const {
+            unsigned channels = bytes.format();
+            size_t rowFloats = (size_t)bytes.width() * channels;
+            if(floats)
+                return floats + y * rowFloats;
+            
+            const unsigned char* src = bytes.row(y);
+            const float* table = SRGBToLinearTable();
+            unsigned colorChannels = (srgb && channels >= 3) ? 3 : 0;
+            for(size_t i = 0; i < rowFloats; i += channels){
+                for(unsigned c = 0; c < channels; ++c)
+                    scratch[i + c] = c < colorChannels ? table[src[i + c]] : src[i + c] * (1.0f / 255.0f);
+            }
+            
+            int alphaChannel = AlphaChannel(channels);
+            if(alphaChannel >= 0){
+                for(size_t i = 0; i < rowFloats; i += channels){
+                    float alpha = scratch[i + alphaChannel];
+                    for(int c = 0; c < alphaChannel; ++c)
+                        scratch[i + c] *= alpha;
+                }
+            }
+            return scratch;
+        }
+    };
+}
+
+// dest[i] = sum over rows of weight * row[i]
+static void CombineRows(const float* const* rows, const float* weights, unsigned rowCount, float* dest, size_t count) {
+    size_t i = 0;
+#ifdef TDOGL_SSE2
+    for(; i + 4 <= count; i += 4){
+        __m128 sum = _mm_mul_ps(_mm_loadu_ps(rows[0] + i), _mm_set1_ps(weights[0]));
+        for(unsigned r = 1; r < rowCount; ++r)
+            sum = _mm_add_ps(sum, _mm_mul_ps(_mm_loadu_ps(rows[r] + i), _mm_set1_ps(weights[r])));
+        _mm_storeu_ps(dest + i, sum);
+    }
+#endif
+    for(; i < count; ++i){
+        float sum = rows[0][i] * weights[0];
+        for(unsigned r = 1; r < rowCount; ++r)
+            sum += rows[r][i] * weights[r];
+        dest[i] = sum;
+    }
+}
+
+// filters one row horizontally with the given taps
+static void FilterRow(const float* src, const std::vector<Taps>& taps, unsigned channels, float* dest) {
+    unsigned x = 0;
+#ifdef TDOGL_SSE2
+    if(channels == 4){
+        for(; x < taps.size(); ++x){
+            const Taps& t = taps[x];
+            const float* s = src + t.first * 4;
+            __m128 sum = _mm_mul_ps(_mm_loadu_ps(s), _mm_set1_ps(t.weights[0]));
+            for(unsigned k = 1; k < t.count; ++k)
+                sum = _mm_add_ps(sum, _mm_mul_ps(_mm_loadu_ps(s + k*4), _mm_set1_ps(t.weights[k])));
+            _mm_storeu_ps(dest + x*4, sum);
+        }
+    }
+#endif
+    for(; x < taps.size(); ++x){
+        const Taps& t = taps[x];
+        for(unsigned c = 0; c < channels; ++c){
+            float sum = 0.0f;
+            for(unsigned k = 0; k < t.count; ++k)
+                sum += src[(t.first + k)*channels + c] * t.weights[k];
+            dest[x*channels + c] = sum;
+        }
+    }
+}
+
+// divides the other channels by alpha, undoing LevelSource's premultiplication.
+// Fully transparent pixels have no color left, so they come out black.
+static void UnpremultiplyRow(const float* src, float* dest, size_t count, unsigned channels) {
+    int alphaChannel = AlphaChannel(channels);
+    for(size_t i = 0; i < count; i += channels){
+        float alpha = src[i + alphaChannel];
+        float scale = alpha > 0.0f ? 1.0f / alpha : 0.0f;
+        for(int c = 0; c < alphaChannel; ++c)
+            dest[i + c] = src[i + c] * scale;
+        dest[i + alphaChannel] = alpha;
+    }
+}
+
+static void EncodeRow(const float* src, unsigned char* dest, size_t count, unsigned channels, bool srgb) {
+    unsigned colorChannels = (srgb && channels >= 3) ? 3 : 0;
+    if(colorChannels != 0){
+        //encode everything as color with the batch encoder, then redo the alpha
+        LinearToSRGB(src, dest, count);
+        if(channels == 4){
+            for(size_t i = 3; i < count; i += 4)
+                dest[i] = LinearToByte(src[i]);
+        }
+        return;
+    }
+    
+    for(size_t i = 0; i < count; i += channels){
+        for(unsigned c = 0; c < channels; ++c)
+            dest[i + c] = c < colorChannels ? LinearToSRGB(src[i + c]) : LinearToByte(src[i + c]);
+    }
+}
+
+// makes the next level down from `src`, writing the bytes to `dest` and, if
+// `destFloats` isn't NULL, the full precision values too
+static void Downsample(const LevelSource& src, unsigned char* dest, float* destFloats, unsigned destWidth, unsigned destHeight) {
+    unsigned channels = src.bytes.format();
+    std::vector<Taps> rowTaps = TapsForAxis(src.bytes.height(), destHeight);
+    std::vector<Taps> colTaps = TapsForAxis(src.bytes.width(), destWidth);
+    size_t srcRowFloats = (size_t)src.bytes.width() * channels;
+    size_t destRowFloats = (size_t)destWidth * channels;
+    
+    auto filterRows = [&](size_t begin, size_t end) {
+        std::vector<float> scratch(srcRowFloats * 4 + destRowFloats);
+        float* combined = &scratch[srcRowFloats * 3];
+        float* filtered = &scratch[srcRowFloats * 4];
+        
+        for(size_t y = begin; y < end; ++y){
+            const Taps& t = rowTaps[y];
+            const float* rows[3];
+            for(unsigned k = 0; k < t.count; ++k)
+                rows[k] = src.row(t.first + k, &scratch[srcRowFloats * k]);
+            
+            CombineRows(rows, t.weights, t.count, combined, srcRowFloats);
+            float* out = destFloats ? destFloats + y * destRowFloats : filtered;
+            FilterRow(combined, colTaps, channels, out);
+            //the floats stay premultiplied for the next level down
+            if(AlphaChannel(channels) >= 0){
+                UnpremultiplyRow(out, filtered, destRowFloats, channels);
+                out = filtered;
+            }
+            EncodeRow(out, dest + y * destRowFloats, destRowFloats, channels, src.srgb);
+        }
+    };
+    
+    if((size_t)destWidth * destHeight >= ParallelPixelThreshold){
+        ThreadPool::shared().parallelFor(destHeight, 16, filterRows);
+    } else {
+        filterRows(0, destHeight);
+    }
+}
+
+MipChain::MipChain(const BitmapView& base, bool srgb) :
+    _format(base.format()),
+    _pixels(NULL),
+    _size(0)
+{
+    if(base.channelType() != Bitmap::ChannelType_UInt8)
+        throw std::runtime_error("Mipmaps can only be generated from 8-bit channels");
+    
+    unsigned width = base.width();
+    unsigned height = base.height();
+    for(;;){
+        Level level = { width, height, _size };
+        _levels.push_back(level);
+        _size += (size_t)width * height * _format;
+        if(width == 1 && height == 1)
+            break;
+        width = NextLevelSize(width);
+        height = NextLevelSize(height);
+    }
+    
+    _pixels = (unsigned char*)malloc(_size);
+    if(!_pixels)
+        throw std::runtime_error("Failed to allocate mipmap chain");
+    
+    BitmapView level0 = level(0);
+    size_t rowSize = (size_t)base.width() * _format;
+    for(unsigned y = 0; y < base.height(); ++y)
+        memcpy(level0.row(y), base.row(y), rowSize);
+    
+    try {
+        // each level is made from the full precision floats of the level above it
+        std::vector<float> srcFloats, destFloats;
+        for(unsigned i = 1; i < levelCount(); ++i){
+            BitmapView dest = level(i);
+            bool isLast = (i + 1 == levelCount());
+            destFloats.resize(isLast ? 0 : (size_t)dest.width() * dest.height() * _format);
+            
+            LevelSource src(level(i - 1), i > 1 ? &srcFloats[0] : NULL, srgb);
+            Downsample(src, dest.origin(), isLast ? NULL : &destFloats[0], dest.width(), dest.height());
+            srcFloats.swap(destFloats);
+        }
+    } catch(...) {
+        free(_pixels);
+        throw;
+    }
+}
+
+MipChain::~MipChain() {
+    if(_pixels) free(_pixels);
+}
+
+unsigned MipChain::levelCount() const {
+    return (unsigned)_levels.size();
+}
+
+Bitmap::Format MipChain::format() const {
+    return _format;
+}
+
+BitmapView MipChain::level(unsigned level) const {
+    if(level >= _levels.size())
+        throw std::runtime_error("Mipmap level out of range");
+    
+    const Level& l = _levels[level];
+    return BitmapView(_pixels + l.offset, l.width, l.height, _format, (ptrdiff_t)l.width * _format);
+}
+
+const unsigned char* MipChain::data() const {
+    return _pixels;
+}
+
+size_t MipChain::size() const {
+    return _size;
+}
+
+MipChain::MipChain(MipChain&& other) :
+    _format(other._format),
+    _levels(std::move(other._levels)),
+    _pixels(other._pixels),
+    _size(other._size)
+{
+    other._levels.clear();
+    other._pixels = NULL;
+    other._size = 0;
+}
+
+MipChain& MipChain::operator = (MipChain&& other) {
+    if(this != &other){
+        if(_pixels) free(_pixels);
+        _format = other._format;
+        _levels = std::move(other._levels);
+        _pixels = other._pixels;
+        _size = other._size;
+        
+        other._levels.clear();
+        other._pixels = NULL;
+        other._size = 0;
+    }
+    return *this;
+}
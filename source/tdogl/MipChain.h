@@ -0,0 +1,97 @@
+/*
+ tdogl::MipChain
+ 
+ Copyright 2012 Thomas Dalling - http://tomdalling.com/
+ 
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+ 
+ http://www.apache.org/licenses/LICENSE-2.0
+ 
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#pragma once
+
+#include "Bitmap.h"
+#include "BitmapView.h"
+#include <vector>
+
+namespace tdogl {
+    
+    /**
+     A full chain of mipmap levels, from the original image down to 1x1 pixels.
+     
+     All the levels live in a single contiguous allocation, one after another,
+     each tightly packed. Each level is half the width and height of the
+     previous one (rounded down, and never less than 1).
+     
+     Levels are made on the CPU with an area-weighted box filter, which handles
+     odd dimensions by using three-pixel footprints instead of two. Color
+     channels of sRGB images are filtered in linear space, and images with
+     alpha are filtered premultiplied, so the color of transparent pixels
+     doesn't fringe the edges of opaque ones. Large images are filtered across
+     the threads of ThreadPool::shared.
+     
+     Use with the tdogl::Texture constructor that takes a MipChain.
+     */
+    class MipChain {
+    public:
+        /**
+         Generates the mipmap chain for the given pixels.
+         
+         @param base  The full size image, which becomes level 0. Must have
+                      8-bit channels.
+         @param srgb  True if the color channels of RGB and RGBA pixels are sRGB
+                      encoded, like tdogl::Texture assumes. Grayscale and alpha
+                      channels are always treated as linear.
+         */
+        explicit MipChain(const BitmapView& base, bool srgb = true);
+        ~MipChain();
+        
+        /** number of levels, including the base level */
+        unsigned levelCount() const;
+        
+        /** the pixel format of every level */
+        Bitmap::Format format() const;
+        
+        /**
+         Returns a view of the given level. Level 0 is the full size image.
+         */
+        BitmapView level(unsigned level) const;
+        
+        /** pointer to the start of the allocation holding all the levels */
+        const unsigned char* data() const;
+        
+        /** total size in bytes of all the levels */
+        size_t size() const;
+        
+        /** Move constructor */
+        MipChain(MipChain&& other);
+        
+        /** Move assignment operator */
+        MipChain& operator = (MipChain&& other);
+        
+    private:
+        struct Level {
+            unsigned width;
+            unsigned height;
+            size_t offset;
+        };
+        
+        Bitmap::Format _format;
+        std::vector<Level> _levels;
+        unsigned char* _pixels;
+        size_t _size;
+        
+        //copying disabled
+        MipChain(const MipChain&) = delete;
+        MipChain& operator = (const MipChain&) = delete;
+    };
+    
+}
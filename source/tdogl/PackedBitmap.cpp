@@ -0,0 +1,295 @@
+/*
+ tdogl::PackedBitmap
+ 
+ Copyright 2012 Thomas Dalling - http://tomdalling.com/
+ 
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+ 
+ http://www.apache.org/licenses/LICENSE-2.0
+ 
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#include "PackedBitmap.h"
+#include "LZCodec.h"
+#include "ThreadPool.h"
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+using namespace tdogl;
+
+// bitmaps with fewer pixels than this are processed on the calling thread
+static const size_t ParallelPixelThreshold = 256 * 256;
+
+// pixel bytes per block when no row count is given, which is also the LZ window
+static const size_t DefaultBlockBytes = 64 * 1024;
+
+// replaces each byte with its difference from the same byte of the pixel to its left
+static void DeltaEncodeRows(unsigned char* pixels, size_t rowSize, unsigned rowCount, unsigned pixelSize) {
+    for(unsigned row = 0; row < rowCount; ++row){
+        unsigned char* p = pixels + row * rowSize;
+        for(size_t i = rowSize; i-- > pixelSize; )
+            p[i] = (unsigned char)(p[i] - p[i - pixelSize]);
+    }
+}
+
+static void DeltaDecodeRows(unsigned char* pixels, size_t rowSize, unsigned rowCount, unsigned pixelSize) {
+    for(unsigned row = 0; row < rowCount; ++row){
+        unsigned char* p = pixels + row * rowSize;
+        for(size_t i = pixelSize; i < rowSize; ++i)
+            p[i] = (unsigned char)(p[i] + p[i - pixelSize]);
+    }
+}
+
+PackedBitmap::PackedBitmap(const BitmapView& src, unsigned rowsPerBlock) :
+    _width(src.width()),
+    _height(src.height()),
+    _format(src.format()),
+    _channelType(src.channelType()),
+    _rowsPerBlock(rowsPerBlock)
+{
+    size_t rowSize = (size_t)_width * bytesPerPixel();
+    if(_rowsPerBlock == 0)
+        _rowsPerBlock = (unsigned)std::max((size_t)1, std::min((size_t)_height, DefaultBlockBytes / rowSize));
+    
+    unsigned count = blockCount();
+    std::vector< std::vector<unsigned char> > packed(count);
+    std::vector<Encoding> encodings(count);
+    
+    auto packBlocks = [&](size_t begin, size_t end) {
+        std::vector<unsigned char> pixels, compressed;
+        for(size_t block = begin; block < end; ++block){
+            unsigned firstRow = blockFirstRow((unsigned)block);
+            unsigned rowCount = blockRowCount((unsigned)block);
+            size_t size = rowSize * rowCount;
+            pixels.resize(size);
+            for(unsigned row = 0; row < rowCount; ++row)
+                memcpy(&pixels[row * rowSize], src.row(firstRow + row), rowSize);
+            
+            compressed.resize(LZCompressBound(size));
+            size_t best = LZCompress(&pixels[0], size, &compressed[0]);
+            packed[block].assign(compressed.begin(), compressed.begin() + best);
+            encodings[block] = Encoding_LZ;
+            
+            DeltaEncodeRows(&pixels[0], rowSize, rowCount, bytesPerPixel());
+            size_t deltaSize = LZCompress(&pixels[0], size, &compressed[0]);
+            if(deltaSize < best){
+                best = deltaSize;
+                packed[block].assign(compressed.begin(), compressed.begin() + best);
+                encodings[block] = Encoding_DeltaLZ;
+            }
+            
+            if(best >= size){
+                DeltaDecodeRows(&pixels[0], rowSize, rowCount, bytesPerPixel());
+                packed[block] = pixels;
+                encodings[block] = Encoding_Raw;
+            }
+        }
+    };
+    
+    if((size_t)_width * _height >= ParallelPixelThreshold)
+        ThreadPool::shared().parallelFor(count, 1, packBlocks);
+    else
+        packBlocks(0, count);
+    
+    //one allocation for all the blocks, so nothing is wasted on per-block overhead
+    size_t total = 0;
+    for(unsigned block = 0; block < count; ++block)
+        total += packed[block].size();
+    
+    _data.resize(total);
+    _blocks.resize(count);
+    size_t offset = 0;
+    for(unsigned block = 0; block < count; ++block){
+        Block& b = _blocks[block];
+        b.offset = offset;
+        b.size = packed[block].size();
+        b.encoding = encodings[block];
+        if(b.size > 0)
+            memcpy(&_data[offset], &packed[block][0], b.size);
+        offset += b.size;
+        std::vector<unsigned char>().swap(packed[block]);
+    }
+}
+
+PackedBitmap::~PackedBitmap() {
+}
+
+PackedBitmap::PackedBitmap(PackedBitmap&& other) :
+    _width(other._width),
+    _height(other._height),
+    _format(other._format),
+    _channelType(other._channelType),
+    _rowsPerBlock(other._rowsPerBlock),
+    _blocks(std::move(other._blocks)),
+    _data(std::move(other._data))
+{
+    other._width = other._height = 0;
+    other._blocks.clear();
+    other._data.clear();
+}
+
+PackedBitmap& PackedBitmap::operator = (PackedBitmap&& other) {
+    if(this != &other){
+        _width = other._width;
+        _height = other._height;
+        _format = other._format;
+        _channelType = other._channelType;
+        _rowsPerBlock = other._rowsPerBlock;
+        _blocks = std::move(other._blocks);
+        _data = std::move(other._data);
+        
+        other._width = other._height = 0;
+        other._blocks.clear();
+        other._data.clear();
+    }
+    return *this;
+}
+
+unsigned PackedBitmap::width() const {
+    return _width;
+}
+
+unsigned PackedBitmap::height() const {
+    return _height;
+}
+
+Bitmap::Format PackedBitmap::format() const {
+    return _format;
+}
+
+Bitmap::ChannelType PackedBitmap::channelType() const {
+    return _channelType;
+}
+
+unsigned PackedBitmap::bytesPerPixel() const {
+    return _format * Bitmap::channelSize(_channelType);
+}
+
+unsigned PackedBitmap::rowsPerBlock() const {
+    return _rowsPerBlock;
+}
+
+unsigned PackedBitmap::blockCount() const {
+    return _height == 0 ? 0 : (unsigned)(((size_t)_height + _rowsPerBlock - 1) / _rowsPerBlock);
+}
+
+unsigned PackedBitmap::blockFirstRow(unsigned block) const {
+    return block * _rowsPerBlock;
+}
+
+unsigned PackedBitmap::blockRowCount(unsigned block) const {
+    return std::min(_rowsPerBlock, _height - blockFirstRow(block));
+}
+
+size_t PackedBitmap::packedSize() const {
+    return _data.size() + _blocks.size() * sizeof(Block);
+}
+
+size_t PackedBitmap::unpackedSize() const {
+    return (size_t)_width * _height * bytesPerPixel();
+}
+
+void PackedBitmap::decompressBlock(unsigned block, const BitmapView& dest) const {
+    if(block >= blockCount())
+        throw std::runtime_error("Block index out of range");
+    if(dest.width() != _width || dest.height() != blockRowCount(block))
+        throw std::runtime_error("View is the wrong size for the block");
+    if(dest.format() != _format || dest.channelType() != _channelType)
+        throw std::runtime_error("View has a different format to the packed bitmap");
+    
+    size_t rowSize = (size_t)_width * bytesPerPixel();
+    if(dest.rowStride() == (ptrdiff_t)rowSize){
+        _decompressBlock(block, dest.origin());
+        return;
+    }
+    
+    std::vector<unsigned char> pixels(rowSize * dest.height());
+    _decompressBlock(block, &pixels[0]);
+    for(unsigned row = 0; row < dest.height(); ++row)
+        memcpy(dest.row(row), &pixels[row * rowSize], rowSize);
+}
+
+void PackedBitmap::decompressRows(unsigned firstRow, const BitmapView& dest) const {
+    if(dest.width() != _width)
+        throw std::runtime_error("View is a different width to the packed bitmap");
+    if((size_t)firstRow + dest.height() > _height)
+        throw std::runtime_error("Rows out of range");
+    
+    bool sameFormat = (dest.format() == _format && dest.channelType() == _channelType);
+    size_t rowSize = (size_t)_width * bytesPerPixel();
+    std::vector<unsigned char> pixels;
+    
+    unsigned endRow = firstRow + dest.height();
+    for(unsigned block = firstRow / _rowsPerBlock; block < blockCount() && blockFirstRow(block) < endRow; ++block){
+        unsigned blockFirst = blockFirstRow(block);
+        unsigned blockRows = blockRowCount(block);
+        unsigned top = std::max(firstRow, blockFirst);
+        unsigned bottom = std::min(endRow, blockFirst + blockRows);
+        
+        //whole blocks go straight into contiguous destinations
+        if(sameFormat && top == blockFirst && bottom == blockFirst + blockRows && dest.rowStride() == (ptrdiff_t)rowSize){
+            _decompressBlock(block, dest.row(top - firstRow));
+            continue;
+        }
+        
+        pixels.resize(rowSize * blockRows);
+        _decompressBlock(block, &pixels[0]);
+        BitmapView blockView(&pixels[0], _width, blockRows, _format, (ptrdiff_t)rowSize, _channelType);
+        CopyPixels(blockView.subView(0, top - blockFirst, _width, bottom - top),
+                   dest.subView(0, top - firstRow, _width, bottom - top));
+    }
+}
+
+Bitmap PackedBitmap::toBitmap() const {
+    Bitmap bitmap(_width, _height, _format, _channelType);
+    BitmapView view(bitmap);
+    
+    //bitmap rows are padded, so blocks are unpacked tightly, then copied row by row
+    size_t rowSize = (size_t)_width * bytesPerPixel();
+    auto unpackBlocks = [&](size_t begin, size_t end) {
+        std::vector<unsigned char> pixels(rowSize * _rowsPerBlock);
+        for(size_t block = begin; block < end; ++block){
+            unsigned first = blockFirstRow((unsigned)block);
+            _decompressBlock((unsigned)block, &pixels[0]);
+            for(unsigned row = 0; row < blockRowCount((unsigned)block); ++row)
+                memcpy(view.row(first + row), &pixels[row * rowSize], rowSize);
+        }
+    };
+    
+    if((size_t)_width * _height >= ParallelPixelThreshold)
+        ThreadPool::shared().parallelFor(blockCount(), 1, unpackBlocks);
+    else
+        unpackBlocks(0, blockCount());
+    
+    return bitmap;
+}
+
+// decompresses a block into tightly packed rows
+void PackedBitmap::_decompressBlock(unsigned block, unsigned char* dest) const {
+    const Block& b = _blocks[block];
+    size_t rowSize = (size_t)_width * bytesPerPixel();
+    unsigned rowCount = blockRowCount(block);
+    size_t size = rowSize * rowCount;
+    const unsigned char* data = _data.empty() ? NULL : &_data[b.offset];
+    
+    switch(b.encoding){
+        case Encoding_Raw:
+            memcpy(dest, data, size);
+            break;
+        case Encoding_LZ:
+            LZDecompress(data, b.size, dest, size);
+            break;
+        case Encoding_DeltaLZ:
+            LZDecompress(data, b.size, dest, size);
+            DeltaDecodeRows(dest, rowSize, rowCount, bytesPerPixel());
+            break;
+    }
+}
@@ -0,0 +1,150 @@
+/*
+ tdogl::PackedBitmap
+ 
+ Copyright 2012 Thomas Dalling - http://tomdalling.com/
+ 
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+ 
+ http://www.apache.org/licenses/LICENSE-2.0
+ 
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#pragma once
+
+#include "Bitmap.h"
+#include "BitmapView.h"
+#include <cstddef>
+#include <vector>
+
+namespace tdogl {
+    
+    /**
+     A bitmap kept in memory compressed, for CPU-side copies of images that are
+     rarely read, e.g. to re-upload textures after the GL context is recreated.
+     
+     The rows are split into blocks, and each block is compressed on its own
+     with tdogl's LZ codec (see LZCodec.h), so rows can be decompressed on
+     demand without touching the rest of the image. Each block is compressed
+     both as it is and with each pixel stored as its difference from the pixel
+     to its left, and the smaller result is kept. Blocks that don't compress are
+     stored as they are.
+     
+     How much smaller this is depends on the image: flat and repetitive images
+     like UI art, masks and atlases shrink several times over, but noisy
+     photographic images barely shrink at all. Decompression runs at memory
+     speed, much faster than reading the image back from disk.
+     
+     Use `decompressRows` or `toBitmap` to get the pixels back, or the
+     tdogl::Texture constructor that takes a PackedBitmap, which uploads one
+     block at a time without unpacking the whole image.
+     */
+    class PackedBitmap {
+    public:
+        /**
+         Compresses the given pixels, across the threads of ThreadPool::shared.
+         
+         @param src           The pixels to compress, of any format and channel type
+         @param rowsPerBlock  The number of rows compressed together. Zero picks
+                              enough rows for about 64KB of pixels per block.
+                              Smaller blocks make random access cheaper, bigger
+                              blocks compress a little better.
+         */
+        explicit PackedBitmap(const BitmapView& src, unsigned rowsPerBlock = 0);
+        
+        ~PackedBitmap();
+        
+        /** width in pixels */
+        unsigned width() const;
+        
+        /** height in pixels */
+        unsigned height() const;
+        
+        /** the pixel format of the bitmap */
+        Bitmap::Format format() const;
+        
+        /** the type of each channel of the pixels */
+        Bitmap::ChannelType channelType() const;
+        
+        /** the size of one pixel in bytes */
+        unsigned bytesPerPixel() const;
+        
+        /** the number of rows in every block but the last */
+        unsigned rowsPerBlock() const;
+        
+        /** the number of blocks the rows are split into */
+        unsigned blockCount() const;
+        
+        /** the first row of the given block */
+        unsigned blockFirstRow(unsigned block) const;
+        
+        /** the number of rows in the given block */
+        unsigned blockRowCount(unsigned block) const;
+        
+        /** the memory used by the compressed blocks and their table, in bytes */
+        size_t packedSize() const;
+        
+        /** the size of the pixels when tightly packed and uncompressed, in bytes */
+        size_t unpackedSize() const;
+        
+        /**
+         Decompresses one block into `dest`, which must be `width()` pixels
+         wide and `blockRowCount(block)` pixels tall, with the same format and
+         channel type as this bitmap.
+         */
+        void decompressBlock(unsigned block, const BitmapView& dest) const;
+        
+        /**
+         Decompresses the rows from `firstRow` down into `dest`, which must be
+         `width()` pixels wide. Only the blocks holding those rows are
+         decompressed. Pixels are converted to the format and channel type of
+         `dest`, like Bitmap::copyFromView.
+         */
+        void decompressRows(unsigned firstRow, const BitmapView& dest) const;
+        
+        /**
+         Decompresses the whole image, across the threads of ThreadPool::shared.
+         */
+        Bitmap toBitmap() const;
+        
+        /** Move constructor */
+        PackedBitmap(PackedBitmap&& other);
+        
+        /** Move assignment operator */
+        PackedBitmap& operator = (PackedBitmap&& other);
+        
+    private:
+        enum Encoding {
+            Encoding_Raw,
+            Encoding_LZ,
+            Encoding_DeltaLZ
+        };
+        
+        struct Block {
+            size_t offset;
+            size_t size;
+            Encoding encoding;
+        };
+        
+        unsigned _width;
+        unsigned _height;
+        Bitmap::Format _format;
+        Bitmap::ChannelType _channelType;
+        unsigned _rowsPerBlock;
+        std::vector<Block> _blocks;
+        std::vector<unsigned char> _data;
+        
+        void _decompressBlock(unsigned block, unsigned char* dest) const;
+        
+        //copying disabled
+        PackedBitmap(const PackedBitmap&) = delete;
+        PackedBitmap& operator = (const PackedBitmap&) = delete;
+    };
+    
+}
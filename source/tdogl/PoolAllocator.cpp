@@ -0,0 +1,232 @@
+/*
+ tdogl::PoolAllocator
+ 
+ Copyright 2012 Thomas Dalling - http://tomdalling.com/
+ 
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+ 
+ http://www.apache.org/licenses/LICENSE-2.0
+ 
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#include "PoolAllocator.h"
+#include <cstdlib>
+#include <cstring>
+#include <stdint.h>
+#include <sys/mman.h>
+#if defined(__APPLE__)
+    #include <mach/vm_statistics.h>
+#endif
+
+using namespace tdogl;
+
+/*
+ Every block starts with a header, and the caller gets the memory after it.
+ Blocks of the same size class all have the same capacity, so any free block
+ of a class can satisfy any request for that class.
+ */
+struct BlockHeader {
+    size_t capacity; //usable bytes after the header
+    size_t mappedLength; //length of the mapping that starts at the header, or 0 if malloc'd
+};
+
+//a whole cache line, so blocks after it are 64 byte aligned
+static const size_t HeaderSize = 64;
+static_assert(sizeof(BlockHeader) <= HeaderSize, "BlockHeader doesn't fit");
+static const unsigned MinClassBits = 6; //smallest class is 64 bytes
+static const unsigned MaxClassBits = 28; //largest pooled class is 256MB
+static const unsigned ClassCount = 1 + (MaxClassBits - MinClassBits) * 4;
+static const size_t MapThreshold = 128 * 1024;
+static const size_t PageSize = 4096;
+static const size_t HugePageSize = 2 * 1024 * 1024;
+
+static inline BlockHeader* HeaderForBlock(void* block) {
+    return (BlockHeader*)((unsigned char*)block - HeaderSize);
+}
+
+static inline size_t RoundUp(size_t value, size_t multiple) {
+    return (value + multiple - 1) / multiple * multiple;
+}
+
+// classes are 64, then four per power of two: 80, 96, 112, 128, 160, 192, ...
+static unsigned SizeClassForSize(size_t size) {
+    if(size <= ((size_t)1 << MinClassBits))
+        return 0;
+    
+    unsigned bit = 0;
+    while(((size - 1) >> (bit + 1)) != 0)
+        ++bit;
+    
+    size_t step = (size_t)1 << (bit - 2);
+    unsigned sub = (unsigned)((size - 1 - ((size_t)1 << bit)) / step);
+    return 1 + (bit - MinClassBits) * 4 + sub;
+}
+
+static size_t SizeForSizeClass(unsigned sizeClass) {
+    if(sizeClass == 0)
+        return (size_t)1 << MinClassBits;
+    
+    unsigned bit = (sizeClass - 1) / 4 + MinClassBits;
+    return ((size_t)1 << bit) + ((sizeClass - 1) % 4 + 1) * ((size_t)1 << (bit - 2));
+}
+
+static void* MapPages(size_t length, bool hugePages) {
+#if defined(MADV_HUGEPAGE)
+    if(hugePages){
+        //over-map, so the block can start on a huge page boundary
+        unsigned char* raw = (unsigned char*)mmap(NULL, length + HugePageSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON, -1, 0);
+        if(raw == MAP_FAILED)
+            return NULL;
+        
+        unsigned char* start = (unsigned char*)RoundUp((uintptr_t)raw, HugePageSize);
+        if(start > raw)
+            munmap(raw, start - raw);
+        if(raw + length + HugePageSize > start + length)
+            munmap(start + length, (raw + length + HugePageSize) - (start + length));
+        
+        madvise(start, length, MADV_HUGEPAGE);
+        return start;
+    }
+#elif defined(VM_FLAGS_SUPERPAGE_SIZE_2MB)
+    if(hugePages){
+        void* pages = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON, VM_FLAGS_SUPERPAGE_SIZE_2MB, 0);
+        if(pages != MAP_FAILED)
+            return pages;
+        //superpages aren't available, so fall back to normal pages
+    }
+#else
+    (void)hugePages;
+#endif
+    
+    void* pages = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON, -1, 0);
+    return (pages == MAP_FAILED) ? NULL : pages;
+}
+
+static void ReleaseBlock(void* block) {
+    BlockHeader* header = HeaderForBlock(block);
+    if(header->mappedLength > 0)
+        munmap(header, header->mappedLength);
+    else
+        free(header);
+}
+
+PoolAllocator::PoolAllocator(size_t maxCachedBytes, size_t hugePageThreshold) :
+    _freeBlocks(ClassCount),
+    _cachedBytes(0),
+    _maxCachedBytes(maxCachedBytes),
+    _hugePageThreshold(hugePageThreshold)
+{
+}
+
+PoolAllocator::~PoolAllocator() {
+    trim();
+}
+
+PoolAllocator& PoolAllocator::shared() {
+    static PoolAllocator pool;
+    return pool;
+}
+
+void* PoolAllocator::_createBlock(size_t capacity) {
+    if(capacity > (size_t)-1 - HugePageSize - HeaderSize)
+        return NULL;
+    
+    BlockHeader* header;
+    size_t mappedLength = 0;
+    if(capacity + HeaderSize >= MapThreshold){
+        bool hugePages = (_hugePageThreshold > 0 && capacity >= _hugePageThreshold);
+        mappedLength = RoundUp(capacity + HeaderSize, hugePages ? HugePageSize : PageSize);
+        header = (BlockHeader*)MapPages(mappedLength, hugePages);
+    } else {
+        void* memory;
+        header = (posix_memalign(&memory, HeaderSize, capacity + HeaderSize) == 0) ? (BlockHeader*)memory : NULL;
+    }
+    
+    if(!header)
+        return NULL;
+    
+    header->capacity = capacity;
+    header->mappedLength = mappedLength;
+    return (unsigned char*)header + HeaderSize;
+}
+
+void* PoolAllocator::allocate(size_t size) {
+    unsigned sizeClass = SizeClassForSize(size);
+    if(sizeClass >= ClassCount)
+        return _createBlock(size); //too big to pool
+    
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        std::vector<void*>& freeBlocks = _freeBlocks[sizeClass];
+        if(!freeBlocks.empty()){
+            void* block = freeBlocks.back();
+            freeBlocks.pop_back();
+            _cachedBytes -= HeaderForBlock(block)->capacity;
+            return block;
+        }
+    }
+    
+    return _createBlock(SizeForSizeClass(sizeClass));
+}
+
+void* PoolAllocator::reallocate(void* block, size_t newSize) {
+    if(!block)
+        return allocate(newSize);
+    
+    //keep the block if it fits, unless it would waste more than half of it
+    size_t capacity = HeaderForBlock(block)->capacity;
+    if(newSize <= capacity && newSize >= capacity / 2)
+        return block;
+    
+    void* newBlock = allocate(newSize);
+    if(!newBlock)
+        return NULL;
+    
+    memcpy(newBlock, block, (newSize < capacity) ? newSize : capacity);
+    deallocate(block);
+    return newBlock;
+}
+
+void PoolAllocator::deallocate(void* block) {
+    if(!block)
+        return;
+    
+    size_t capacity = HeaderForBlock(block)->capacity;
+    unsigned sizeClass = SizeClassForSize(capacity);
+    if(sizeClass < ClassCount && SizeForSizeClass(sizeClass) == capacity){
+        std::lock_guard<std::mutex> lock(_mutex);
+        if(_cachedBytes + capacity <= _maxCachedBytes){
+            _freeBlocks[sizeClass].push_back(block);
+            _cachedBytes += capacity;
+            return;
+        }
+    }
+    
+    ReleaseBlock(block);
+}
+
+void PoolAllocator::trim() {
+    std::vector< std::vector<void*> > released(ClassCount);
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        released.swap(_freeBlocks);
+        _cachedBytes = 0;
+    }
+    
+    for(size_t i = 0; i < released.size(); ++i){
+        for(size_t b = 0; b < released[i].size(); ++b)
+            ReleaseBlock(released[i][b]);
+    }
+}
+
+size_t PoolAllocator::cachedBytes() const {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _cachedBytes;
+}
@@ -0,0 +1,96 @@
+/*
+ tdogl::PoolAllocator
+ 
+ Copyright 2012 Thomas Dalling - http://tomdalling.com/
+ 
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+ 
+ http://www.apache.org/licenses/LICENSE-2.0
+ 
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#pragma once
+
+#include "Allocator.h"
+#include <mutex>
+#include <vector>
+
+namespace tdogl {
+    
+    /**
+     An allocator for pixel buffers, which keeps freed blocks around to reuse.
+     
+     Requests are rounded up to a size class (four per power of two, so at
+     most 25% is wasted), and a freed block goes on its class's free list
+     instead of back to the heap. Loading a burst of textures of similar sizes
+     then reuses the same few blocks, rather than fragmenting the heap.
+     
+     Blocks of 128KB or more are mapped straight from the OS, so they never
+     fragment the heap, and their memory really is returned when they are
+     released. Free lists are capped at `maxCachedBytes` in total. Call `trim`
+     to release every cached block, e.g. after loading a level.
+     
+     Blocks are aligned to 64 bytes (a cache line), which is what bitmaps
+     align their pixels to, so they never need to over-allocate to align.
+     
+     Thread safe. Bitmaps use PoolAllocator::shared by default.
+     */
+    class PoolAllocator : public Allocator {
+    public:
+        /**
+         @param maxCachedBytes     The most memory to hold in freed blocks. When
+                                   the free lists are full, freed blocks are
+                                   released to the OS.
+         @param hugePageThreshold  Blocks at least this big are backed by 2MB
+                                   pages where the OS supports them, which
+                                   speeds up touching very large images. Zero
+                                   disables huge pages.
+         */
+        explicit PoolAllocator(size_t maxCachedBytes = 64 * 1024 * 1024,
+                               size_t hugePageThreshold = 0);
+        
+        /**
+         Releases all cached blocks. Blocks that are still allocated must not be
+         used afterwards.
+         */
+        ~PoolAllocator();
+        
+        /**
+         The pool used for bitmap pixels, with default settings.
+         */
+        static PoolAllocator& shared();
+        
+        void* allocate(size_t size);
+        void* reallocate(void* block, size_t newSize);
+        void deallocate(void* block);
+        
+        /**
+         Releases every cached (freed) block back to the OS or heap.
+         */
+        void trim();
+        
+        /** total size of the cached blocks, in bytes */
+        size_t cachedBytes() const;
+        
+    private:
+        mutable std::mutex _mutex;
+        std::vector< std::vector<void*> > _freeBlocks; //one list per size class
+        size_t _cachedBytes;
+        size_t _maxCachedBytes;
+        size_t _hugePageThreshold;
+        
+        void* _createBlock(size_t capacity);
+        
+        //copying disabled
+        PoolAllocator(const PoolAllocator&) = delete;
+        PoolAllocator& operator = (const PoolAllocator&) = delete;
+    };
+    
+}
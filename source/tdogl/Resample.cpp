@@ -0,0 +1,370 @@
+/*
+ tdogl::Resample
+ 
+ Copyright 2012 Thomas Dalling - http://tomdalling.com/
+ 
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+ 
+ http://www.apache.org/licenses/LICENSE-2.0
+ 
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#include "Resample.h"
+#include "ColorSpace.h"
+#include "ThreadPool.h"
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include <vector>
+
+#if !defined(TDOGL_DISABLE_SIMD) && (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+    #define TDOGL_SSE2 1
+    #include <emmintrin.h>
+#endif
+
+using namespace tdogl;
+
+// images with fewer destination pixels than this are resized on the calling thread
+static const size_t ParallelPixelThreshold = 256 * 256;
+
+static const double Pi = 3.14159265358979323846;
+
+/*
+ Filter kernels, centered on zero. `support` is the radius outside of which
+ the kernel is zero, at a scale of one source pixel per destination pixel.
+ */
+
+static double BoxKernel(double x) {
+    return (x >= -0.5 && x < 0.5) ? 1.0 : 0.0;
+}
+
+// Mitchell-Netravali with B = C = 1/3
+static double MitchellKernel(double x) {
+    const double B = 1.0 / 3.0;
+    const double C = 1.0 / 3.0;
+    x = std::fabs(x);
+    if(x < 1.0)
+        return ((12 - 9*B - 6*C)*x*x*x + (-18 + 12*B + 6*C)*x*x + (6 - 2*B)) / 6.0;
+    if(x < 2.0)
+        return ((-B - 6*C)*x*x*x + (6*B + 30*C)*x*x + (-12*B - 48*C)*x + (8*B + 24*C)) / 6.0;
+    return 0.0;
+}
+
+static double Sinc(double x) {
+    if(x == 0.0) return 1.0;
+    x *= Pi;
+    return std::sin(x) / x;
+}
+
+static double Lanczos3Kernel(double x) {
+    return (std::fabs(x) < 3.0) ? Sinc(x) * Sinc(x / 3.0) : 0.0;
+}
+
+namespace {
+    struct Kernel {
+        double (*weight)(double x);
+        double support;
+    };
+    
+    /*
+     The source pixels that contribute to each destination pixel, along one
+     axis. Every destination pixel has the same number of taps, padded with
+     zero weights near the edges, so the inner loops don't branch.
+     */
+    struct AxisTaps {
+        unsigned tapCount;
+        std::vector<unsigned> first; //first source pixel, per destination pixel
+        std::vector<float> weights; //tapCount weights per destination pixel
+    };
+}
+
+static Kernel KernelForFilter(Bitmap::ResizeFilter filter) {
+    Kernel k;
+    switch(filter){
+        case Bitmap::ResizeFilter_Box: k.weight = BoxKernel; k.support = 0.5; break;
+        case Bitmap::ResizeFilter_Mitchell: k.weight = MitchellKernel; k.support = 2.0; break;
+        case Bitmap::ResizeFilter_Lanczos3: k.weight = Lanczos3Kernel; k.support = 3.0; break;
+        default: throw std::runtime_error("Unrecognised Bitmap::ResizeFilter");
+    }
+    return k;
+}
+
+static AxisTaps TapsForAxis(unsigned srcSize, unsigned destSize, const Kernel& kernel) {
+    //when downscaling, stretch the kernel over each destination pixel's footprint
+    double scale = (double)srcSize / destSize;
+    double kernelScale = std::max(1.0, scale);
+    double support = kernel.support * kernelScale;
+    
+    AxisTaps taps;
+    taps.tapCount = (unsigned)std::min<double>(srcSize, std::ceil(support * 2.0) + 1.0);
+    taps.first.resize(destSize);
+    taps.weights.assign((size_t)destSize * taps.tapCount, 0.0f);
+    
+    std::vector<double> weights(taps.tapCount);
+    for(unsigned x = 0; x < destSize; ++x){
+        double center = (x + 0.5) * scale - 0.5;
+        int lo = std::max(0, (int)std::ceil(center - support));
+        int hi = std::min((int)srcSize - 1, (int)std::floor(center + support));
+        unsigned start = (unsigned)std::min(lo, (int)(srcSize - taps.tapCount));
+        
+        std::fill(weights.begin(), weights.end(), 0.0);
+        double total = 0.0;
+        for(int i = lo; i <= hi; ++i){
+            double w = kernel.weight((i - center) / kernelScale);
+            weights[i - start] = w;
+            total += w;
+        }
+        
+        //a box can fall between source pixels when upscaling, so use the nearest one
+        if(total == 0.0){
+            int nearest = std::min((int)srcSize - 1, std::max(0, (int)std::floor(center + 0.5)));
+            weights[nearest - start] = 1.0;
+            total = 1.0;
+        }
+        
+        taps.first[x] = start;
+        float* dest = &taps.weights[(size_t)x * taps.tapCount];
+        for(unsigned k = 0; k < taps.tapCount; ++k)
+            dest[k] = (float)(weights[k] / total);
+    }
+    
+    return taps;
+}
+
+/*
+ Rows are filtered as floats, one float per channel, except that RGB pixels
+ are padded out to four floats so they can be filtered with the same SIMD code
+ as RGBA pixels.
+ */
+static unsigned FloatsPerPixel(Bitmap::Format format) {
+    return format == Bitmap::Format_RGB ? 4 : (unsigned)format;
+}
+
+// bytes to floats from 0 to 1
+static void BytesToFloats(const unsigned char* src, float* dest, size_t count) {
+    size_t i = 0;
+#ifdef TDOGL_SSE2
+    const __m128i zero = _mm_setzero_si128();
+    const __m128 scale = _mm_set1_ps(1.0f / 255.0f);
+    for(; i + 16 <= count; i += 16){
+        __m128i bytes = _mm_loadu_si128((const __m128i*)(src + i));
+        __m128i lo = _mm_unpacklo_epi8(bytes, zero);
+        __m128i hi = _mm_unpackhi_epi8(bytes, zero);
+        _mm_storeu_ps(dest + i,      _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(lo, zero)), scale));
+        _mm_storeu_ps(dest + i + 4,  _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpackhi_epi16(lo, zero)), scale));
+        _mm_storeu_ps(dest + i + 8,  _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(hi, zero)), scale));
+        _mm_storeu_ps(dest + i + 12, _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpackhi_epi16(hi, zero)), scale));
+    }
+#endif
+    for(; i < count; ++i)
+        dest[i] = src[i] * (1.0f / 255.0f);
+}
+
+// the index of the alpha channel, or -1 if there isn't one
+static int AlphaChannel(unsigned channels) {
+    return (channels == 2 || channels == 4) ? (int)channels - 1 : -1;
+}
+
+/*
+ Decoded rows are linear, with the other channels premultiplied by alpha, so
+ the color of transparent pixels doesn't bleed into their neighbours as dark
+ or light halos. EncodeRow divides it back out.
+ */
+static void DecodeRow(const unsigned char* src, float* dest, unsigned width, unsigned channels, unsigned stride, bool srgb) {
+    if(srgb && channels >= 3){
+        const float* table = SRGBToLinearTable();
+        for(unsigned x = 0; x < width; ++x, src += channels, dest += 4){
+            if(channels == 4){
+                float alpha = src[3] * (1.0f / 255.0f);
+#ifdef TDOGL_SSE2
+                _mm_storeu_ps(dest, _mm_mul_ps(_mm_setr_ps(table[src[0]], table[src[1]], table[src[2]], 1.0f),
+                                               _mm_set1_ps(alpha)));
+#else
+                dest[0] = table[src[0]] * alpha;
+                dest[1] = table[src[1]] * alpha;
+                dest[2] = table[src[2]] * alpha;
+                dest[3] = alpha;
+#endif
+            } else {
+                dest[0] = table[src[0]];
+                dest[1] = table[src[1]];
+                dest[2] = table[src[2]];
+                dest[3] = 0.0f;
+            }
+        }
+    } else if(channels == stride) {
+        BytesToFloats(src, dest, (size_t)width * channels);
+        int alphaChannel = AlphaChannel(channels);
+        if(alphaChannel >= 0){
+            for(unsigned x = 0; x < width; ++x, dest += channels){
+                for(int c = 0; c < alphaChannel; ++c)
+                    dest[c] *= dest[alphaChannel];
+            }
+        }
+    } else {
+        //linear RGB, padded out to four floats
+        for(unsigned x = 0; x < width; ++x, src += channels, dest += stride){
+            dest[0] = src[0] * (1.0f / 255.0f);
+            dest[1] = src[1] * (1.0f / 255.0f);
+            dest[2] = src[2] * (1.0f / 255.0f);
+            dest[3] = 0.0f;
+        }
+    }
+}
+
+// encodes a filtered row, unpremultiplying it in place first
+static void EncodeRow(float* src, unsigned char* dest, unsigned width, unsigned channels, unsigned stride, bool srgb) {
+    int alphaChannel = AlphaChannel(channels);
+    if(alphaChannel >= 0){
+        //filters with negative lobes can ring below zero alpha, which is as transparent as zero
+        for(unsigned x = 0; x < width; ++x){
+            float* p = src + (size_t)x * stride;
+            float scale = p[alphaChannel] > 0.0f ? 1.0f / p[alphaChannel] : 0.0f;
+            for(int c = 0; c < alphaChannel; ++c)
+                p[c] *= scale;
+        }
+    }
+    
+    unsigned colorChannels = (srgb && channels >= 3) ? 3 : 0;
+    if(colorChannels != 0 && channels == stride){
+        //encode everything as color with the batch encoder, then redo the alpha
+        LinearToSRGB(src, dest, (size_t)width * 4);
+        for(unsigned x = 0; x < width; ++x)
+            dest[x*4 + 3] = LinearToByte(src[x*4 + 3]);
+        return;
+    }
+    
+    for(unsigned x = 0; x < width; ++x, src += stride, dest += channels){
+        for(unsigned c = 0; c < channels; ++c)
+            dest[c] = c < colorChannels ? LinearToSRGB(src[c]) : LinearToByte(src[c]);
+    }
+}
+
+// filters one row horizontally with the given taps
+static void FilterRow(const float* src, const AxisTaps& taps, unsigned stride, float* dest) {
+    size_t destWidth = taps.first.size();
+    size_t x = 0;
+#ifdef TDOGL_SSE2
+    if(stride == 4){
+        for(; x < destWidth; ++x){
+            const float* s = src + (size_t)taps.first[x] * 4;
+            const float* w = &taps.weights[x * taps.tapCount];
+            //two sums, so consecutive adds don't wait on each other
+            __m128 sum0 = _mm_setzero_ps();
+            __m128 sum1 = _mm_setzero_ps();
+            unsigned k = 0;
+            for(; k + 2 <= taps.tapCount; k += 2){
+                sum0 = _mm_add_ps(sum0, _mm_mul_ps(_mm_loadu_ps(s + k*4), _mm_set1_ps(w[k])));
+                sum1 = _mm_add_ps(sum1, _mm_mul_ps(_mm_loadu_ps(s + k*4 + 4), _mm_set1_ps(w[k + 1])));
+            }
+            if(k < taps.tapCount)
+                sum0 = _mm_add_ps(sum0, _mm_mul_ps(_mm_loadu_ps(s + k*4), _mm_set1_ps(w[k])));
+            _mm_storeu_ps(dest + x*4, _mm_add_ps(sum0, sum1));
+        }
+    }
+#endif
+    for(; x < destWidth; ++x){
+        const float* s = src + (size_t)taps.first[x] * stride;
+        const float* w = &taps.weights[x * taps.tapCount];
+        for(unsigned c = 0; c < stride; ++c){
+            float sum = 0.0f;
+            for(unsigned k = 0; k < taps.tapCount; ++k)
+                sum += s[k*stride + c] * w[k];
+            dest[x*stride + c] = sum;
+        }
+    }
+}
+
+// dest[i] = sum over rows of weight * row[i]
+static void CombineRows(const float* const* rows, const float* weights, unsigned rowCount, float* dest, size_t count) {
+    size_t i = 0;
+#ifdef TDOGL_SSE2
+    for(; i + 8 <= count; i += 8){
+        __m128 sum0 = _mm_setzero_ps();
+        __m128 sum1 = _mm_setzero_ps();
+        for(unsigned r = 0; r < rowCount; ++r){
+            __m128 w = _mm_set1_ps(weights[r]);
+            sum0 = _mm_add_ps(sum0, _mm_mul_ps(_mm_loadu_ps(rows[r] + i), w));
+            sum1 = _mm_add_ps(sum1, _mm_mul_ps(_mm_loadu_ps(rows[r] + i + 4), w));
+        }
+        _mm_storeu_ps(dest + i, sum0);
+        _mm_storeu_ps(dest + i + 4, sum1);
+    }
+#endif
+    for(; i < count; ++i){
+        float sum = 0.0f;
+        for(unsigned r = 0; r < rowCount; ++r)
+            sum += rows[r][i] * weights[r];
+        dest[i] = sum;
+    }
+}
+
+void tdogl::Resample(const BitmapView& src, const BitmapView& dest, Bitmap::ResizeFilter filter, bool srgb) {
+    if(src.format() != dest.format())
+        throw std::runtime_error("Can't resample between different pixel formats");
+    if(src.channelType() != Bitmap::ChannelType_UInt8 || dest.channelType() != Bitmap::ChannelType_UInt8)
+        throw std::runtime_error("Can only resample 8-bit channels");
+    if(dest.width() == 0 || dest.height() == 0)
+        return;
+    if(src.width() == 0 || src.height() == 0)
+        throw std::runtime_error("Can't resample an empty view");
+    
+    const unsigned char* srcFirst = src.row(src.rowStride() < 0 ? src.height() - 1 : 0);
+    const unsigned char* srcLast = src.row(src.rowStride() < 0 ? 0 : src.height() - 1) + (size_t)src.width() * src.format();
+    const unsigned char* destFirst = dest.row(dest.rowStride() < 0 ? dest.height() - 1 : 0);
+    const unsigned char* destLast = dest.row(dest.rowStride() < 0 ? 0 : dest.height() - 1) + (size_t)dest.width() * dest.format();
+    if(srcFirst < destLast && destFirst < srcLast)
+        throw std::runtime_error("Can't resample into a view that overlaps the source");
+    
+    Kernel kernel = KernelForFilter(filter);
+    AxisTaps colTaps = TapsForAxis(src.width(), dest.width(), kernel);
+    AxisTaps rowTaps = TapsForAxis(src.height(), dest.height(), kernel);
+    
+    unsigned channels = src.format();
+    unsigned stride = FloatsPerPixel(src.format());
+    size_t srcRowFloats = (size_t)src.width() * stride;
+    size_t destRowFloats = (size_t)dest.width() * stride;
+    bool parallel = (size_t)dest.width() * dest.height() >= ParallelPixelThreshold;
+    
+    /*
+     Each chunk of destination rows filters the source rows it needs
+     horizontally into a ring buffer, then combines them vertically. The source
+     rows used by consecutive destination rows only move forward, so every
+     source row is filtered once per chunk, and the ring stays in cache instead
+     of holding the whole horizontally filtered image.
+     */
+    auto resampleRows = [&](size_t begin, size_t end) {
+        unsigned ringSize = rowTaps.tapCount;
+        std::vector<float> decoded(srcRowFloats);
+        std::vector<float> ring((size_t)ringSize * destRowFloats);
+        std::vector<float> combined(destRowFloats);
+        std::vector<const float*> rows(ringSize);
+        unsigned nextRow = rowTaps.first[begin]; //next source row to filter
+        
+        for(size_t y = begin; y < end; ++y){
+            unsigned first = rowTaps.first[y];
+            nextRow = std::max(nextRow, first);
+            for(; nextRow < first + ringSize; ++nextRow){
+                DecodeRow(src.row(nextRow), &decoded[0], src.width(), channels, stride, srgb);
+                FilterRow(&decoded[0], colTaps, stride, &ring[(size_t)(nextRow % ringSize) * destRowFloats]);
+            }
+            
+            for(unsigned k = 0; k < ringSize; ++k)
+                rows[k] = &ring[(size_t)((first + k) % ringSize) * destRowFloats];
+            CombineRows(&rows[0], &rowTaps.weights[y * ringSize], ringSize, &combined[0], destRowFloats);
+            EncodeRow(&combined[0], dest.row((unsigned)y), dest.width(), channels, stride, srgb);
+        }
+    };
+    
+    if(parallel)
+        ThreadPool::shared().parallelFor(dest.height(), 16, resampleRows);
+    else
+        resampleRows(0, dest.height());
+}
@@ -0,0 +1,51 @@
+/*
+ tdogl::Resample
+ 
+ Copyright 2012 Thomas Dalling - http://tomdalling.com/
+ 
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+ 
+ http://www.apache.org/licenses/LICENSE-2.0
+ 
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#pragma once
+
+#include "Bitmap.h"
+#include "BitmapView.h"
+
+namespace tdogl {
+    
+    /**
+     Resizes the pixels of `src` to fill `dest`, with a separable filter.
+     
+     The filter weights are worked out once per column and once per row, then
+     the image is filtered horizontally and then vertically, in floating point,
+     across the threads of ThreadPool::shared. When downscaling, the filters
+     are widened to cover each destination pixel's whole footprint, so small
+     details are averaged rather than skipped. Pixels with alpha are filtered
+     premultiplied, so the color of transparent pixels doesn't make halos
+     around opaque ones.
+     
+     @param src     The pixels to resize. Must have 8-bit channels.
+     @param dest    Where the resized pixels go. Must have the same format as
+                    `src`, and must not overlap it.
+     @param filter  The filter to resize with
+     @param srgb    True if the color channels of RGB and RGBA pixels are sRGB
+                    encoded, like tdogl::Texture assumes. They are then filtered
+                    in linear space. Grayscale and alpha channels are always
+                    treated as linear.
+     */
+    void Resample(const BitmapView& src,
+                  const BitmapView& dest,
+                  Bitmap::ResizeFilter filter = Bitmap::ResizeFilter_Lanczos3,
+                  bool srgb = true);
+    
+}
@@ -0,0 +1,163 @@
+/*
+ tdogl::ScratchArena
+ 
+ Copyright 2012 Thomas Dalling - http://tomdalling.com/
+ 
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+ 
+ http://www.apache.org/licenses/LICENSE-2.0
+ 
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#include "ScratchArena.h"
+#include <cstdlib>
+#include <cstring>
+
+using namespace tdogl;
+
+// each block starts with a header holding its size, which keeps blocks 16 byte aligned
+static const size_t HeaderSize = 16;
+
+static inline size_t RoundUp16(size_t value) {
+    return (value + 15) & ~(size_t)15;
+}
+
+static inline size_t& BlockSize(unsigned char* header) {
+    return *(size_t*)header;
+}
+
+ScratchArena::Scope::Scope(ScratchArena& arena) :
+    _arena(arena),
+    _chunk(arena._current),
+    _offset(arena._offset)
+{
+}
+
+ScratchArena::Scope::~Scope() {
+    _arena._rewind(_chunk, _offset);
+}
+
+ScratchArena::ScratchArena(size_t chunkSize) :
+    _current(0),
+    _offset(0),
+    _chunkSize(RoundUp16(chunkSize)),
+    _last(NULL)
+{
+}
+
+ScratchArena::~ScratchArena() {
+    for(size_t i = 0; i < _chunks.size(); ++i)
+        free(_chunks[i].memory);
+}
+
+ScratchArena& ScratchArena::threadLocal() {
+    static thread_local ScratchArena arena;
+    return arena;
+}
+
+void* ScratchArena::allocate(size_t size) {
+    if(size > (size_t)-1 - HeaderSize - 15)
+        return NULL;
+    size_t needed = HeaderSize + RoundUp16(size);
+    
+    if(_chunks.empty() || _offset + needed > _chunks[_current].size){
+        Chunk chunk;
+        chunk.size = (needed > _chunkSize) ? needed : _chunkSize;
+        chunk.memory = (unsigned char*)malloc(chunk.size);
+        if(!chunk.memory)
+            return NULL;
+        
+        _chunks.push_back(chunk);
+        _current = _chunks.size() - 1;
+        _offset = 0;
+    }
+    
+    unsigned char* header = _chunks[_current].memory + _offset;
+    BlockSize(header) = size;
+    _offset += needed;
+    _last = header;
+    return header + HeaderSize;
+}
+
+void* ScratchArena::reallocate(void* block, size_t newSize) {
+    if(!block)
+        return allocate(newSize);
+    
+    unsigned char* header = (unsigned char*)block - HeaderSize;
+    size_t oldSize = BlockSize(header);
+    
+    //the most recent block can grow or shrink in place, if it fits
+    if(header == _last && newSize <= (size_t)-1 - HeaderSize - 15){
+        size_t start = (size_t)(header - _chunks[_current].memory);
+        size_t needed = HeaderSize + RoundUp16(newSize);
+        if(start + needed <= _chunks[_current].size){
+            BlockSize(header) = newSize;
+            _offset = start + needed;
+            return block;
+        }
+    }
+    
+    void* newBlock = allocate(newSize);
+    if(!newBlock)
+        return NULL;
+    
+    memcpy(newBlock, block, (oldSize < newSize) ? oldSize : newSize);
+    deallocate(block);
+    return newBlock;
+}
+
+void ScratchArena::deallocate(void* block) {
+    if(!block)
+        return;
+    
+    //only the most recent block can be given back before its scope ends
+    unsigned char* header = (unsigned char*)block - HeaderSize;
+    if(header == _last){
+        _offset = (size_t)(header - _chunks[_current].memory);
+        _last = NULL;
+    }
+}
+
+bool ScratchArena::owns(const void* block) const {
+    const unsigned char* p = (const unsigned char*)block;
+    for(size_t i = 0; i < _chunks.size(); ++i){
+        if(p >= _chunks[i].memory && p < _chunks[i].memory + _chunks[i].size)
+            return true;
+    }
+    return false;
+}
+
+size_t ScratchArena::blockSize(const void* block) const {
+    return *(const size_t*)((const unsigned char*)block - HeaderSize);
+}
+
+size_t ScratchArena::bytesInUse() const {
+    size_t total = _offset;
+    for(size_t i = 0; i < _current && i < _chunks.size(); ++i)
+        total += _chunks[i].size;
+    return total;
+}
+
+void ScratchArena::_rewind(size_t chunk, size_t offset) {
+    //chunks after the one being rewound to are released, and so is the
+    //first chunk when the arena becomes empty, if it was oversized
+    size_t keep = chunk + 1;
+    if(chunk == 0 && offset == 0 && !_chunks.empty() && _chunks[0].size != _chunkSize)
+        keep = 0;
+    
+    while(_chunks.size() > keep){
+        free(_chunks.back().memory);
+        _chunks.pop_back();
+    }
+    
+    _current = chunk;
+    _offset = offset;
+    _last = NULL;
+}
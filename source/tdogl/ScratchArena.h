@@ -0,0 +1,108 @@
+/*
+ tdogl::ScratchArena
+ 
+ Copyright 2012 Thomas Dalling - http://tomdalling.com/
+ 
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+ 
+ http://www.apache.org/licenses/LICENSE-2.0
+ 
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#pragma once
+
+#include "Allocator.h"
+#include <vector>
+
+namespace tdogl {
+    
+    /**
+     A bump allocator for short-lived temporaries, like the tables and buffers
+     an image decoder needs while it runs.
+     
+     Allocating just moves a pointer forward through a chunk of memory, and
+     freeing the most recent block moves it back. Other blocks are only freed
+     when a Scope that was opened before them ends, all at once. After the
+     outermost scope ends, only the first chunk is kept for the next time, so
+     a big decode doesn't leave the memory it used behind.
+     
+     Not thread safe: use one arena per thread, e.g. ScratchArena::threadLocal.
+     */
+    class ScratchArena : public Allocator {
+    public:
+        /**
+         Frees every block that was allocated from the arena while the scope
+         was open, when the scope ends.
+         */
+        class Scope {
+        public:
+            explicit Scope(ScratchArena& arena);
+            ~Scope();
+            
+        private:
+            ScratchArena& _arena;
+            size_t _chunk;
+            size_t _offset;
+            
+            //copying disabled
+            Scope(const Scope&) = delete;
+            Scope& operator = (const Scope&) = delete;
+        };
+        
+        /**
+         @param chunkSize  The size of each chunk of memory that blocks are
+                           carved from. Blocks bigger than this get a chunk of
+                           their own.
+         */
+        explicit ScratchArena(size_t chunkSize = 1024 * 1024);
+        ~ScratchArena();
+        
+        /**
+         The calling thread's arena.
+         */
+        static ScratchArena& threadLocal();
+        
+        void* allocate(size_t size);
+        void* reallocate(void* block, size_t newSize);
+        void deallocate(void* block);
+        
+        /**
+         True if the block was allocated from this arena.
+         */
+        bool owns(const void* block) const;
+        
+        /**
+         The size that the block was allocated or last reallocated with.
+         */
+        size_t blockSize(const void* block) const;
+        
+        /** bytes allocated from the arena and not yet freed, including headers */
+        size_t bytesInUse() const;
+        
+    private:
+        struct Chunk {
+            unsigned char* memory;
+            size_t size;
+        };
+        
+        std::vector<Chunk> _chunks;
+        size_t _current; //index of the chunk being allocated from
+        size_t _offset; //bytes used in the current chunk
+        size_t _chunkSize;
+        unsigned char* _last; //the most recent block, which can grow or shrink in place
+        
+        void _rewind(size_t chunk, size_t offset);
+        
+        //copying disabled
+        ScratchArena(const ScratchArena&) = delete;
+        ScratchArena& operator = (const ScratchArena&) = delete;
+    };
+    
+}
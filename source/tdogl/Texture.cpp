@@ -17,7 +17,9 @@
  */
 
 #include "Texture.h"
+#include "HalfFloat.h"
 #include <stdexcept>
+#include <vector>
 
 using namespace tdogl;
 
@@ -32,9 +34,152 @@ static GLenum TextureFormatForBitmapFormat(Bitmap::Format format, bool srgb)
     }
 }
 
+// internal formats for channel types other than UInt8, which are all linear
+static GLenum TextureFormatForChannelType(Bitmap::Format format, Bitmap::ChannelType channelType)
+{
+    bool isFloat = (channelType != Bitmap::ChannelType_UInt16);
+    switch (format) {
+        case Bitmap::Format_Grayscale: return (isFloat ? GL_LUMINANCE16F_ARB : GL_LUMINANCE16);
+        case Bitmap::Format_GrayscaleAlpha: return (isFloat ? GL_LUMINANCE_ALPHA16F_ARB : GL_LUMINANCE16_ALPHA16);
+        case Bitmap::Format_RGB: return (isFloat ? GL_RGB16F : GL_RGB16);
+        case Bitmap::Format_RGBA: return (isFloat ? GL_RGBA16F : GL_RGBA16);
+        default: throw std::runtime_error("Unrecognised Bitmap::Format");
+    }
+}
+
+static GLenum PixelTypeForChannelType(Bitmap::ChannelType channelType)
+{
+    switch (channelType) {
+        case Bitmap::ChannelType_UInt8: return GL_UNSIGNED_BYTE;
+        case Bitmap::ChannelType_UInt16: return GL_UNSIGNED_SHORT;
+        case Bitmap::ChannelType_Half: return GL_HALF_FLOAT;
+        case Bitmap::ChannelType_Float: return GL_FLOAT;
+        default: throw std::runtime_error("Unrecognised Bitmap::ChannelType");
+    }
+}
+
 Texture::Texture(const Bitmap& bitmap, GLint minMagFiler, GLint wrapMode) :
-    _originalWidth((GLfloat)bitmap.width()),
-    _originalHeight((GLfloat)bitmap.height())
+    Texture(BitmapView(bitmap), minMagFiler, wrapMode)
+{
+}
+
+static GLenum TextureFormatForCompressedFormat(CompressedBitmap::Format format)
+{
+    switch (format) {
+        case CompressedBitmap::Format_BC1: return GL_COMPRESSED_SRGB_S3TC_DXT1_EXT;
+        case CompressedBitmap::Format_BC3: return GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT;
+        case CompressedBitmap::Format_BC4: return GL_COMPRESSED_RED_RGTC1;
+        case CompressedBitmap::Format_BC5: return GL_COMPRESSED_RG_RGTC2;
+        default: throw std::runtime_error("Unrecognised CompressedBitmap::Format");
+    }
+}
+
+// makes BC4 and BC5 in the bound GL_TEXTURE_2D sample as gray, and gray with
+// alpha, instead of red, and red and green. See CompressedBitmap::textureSwizzle.
+static void SwizzleCompressedTexture(CompressedBitmap::Format format) {
+    CompressedBitmap::Swizzle swizzle[4];
+    CompressedBitmap::textureSwizzle(format, swizzle);
+    
+    static const GLint Sources[] = { GL_RED, GL_GREEN, GL_BLUE, GL_ALPHA, GL_ONE };
+    GLint glSwizzle[4];
+    bool identity = true;
+    for(int c = 0; c < 4; ++c){
+        glSwizzle[c] = Sources[swizzle[c]];
+        identity = identity && (swizzle[c] == (CompressedBitmap::Swizzle)c);
+    }
+    if(identity)
+        return;
+    
+    if(!GLEW_VERSION_3_3 && !GLEW_ARB_texture_swizzle)
+        throw std::runtime_error("BC4 and BC5 textures need OpenGL 3.3 or ARB_texture_swizzle");
+    glTexParameteriv(GL_TEXTURE_2D, GL_TEXTURE_SWIZZLE_RGBA, glSwizzle);
+}
+
+// defines the given level of the bound GL_TEXTURE_2D without uploading any pixels
+static void DefineLevel(GLint level, unsigned width, unsigned height, Bitmap::Format format, Bitmap::ChannelType channelType) {
+    GLenum internalFormat = (channelType == Bitmap::ChannelType_UInt8 ?
+                             TextureFormatForBitmapFormat(format, true) :
+                             TextureFormatForChannelType(format, channelType));
+    //floats are uploaded as half floats, see UploadRows
+    GLenum pixelType = PixelTypeForChannelType(channelType == Bitmap::ChannelType_Float ? Bitmap::ChannelType_Half : channelType);
+    glTexImage2D(GL_TEXTURE_2D,
+                 level,
+                 internalFormat,
+                 (GLsizei)width,
+                 (GLsizei)height,
+                 0,
+                 TextureFormatForBitmapFormat(format, false),
+                 pixelType,
+                 NULL);
+}
+
+// Uploads the pixels of the view to the given level of the bound GL_TEXTURE_2D, with
+// the top row of the view at `destRow`. If `define` is true, the level is (re)defined
+// to be the size of the view, otherwise the level must already be defined.
+static void UploadRows(GLint level, GLint destRow, const BitmapView& view, bool define) {
+    if(view.channelType() == Bitmap::ChannelType_Float){
+        //float textures are stored as half floats, so halve them here, rather
+        //than sending twice the bytes for the driver to convert
+        size_t rowChannels = (size_t)view.width() * view.format();
+        std::vector<unsigned short> halves(rowChannels * view.height());
+        for(unsigned row = 0; row < view.height(); ++row)
+            FloatToHalf((const float*)view.row(row), &halves[row * rowChannels], rowChannels);
+        
+        UploadRows(level, destRow, BitmapView((unsigned char*)&halves[0], view.width(), view.height(), view.format(),
+                                              (ptrdiff_t)(rowChannels * sizeof(unsigned short)), Bitmap::ChannelType_Half), define);
+        return;
+    }
+    
+    GLenum internalFormat = (view.channelType() == Bitmap::ChannelType_UInt8 ?
+                             TextureFormatForBitmapFormat(view.format(), true) :
+                             TextureFormatForChannelType(view.format(), view.channelType()));
+    GLenum pixelFormat = TextureFormatForBitmapFormat(view.format(), false);
+    GLenum pixelType = PixelTypeForChannelType(view.channelType());
+    ptrdiff_t pixelSize = view.bytesPerPixel();
+    
+    //bitmap rows are padded to RowAlignment, but tightly packed views (e.g. RGB
+    //pixels from stb_image with odd widths) may only be byte aligned
+    ptrdiff_t stride = view.rowStride() < 0 ? -view.rowStride() : view.rowStride();
+    GLint alignment = (stride % 8 == 0) ? 8 : (stride % 4 == 0) ? 4 : (stride % 2 == 0) ? 2 : 1;
+    glPixelStorei(GL_UNPACK_ALIGNMENT, alignment);
+    
+    if(view.rowStride() > 0 && view.rowStride() % pixelSize == 0){
+        glPixelStorei(GL_UNPACK_ROW_LENGTH, (GLint)(view.rowStride() / pixelSize));
+        if(define){
+            glTexImage2D(GL_TEXTURE_2D,
+                         level, 
+                         internalFormat,
+                         (GLsizei)view.width(), 
+                         (GLsizei)view.height(),
+                         0, 
+                         pixelFormat,
+                         pixelType, 
+                         view.origin());
+        } else {
+            glTexSubImage2D(GL_TEXTURE_2D, level, 0, destRow, (GLsizei)view.width(), (GLsizei)view.height(),
+                            pixelFormat, pixelType, view.origin());
+        }
+        glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+    } else {
+        if(define)
+            DefineLevel(level, view.width(), view.height(), view.format(), view.channelType());
+        for(unsigned row = 0; row < view.height(); ++row){
+            glTexSubImage2D(GL_TEXTURE_2D, level, 0, destRow + (GLint)row, (GLsizei)view.width(), 1,
+                            pixelFormat, pixelType, view.row(row));
+        }
+    }
+    
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+}
+
+// uploads the pixels of the view to the given level of the bound GL_TEXTURE_2D
+static void UploadLevel(GLint level, const BitmapView& view) {
+    UploadRows(level, 0, view, true);
+}
+
+Texture::Texture(const BitmapView& view, GLint minMagFiler, GLint wrapMode) :
+    _originalWidth((GLfloat)view.width()),
+    _originalHeight((GLfloat)view.height())
 {
     glGenTextures(1, &_object);
     glBindTexture(GL_TEXTURE_2D, _object);
@@ -42,15 +187,103 @@ Texture::Texture(const Bitmap& bitmap, GLint minMagFiler, GLint wrapMode) :
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, minMagFiler);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, wrapMode);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, wrapMode);
-    glTexImage2D(GL_TEXTURE_2D,
-                 0, 
-                 TextureFormatForBitmapFormat(bitmap.format(), true),
-                 (GLsizei)bitmap.width(), 
-                 (GLsizei)bitmap.height(),
-                 0, 
-                 TextureFormatForBitmapFormat(bitmap.format(), false),
-                 GL_UNSIGNED_BYTE, 
-                 bitmap.pixelBuffer());
+    UploadLevel(0, view);
+    glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+Texture::Texture(const MipChain& mips, GLint wrapMode) :
+    _originalWidth((GLfloat)mips.level(0).width()),
+    _originalHeight((GLfloat)mips.level(0).height())
+{
+    glGenTextures(1, &_object);
+    glBindTexture(GL_TEXTURE_2D, _object);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, wrapMode);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, wrapMode);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, 0);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, (GLint)mips.levelCount() - 1);
+    for(unsigned level = 0; level < mips.levelCount(); ++level)
+        UploadLevel((GLint)level, mips.level(level));
+    glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+Texture::Texture(const CompressedBitmap& image, GLint minMagFiler, GLint wrapMode) :
+    _originalWidth((GLfloat)image.width()),
+    _originalHeight((GLfloat)image.height())
+{
+    glGenTextures(1, &_object);
+    glBindTexture(GL_TEXTURE_2D, _object);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, minMagFiler);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, minMagFiler);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, wrapMode);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, wrapMode);
+    glCompressedTexImage2D(GL_TEXTURE_2D,
+                           0,
+                           TextureFormatForCompressedFormat(image.format()),
+                           (GLsizei)image.width(),
+                           (GLsizei)image.height(),
+                           0,
+                           (GLsizei)image.size(),
+                           image.blocks());
+    SwizzleCompressedTexture(image.format());
+    glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+Texture::Texture(const PackedBitmap& image, GLint minMagFiler, GLint wrapMode) :
+    _originalWidth((GLfloat)image.width()),
+    _originalHeight((GLfloat)image.height())
+{
+    glGenTextures(1, &_object);
+    glBindTexture(GL_TEXTURE_2D, _object);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, minMagFiler);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, minMagFiler);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, wrapMode);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, wrapMode);
+    DefineLevel(0, image.width(), image.height(), image.format(), image.channelType());
+    
+    //one block's worth of pixels at a time, so the whole image is never unpacked
+    size_t rowSize = (size_t)image.width() * image.bytesPerPixel();
+    std::vector<unsigned char> pixels(rowSize * image.rowsPerBlock());
+    for(unsigned block = 0; block < image.blockCount(); ++block){
+        BitmapView view(&pixels[0], image.width(), image.blockRowCount(block), image.format(), (ptrdiff_t)rowSize, image.channelType());
+        image.decompressBlock(block, view);
+        UploadRows(0, (GLint)image.blockFirstRow(block), view, false);
+    }
+    glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+Texture::Texture(const CachedImage& image, GLint wrapMode) :
+    _originalWidth((GLfloat)image.levelWidth(0)),
+    _originalHeight((GLfloat)image.levelHeight(0))
+{
+    bool mipmapped = (image.levelCount() > 1);
+    
+    glGenTextures(1, &_object);
+    glBindTexture(GL_TEXTURE_2D, _object);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, mipmapped ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, wrapMode);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, wrapMode);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, 0);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, (GLint)image.levelCount() - 1);
+    
+    for(unsigned level = 0; level < image.levelCount(); ++level){
+        if(image.isCompressed()){
+            glCompressedTexImage2D(GL_TEXTURE_2D,
+                                   (GLint)level,
+                                   TextureFormatForCompressedFormat(image.compressedFormat()),
+                                   (GLsizei)image.levelWidth(level),
+                                   (GLsizei)image.levelHeight(level),
+                                   0,
+                                   (GLsizei)image.levelSize(level),
+                                   image.levelData(level));
+        } else {
+            UploadLevel((GLint)level, image.level(level));
+        }
+    }
+    if(image.isCompressed())
+        SwizzleCompressedTexture(image.compressedFormat());
     glBindTexture(GL_TEXTURE_2D, 0);
 }
 
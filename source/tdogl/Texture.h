@@ -20,6 +20,11 @@
 
 #include <GL/glew.h>
 #include "Bitmap.h"
+#include "BitmapView.h"
+#include "MipChain.h"
+#include "CompressedBitmap.h"
+#include "CachedImage.h"
+#include "PackedBitmap.h"
 
 namespace tdogl {
     
@@ -35,6 +40,12 @@ namespace tdogl {
          is ordered from the top row down, but OpenGL expects the data to
          be from the bottom row up.
          
+         Bitmaps with 8-bit RGB or RGBA channels are uploaded as sRGB. The other
+         channel types are linear: UInt16 bitmaps become 16-bit normalized
+         textures (e.g. GL_RGBA16), and Half and Float bitmaps become half float
+         textures (e.g. GL_RGBA16F). Float pixels are converted to half floats
+         before uploading, so they take half the memory and upload bandwidth.
+         
          @param bitmap  The bitmap to load the texture from
          @param minMagFiler  GL_NEAREST or GL_LINEAR
          @param wrapMode GL_REPEAT, GL_MIRRORED_REPEAT, GL_CLAMP_TO_EDGE, or GL_CLAMP_TO_BORDER
@@ -43,6 +54,84 @@ namespace tdogl {
                 GLint minMagFiler = GL_LINEAR,
                 GLint wrapMode = GL_CLAMP_TO_EDGE);
         
+        /**
+         Creates a texture from a view of a bitmap, without copying the pixels
+         first.
+         
+         Views with a positive row stride are uploaded in one go using 
+         GL_UNPACK_ROW_LENGTH. OpenGL can't read rows backwards, so views with a
+         negative row stride (e.g. from BitmapView::flippedVertically) are
+         uploaded one row at a time.
+         
+         @param view  The pixels to load the texture from. Row 0 of the view
+                      becomes row 0 of the texture (the bottom, in OpenGL terms).
+         @param minMagFiler  GL_NEAREST or GL_LINEAR
+         @param wrapMode GL_REPEAT, GL_MIRRORED_REPEAT, GL_CLAMP_TO_EDGE, or GL_CLAMP_TO_BORDER
+         */
+        Texture(const BitmapView& view,
+                GLint minMagFiler = GL_LINEAR,
+                GLint wrapMode = GL_CLAMP_TO_EDGE);
+        
+        /**
+         Creates a mipmapped texture, uploading every level of the chain.
+         
+         Uses trilinear filtering (GL_LINEAR_MIPMAP_LINEAR) for minification
+         and GL_LINEAR for magnification. Row 0 of each level becomes row 0 of
+         the texture, as with the BitmapView constructor.
+         
+         @param mips  The levels to upload, e.g. from Bitmap::generateMipChain
+         @param wrapMode GL_REPEAT, GL_MIRRORED_REPEAT, GL_CLAMP_TO_EDGE, or GL_CLAMP_TO_BORDER
+         */
+        Texture(const MipChain& mips,
+                GLint wrapMode = GL_CLAMP_TO_EDGE);
+        
+        /**
+         Creates a texture from precompressed blocks, with glCompressedTexImage2D.
+         
+         BC1 and BC3 are uploaded as sRGB (needs EXT_texture_sRGB and
+         EXT_texture_compression_s3tc). BC4 and BC5 are uploaded as red and
+         red-green RGTC textures, swizzled to sample as gray and gray with alpha
+         like Grayscale and GrayscaleAlpha bitmaps (needs OpenGL 3.3 or
+         ARB_texture_swizzle). See CompressedBitmap::textureSwizzle. Like the
+         Bitmap constructor, the texture will be upside down unless the image
+         was compressed from a flipped view.
+         
+         @param image  The compressed image to upload
+         @param minMagFiler  GL_NEAREST or GL_LINEAR
+         @param wrapMode GL_REPEAT, GL_MIRRORED_REPEAT, GL_CLAMP_TO_EDGE, or GL_CLAMP_TO_BORDER
+         */
+        Texture(const CompressedBitmap& image,
+                GLint minMagFiler = GL_LINEAR,
+                GLint wrapMode = GL_CLAMP_TO_EDGE);
+        
+        /**
+         Creates a texture from a packed bitmap, decompressing and uploading
+         one block of rows at a time, so the whole image is never unpacked in
+         memory. Formats are as in the Bitmap constructor, and so is the
+         orientation.
+         
+         @param image  The packed image to upload
+         @param minMagFiler  GL_NEAREST or GL_LINEAR
+         @param wrapMode GL_REPEAT, GL_MIRRORED_REPEAT, GL_CLAMP_TO_EDGE, or GL_CLAMP_TO_BORDER
+         */
+        Texture(const PackedBitmap& image,
+                GLint minMagFiler = GL_LINEAR,
+                GLint wrapMode = GL_CLAMP_TO_EDGE);
+        
+        /**
+         Creates a texture from a cache file, uploading every level straight
+         from the memory mapping, compressed or not.
+         
+         Cached levels are already bottom row first, so the texture is the
+         right way up. Images with more than one level use trilinear filtering,
+         like the MipChain constructor, and single level images use GL_LINEAR.
+         
+         @param image  The cached image, e.g. from TextureCache::load
+         @param wrapMode GL_REPEAT, GL_MIRRORED_REPEAT, GL_CLAMP_TO_EDGE, or GL_CLAMP_TO_BORDER
+         */
+        Texture(const CachedImage& image,
+                GLint wrapMode = GL_CLAMP_TO_EDGE);
+        
         /**
          Deletes the texture object with glDeleteTextures
          */
@@ -0,0 +1,262 @@
+/*
+ tdogl::TextureAtlas
+ 
+ Copyright 2012 Thomas Dalling - http://tomdalling.com/
+ 
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+ 
+ http://www.apache.org/licenses/LICENSE-2.0
+ 
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#include "TextureAtlas.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+
+using namespace tdogl;
+
+/*
+ Skyline bottom-left packer
+
+ The skyline is the top edge of everything packed so far, stored as a list of
+ horizontal segments from left to right. Coordinates grow downwards, so "lowest"
+ means smallest y. Each rectangle goes where its bottom edge ends up highest
+ (smallest y + height). Ties go to the narrowest skyline segment under the
+ rectangle's left edge, which leaves fewer thin gaps, and then to the left-most.
+ */
+
+namespace {
+    struct SkylineSegment {
+        unsigned x, y, width;
+    };
+    
+    struct PackRect {
+        size_t index;
+        unsigned width, height;
+        unsigned x, y;
+    };
+    
+    class SkylinePacker {
+    public:
+        SkylinePacker(unsigned width, unsigned maxHeight) :
+            _width(width),
+            _maxHeight(maxHeight),
+            _usedHeight(0)
+        {
+            SkylineSegment all = { 0, 0, width };
+            _skyline.push_back(all);
+        }
+        
+        bool insert(unsigned width, unsigned height, unsigned& outX, unsigned& outY) {
+            size_t bestSegment = 0;
+            unsigned bestBottom = ~0u, bestWidth = ~0u, bestY = 0;
+            for(size_t i = 0; i < _skyline.size(); ++i){
+                unsigned y;
+                if(!_fits(i, width, height, y))
+                    continue;
+                unsigned bottom = y + height;
+                if(bottom < bestBottom || (bottom == bestBottom && _skyline[i].width < bestWidth)){
+                    bestSegment = i;
+                    bestBottom = bottom;
+                    bestWidth = _skyline[i].width;
+                    bestY = y;
+                }
+            }
+            if(bestBottom == ~0u)
+                return false;
+            
+            outX = _skyline[bestSegment].x;
+            outY = bestY;
+            _add(bestSegment, outX, bestY + height, width);
+            _usedHeight = std::max(_usedHeight, bestY + height);
+            return true;
+        }
+        
+        unsigned usedHeight() const {
+            return _usedHeight;
+        }
+        
+    private:
+        unsigned _width;
+        unsigned _maxHeight;
+        unsigned _usedHeight;
+        std::vector<SkylineSegment> _skyline;
+        
+        // can a rect with its left edge at segment i sit on the skyline?
+        bool _fits(size_t i, unsigned width, unsigned height, unsigned& outY) const {
+            unsigned x = _skyline[i].x;
+            if(x + width > _width)
+                return false;
+            
+            unsigned y = 0;
+            unsigned widthLeft = width;
+            while(widthLeft > 0){
+                y = std::max(y, _skyline[i].y);
+                if(y + height > _maxHeight)
+                    return false;
+                widthLeft -= std::min(widthLeft, _skyline[i].width);
+                ++i;
+            }
+            outY = y;
+            return true;
+        }
+        
+        void _add(size_t i, unsigned x, unsigned y, unsigned width) {
+            SkylineSegment added = { x, y, width };
+            _skyline.insert(_skyline.begin() + i, added);
+            
+            // trim or remove the segments now underneath the new one
+            size_t next = i + 1;
+            while(next < _skyline.size()){
+                SkylineSegment& s = _skyline[next];
+                unsigned addedEnd = x + width;
+                if(s.x >= addedEnd)
+                    break;
+                unsigned segmentEnd = s.x + s.width;
+                if(segmentEnd <= addedEnd){
+                    _skyline.erase(_skyline.begin() + next);
+                } else {
+                    s.width = segmentEnd - addedEnd;
+                    s.x = addedEnd;
+                    break;
+                }
+            }
+            
+            // merge neighbours at the same height
+            for(size_t j = 0; j + 1 < _skyline.size(); ){
+                if(_skyline[j].y == _skyline[j + 1].y){
+                    _skyline[j].width += _skyline[j + 1].width;
+                    _skyline.erase(_skyline.begin() + j + 1);
+                } else {
+                    ++j;
+                }
+            }
+        }
+    };
+}
+
+static bool TallestFirst(const PackRect& a, const PackRect& b) {
+    if(a.height != b.height) return a.height > b.height;
+    if(a.width != b.width) return a.width > b.width;
+    return a.index < b.index;
+}
+
+static unsigned NextPowerOfTwo(unsigned value) {
+    unsigned result = 1;
+    while(result < value)
+        result <<= 1;
+    return result;
+}
+
+// packs the rects at the given atlas width, returning the height used, or 0 if they don't fit
+static unsigned PackAtWidth(std::vector<PackRect>& rects, unsigned width, unsigned maxHeight) {
+    SkylinePacker packer(width, maxHeight);
+    for(size_t i = 0; i < rects.size(); ++i){
+        if(!packer.insert(rects[i].width, rects[i].height, rects[i].x, rects[i].y))
+            return 0;
+    }
+    return packer.usedHeight();
+}
+
+// fills the padding around a blitted image by repeating its edge pixels
+static void BleedGutter(Bitmap& atlas, unsigned x, unsigned y, unsigned width, unsigned height, unsigned padding) {
+    unsigned pixelSize = atlas.format();
+    for(unsigned row = y; row < y + height; ++row){
+        unsigned char* r = atlas.row(row);
+        for(unsigned p = 1; p <= padding; ++p){
+            memcpy(r + (size_t)(x - p) * pixelSize, r + (size_t)x * pixelSize, pixelSize);
+            memcpy(r + (size_t)(x + width - 1 + p) * pixelSize, r + (size_t)(x + width - 1) * pixelSize, pixelSize);
+        }
+    }
+    
+    size_t paddedRowSize = (size_t)(width + 2*padding) * pixelSize;
+    size_t rowStart = (size_t)(x - padding) * pixelSize;
+    for(unsigned p = 1; p <= padding; ++p){
+        memcpy(atlas.row(y - p) + rowStart, atlas.row(y) + rowStart, paddedRowSize);
+        memcpy(atlas.row(y + height - 1 + p) + rowStart, atlas.row(y + height - 1) + rowStart, paddedRowSize);
+    }
+}
+
+TextureAtlas::TextureAtlas(const std::vector<BitmapView>& sources,
+                           Bitmap::Format format,
+                           unsigned padding,
+                           unsigned maxSize) :
+    _bitmap(1, 1, format)
+{
+    if(sources.empty())
+        throw std::runtime_error("No images to put in the atlas");
+    
+    std::vector<PackRect> rects(sources.size());
+    double totalArea = 0;
+    unsigned widest = 0;
+    for(size_t i = 0; i < sources.size(); ++i){
+        PackRect& r = rects[i];
+        r.index = i;
+        r.width = sources[i].width() + 2*padding;
+        r.height = sources[i].height() + 2*padding;
+        if(r.width > maxSize || r.height > maxSize)
+            throw std::runtime_error("Image is too big to fit in the atlas");
+        totalArea += (double)r.width * r.height;
+        widest = std::max(widest, r.width);
+    }
+    std::sort(rects.begin(), rects.end(), TallestFirst);
+    
+    // start with a square-ish power-of-two width, and widen until everything fits
+    unsigned width = std::max(NextPowerOfTwo(widest), NextPowerOfTwo((unsigned)std::ceil(std::sqrt(totalArea))));
+    width = std::min(width, maxSize);
+    unsigned height = 0;
+    for(;;){
+        height = PackAtWidth(rects, width, maxSize);
+        if(height > 0)
+            break;
+        if(width >= maxSize)
+            throw std::runtime_error("Images don't fit within the maximum atlas size");
+        width = std::min(width * 2, maxSize);
+    }
+    
+    _bitmap = Bitmap(width, height, format);
+    memset(_bitmap.pixelBuffer(), 0, _bitmap.rowPitch() * height);
+    
+    _regions.resize(sources.size());
+    for(size_t i = 0; i < rects.size(); ++i){
+        const PackRect& r = rects[i];
+        const BitmapView& src = sources[r.index];
+        Region& region = _regions[r.index];
+        region.x = r.x + padding;
+        region.y = r.y + padding;
+        region.width = src.width();
+        region.height = src.height();
+        
+        // v = 0 is the bottom of both the image and the atlas, once flipped for OpenGL
+        region.uvScaleU = (float)region.width / width;
+        region.uvScaleV = (float)region.height / height;
+        region.uvOffsetU = (float)region.x / width;
+        region.uvOffsetV = (float)(height - region.y - region.height) / height;
+        
+        _bitmap.copyFromView(src, region.x, region.y);
+        BleedGutter(_bitmap, region.x, region.y, region.width, region.height, padding);
+    }
+}
+
+const Bitmap& TextureAtlas::bitmap() const {
+    return _bitmap;
+}
+
+size_t TextureAtlas::regionCount() const {
+    return _regions.size();
+}
+
+const TextureAtlas::Region& TextureAtlas::region(size_t index) const {
+    if(index >= _regions.size())
+        throw std::runtime_error("Atlas region index out of range");
+    return _regions[index];
+}
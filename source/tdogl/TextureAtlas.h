@@ -0,0 +1,95 @@
+/*
+ tdogl::TextureAtlas
+ 
+ Copyright 2012 Thomas Dalling - http://tomdalling.com/
+ 
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+ 
+ http://www.apache.org/licenses/LICENSE-2.0
+ 
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#pragma once
+
+#include "Bitmap.h"
+#include "BitmapView.h"
+#include <vector>
+
+namespace tdogl {
+    
+    /**
+     Packs many small images into one large bitmap, so they can share a single
+     texture (and a single bind).
+     
+     Images are packed with a skyline bottom-left packer, tallest first. Each
+     image is surrounded by `padding` pixels that are filled by repeating its
+     edge pixels ("gutter bleeding"), so linear filtering and mipmapping near
+     the edges of an image don't pick up colors from its neighbours.
+     
+     Like any other bitmap, the atlas is meant to be flipped vertically when it
+     becomes a texture (see TextureCache::_rebuild). The UV transforms assume
+     that, i.e. that v = 0 is the bottom row of each image.
+     */
+    class TextureAtlas {
+    public:
+        /**
+         Where a source image ended up in the atlas.
+         */
+        struct Region {
+            /** position of the top left pixel of the image in the atlas, excluding padding */
+            unsigned x, y;
+            
+            /** size of the image in pixels */
+            unsigned width, height;
+            
+            /**
+             Maps UV coordinates of the source image to UV coordinates of the
+             atlas: atlasUV = sourceUV * uvScale + uvOffset
+             */
+            float uvScaleU, uvScaleV;
+            float uvOffsetU, uvOffsetV;
+        };
+        
+        /**
+         Packs the given images into a new atlas.
+         
+         @param sources  The images to pack. They are copied, so they don't need
+                         to stay alive after the atlas is made. Bitmaps can be
+                         passed directly.
+         @param format   The pixel format of the atlas. Sources in other
+                         formats are converted.
+         @param padding  Pixels of bled edge color around each image
+         @param maxSize  Maximum width and height of the atlas
+         
+         @throws std::exception if the sources don't fit within maxSize x maxSize
+         */
+        TextureAtlas(const std::vector<BitmapView>& sources,
+                     Bitmap::Format format,
+                     unsigned padding = 2,
+                     unsigned maxSize = 4096);
+        
+        /** the atlas image */
+        const Bitmap& bitmap() const;
+        
+        /** the number of source images */
+        size_t regionCount() const;
+        
+        /**
+         Where the source image at the given index (in the order they were
+         passed to the constructor) was placed.
+         */
+        const Region& region(size_t index) const;
+        
+    private:
+        Bitmap _bitmap;
+        std::vector<Region> _regions;
+    };
+    
+}
@@ -0,0 +1,170 @@
+/*
+ tdogl::TextureCache
+ 
+ Copyright 2012 Thomas Dalling - http://tomdalling.com/
+ 
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+ 
+ http://www.apache.org/licenses/LICENSE-2.0
+ 
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#include "TextureCache.h"
+#include "ContentHasher.h"
+#include <stdexcept>
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <sys/stat.h>
+
+using namespace tdogl;
+
+/*
+ The version of the code that turns image files into cache file levels:
+ decoding, resizing, mip filtering and compression. Bump it whenever any of
+ them changes the pixels they make, so that stale cache files are rebuilt
+ instead of being served forever.
+ 
+   1: before cache files recorded it
+   2: resizing and mip filtering premultiply alpha
+ */
+static const uint32_t PipelineVersion = 2;
+
+// BC4 and BC5 decode to red and green on the GPU, but Texture swizzles them
+// back to gray and alpha, so they sample like uncompressed gray levels
+static CompressedBitmap::Format CompressedFormatForBitmapFormat(Bitmap::Format format) {
+    switch(format){
+        case Bitmap::Format_Grayscale: return CompressedBitmap::Format_BC4;
+        case Bitmap::Format_GrayscaleAlpha: return CompressedBitmap::Format_BC5;
+        case Bitmap::Format_RGB: return CompressedBitmap::Format_BC1;
+        case Bitmap::Format_RGBA: return CompressedBitmap::Format_BC3;
+        default: throw std::runtime_error("Unrecognised Bitmap::Format");
+    }
+}
+
+static const char* QualityName(CompressedBitmap::Quality quality) {
+    switch(quality){
+        case CompressedBitmap::Quality_Fast: return "fast";
+        case CompressedBitmap::Quality_Normal: return "normal";
+        case CompressedBitmap::Quality_High: return "high";
+        default: throw std::runtime_error("Unrecognised CompressedBitmap::Quality");
+    }
+}
+
+static Bitmap DecodeSource(const std::string& sourcePath, const MappedFile& source, unsigned maxSize) {
+    try {
+        // big JPEGs can be decoded straight to a smaller size, as long as that
+        // still leaves the resize at least maxSize pixels to filter down from
+        unsigned scaleShift = (maxSize != 0) ? Bitmap::jpegScaleShift(source.data(), source.size(), maxSize) : 0;
+        if(scaleShift != 0)
+            return Bitmap::bitmapFromMemoryScaled(source.data(), source.size(), scaleShift);
+        return Bitmap::bitmapFromMemory(source.data(), source.size());
+    } catch(const std::exception& e) {
+        throw std::runtime_error(sourcePath + ": " + e.what());
+    }
+}
+
+TextureCache::TextureCache(const std::string& directory, bool compress, CompressedBitmap::Quality quality) :
+    _directory(directory),
+    _compress(compress),
+    _quality(quality),
+    _duplicateCount(0)
+{
+    if(mkdir(directory.c_str(), 0755) != 0 && errno != EEXIST)
+        throw std::runtime_error("Failed to create texture cache directory '" + directory + "': " + strerror(errno));
+}
+
+std::string TextureCache::cachePath(const SourceKey& key) const {
+    char contentName[64];
+    snprintf(contentName, sizeof(contentName), "%016llx-%llu-p%u",
+             (unsigned long long)key.hash, (unsigned long long)key.size, (unsigned)PipelineVersion);
+    
+    std::string sizeSuffix;
+    if(key.maxSize != 0)
+        sizeSuffix = "-max" + std::to_string(key.maxSize);
+    
+    // compressed and uncompressed caches of the same image can live side by side
+    std::string compressionSuffix;
+    if(_compress)
+        compressionSuffix = std::string("-bc-") + QualityName(_quality);
+    
+    return _directory + "/" + contentName + sizeSuffix + compressionSuffix + ".tdcache";
+}
+
+CachedImage TextureCache::load(const std::string& sourcePath, unsigned maxSize) {
+    MappedFile source(sourcePath);
+    uint64_t sourceHash = ContentHasher::hash(source.data(), source.size());
+    
+    SourceKey key;
+    key.hash = sourceHash;
+    key.size = source.size();
+    key.maxSize = maxSize;
+    
+    // an identical image at another path was loaded first, and made the cache file
+    std::map<SourceKey, std::string>::const_iterator first = _firstSourcePaths.find(key);
+    if(first == _firstSourcePaths.end())
+        _firstSourcePaths[key] = sourcePath;
+    else if(first->second != sourcePath)
+        ++_duplicateCount;
+    
+    std::string cacheFilePath = cachePath(key);
+    try {
+        CachedImage cached(cacheFilePath);
+        if(_isCurrent(cached, sourceHash, source.size()))
+            return cached;
+    } catch(const std::exception&) {
+        //missing or corrupt, so fall through and regenerate it
+    }
+    
+    _rebuild(sourcePath, cacheFilePath, source, sourceHash, maxSize);
+    return CachedImage(cacheFilePath);
+}
+
+unsigned TextureCache::duplicateCount() const {
+    return _duplicateCount;
+}
+
+bool TextureCache::_isCurrent(const CachedImage& cached, uint64_t sourceHash, uint64_t sourceSize) const {
+    return cached.sourceHash() == sourceHash &&
+           cached.sourceSize() == sourceSize &&
+           cached.pipelineVersion() == PipelineVersion &&
+           cached.isCompressed() == _compress &&
+           (!_compress || cached.compressionQuality() == _quality);
+}
+
+void TextureCache::_rebuild(const std::string& sourcePath,
+                            const std::string& cacheFilePath,
+                            const MappedFile& source,
+                            uint64_t sourceHash,
+                            unsigned maxSize)
+{
+    Bitmap bitmap = DecodeSource(sourcePath, source, maxSize);
+    if(maxSize != 0 && (bitmap.width() > maxSize || bitmap.height() > maxSize)){
+        double scale = (double)maxSize / std::max(bitmap.width(), bitmap.height());
+        unsigned width = std::max(1u, (unsigned)(bitmap.width() * scale + 0.5));
+        unsigned height = std::max(1u, (unsigned)(bitmap.height() * scale + 0.5));
+        bitmap.resize(std::min(width, maxSize), std::min(height, maxSize));
+    }
+    
+    // bitmaps are stored top row first, but OpenGL expects the bottom row first
+    MipChain mips(BitmapView(bitmap).flippedVertically());
+    
+    if(_compress){
+        CompressedBitmap::Format format = CompressedFormatForBitmapFormat(mips.format());
+        std::vector<CompressedBitmap> levels;
+        levels.reserve(mips.levelCount());
+        for(unsigned i = 0; i < mips.levelCount(); ++i)
+            levels.push_back(CompressedBitmap(mips.level(i), format, _quality));
+        CachedImage::write(cacheFilePath, levels, _quality, sourceHash, source.size(), PipelineVersion);
+    } else {
+        CachedImage::write(cacheFilePath, mips, sourceHash, source.size(), PipelineVersion);
+    }
+}
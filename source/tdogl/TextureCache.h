@@ -0,0 +1,125 @@
+/*
+ tdogl::TextureCache
+ 
+ Copyright 2012 Thomas Dalling - http://tomdalling.com/
+ 
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+ 
+ http://www.apache.org/licenses/LICENSE-2.0
+ 
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#pragma once
+
+#include "CachedImage.h"
+#include "CompressedBitmap.h"
+#include <map>
+#include <string>
+#include <stdint.h>
+
+namespace tdogl {
+    
+    /**
+     A directory of pre-decoded images, so that images only need to be decoded
+     the first time they are loaded.
+     
+     The first load of an image file decodes it, generates its mipmap chain,
+     optionally block-compresses every level, and writes the result to a
+     tdogl::CachedImage file. Later loads just hash the image file, and if it
+     hasn't changed, map the cache file and use it directly. Editing, replacing
+     or reverting the image file changes its hash, which makes the cache file
+     get regenerated.
+     
+     Cache files are written atomically, so several processes can share a
+     cache directory.
+     
+     Cache files are named after the hash and size of the image file, not its
+     path, so image files with identical contents share a cache file, even if
+     they have different paths. Only the first of them to be loaded is ever
+     decoded, by any process; the rest find the cache file it made.
+     */
+    class TextureCache {
+    public:
+        /**
+         @param directory  Where the cache files go. Created if it doesn't exist
+                           (but its parent must exist).
+         @param compress   True to store block-compressed levels: BC1 for RGB
+                           images, BC3 for RGBA, BC4 for grayscale and BC5 for
+                           grayscale with alpha. Compressed gray images look
+                           the same as uncompressed ones once uploaded (see
+                           CompressedBitmap::textureSwizzle). False to store
+                           raw pixels.
+         @param quality    The compression quality, if compressing
+         */
+        explicit TextureCache(const std::string& directory,
+                              bool compress = false,
+                              CompressedBitmap::Quality quality = CompressedBitmap::Quality_Normal);
+        
+        /**
+         Returns the cached version of an image file, regenerating it first if
+         it's missing, corrupt, stale, or was made with different settings or
+         by an older version of the code.
+         
+         @param maxSize  If not zero, images wider or taller than this are
+                         downscaled with a Lanczos3 filter until they fit,
+                         keeping their aspect ratio. Lets lower quality
+                         settings use less video memory. JPEGs at least twice
+                         this size are decoded at 1/2, 1/4 or 1/8 scale first.
+         
+         @throws std::exception if the image file can't be loaded, or the cache
+                 file can't be written.
+         */
+        CachedImage load(const std::string& sourcePath, unsigned maxSize = 0);
+        
+        /**
+         Identifies what a cache file holds: the ContentHasher hash and size of
+         the image file, and the maximum size it was loaded with. Image files
+         with the same contents get the same key, whatever their paths, so it
+         also works as a key for sharing the textures made from them.
+         */
+        struct SourceKey {
+            uint64_t hash;
+            uint64_t size;
+            unsigned maxSize;
+            
+            bool operator < (const SourceKey& other) const {
+                if(hash != other.hash) return hash < other.hash;
+                if(size != other.size) return size < other.size;
+                return maxSize < other.maxSize;
+            }
+        };
+        
+        /**
+         The path of the cache file for image files with the given contents and
+         maximum size. Each compression setting gets a different cache file,
+         and so does each version of the code that makes the levels.
+         */
+        std::string cachePath(const SourceKey& key) const;
+        
+        /** number of loads of an image that was first loaded from another path, with identical contents */
+        unsigned duplicateCount() const;
+        
+    private:
+        std::string _directory;
+        bool _compress;
+        CompressedBitmap::Quality _quality;
+        std::map<SourceKey, std::string> _firstSourcePaths;
+        unsigned _duplicateCount;
+        
+        bool _isCurrent(const CachedImage& cached, uint64_t sourceHash, uint64_t sourceSize) const;
+        
+        void _rebuild(const std::string& sourcePath,
+                      const std::string& cacheFilePath,
+                      const MappedFile& source,
+                      uint64_t sourceHash,
+                      unsigned maxSize);
+    };
+    
+}
@@ -0,0 +1,152 @@
+/*
+ tdogl::ThreadPool
+ 
+ Copyright 2012 Thomas Dalling - http://tomdalling.com/
+ 
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+ 
+ http://www.apache.org/licenses/LICENSE-2.0
+ 
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#include "ThreadPool.h"
+#include <algorithm>
+#include <atomic>
+#include <exception>
+
+using namespace tdogl;
+
+ThreadPool::ThreadPool(unsigned threadCount) :
+    _stopping(false)
+{
+    if(threadCount == 0)
+        threadCount = std::max(1u, std::thread::hardware_concurrency());
+    
+    _workers.reserve(threadCount);
+    for(unsigned i = 0; i < threadCount; ++i)
+        _workers.push_back(std::thread(&ThreadPool::_workerMain, this));
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stopping = true;
+    }
+    _wakeUp.notify_all();
+    
+    for(size_t i = 0; i < _workers.size(); ++i)
+        _workers[i].join();
+}
+
+ThreadPool& ThreadPool::shared() {
+    static ThreadPool pool;
+    return pool;
+}
+
+namespace {
+    // shared between the caller of parallelFor and its helper tasks, which may
+    // outlive the call if they only get to run after all the chunks are done
+    struct ParallelForState {
+        std::function<void(size_t, size_t)> body;
+        size_t count;
+        size_t chunkSize;
+        size_t chunkCount;
+        std::atomic<size_t> nextChunk;
+        size_t finishedChunks;
+        std::exception_ptr error;
+        std::mutex mutex;
+        std::condition_variable finished;
+        
+        ParallelForState() : nextChunk(0), finishedChunks(0) {}
+        
+        // runs chunks until there are none left
+        void work() {
+            for(;;){
+                size_t chunk = nextChunk++;
+                if(chunk >= chunkCount)
+                    return;
+                
+                std::exception_ptr chunkError;
+                try {
+                    size_t begin = chunk * chunkSize;
+                    body(begin, std::min(begin + chunkSize, count));
+                } catch(...) {
+                    chunkError = std::current_exception();
+                }
+                
+                std::lock_guard<std::mutex> lock(mutex);
+                if(chunkError && !error)
+                    error = chunkError;
+                if(++finishedChunks == chunkCount)
+                    finished.notify_all();
+            }
+        }
+    };
+}
+
+void ThreadPool::parallelFor(size_t count, size_t grainSize, const std::function<void(size_t begin, size_t end)>& body) {
+    if(count == 0)
+        return;
+    
+    //a few chunks per thread, to even out chunks that take longer than others
+    size_t chunkSize = std::max<size_t>(std::max<size_t>(grainSize, 1), count / (threadCount() * 4 + 1) + 1);
+    size_t chunkCount = (count + chunkSize - 1) / chunkSize;
+    if(chunkCount == 1){
+        body(0, count);
+        return;
+    }
+    
+    std::shared_ptr<ParallelForState> state = std::make_shared<ParallelForState>();
+    state->body = body;
+    state->count = count;
+    state->chunkSize = chunkSize;
+    state->chunkCount = chunkCount;
+    
+    size_t helpers = std::min<size_t>(chunkCount - 1, threadCount());
+    for(size_t i = 0; i < helpers; ++i)
+        _push([state]() { state->work(); });
+    
+    state->work();
+    
+    std::unique_lock<std::mutex> lock(state->mutex);
+    state->finished.wait(lock, [&state]{ return state->finishedChunks == state->chunkCount; });
+    if(state->error)
+        std::rethrow_exception(state->error);
+}
+
+unsigned ThreadPool::threadCount() const {
+    return (unsigned)_workers.size();
+}
+
+void ThreadPool::_push(std::function<void()> task) {
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _tasks.push_back(std::move(task));
+    }
+    _wakeUp.notify_one();
+}
+
+void ThreadPool::_workerMain() {
+    for(;;){
+        std::function<void()> task;
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _wakeUp.wait(lock, [this]{ return _stopping || !_tasks.empty(); });
+            
+            //keep going until the queue is drained, even when stopping
+            if(_tasks.empty())
+                return;
+            
+            task = std::move(_tasks.front());
+            _tasks.pop_front();
+        }
+        task();
+    }
+}
@@ -0,0 +1,105 @@
+/*
+ tdogl::ThreadPool
+ 
+ Copyright 2012 Thomas Dalling - http://tomdalling.com/
+ 
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+ 
+ http://www.apache.org/licenses/LICENSE-2.0
+ 
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+namespace tdogl {
+    
+    /**
+     A fixed-size pool of worker threads that run queued tasks in FIFO order.
+     
+     This is not related to OpenGL. Tasks must not make OpenGL calls, because
+     the GL context is only current on the main thread.
+     */
+    class ThreadPool {
+    public:
+        /**
+         Starts the worker threads.
+         
+         @param threadCount  Number of worker threads. Zero means one per
+                             hardware thread.
+         */
+        explicit ThreadPool(unsigned threadCount = 0);
+        
+        /**
+         Finishes all queued tasks, then stops the worker threads.
+         */
+        ~ThreadPool();
+        
+        /**
+         A pool shared by the whole process, with one thread per hardware thread.
+         
+         Created the first time it is used.
+         */
+        static ThreadPool& shared();
+        
+        /** the number of worker threads */
+        unsigned threadCount() const;
+        
+        /**
+         Runs `body(begin, end)` over the range 0 to `count`, split into chunks
+         of at least `grainSize` items, and waits for all chunks to finish.
+         
+         The calling thread works through chunks too, so this is safe to call
+         from inside a task running on the same pool. If any chunk throws, the
+         first exception is rethrown once all chunks have finished.
+         */
+        void parallelFor(size_t count, size_t grainSize, const std::function<void(size_t begin, size_t end)>& body);
+        
+        /**
+         Queues a task to run on one of the worker threads.
+         
+         @result A future for the return value of `task`. If `task` throws, the
+                 exception is rethrown by the future's `get` method.
+         */
+        template <typename Task>
+        std::future<typename std::result_of<Task()>::type> enqueue(Task task) {
+            typedef typename std::result_of<Task()>::type Result;
+            std::shared_ptr< std::packaged_task<Result()> > packaged =
+                std::make_shared< std::packaged_task<Result()> >(std::move(task));
+            std::future<Result> result = packaged->get_future();
+            _push([packaged]() { (*packaged)(); });
+            return result;
+        }
+        
+    private:
+        std::vector<std::thread> _workers;
+        std::deque< std::function<void()> > _tasks;
+        std::mutex _mutex;
+        std::condition_variable _wakeUp;
+        bool _stopping;
+        
+        void _push(std::function<void()> task);
+        void _workerMain();
+        
+        //copying disabled
+        ThreadPool(const ThreadPool&);
+        const ThreadPool& operator=(const ThreadPool&);
+    };
+    
+}
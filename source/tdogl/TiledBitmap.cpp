@@ -0,0 +1,439 @@
+/*
+ tdogl::TiledBitmap
+ 
+ Copyright 2012 Thomas Dalling - http://tomdalling.com/
+ 
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+ 
+ http://www.apache.org/licenses/LICENSE-2.0
+ 
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#include "TiledBitmap.h"
+#include "Allocator.h"
+#include "ThreadPool.h"
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <utility>
+
+using namespace tdogl;
+
+// bitmaps with fewer pixels than this are processed on the calling thread
+static const size_t ParallelPixelThreshold = 256 * 256;
+
+// spreads the bits of `value` out to the even bits of the result
+static uint64_t SpreadBits(uint32_t value) {
+    uint64_t x = value;
+    x = (x | (x << 16)) & 0x0000FFFF0000FFFFull;
+    x = (x | (x << 8)) & 0x00FF00FF00FF00FFull;
+    x = (x | (x << 4)) & 0x0F0F0F0F0F0F0F0Full;
+    x = (x | (x << 2)) & 0x3333333333333333ull;
+    x = (x | (x << 1)) & 0x5555555555555555ull;
+    return x;
+}
+
+// position of a tile along the Z-order curve
+static uint64_t MortonCode(unsigned column, unsigned row) {
+    return SpreadBits(column) | (SpreadBits(row) << 1);
+}
+
+const unsigned TiledBitmap::TileSize;
+
+TiledBitmap::TiledBitmap(unsigned width,
+                         unsigned height,
+                         Bitmap::Format format,
+                         Bitmap::ChannelType channelType) :
+    _width(width),
+    _height(height),
+    _format(format),
+    _channelType(channelType),
+    _pixels(NULL),
+    _allocator(NULL)
+{
+    if(width == 0) throw std::runtime_error("Zero width bitmap");
+    if(height == 0) throw std::runtime_error("Zero height bitmap");
+    if(format <= 0 || format > 4) throw std::runtime_error("Invalid bitmap format");
+    if((unsigned)channelType > Bitmap::ChannelType_Float) throw std::runtime_error("Invalid bitmap channel type");
+    
+    _tileColumns = (unsigned)(((uint64_t)width + TileSize - 1) / TileSize);
+    _tileRows = (unsigned)(((uint64_t)height + TileSize - 1) / TileSize);
+    _tileBytes = (size_t)TileSize * TileSize * bytesPerPixel();
+    //tile counts fit in 64 bits, but the bytes of a huge enough grid don't
+    if((uint64_t)_tileColumns * _tileRows > (size_t)-1 / _tileBytes)
+        throw std::runtime_error("Tiled bitmap is too big for the address space");
+    
+    Allocator& allocator = Bitmap::defaultAllocator();
+    _pixels = (unsigned char*)allocator.allocate((size_t)byteSize());
+    if(!_pixels)
+        throw std::runtime_error("Failed to allocate tiled bitmap pixels");
+    _allocator = &allocator;
+    
+    // sorting the tiles by Morton code gives Z-order for any grid shape, not just powers of two
+    try {
+        size_t count = tileCount();
+        std::vector< std::pair<uint64_t, size_t> > codes(count);
+        for(unsigned row = 0; row < _tileRows; ++row){
+            for(unsigned col = 0; col < _tileColumns; ++col){
+                size_t index = (size_t)row * _tileColumns + col;
+                codes[index] = std::make_pair(MortonCode(col, row), index);
+            }
+        }
+        std::sort(codes.begin(), codes.end());
+        
+        _slots.resize(count);
+        _order.resize(count);
+        for(size_t slot = 0; slot < count; ++slot){
+            _order[slot] = codes[slot].second;
+            _slots[codes[slot].second] = slot;
+        }
+    } catch(...) {
+        _release();
+        throw;
+    }
+}
+
+TiledBitmap::TiledBitmap(const BitmapView& src) :
+    TiledBitmap(src.width(), src.height(), src.format(), src.channelType())
+{
+    copyFromView(src, 0, 0);
+}
+
+TiledBitmap::~TiledBitmap() {
+    _release();
+}
+
+TiledBitmap::TiledBitmap(TiledBitmap&& other) :
+    _width(other._width),
+    _height(other._height),
+    _format(other._format),
+    _channelType(other._channelType),
+    _tileColumns(other._tileColumns),
+    _tileRows(other._tileRows),
+    _tileBytes(other._tileBytes),
+    _slots(std::move(other._slots)),
+    _order(std::move(other._order)),
+    _pixels(other._pixels),
+    _allocator(other._allocator)
+{
+    other._width = other._height = 0;
+    other._tileColumns = other._tileRows = 0;
+    other._slots.clear();
+    other._order.clear();
+    other._pixels = NULL;
+    other._allocator = NULL;
+}
+
+TiledBitmap& TiledBitmap::operator = (TiledBitmap&& other) {
+    if(this != &other){
+        _release();
+        _width = other._width;
+        _height = other._height;
+        _format = other._format;
+        _channelType = other._channelType;
+        _tileColumns = other._tileColumns;
+        _tileRows = other._tileRows;
+        _tileBytes = other._tileBytes;
+        _slots = std::move(other._slots);
+        _order = std::move(other._order);
+        _pixels = other._pixels;
+        _allocator = other._allocator;
+        
+        other._width = other._height = 0;
+        other._tileColumns = other._tileRows = 0;
+        other._slots.clear();
+        other._order.clear();
+        other._pixels = NULL;
+        other._allocator = NULL;
+    }
+    return *this;
+}
+
+unsigned TiledBitmap::width() const {
+    return _width;
+}
+
+unsigned TiledBitmap::height() const {
+    return _height;
+}
+
+Bitmap::Format TiledBitmap::format() const {
+    return _format;
+}
+
+Bitmap::ChannelType TiledBitmap::channelType() const {
+    return _channelType;
+}
+
+unsigned TiledBitmap::bytesPerPixel() const {
+    return _format * Bitmap::channelSize(_channelType);
+}
+
+unsigned TiledBitmap::tileColumns() const {
+    return _tileColumns;
+}
+
+unsigned TiledBitmap::tileRows() const {
+    return _tileRows;
+}
+
+size_t TiledBitmap::tileCount() const {
+    return (size_t)_tileColumns * _tileRows;
+}
+
+uint64_t TiledBitmap::byteSize() const {
+    return (uint64_t)tileCount() * _tileBytes;
+}
+
+BitmapView TiledBitmap::tile(unsigned tileColumn, unsigned tileRow) const {
+    if(tileColumn >= _tileColumns || tileRow >= _tileRows)
+        throw std::runtime_error("Tile coordinate out of bounds");
+    
+    return _tileView(tileColumn, tileRow);
+}
+
+TiledBitmap::TileIterator TiledBitmap::begin() const {
+    return TileIterator(this, 0);
+}
+
+TiledBitmap::TileIterator TiledBitmap::end() const {
+    return TileIterator(this, tileCount());
+}
+
+void TiledBitmap::forEachTile(const std::function<void(const Tile& tile)>& body) const {
+    auto tiles = [&](size_t begin, size_t end) {
+        for(size_t slot = begin; slot < end; ++slot)
+            body(_tileInSlot(slot));
+    };
+    
+    if((uint64_t)_width * _height >= ParallelPixelThreshold)
+        ThreadPool::shared().parallelFor(tileCount(), 4, tiles);
+    else
+        tiles(0, tileCount());
+}
+
+uint64_t TiledBitmap::pixelOffset(unsigned column, unsigned row) const {
+    size_t slot = _slots[(size_t)(row / TileSize) * _tileColumns + column / TileSize];
+    uint64_t inTile = (uint64_t)(row % TileSize) * TileSize + column % TileSize;
+    return (uint64_t)slot * _tileBytes + inTile * bytesPerPixel();
+}
+
+unsigned char* TiledBitmap::getPixel(unsigned column, unsigned row) const {
+    if(column >= _width || row >= _height)
+        throw std::runtime_error("Pixel coordinate out of bounds");
+    
+    return _pixels + (size_t)pixelOffset(column, row);
+}
+
+void TiledBitmap::setPixel(unsigned column, unsigned row, const unsigned char* pixel) {
+    memcpy(getPixel(column, row), pixel, bytesPerPixel());
+}
+
+void TiledBitmap::copyFromView(const BitmapView& src, unsigned destCol, unsigned destRow) {
+    if((uint64_t)destCol + src.width() > _width || (uint64_t)destRow + src.height() > _height)
+        throw std::runtime_error("View doesn't fit within destination bitmap");
+    
+    const unsigned char* srcFirst = src.rowStride() < 0 ? src.row(src.height() - 1) : src.origin();
+    const unsigned char* srcLast = (src.rowStride() < 0 ? src.origin() : src.row(src.height() - 1)) + (size_t)src.width() * src.bytesPerPixel();
+    if(srcFirst < _pixels + (size_t)byteSize() && _pixels < srcLast)
+        throw std::runtime_error("Source view points into the destination bitmap. Not allowed!");
+    
+    _forEachPiece(destCol, destRow, src.width(), src.height(), true, [&](const BitmapView& piece, unsigned offsetCol, unsigned offsetRow) {
+        CopyPixels(src.subView(offsetCol, offsetRow, piece.width(), piece.height()), piece);
+    });
+}
+
+void TiledBitmap::copyToView(unsigned srcCol, unsigned srcRow, const BitmapView& dest) const {
+    if((uint64_t)srcCol + dest.width() > _width || (uint64_t)srcRow + dest.height() > _height)
+        throw std::runtime_error("View doesn't fit within source bitmap");
+    
+    const unsigned char* destFirst = dest.rowStride() < 0 ? dest.row(dest.height() - 1) : dest.origin();
+    const unsigned char* destLast = (dest.rowStride() < 0 ? dest.origin() : dest.row(dest.height() - 1)) + (size_t)dest.width() * dest.bytesPerPixel();
+    if(destFirst < _pixels + (size_t)byteSize() && _pixels < destLast)
+        throw std::runtime_error("Destination view points into the source bitmap. Not allowed!");
+    
+    _forEachPiece(srcCol, srcRow, dest.width(), dest.height(), true, [&](const BitmapView& piece, unsigned offsetCol, unsigned offsetRow) {
+        CopyPixels(piece, dest.subView(offsetCol, offsetRow, piece.width(), piece.height()));
+    });
+}
+
+Bitmap TiledBitmap::toBitmap() const {
+    Bitmap bitmap(_width, _height, _format, _channelType);
+    copyToView(0, 0, BitmapView(bitmap));
+    return bitmap;
+}
+
+TiledBitmap TiledBitmap::clone() const {
+    //same size, so same tile order
+    TiledBitmap copy(_width, _height, _format, _channelType);
+    memcpy(copy._pixels, _pixels, (size_t)byteSize());
+    return copy;
+}
+
+void TiledBitmap::flipVertically() {
+    _rearrange(Rearrange_FlipVertically);
+}
+
+void TiledBitmap::rotate90CounterClockwise() {
+    _rearrange(Rearrange_Rotate90CounterClockwise);
+}
+
+void TiledBitmap::rotate90Clockwise() {
+    _rearrange(Rearrange_Rotate90Clockwise);
+}
+
+void TiledBitmap::rotate180() {
+    _rearrange(Rearrange_Rotate180);
+}
+
+void TiledBitmap::transpose() {
+    _rearrange(Rearrange_Transpose);
+}
+
+TiledBitmap::Tile TiledBitmap::_tileInSlot(size_t slot) const {
+    size_t index = _order[slot];
+    unsigned column = (unsigned)(index % _tileColumns);
+    unsigned row = (unsigned)(index / _tileColumns);
+    Tile tile = { column, row, _tileView(column, row) };
+    return tile;
+}
+
+BitmapView TiledBitmap::_tileView(unsigned tileColumn, unsigned tileRow) const {
+    size_t slot = _slots[(size_t)tileRow * _tileColumns + tileColumn];
+    unsigned width = std::min(TileSize, _width - tileColumn * TileSize);
+    unsigned height = std::min(TileSize, _height - tileRow * TileSize);
+    return BitmapView(_pixels + slot * _tileBytes, width, height, _format, (ptrdiff_t)TileSize * bytesPerPixel(), _channelType);
+}
+
+// Splits the given rectangle along tile edges, and calls `body` with each piece and
+// its position relative to the top left of the rectangle.
+void TiledBitmap::_forEachPiece(unsigned col, unsigned row, unsigned width, unsigned height, bool parallel,
+                                const std::function<void(const BitmapView& piece, unsigned offsetCol, unsigned offsetRow)>& body) const
+{
+    if(width == 0 || height == 0)
+        return;
+    
+    unsigned firstTileRow = row / TileSize;
+    unsigned lastTileRow = (unsigned)(((uint64_t)row + height - 1) / TileSize);
+    unsigned firstTileCol = col / TileSize;
+    unsigned lastTileCol = (unsigned)(((uint64_t)col + width - 1) / TileSize);
+    
+    auto tileRows = [&](size_t begin, size_t end) {
+        for(size_t tileRow = firstTileRow + begin; tileRow < firstTileRow + end; ++tileRow){
+            unsigned top = std::max(row, (unsigned)tileRow * TileSize);
+            unsigned bottom = (unsigned)std::min((uint64_t)row + height, ((uint64_t)tileRow + 1) * TileSize);
+            for(unsigned tileCol = firstTileCol; tileCol <= lastTileCol; ++tileCol){
+                unsigned left = std::max(col, tileCol * TileSize);
+                unsigned right = (unsigned)std::min((uint64_t)col + width, ((uint64_t)tileCol + 1) * TileSize);
+                BitmapView piece = _tileView(tileCol, (unsigned)tileRow).subView(left - tileCol * TileSize, top - (unsigned)tileRow * TileSize,
+                                                                                 right - left, bottom - top);
+                body(piece, left - col, top - row);
+            }
+        }
+    };
+    
+    size_t rowCount = lastTileRow - firstTileRow + 1;
+    if(parallel && (uint64_t)width * height >= ParallelPixelThreshold)
+        ThreadPool::shared().parallelFor(rowCount, 1, tileRows);
+    else
+        tileRows(0, rowCount);
+}
+
+// Builds the rearranged bitmap one destination tile at a time, from the pieces of
+// the source tiles that land in it, then replaces this bitmap with it.
+void TiledBitmap::_rearrange(Rearrangement rearrangement) {
+    bool swapsAxes = (rearrangement == Rearrange_Transpose ||
+                      rearrangement == Rearrange_Rotate90CounterClockwise ||
+                      rearrangement == Rearrange_Rotate90Clockwise);
+    TiledBitmap result(swapsAxes ? _height : _width, swapsAxes ? _width : _height, _format, _channelType);
+    unsigned pixelSize = bytesPerPixel();
+    
+    auto destTiles = [&](size_t begin, size_t end) {
+        std::vector<unsigned char> scratch(rearrangement == Rearrange_Rotate180 ? _tileBytes : 0);
+        for(size_t slot = begin; slot < end; ++slot){
+            Tile destTile = result._tileInSlot(slot);
+            const BitmapView& dest = destTile.pixels;
+            unsigned destCol = destTile.column * TileSize;
+            unsigned destRow = destTile.row * TileSize;
+            
+            //the rectangle of this bitmap that ends up in the destination tile
+            unsigned srcCol, srcRow, srcWidth, srcHeight;
+            if(swapsAxes){
+                srcWidth = dest.height();
+                srcHeight = dest.width();
+            } else {
+                srcWidth = dest.width();
+                srcHeight = dest.height();
+            }
+            switch(rearrangement){
+                case Rearrange_FlipVertically:
+                    srcCol = destCol;
+                    srcRow = _height - destRow - srcHeight;
+                    break;
+                case Rearrange_Rotate180:
+                    srcCol = _width - destCol - srcWidth;
+                    srcRow = _height - destRow - srcHeight;
+                    break;
+                case Rearrange_Transpose:
+                    srcCol = destRow;
+                    srcRow = destCol;
+                    break;
+                case Rearrange_Rotate90CounterClockwise:
+                    srcCol = _width - destRow - srcWidth;
+                    srcRow = destCol;
+                    break;
+                default:
+                    srcCol = destRow;
+                    srcRow = _height - destCol - srcHeight;
+                    break;
+            }
+            
+            _forEachPiece(srcCol, srcRow, srcWidth, srcHeight, false, [&](const BitmapView& piece, unsigned offsetCol, unsigned offsetRow) {
+                unsigned w = piece.width();
+                unsigned h = piece.height();
+                switch(rearrangement){
+                    case Rearrange_FlipVertically:
+                        CopyPixels(piece.flippedVertically(), dest.subView(offsetCol, srcHeight - offsetRow - h, w, h));
+                        break;
+                    case Rearrange_Rotate180: {
+                        //transposing twice, the second time reversed, turns the piece around
+                        BitmapView transposed(&scratch[0], h, w, _format, (ptrdiff_t)h * pixelSize, _channelType);
+                        CopyTransposedPixels(piece, transposed, false, false);
+                        CopyTransposedPixels(transposed, dest.subView(srcWidth - offsetCol - w, srcHeight - offsetRow - h, w, h), true, true);
+                        break;
+                    }
+                    case Rearrange_Transpose:
+                        CopyTransposedPixels(piece, dest.subView(offsetRow, offsetCol, h, w), false, false);
+                        break;
+                    case Rearrange_Rotate90CounterClockwise:
+                        CopyTransposedPixels(piece, dest.subView(offsetRow, srcWidth - offsetCol - w, h, w), true, false);
+                        break;
+                    default:
+                        CopyTransposedPixels(piece, dest.subView(srcHeight - offsetRow - h, offsetCol, h, w), false, true);
+                        break;
+                }
+            });
+        }
+    };
+    
+    if((uint64_t)_width * _height >= ParallelPixelThreshold)
+        ThreadPool::shared().parallelFor(result.tileCount(), 4, destTiles);
+    else
+        destTiles(0, result.tileCount());
+    
+    *this = std::move(result);
+}
+
+void TiledBitmap::_release() {
+    if(_pixels && _allocator)
+        _allocator->deallocate(_pixels);
+    _pixels = NULL;
+    _allocator = NULL;
+}
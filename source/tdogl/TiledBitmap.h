@@ -0,0 +1,247 @@
+/*
+ tdogl::TiledBitmap
+ 
+ Copyright 2012 Thomas Dalling - http://tomdalling.com/
+ 
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+ 
+ http://www.apache.org/licenses/LICENSE-2.0
+ 
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#pragma once
+
+#include "Bitmap.h"
+#include "BitmapView.h"
+#include <functional>
+#include <stdint.h>
+#include <vector>
+
+namespace tdogl {
+    
+    /**
+     A bitmap stored as square tiles instead of rows, for very large images.
+     
+     Each tile is TileSize x TileSize pixels, stored row by row, so a tile is a
+     plain BitmapView that anything taking a view can work on. The tiles are
+     stored in Morton (Z) order, so tiles that are close in 2D are close in
+     memory, which keeps rotations, sub-rect copies and filters cache friendly
+     in both directions. Tiles on the right and bottom edges are stored full
+     size, but their views are clipped to the image.
+     
+     Offsets are 64-bit throughout, so images aren't limited to 4GB of pixels.
+     Convert from row-major pixels with the BitmapView constructor or
+     `copyFromView` (e.g. one BandDecoder band at a time), and back with
+     `toBitmap` or `copyToView`.
+     
+     Rearranging operations work tile by tile across the threads of
+     ThreadPool::shared. Pixels are allocated from Bitmap::defaultAllocator.
+     */
+    class TiledBitmap {
+    public:
+        /** width and height of each tile, in pixels */
+        static const unsigned TileSize = 64;
+        
+        /**
+         One tile of the bitmap.
+         */
+        struct Tile {
+            unsigned column; /**< the column of the tile, in tiles from the left */
+            unsigned row; /**< the row of the tile, in tiles from the top */
+            BitmapView pixels; /**< the pixels of the tile, clipped to the image */
+        };
+        
+        /**
+         Iterates over the tiles in the order they are stored, which is the
+         fastest order to visit them in.
+         */
+        class TileIterator {
+        public:
+            TileIterator(const TiledBitmap* bitmap, size_t slot) : _bitmap(bitmap), _slot(slot) {}
+            
+            Tile operator * () const { return _bitmap->_tileInSlot(_slot); }
+            TileIterator& operator ++ () { ++_slot; return *this; }
+            TileIterator operator ++ (int) { TileIterator old = *this; ++_slot; return old; }
+            bool operator == (const TileIterator& other) const { return _slot == other._slot && _bitmap == other._bitmap; }
+            bool operator != (const TileIterator& other) const { return !(*this == other); }
+            
+        private:
+            const TiledBitmap* _bitmap;
+            size_t _slot;
+        };
+        
+        /**
+         Creates a tiled bitmap with uninitialised pixels.
+         */
+        TiledBitmap(unsigned width,
+                    unsigned height,
+                    Bitmap::Format format,
+                    Bitmap::ChannelType channelType = Bitmap::ChannelType_UInt8);
+        
+        /**
+         Creates a tiled copy of row-major pixels, with the same format and
+         channel type.
+         */
+        explicit TiledBitmap(const BitmapView& src);
+        
+        ~TiledBitmap();
+        
+        /** width in pixels */
+        unsigned width() const;
+        
+        /** height in pixels */
+        unsigned height() const;
+        
+        /** the pixel format of the bitmap */
+        Bitmap::Format format() const;
+        
+        /** the type of each channel of the pixels */
+        Bitmap::ChannelType channelType() const;
+        
+        /** the size of one pixel in bytes */
+        unsigned bytesPerPixel() const;
+        
+        /** number of tiles across */
+        unsigned tileColumns() const;
+        
+        /** number of tiles down */
+        unsigned tileRows() const;
+        
+        /** total number of tiles */
+        size_t tileCount() const;
+        
+        /** total size of the pixel storage in bytes, including the padding of edge tiles */
+        uint64_t byteSize() const;
+        
+        /**
+         Returns a view of the tile at the given tile coordinates. Throws an
+         exception if they are out of bounds.
+         */
+        BitmapView tile(unsigned tileColumn, unsigned tileRow) const;
+        
+        /** the first tile, in storage order */
+        TileIterator begin() const;
+        
+        /** one past the last tile, in storage order */
+        TileIterator end() const;
+        
+        /**
+         Calls `body` once for every tile, across the threads of
+         ThreadPool::shared. Tiles don't overlap, so each call can modify the
+         pixels of its own tile.
+         */
+        void forEachTile(const std::function<void(const Tile& tile)>& body) const;
+        
+        /**
+         Offset in bytes of the pixel at the given coordinates, from the start
+         of the pixel storage. Does no bounds checking.
+         */
+        uint64_t pixelOffset(unsigned column, unsigned row) const;
+        
+        /**
+         Returns a pointer to the pixel at the given coordinates. Throws an
+         exception if they are out of bounds.
+         */
+        unsigned char* getPixel(unsigned column, unsigned row) const;
+        
+        /**
+         Sets the pixel at the given coordinates. The size of the pixel is
+         `bytesPerPixel()`.
+         */
+        void setPixel(unsigned column, unsigned row, const unsigned char* pixel);
+        
+        /**
+         Copies the pixels of `src` into this bitmap, with the top left corner at
+         the given coordinates. Pixels are converted to the format and channel
+         type of this bitmap, like Bitmap::copyFromView.
+         */
+        void copyFromView(const BitmapView& src, unsigned destCol, unsigned destRow);
+        
+        /**
+         Copies the rectangle of this bitmap with its top left corner at the
+         given coordinates, and the same size as `dest`, into `dest`. Pixels are
+         converted to the format and channel type of `dest`.
+         */
+        void copyToView(unsigned srcCol, unsigned srcRow, const BitmapView& dest) const;
+        
+        /**
+         Returns a row-major copy of the whole bitmap.
+         */
+        Bitmap toBitmap() const;
+        
+        /** Makes an exact copy of this bitmap */
+        TiledBitmap clone() const;
+        
+        /**
+         Reverses the row order of the pixels, so the bitmap will be upside down.
+         */
+        void flipVertically();
+        
+        /**
+         Rotates the image 90 degrees counter clockwise.
+         */
+        void rotate90CounterClockwise();
+        
+        /**
+         Rotates the image 90 degrees clockwise.
+         */
+        void rotate90Clockwise();
+        
+        /**
+         Rotates the image 180 degrees.
+         */
+        void rotate180();
+        
+        /**
+         Swaps the rows and columns of the image, i.e. mirrors it along the
+         diagonal from the top left corner to the bottom right corner.
+         */
+        void transpose();
+        
+        /** Move constructor */
+        TiledBitmap(TiledBitmap&& other);
+        
+        /** Move assignment operator */
+        TiledBitmap& operator = (TiledBitmap&& other);
+        
+    private:
+        enum Rearrangement {
+            Rearrange_FlipVertically,
+            Rearrange_Rotate180,
+            Rearrange_Transpose,
+            Rearrange_Rotate90CounterClockwise,
+            Rearrange_Rotate90Clockwise
+        };
+        
+        unsigned _width;
+        unsigned _height;
+        Bitmap::Format _format;
+        Bitmap::ChannelType _channelType;
+        unsigned _tileColumns;
+        unsigned _tileRows;
+        size_t _tileBytes;
+        std::vector<size_t> _slots; //storage slot of each tile, indexed by tile row * tileColumns + tile column
+        std::vector<size_t> _order; //the tile in each storage slot, the inverse of _slots
+        unsigned char* _pixels;
+        Allocator* _allocator;
+        
+        Tile _tileInSlot(size_t slot) const;
+        BitmapView _tileView(unsigned tileColumn, unsigned tileRow) const;
+        void _forEachPiece(unsigned col, unsigned row, unsigned width, unsigned height, bool parallel,
+                           const std::function<void(const BitmapView& piece, unsigned offsetCol, unsigned offsetRow)>& body) const;
+        void _rearrange(Rearrangement rearrangement);
+        void _release();
+        
+        //copying disabled
+        TiledBitmap(const TiledBitmap&) = delete;
+        TiledBitmap& operator = (const TiledBitmap&) = delete;
+    };
+    
+}
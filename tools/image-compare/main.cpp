@@ -0,0 +1,238 @@
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <dirent.h>
+#include <future>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <sys/stat.h>
+#include <vector>
+
+#include "tdogl/Bitmap.h"
+#include "tdogl/ImageCompare.h"
+#include "tdogl/ThreadPool.h"
+
+/*
+ Compares images against reference copies, for golden-frame regression tests
+ on machines without a GPU.
+
+ Given two files, compares them. Given two directories, compares every file in
+ the reference directory with the file of the same name in the candidate
+ directory. Pairs are compared across the threads of ThreadPool::shared, and
+ one line is printed for each, in order. The exit status is non-zero if any
+ pair fails, can't be loaded, or is missing.
+
+ Usage: image-compare [options] <reference> <candidate>
+
+   --max-diff <n>     fail if any channel differs by more than <n> (0 to 255).
+                      Defaults to 0, unless --min-psnr or --min-ssim is given.
+   --min-psnr <dB>    fail if the PSNR is below <dB>
+   --min-ssim <x>     fail if the mean SSIM is below <x>. Implies --ssim.
+   --ssim             also measure SSIM, which is slower than the other checks
+   --heatmaps <dir>   write a difference heatmap of each failing pair into
+                      <dir>, as a binary PPM named after the image
+   --gain <x>         multiply the differences in the heatmaps by <x>, so
+                      small ones stand out. Defaults to 1.
+ */
+
+struct Options {
+    int maxDiff; //negative when not given
+    double minPsnr;
+    double minSsim;
+    bool ssim;
+    std::string heatmaps;
+    float gain;
+    std::string reference;
+    std::string candidate;
+
+    Options() : maxDiff(-1), minPsnr(-HUGE_VAL), minSsim(-HUGE_VAL), ssim(false), gain(1.0f) {}
+};
+
+// the outcome of comparing one pair of images
+struct PairResult {
+    std::string name;
+    std::string error; //empty unless the pair couldn't be compared
+    tdogl::ImageDifference difference;
+    double ssim;
+    bool passed;
+};
+
+static void PrintUsage() {
+    std::cerr << "Usage: image-compare [--max-diff <n>] [--min-psnr <dB>] [--min-ssim <x>] [--ssim]\n"
+                 "                     [--heatmaps <dir>] [--gain <x>] <reference> <candidate>" << std::endl;
+}
+
+static Options ParseOptions(int argc, char* argv[]) {
+    Options options;
+    std::vector<std::string> paths;
+    for(int i = 1; i < argc; ++i){
+        std::string arg = argv[i];
+        bool hasValue = (i + 1 < argc);
+        if(arg == "--max-diff" && hasValue){
+            options.maxDiff = (int)strtol(argv[++i], NULL, 10);
+        } else if(arg == "--min-psnr" && hasValue){
+            options.minPsnr = strtod(argv[++i], NULL);
+        } else if(arg == "--min-ssim" && hasValue){
+            options.minSsim = strtod(argv[++i], NULL);
+            options.ssim = true;
+        } else if(arg == "--ssim"){
+            options.ssim = true;
+        } else if(arg == "--heatmaps" && hasValue){
+            options.heatmaps = argv[++i];
+        } else if(arg == "--gain" && hasValue){
+            options.gain = (float)strtod(argv[++i], NULL);
+        } else if(arg.size() > 2 && arg.compare(0, 2, "--") == 0){
+            throw std::runtime_error("Unknown or incomplete option: " + arg);
+        } else {
+            paths.push_back(arg);
+        }
+    }
+    if(paths.size() != 2){
+        PrintUsage();
+        throw std::runtime_error("Expected a reference and a candidate path");
+    }
+
+    // with no thresholds at all, only identical images pass
+    if(options.maxDiff < 0)
+        options.maxDiff = (options.minPsnr > -HUGE_VAL || options.minSsim > -HUGE_VAL) ? 255 : 0;
+    options.reference = paths[0];
+    options.candidate = paths[1];
+    return options;
+}
+
+static bool IsDirectory(const std::string& path) {
+    struct stat info;
+    return stat(path.c_str(), &info) == 0 && S_ISDIR(info.st_mode);
+}
+
+// the names of the regular files in a directory, sorted so the output is stable
+static std::vector<std::string> ListFiles(const std::string& directory) {
+    DIR* dir = opendir(directory.c_str());
+    if(!dir)
+        throw std::runtime_error("Failed to open directory '" + directory + "': " + strerror(errno));
+
+    std::vector<std::string> names;
+    while(struct dirent* entry = readdir(dir)){
+        std::string name = entry->d_name;
+        struct stat info;
+        if(name[0] != '.' && stat((directory + "/" + name).c_str(), &info) == 0 && S_ISREG(info.st_mode))
+            names.push_back(name);
+    }
+    closedir(dir);
+    std::sort(names.begin(), names.end());
+    return names;
+}
+
+static std::string FileName(const std::string& path) {
+    size_t slash = path.find_last_of("/\\");
+    return (slash == std::string::npos) ? path : path.substr(slash + 1);
+}
+
+static void WritePPM(const std::string& path, const tdogl::Bitmap& bitmap) {
+    FILE* file = fopen(path.c_str(), "wb");
+    if(!file)
+        throw std::runtime_error("Failed to create '" + path + "': " + strerror(errno));
+
+    fprintf(file, "P6\n%u %u\n255\n", bitmap.width(), bitmap.height());
+    size_t rowSize = (size_t)bitmap.width() * 3;
+    bool written = true;
+    for(unsigned row = 0; row < bitmap.height() && written; ++row)
+        written = fwrite(bitmap.row(row), 1, rowSize, file) == rowSize;
+    if(fclose(file) != 0 || !written)
+        throw std::runtime_error("Failed to write '" + path + "'");
+}
+
+static PairResult ComparePair(const Options& options, const std::string& name,
+                              const std::string& referencePath, const std::string& candidatePath)
+{
+    PairResult result;
+    result.name = name;
+    result.ssim = 1.0;
+    result.passed = false;
+    try {
+        tdogl::Bitmap reference = tdogl::Bitmap::bitmapFromMappedFile(referencePath);
+        tdogl::Bitmap candidate = tdogl::Bitmap::bitmapFromMappedFile(candidatePath);
+        result.difference = tdogl::CompareImages(reference, candidate);
+
+        // identical images can't fail the SSIM check, so don't spend time on it
+        if(options.ssim && result.difference.maxAbsDiff != 0)
+            result.ssim = tdogl::StructuralSimilarity(reference, candidate);
+
+        result.passed = (int)result.difference.maxAbsDiff <= options.maxDiff &&
+                        result.difference.psnr >= options.minPsnr &&
+                        result.ssim >= options.minSsim;
+
+        if(!result.passed && !options.heatmaps.empty())
+            WritePPM(options.heatmaps + "/" + name + ".diff.ppm", tdogl::DifferenceHeatmap(reference, candidate, options.gain));
+    } catch(const std::exception& e) {
+        result.error = e.what();
+        result.passed = false;
+    }
+    return result;
+}
+
+static void PrintResult(const Options& options, const PairResult& result) {
+    if(!result.error.empty()){
+        printf("ERROR %s: %s\n", result.name.c_str(), result.error.c_str());
+    } else {
+        printf("%s  %s  max diff %u  PSNR %.2f dB", (result.passed ? "PASS" : "FAIL"), result.name.c_str(),
+               result.difference.maxAbsDiff, result.difference.psnr);
+        if(options.ssim)
+            printf("  SSIM %.6f", result.ssim);
+        printf("\n");
+    }
+    fflush(stdout);
+}
+
+static bool CompareMain(int argc, char* argv[]) {
+    Options options = ParseOptions(argc, argv);
+    if(!options.heatmaps.empty() && mkdir(options.heatmaps.c_str(), 0755) != 0 && errno != EEXIST)
+        throw std::runtime_error("Failed to create heatmap directory '" + options.heatmaps + "': " + strerror(errno));
+
+    if(!IsDirectory(options.reference)){
+        PairResult result = ComparePair(options, FileName(options.candidate), options.reference, options.candidate);
+        PrintResult(options, result);
+        return result.passed;
+    }
+
+    if(!IsDirectory(options.candidate))
+        throw std::runtime_error("'" + options.candidate + "' is not a directory, but the reference is");
+
+    // one task per pair, so thousands of small frames keep every thread busy.
+    // Each task holds its images only while it runs.
+    std::vector<std::string> names = ListFiles(options.reference);
+    std::vector< std::future<PairResult> > pending;
+    pending.reserve(names.size());
+    for(size_t i = 0; i < names.size(); ++i){
+        std::string name = names[i];
+        pending.push_back(tdogl::ThreadPool::shared().enqueue([&options, name]{
+            return ComparePair(options, name, options.reference + "/" + name, options.candidate + "/" + name);
+        }));
+    }
+
+    unsigned failures = 0;
+    for(size_t i = 0; i < pending.size(); ++i){
+        PairResult result = pending[i].get();
+        PrintResult(options, result);
+        if(!result.passed)
+            ++failures;
+    }
+    printf("%lu compared, %u failed\n", (unsigned long)names.size(), failures);
+    return failures == 0;
+}
+
+int main(int argc, char *argv[]) {
+    try {
+        if(!CompareMain(argc, argv))
+            return EXIT_FAILURE;
+    } catch (const std::exception& e){
+        std::cerr << "ERROR: " << e.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
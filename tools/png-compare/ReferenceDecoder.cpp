@@ -0,0 +1,44 @@
+#include "ReferenceDecoder.h"
+
+//every name stb_image exports, so none of them clash with the current decoder's
+#define stbi_convert_iphone_png_to_rgb reference_stbi_convert_iphone_png_to_rgb
+#define stbi_failure_reason reference_stbi_failure_reason
+#define stbi_hdr_to_ldr_gamma reference_stbi_hdr_to_ldr_gamma
+#define stbi_hdr_to_ldr_scale reference_stbi_hdr_to_ldr_scale
+#define stbi_image_free reference_stbi_image_free
+#define stbi_info reference_stbi_info
+#define stbi_info_from_callbacks reference_stbi_info_from_callbacks
+#define stbi_info_from_file reference_stbi_info_from_file
+#define stbi_info_from_memory reference_stbi_info_from_memory
+#define stbi_is_hdr reference_stbi_is_hdr
+#define stbi_is_hdr_from_callbacks reference_stbi_is_hdr_from_callbacks
+#define stbi_is_hdr_from_file reference_stbi_is_hdr_from_file
+#define stbi_is_hdr_from_memory reference_stbi_is_hdr_from_memory
+#define stbi_ldr_to_hdr_gamma reference_stbi_ldr_to_hdr_gamma
+#define stbi_ldr_to_hdr_scale reference_stbi_ldr_to_hdr_scale
+#define stbi_load reference_stbi_load
+#define stbi_load_16 reference_stbi_load_16
+#define stbi_load_16_from_file reference_stbi_load_16_from_file
+#define stbi_load_16_from_memory reference_stbi_load_16_from_memory
+#define stbi_load_from_callbacks reference_stbi_load_from_callbacks
+#define stbi_load_from_file reference_stbi_load_from_file
+#define stbi_load_from_memory reference_stbi_load_from_memory
+#define stbi_loadf reference_stbi_loadf
+#define stbi_loadf_from_callbacks reference_stbi_loadf_from_callbacks
+#define stbi_loadf_from_file reference_stbi_loadf_from_file
+#define stbi_loadf_from_memory reference_stbi_loadf_from_memory
+#define stbi_loadf_main reference_stbi_loadf_main
+#define stbi_png_partial reference_stbi_png_partial
+#define stbi_png_stream reference_stbi_png_stream
+#define stbi_png_stream_info reference_stbi_png_stream_info
+#define stbi_set_unpremultiply_on_load reference_stbi_set_unpremultiply_on_load
+#define stbi_zlib_decode_buffer reference_stbi_zlib_decode_buffer
+#define stbi_zlib_decode_malloc reference_stbi_zlib_decode_malloc
+#define stbi_zlib_decode_malloc_guesssize reference_stbi_zlib_decode_malloc_guesssize
+#define stbi_zlib_decode_malloc_guesssize_headerflag reference_stbi_zlib_decode_malloc_guesssize_headerflag
+#define stbi_zlib_decode_noheader_buffer reference_stbi_zlib_decode_noheader_buffer
+#define stbi_zlib_decode_noheader_malloc reference_stbi_zlib_decode_noheader_malloc
+#define stbi_install_idct reference_stbi_install_idct
+#define stbi_install_YCbCr_to_RGB reference_stbi_install_YCbCr_to_RGB
+
+#include "reference/stb_image.c"
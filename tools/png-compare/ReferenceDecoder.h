@@ -0,0 +1,18 @@
+#pragma once
+
+#include <cstddef>
+
+/*
+ stb_image as it was before inflate and PNG unfiltering were sped up, kept
+ so the current decoder can be checked against it. Its exported names are
+ prefixed with reference_ so it can be linked next to the current one.
+ */
+extern "C" {
+    unsigned char* reference_stbi_load_from_memory(unsigned char const* buffer, int len, int* x, int* y, int* comp, int req_comp);
+    unsigned short* reference_stbi_load_16_from_memory(unsigned char const* buffer, int len, int* x, int* y, int* comp, int req_comp);
+    int reference_stbi_png_stream_info(unsigned char const* buffer, size_t len, int* x, int* y, int* comp);
+    int reference_stbi_png_stream(unsigned char const* buffer, size_t len, int band_rows,
+                                  int (*band)(void* user, unsigned char const* rows, int first_row, int row_count),
+                                  void* user);
+    void reference_stbi_image_free(void* retval_from_stbi_load);
+}
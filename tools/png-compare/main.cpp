@@ -0,0 +1,190 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <dirent.h>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "tdogl/MappedFile.h"
+#include "ReferenceDecoder.h"
+
+//the stb_image implementation is compiled in Bitmap.cpp
+#define STBI_HEADER_FILE_ONLY
+#include <stb_image.c>
+
+/*
+ Checks the PNG decoder against the one it replaced
+
+ Decodes every PNG in the corpus directory with both the current stb_image and
+ the reference copy from before inflate and unfiltering were sped up, and
+ fails if they differ by a single byte, or if one fails where the other
+ doesn't. Each file is decoded to every channel count at 8 and 16 bits, and
+ streamed in bands of 1, 7 and 64 rows if it can be streamed.
+
+ The corpus is made by make-corpus.py, which describes what it covers. Neither
+ decoder supports 1, 2 or 4 bit images, so for those files the check is that
+ both reject them. Building with TDOGL_DISABLE_SIMD checks the scalar
+ unfiltering instead of the SSE2 one.
+
+ Usage: png-compare [corpus directory]
+ */
+
+static const int BandRows[] = { 1, 7, 64 };
+
+namespace {
+    struct Stats {
+        unsigned files;
+        unsigned checks;
+        unsigned decoded; //checks where both decoders succeeded
+        unsigned mismatches;
+
+        Stats() : files(0), checks(0), decoded(0), mismatches(0) {}
+    };
+
+    // the rows handed to a band callback, in order
+    struct Streamed {
+        size_t rowSize;
+        std::vector<unsigned char> pixels;
+        int nextRow;
+        bool outOfOrder;
+
+        explicit Streamed(size_t rowSize) : rowSize(rowSize), nextRow(0), outOfOrder(false) {}
+    };
+}
+
+static int CollectBand(void* user, const stbi_uc* rows, int firstRow, int rowCount) {
+    Streamed* streamed = (Streamed*)user;
+    if(firstRow != streamed->nextRow)
+        streamed->outOfOrder = true;
+    streamed->pixels.insert(streamed->pixels.end(), rows, rows + streamed->rowSize * rowCount);
+    streamed->nextRow = firstRow + rowCount;
+    return 1;
+}
+
+static void Report(Stats& stats, const std::string& name, const std::string& check, const char* problem) {
+    ++stats.mismatches;
+    printf("MISMATCH %s (%s): %s\n", name.c_str(), check.c_str(), problem);
+}
+
+template <typename Sample>
+static void Compare(Stats& stats, const std::string& name, const std::string& check,
+                    Sample* current, int x, int y, int comp,
+                    Sample* reference, int refX, int refY, int refComp,
+                    int reqComp)
+{
+    ++stats.checks;
+    if(!current != !reference)
+        Report(stats, name, check, current ? "only the reference decoder failed" : "only the current decoder failed");
+    else if(current && (x != refX || y != refY || comp != refComp))
+        Report(stats, name, check, "different dimensions or channel count");
+    else if(current){
+        ++stats.decoded;
+        size_t samples = (size_t)x * y * (reqComp ? reqComp : comp);
+        if(memcmp(current, reference, samples * sizeof(Sample)) != 0)
+            Report(stats, name, check, "different pixels");
+    }
+}
+
+static void CheckFile(Stats& stats, const std::string& directory, const std::string& name) {
+    tdogl::MappedFile file(directory + name);
+    const stbi_uc* data = file.data();
+    int size = (int)file.size();
+    ++stats.files;
+
+    for(int reqComp = 0; reqComp <= 4; ++reqComp){
+        std::string check = "8-bit, req_comp " + std::to_string(reqComp);
+        int x = 0, y = 0, comp = 0, refX = 0, refY = 0, refComp = 0;
+        stbi_uc* current = stbi_load_from_memory(data, size, &x, &y, &comp, reqComp);
+        stbi_uc* reference = reference_stbi_load_from_memory(data, size, &refX, &refY, &refComp, reqComp);
+        Compare(stats, name, check, current, x, y, comp, reference, refX, refY, refComp, reqComp);
+        stbi_image_free(current);
+        reference_stbi_image_free(reference);
+
+        check = "16-bit, req_comp " + std::to_string(reqComp);
+        stbi_us* current16 = stbi_load_16_from_memory(data, size, &x, &y, &comp, reqComp);
+        stbi_us* reference16 = reference_stbi_load_16_from_memory(data, size, &refX, &refY, &refComp, reqComp);
+        Compare(stats, name, check, current16, x, y, comp, reference16, refX, refY, refComp, reqComp);
+        stbi_image_free(current16);
+        reference_stbi_image_free(reference16);
+    }
+
+    int x = 0, y = 0, comp = 0, refX = 0, refY = 0, refComp = 0;
+    int streamable = stbi_png_stream_info(data, file.size(), &x, &y, &comp);
+    int refStreamable = reference_stbi_png_stream_info(data, file.size(), &refX, &refY, &refComp);
+    ++stats.checks;
+    if(streamable != refStreamable || (streamable && (x != refX || y != refY || comp != refComp))){
+        Report(stats, name, "stream info", "different results");
+        return;
+    }
+    if(!streamable)
+        return;
+
+    for(size_t i = 0; i < sizeof(BandRows) / sizeof(BandRows[0]); ++i){
+        std::string check = "streamed in bands of " + std::to_string(BandRows[i]);
+        Streamed current((size_t)x * comp), reference((size_t)x * comp);
+        int result = stbi_png_stream(data, file.size(), BandRows[i], CollectBand, &current);
+        int refResult = reference_stbi_png_stream(data, file.size(), BandRows[i], CollectBand, &reference);
+        ++stats.checks;
+        if(result != refResult)
+            Report(stats, name, check, "only one decoder failed");
+        else if(current.outOfOrder || reference.outOfOrder)
+            Report(stats, name, check, "bands out of order");
+        else if(current.pixels != reference.pixels)
+            Report(stats, name, check, "different pixels");
+        else if(result)
+            ++stats.decoded;
+    }
+}
+
+static std::vector<std::string> ListPNGs(const std::string& directory) {
+    DIR* dir = opendir(directory.c_str());
+    if(!dir)
+        throw std::runtime_error("Failed to open directory '" + directory + "': " + strerror(errno));
+
+    std::vector<std::string> names;
+    while(struct dirent* entry = readdir(dir)){
+        std::string name = entry->d_name;
+        if(name.size() > 4 && name.compare(name.size() - 4, 4, ".png") == 0)
+            names.push_back(name);
+    }
+    closedir(dir);
+    std::sort(names.begin(), names.end());
+    return names;
+}
+
+static bool CompareMain(int argc, char* argv[]) {
+    if(argc > 2)
+        throw std::runtime_error("Usage: png-compare [corpus directory]");
+
+    std::string directory = (argc == 2) ? argv[1] : "../../tools/png-compare/corpus/";
+    if(directory[directory.size() - 1] != '/')
+        directory += '/';
+
+    std::vector<std::string> names = ListPNGs(directory);
+    if(names.empty())
+        throw std::runtime_error("No PNG files in '" + directory + "'");
+
+    Stats stats;
+    for(size_t i = 0; i < names.size(); ++i)
+        CheckFile(stats, directory, names[i]);
+
+    printf("%u files, %u checks, %u decoded by both, %u mismatches\n",
+           stats.files, stats.checks, stats.decoded, stats.mismatches);
+    return stats.mismatches == 0;
+}
+
+int main(int argc, char *argv[]) {
+    try {
+        if(!CompareMain(argc, argv))
+            return EXIT_FAILURE;
+    } catch (const std::exception& e){
+        std::cerr << "ERROR: " << e.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,159 @@
+#!/usr/bin/env python3
+"""
+Writes the PNG corpus that png-compare decodes.
+
+Covers every valid colour type and bit depth, each filter type and a random
+filter per row, plain and interlaced images, colour-key and palette tRNS,
+zlib levels 0-9 with each strategy, and IDATs split into several sizes.
+Output is deterministic, so rerunning it reproduces the checked-in files.
+
+Usage: make-corpus.py [output directory]
+"""
+
+import os
+import random
+import struct
+import sys
+import zlib
+
+COLOR_TYPES = [(0, 1), (0, 2), (0, 4), (0, 8), (0, 16),
+               (2, 8), (2, 16),
+               (3, 1), (3, 2), (3, 4), (3, 8),
+               (4, 8), (4, 16),
+               (6, 8), (6, 16)]
+CHANNELS = {0: 1, 2: 3, 3: 1, 4: 2, 6: 4}
+FILTERS = [0, 1, 2, 3, 4, "mixed"]
+SIZES = [(1, 1), (3, 5), (17, 9), (33, 17), (64, 31), (129, 65)]
+STRATEGIES = [zlib.Z_DEFAULT_STRATEGY, zlib.Z_FILTERED, zlib.Z_HUFFMAN_ONLY, zlib.Z_RLE, zlib.Z_FIXED]
+IDAT_SPLITS = [0, 1, 37, 1000]  # 0 is a single IDAT
+
+# (x start, y start, x step, y step) of each Adam7 pass
+ADAM7 = [(0, 0, 8, 8), (4, 0, 8, 8), (0, 4, 4, 8), (2, 0, 4, 4), (0, 2, 2, 4), (1, 0, 2, 2), (0, 1, 1, 2)]
+
+
+def chunk(kind, data):
+    body = kind + data
+    return struct.pack(">I", len(data)) + body + struct.pack(">I", zlib.crc32(body) & 0xffffffff)
+
+
+def samples(rng, width, height, channels, depth):
+    """gradients with noisy and flat patches, so the encoder finds both literals and matches"""
+    top = (1 << depth) - 1
+    image = []
+    for y in range(height):
+        row = []
+        style = rng.randrange(3)
+        for x in range(width):
+            for c in range(channels):
+                if style == 0:
+                    value = ((x * 7 + y * 3 + c * 50) * top) // (width * 7 + height * 3 + 200)
+                elif style == 1:
+                    value = rng.randrange(top + 1)
+                else:
+                    value = (top * c) // max(1, channels)
+                row.append(value)
+        image.append(row)
+    return image
+
+
+def pack_row(values, depth):
+    if depth == 16:
+        return b"".join(struct.pack(">H", v) for v in values)
+    if depth == 8:
+        return bytes(values)
+    out = bytearray()
+    per_byte = 8 // depth
+    for i in range(0, len(values), per_byte):
+        byte = 0
+        for j in range(per_byte):
+            v = values[i + j] if i + j < len(values) else 0
+            byte |= v << (8 - depth * (j + 1))
+        out.append(byte)
+    return bytes(out)
+
+
+def paeth(a, b, c):
+    p = a + b - c
+    pa, pb, pc = abs(p - a), abs(p - b), abs(p - c)
+    if pa <= pb and pa <= pc:
+        return a
+    return b if pb <= pc else c
+
+
+def filter_row(kind, row, prior, bpp):
+    out = bytearray([kind])
+    for i, x in enumerate(row):
+        a = row[i - bpp] if i >= bpp else 0
+        b = prior[i] if prior else 0
+        c = prior[i - bpp] if prior and i >= bpp else 0
+        predictor = [0, a, b, (a + b) // 2, paeth(a, b, c)][kind]
+        out.append((x - predictor) & 255)
+    return bytes(out)
+
+
+def filtered_data(rng, image, channels, depth, filter_type, interlaced):
+    bpp = max(1, channels * depth // 8)
+    height, width = len(image), len(image[0]) // channels
+    passes = ADAM7 if interlaced else [(0, 0, 1, 1)]
+    data = bytearray()
+    for x0, y0, dx, dy in passes:
+        prior = None
+        for y in range(y0, height, dy):
+            values = []
+            for x in range(x0, width, dx):
+                values.extend(image[y][x * channels:(x + 1) * channels])
+            if not values:
+                continue
+            row = pack_row(values, depth)
+            kind = rng.randrange(5) if filter_type == "mixed" else filter_type
+            data += filter_row(kind, row, prior, bpp)
+            prior = row
+    return bytes(data)
+
+
+def write_png(path, rng, index, color_type, depth, filter_type, interlaced):
+    width, height = SIZES[index % len(SIZES)]
+    channels = CHANNELS[color_type]
+    image = samples(rng, width, height, channels, depth)
+
+    chunks = [chunk(b"IHDR", struct.pack(">IIBBBBB", width, height, depth, color_type, 0, 0, int(interlaced)))]
+    if color_type == 3:
+        entries = 1 << depth
+        chunks.append(chunk(b"PLTE", bytes(rng.randrange(256) for _ in range(entries * 3))))
+        if index % 2:
+            chunks.append(chunk(b"tRNS", bytes(rng.randrange(256) for _ in range(rng.randrange(1, entries + 1)))))
+    elif color_type in (0, 2) and index % 2:
+        # colour-key transparency, using a sample that's in the image
+        key = image[0][:channels]
+        chunks.append(chunk(b"tRNS", b"".join(struct.pack(">H", v) for v in key)))
+
+    level = index % 10
+    strategy = STRATEGIES[index % len(STRATEGIES)]
+    compressor = zlib.compressobj(level, zlib.DEFLATED, 15, 9, strategy)
+    stream = compressor.compress(filtered_data(rng, image, channels, depth, filter_type, interlaced)) + compressor.flush()
+    split = IDAT_SPLITS[index % len(IDAT_SPLITS)] or len(stream)
+    if split == 1 and len(stream) > 4096:
+        split = 37  # one byte IDATs are 13 times the size of the data, so only small images get them
+    for i in range(0, len(stream), split):
+        chunks.append(chunk(b"IDAT", stream[i:i + split]))
+    chunks.append(chunk(b"IEND", b""))
+
+    with open(path, "wb") as f:
+        f.write(b"\x89PNG\r\n\x1a\n" + b"".join(chunks))
+
+
+def main():
+    directory = sys.argv[1] if len(sys.argv) > 1 else os.path.join(os.path.dirname(os.path.abspath(__file__)), "corpus")
+    os.makedirs(directory, exist_ok=True)
+    rng = random.Random(1234)
+    index = 0
+    for color_type, depth in COLOR_TYPES:
+        for filter_type in FILTERS:
+            for interlaced in (False, True):
+                name = "c%d-d%02d-f%s-%s.png" % (color_type, depth, filter_type, "i" if interlaced else "p")
+                write_png(os.path.join(directory, name), rng, index, color_type, depth, filter_type, interlaced)
+                index += 1
+
+
+if __name__ == "__main__":
+    main()
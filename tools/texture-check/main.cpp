@@ -0,0 +1,221 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "tdogl/Bitmap.h"
+#include "tdogl/CompressedBitmap.h"
+#include "tdogl/ImageCompare.h"
+#include "tdogl/MipChain.h"
+
+/*
+ Checks what the texture pipeline makes against what it should look like,
+ without a GPU
+
+ compressed gray: compresses every mip level of Grayscale and GrayscaleAlpha
+   images to BC4 and BC5 at every quality, as TextureCache does, and decodes
+   them the way tdogl::Texture samples them (CompressedBitmap::decompress).
+   Fails unless they look like the uncompressed textures, which sample as
+   (L,L,L,1) and (L,L,L,A).
+
+ transparent mips: makes the mip chains of RGBA and gray+alpha images twice,
+   once with the color of every fully transparent pixel set to black, and
+   once with it set to white. Fails unless they match exactly, as the color of
+   an invisible pixel mustn't show up as fringes in the levels below it.
+
+ transparent resizes: the same, but resizing the images up and down with
+   each Bitmap::ResizeFilter, instead of making mips. Color from transparent
+   pixels would show up as halos around the edges of opaque ones.
+
+ The compressed gray checks use gray and gray+alpha copies of
+ wooden-crate.jpg and hazard.png, plus a gradient with a noisy alpha channel.
+ The transparent checks use hazard.png, which is half transparent, and a
+ gray+alpha copy of it.
+
+ Usage: texture-check [resources directory]
+ */
+
+// lowest PSNR a compressed image may have against the uncompressed one. BC4
+// and BC5 are usually well over 40dB, and sampling the wrong channels is under 10.
+static const double MinCompressedPSNR = 30.0;
+
+static const tdogl::CompressedBitmap::Quality QUALITIES[] = {
+    tdogl::CompressedBitmap::Quality_Fast,
+    tdogl::CompressedBitmap::Quality_Normal,
+    tdogl::CompressedBitmap::Quality_High,
+};
+
+namespace {
+    struct Stats {
+        unsigned checks;
+        unsigned failures;
+
+        Stats() : checks(0), failures(0) {}
+    };
+
+    struct TestImage {
+        std::string name;
+        tdogl::Bitmap bitmap;
+
+        TestImage(const std::string& name, tdogl::Bitmap&& bitmap) : name(name), bitmap(std::move(bitmap)) {}
+    };
+}
+
+static const char* QualityName(tdogl::CompressedBitmap::Quality quality) {
+    switch (quality) {
+        case tdogl::CompressedBitmap::Quality_Fast: return "fast";
+        case tdogl::CompressedBitmap::Quality_Normal: return "normal";
+        case tdogl::CompressedBitmap::Quality_High: return "high";
+        default: return "unknown";
+    }
+}
+
+static tdogl::Bitmap Converted(const tdogl::BitmapView& view, tdogl::Bitmap::Format format) {
+    tdogl::Bitmap bitmap(view.width(), view.height(), format);
+    bitmap.copyFromView(view, 0, 0);
+    return bitmap;
+}
+
+// a horizontal gray ramp, with noise in the alpha channel, so every block has some contrast
+static tdogl::Bitmap GradientBitmap(unsigned width, unsigned height) {
+    tdogl::Bitmap bitmap(width, height, tdogl::Bitmap::Format_GrayscaleAlpha);
+    unsigned state = 12345;
+    for(unsigned row = 0; row < height; ++row){
+        unsigned char* pixels = bitmap.row(row);
+        for(unsigned col = 0; col < width; ++col){
+            state = state * 1664525 + 1013904223;
+            pixels[2*col] = (unsigned char)(col * 255 / (width - 1));
+            pixels[2*col + 1] = (unsigned char)(state >> 24);
+        }
+    }
+    return bitmap;
+}
+
+static std::vector<TestImage> TestImages(const std::string& resources) {
+    std::vector<TestImage> images;
+    const char* files[] = { "wooden-crate.jpg", "hazard.png" };
+    for(size_t i = 0; i < sizeof(files) / sizeof(files[0]); ++i){
+        tdogl::Bitmap bitmap = tdogl::Bitmap::bitmapFromFile(resources + files[i]);
+        images.push_back(TestImage(std::string(files[i]) + " (gray)", Converted(bitmap, tdogl::Bitmap::Format_Grayscale)));
+        images.push_back(TestImage(std::string(files[i]) + " (gray+alpha)", Converted(bitmap, tdogl::Bitmap::Format_GrayscaleAlpha)));
+    }
+    images.push_back(TestImage("gradient (gray+alpha)", GradientBitmap(253, 61)));
+    return images;
+}
+
+static void Report(Stats& stats, const std::string& name, const std::string& check, const std::string& problem) {
+    ++stats.failures;
+    printf("FAIL %s (%s): %s\n", name.c_str(), check.c_str(), problem.c_str());
+}
+
+static void CheckCompressedGray(Stats& stats, const TestImage& image) {
+    tdogl::CompressedBitmap::Format format = (image.bitmap.format() == tdogl::Bitmap::Format_Grayscale ?
+                                              tdogl::CompressedBitmap::Format_BC4 :
+                                              tdogl::CompressedBitmap::Format_BC5);
+    //every level, like TextureCache compresses them
+    tdogl::MipChain mips = image.bitmap.generateMipChain();
+    for(unsigned level = 0; level < mips.levelCount(); ++level){
+        //the uncompressed texture samples the same as an RGBA copy
+        tdogl::Bitmap expected = Converted(mips.level(level), tdogl::Bitmap::Format_RGBA);
+
+        for(size_t i = 0; i < sizeof(QUALITIES) / sizeof(QUALITIES[0]); ++i){
+            std::string check = std::string(format == tdogl::CompressedBitmap::Format_BC4 ? "BC4" : "BC5") +
+                                ", " + QualityName(QUALITIES[i]) + ", level " + std::to_string(level);
+            tdogl::CompressedBitmap compressed(mips.level(level), format, QUALITIES[i]);
+            tdogl::ImageDifference difference = tdogl::CompareImages(compressed.decompress(), expected);
+            ++stats.checks;
+            if(difference.psnr < MinCompressedPSNR)
+                Report(stats, image.name, check, "PSNR " + std::to_string(difference.psnr) + "dB against the uncompressed texture");
+        }
+    }
+}
+
+// a copy with the other channels of every fully transparent pixel set to `value`
+static tdogl::Bitmap WithTransparentColor(const tdogl::Bitmap& bitmap, unsigned char value) {
+    tdogl::Bitmap copy = Converted(bitmap, bitmap.format());
+    unsigned channels = copy.format();
+    for(unsigned row = 0; row < copy.height(); ++row){
+        unsigned char* pixels = copy.row(row);
+        for(unsigned col = 0; col < copy.width(); ++col){
+            unsigned char* p = pixels + col * channels;
+            if(p[channels - 1] == 0)
+                memset(p, value, channels - 1);
+        }
+    }
+    return copy;
+}
+
+static void CheckTransparentMips(Stats& stats, const std::string& name, const tdogl::Bitmap& bitmap) {
+    tdogl::MipChain black(WithTransparentColor(bitmap, 0));
+    tdogl::MipChain white(WithTransparentColor(bitmap, 255));
+    for(unsigned level = 1; level < black.levelCount(); ++level){
+        tdogl::ImageDifference difference = tdogl::CompareImages(black.level(level), white.level(level));
+        ++stats.checks;
+        if(difference.maxAbsDiff != 0)
+            Report(stats, name, "mip level " + std::to_string(level),
+                   "transparent black and white pixels differ by up to " + std::to_string(difference.maxAbsDiff));
+    }
+}
+
+static void CheckTransparentResizes(Stats& stats, const std::string& name, const tdogl::Bitmap& bitmap) {
+    const tdogl::Bitmap::ResizeFilter filters[] = {
+        tdogl::Bitmap::ResizeFilter_Box, tdogl::Bitmap::ResizeFilter_Mitchell, tdogl::Bitmap::ResizeFilter_Lanczos3
+    };
+    const char* filterNames[] = { "box", "Mitchell", "Lanczos3" };
+    //odd sizes, so destination pixels don't line up with source pixels
+    const unsigned sizes[][2] = { { bitmap.width() * 2 / 5, bitmap.height() * 3 / 10 },
+                                  { bitmap.width() * 8 / 5 + 1, bitmap.height() * 13 / 10 } };
+
+    for(size_t f = 0; f < sizeof(filters) / sizeof(filters[0]); ++f){
+        for(size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); ++i){
+            tdogl::Bitmap black = WithTransparentColor(bitmap, 0);
+            tdogl::Bitmap white = WithTransparentColor(bitmap, 255);
+            black.resize(sizes[i][0], sizes[i][1], filters[f]);
+            white.resize(sizes[i][0], sizes[i][1], filters[f]);
+            tdogl::ImageDifference difference = tdogl::CompareImages(black, white);
+            ++stats.checks;
+            if(difference.maxAbsDiff != 0)
+                Report(stats, name, std::string(filterNames[f]) + " resize to " + std::to_string(sizes[i][0]) + "x" + std::to_string(sizes[i][1]),
+                       "transparent black and white pixels differ by up to " + std::to_string(difference.maxAbsDiff));
+        }
+    }
+}
+
+static bool CheckMain(int argc, char* argv[]) {
+    if(argc > 2)
+        throw std::runtime_error("Usage: texture-check [resources directory]");
+
+    std::string resources = (argc == 2) ? argv[1] : "../../resources/";
+    if(resources[resources.size() - 1] != '/')
+        resources += '/';
+
+    std::vector<TestImage> images = TestImages(resources);
+    Stats stats;
+    for(size_t i = 0; i < images.size(); ++i)
+        CheckCompressedGray(stats, images[i]);
+
+    tdogl::Bitmap hazard = tdogl::Bitmap::bitmapFromFile(resources + "hazard.png");
+    tdogl::Bitmap hazardGray = Converted(hazard, tdogl::Bitmap::Format_GrayscaleAlpha);
+    CheckTransparentMips(stats, "hazard.png", hazard);
+    CheckTransparentMips(stats, "hazard.png (gray+alpha)", hazardGray);
+    CheckTransparentResizes(stats, "hazard.png", hazard);
+    CheckTransparentResizes(stats, "hazard.png (gray+alpha)", hazardGray);
+
+    printf("%u checks, %u failures\n", stats.checks, stats.failures);
+    return stats.failures == 0;
+}
+
+int main(int argc, char *argv[]) {
+    try {
+        if(!CheckMain(argc, argv))
+            return EXIT_FAILURE;
+    } catch (const std::exception& e){
+        std::cerr << "ERROR: " << e.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -5,7 +5,12 @@ Build {
 			Name = "macosx-clang",
 			DefaultOnHost = "macosx",
 			Tools = { "clang-osx" },
-			Env = { CXXOPTS_DEBUG = "-g", CPPPATH = "./includes/stb_image" },
+			Env = {
+				CXXOPTS = { "-std=c++11", "-stdlib=libc++" },
+				CXXOPTS_DEBUG = "-g",
+				PROGOPTS = { "-stdlib=libc++" },
+				CPPPATH = "./includes/stb_image",
+			},
 		},
 	},
 }
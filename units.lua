@@ -11,4 +11,65 @@ Program {
 
 }
 
+-- the parts of tdogl that don't need GL, for the command line tools
+local ImageSources = {
+	"source/tdogl/Allocator.cpp",
+	"source/tdogl/BandDecoder.cpp",
+	"source/tdogl/Bitmap.cpp",
+	"source/tdogl/BitmapLoader.cpp",
+	"source/tdogl/BitmapView.cpp",
+	"source/tdogl/CachedImage.cpp",
+	"source/tdogl/ColorSpace.cpp",
+	"source/tdogl/CompressedBitmap.cpp",
+	"source/tdogl/ContentHasher.cpp",
+	"source/tdogl/DistanceField.cpp",
+	"source/tdogl/HalfFloat.cpp",
+	"source/tdogl/ImageCompare.cpp",
+	"source/tdogl/LZCodec.cpp",
+	"source/tdogl/MappedFile.cpp",
+	"source/tdogl/MipChain.cpp",
+	"source/tdogl/PackedBitmap.cpp",
+	"source/tdogl/PoolAllocator.cpp",
+	"source/tdogl/Resample.cpp",
+	"source/tdogl/ScratchArena.cpp",
+	"source/tdogl/TextureAtlas.cpp",
+	"source/tdogl/TextureCache.cpp",
+	"source/tdogl/ThreadPool.cpp",
+	"source/tdogl/TiledBitmap.cpp",
+}
+
+-- microbenchmarks for the image code, runnable without a GL context
+Program {
+	Name = "bitmap-bench",
+	Sources = { "benchmarks/main.cpp", ImageSources },
+	Includes = { "source" },
+	ReplaceEnv = { LD = { "$(CXX)" ; Config = { "*-clang-*" } }, },
+}
+
+-- compares images with reference copies, for golden-frame tests without a GPU
+Program {
+	Name = "image-compare",
+	Sources = { "tools/image-compare/main.cpp", ImageSources },
+	Includes = { "source" },
+	ReplaceEnv = { LD = { "$(CXX)" ; Config = { "*-clang-*" } }, },
+}
+
+-- checks the PNG decoder against the copy of stb_image it replaced, using the
+-- corpus in tools/png-compare/corpus. Fails on any difference.
+Program {
+	Name = "png-compare",
+	Sources = { "tools/png-compare/main.cpp", "tools/png-compare/ReferenceDecoder.cpp", ImageSources },
+	Includes = { "source" },
+	ReplaceEnv = { LD = { "$(CXX)" ; Config = { "*-clang-*" } }, },
+}
+
+-- checks what the texture pipeline makes, e.g. compressed gray textures and mips and
+-- resizes of transparent images, against what it should look like. Fails if any check does.
+Program {
+	Name = "texture-check",
+	Sources = { "tools/texture-check/main.cpp", ImageSources },
+	Includes = { "source" },
+	ReplaceEnv = { LD = { "$(CXX)" ; Config = { "*-clang-*" } }, },
+}
+
 Default "JiNXGL"
\ No newline at end of file